@@ -10,10 +10,15 @@
  * and only send frames with faces.                
  * - The 'task_process_handler' copies the bounding box coordinates 
  * from the AI library struct into a struct here
+ * - ROI mode: the first stage may run on regions of the frame only
+ * (human_face_detection_set_roi)
+ * - All faces of a frame are sent, one item each, sharing the frame
+ * (face_frame_ref_t, face_to_send_release)
  */
 
 #include "esp_log.h"
 #include "esp_camera.h"
+#include "esp_heap_caps.h"
 
 #include "dl_image.hpp"
 #include "who_human_face_detection.hpp"
@@ -25,6 +30,9 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <vector> // Required for std::vector operations
+#include <algorithm>
+#include <new>
+#include <string.h>
 
 #define TWO_STAGE_ON 1
 static const char* TAG = "human_face_detection";
@@ -35,6 +43,149 @@ static QueueHandle_t xQueueFrameO = NULL;
 static QueueHandle_t xQueueResult = NULL;
 
 static bool gEvent = true;
+static uint32_t s_face_frames = 0; // frames with faces so far, their face_to_send_t::id
+
+#define ROI_MAX_REGIONS 4
+
+static face_roi_config_t s_roi = {};
+static bool s_roi_enabled = false;
+static std::vector<face_box_t> s_previous_faces; // faces of the last frame, regions for the next one
+static uint32_t s_frames_since_full_scan = 0;
+static uint16_t* s_roi_buf = NULL; // one cropped region, RGB565
+static size_t s_roi_buf_pixels = 0;
+
+static void frame_ref_release(face_frame_ref_t* frame)
+{
+    if (frame && frame->refs.fetch_sub(1) == 1) {
+        esp_camera_fb_return(frame->fb);
+        delete frame;
+    }
+}
+
+void face_to_send_release(face_to_send_t* face)
+{
+    if (!face) return;
+    face_frame_ref_t* frame = face->frame;
+    delete face;
+    frame_ref_release(frame);
+}
+
+void human_face_detection_set_roi(const face_roi_config_t* config)
+{
+    s_roi_enabled = config != NULL;
+    if (config) {
+        s_roi = *config;
+    }
+}
+
+// Grows r by margin and up to min_size, inside the frame
+static void roi_grow(face_box_t& r, int frame_w, int frame_h)
+{
+    int x0 = r.x - s_roi.margin;
+    int y0 = r.y - s_roi.margin;
+    int x1 = r.x + r.w + s_roi.margin;
+    int y1 = r.y + r.h + s_roi.margin;
+    int min_w = std::min(s_roi.min_size, frame_w);
+    int min_h = std::min(s_roi.min_size, frame_h);
+    if (x1 - x0 < min_w) {
+        x0 -= (min_w - (x1 - x0)) / 2;
+        x1 = x0 + min_w;
+    }
+    if (y1 - y0 < min_h) {
+        y0 -= (min_h - (y1 - y0)) / 2;
+        y1 = y0 + min_h;
+    }
+    // Shift back inside the frame before clipping, so the size is kept
+    if (x0 < 0) { x1 -= x0; x0 = 0; }
+    if (y0 < 0) { y1 -= y0; y0 = 0; }
+    if (x1 > frame_w) { x0 = std::max(0, x0 - (x1 - frame_w)); x1 = frame_w; }
+    if (y1 > frame_h) { y0 = std::max(0, y0 - (y1 - frame_h)); y1 = frame_h; }
+    r = { x0, y0, x1 - x0, y1 - y0 };
+}
+
+static bool roi_overlap(const face_box_t& a, const face_box_t& b)
+{
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+/* Regions for this frame: source (motion) + previous faces, grown and merged
+ * until none overlap. Returns false if the frame should be scanned whole. */
+static bool roi_collect(const camera_fb_t* frame, std::vector<face_box_t>& regions)
+{
+    regions.clear();
+    if (!s_roi_enabled || s_roi.full_scan_every <= 0 || ++s_frames_since_full_scan >= (uint32_t)s_roi.full_scan_every) {
+        return false;
+    }
+    face_box_t source[ROI_MAX_REGIONS];
+    int count = s_roi.source ? s_roi.source(frame, source, ROI_MAX_REGIONS) : 0;
+    regions.assign(source, source + std::max(0, std::min(count, ROI_MAX_REGIONS)));
+    regions.insert(regions.end(), s_previous_faces.begin(), s_previous_faces.end());
+    if (regions.empty()) {
+        return false;
+    }
+    for (face_box_t& r : regions) {
+        roi_grow(r, frame->width, frame->height);
+    }
+    // Merge overlapping regions into their bounding box, one pixel scanned once
+    for (bool merged = true; merged;) {
+        merged = false;
+        for (size_t i = 0; i < regions.size() && !merged; i++) {
+            for (size_t j = i + 1; j < regions.size() && !merged; j++) {
+                if (roi_overlap(regions[i], regions[j])) {
+                    int x0 = std::min(regions[i].x, regions[j].x);
+                    int y0 = std::min(regions[i].y, regions[j].y);
+                    int x1 = std::max(regions[i].x + regions[i].w, regions[j].x + regions[j].w);
+                    int y1 = std::max(regions[i].y + regions[i].h, regions[j].y + regions[j].h);
+                    regions[i] = { x0, y0, x1 - x0, y1 - y0 };
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                }
+            }
+        }
+    }
+    int area = 0;
+    for (const face_box_t& r : regions) {
+        area += r.w * r.h;
+    }
+    return area * 100 <= s_roi.max_area_percent * (int)(frame->width * frame->height);
+}
+
+/* First stage on each region: crop it out of the frame, infer, move the
+ * candidates back to frame coordinates */
+static std::list<dl::detect::result_t> roi_detect(HumanFaceDetectMSR01& detector, const camera_fb_t* frame,
+                                                  const std::vector<face_box_t>& regions)
+{
+    std::list<dl::detect::result_t> candidates;
+    for (const face_box_t& r : regions) {
+        size_t pixels = (size_t)r.w * r.h;
+        if (pixels > s_roi_buf_pixels) {
+            heap_caps_free(s_roi_buf);
+            s_roi_buf = (uint16_t*)heap_caps_malloc(pixels * sizeof(uint16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            s_roi_buf_pixels = s_roi_buf ? pixels : 0;
+            if (!s_roi_buf) {
+                ESP_LOGE(TAG, "No memory for a %dx%d region.", r.w, r.h);
+                return candidates;
+            }
+        }
+        const uint16_t* src = (const uint16_t*)frame->buf + (size_t)r.y * frame->width + r.x;
+        for (int row = 0; row < r.h; row++) {
+            memcpy(s_roi_buf + (size_t)row * r.w, src + (size_t)row * frame->width, r.w * sizeof(uint16_t));
+        }
+        std::list<dl::detect::result_t>& found = detector.infer(s_roi_buf, { r.h, r.w, 3 });
+        for (dl::detect::result_t res : found) {
+            res.box[0] += r.x;
+            res.box[1] += r.y;
+            res.box[2] += r.x;
+            res.box[3] += r.y;
+            for (size_t k = 0; k + 1 < res.keypoint.size(); k += 2) {
+                res.keypoint[k] += r.x;
+                res.keypoint[k + 1] += r.y;
+            }
+            candidates.push_back(res);
+        }
+    }
+    return candidates;
+}
 
 // Helper to print detection results - Keeping for consistency
 static void print_detection_result(std::list<dl::detect::result_t>& detect_results) {
@@ -74,46 +225,83 @@ void task_process_handler(void* arg)
                 // and dl::image::rgb565 as input to infer.
                 // NOTE: The `infer` method takes `uint16_t*` and `dl::image::rgb565` is usually the format.
                 // The third parameter `3` indicates channels, for RGB565 it should implicitly handle 2 bytes/pixel.
+                // ROI mode: stage 1 on the regions only, its cost follows their area
+                std::vector<face_box_t> regions;
+                std::list<dl::detect::result_t> roi_candidates;
+                bool roi = roi_collect(frame, regions);
+                if (roi) {
+                    roi_candidates = roi_detect(detector, frame, regions);
+                    ESP_LOGD(TAG, "ROI scan: %zu region(s), %zu candidate(s).", regions.size(), roi_candidates.size());
+                } else {
+                    s_frames_since_full_scan = 0;
+                }
 #if TWO_STAGE_ON
-                std::list<dl::detect::result_t>& detect_candidates = detector.infer((uint16_t*)frame->buf, { (int)frame->height, (int)frame->width, 3 });
+                std::list<dl::detect::result_t>& detect_candidates = roi ? roi_candidates : detector.infer((uint16_t*)frame->buf, { (int)frame->height, (int)frame->width, 3 });
                 std::list<dl::detect::result_t>& detect_results = detector2.infer((uint16_t*)frame->buf, { (int)frame->height, (int)frame->width, 3 }, detect_candidates);
 #else
-                std::list<dl::detect::result_t>& detect_results = detector.infer((uint16_t*)frame->buf, { (int)frame->height, (int)frame->width, 3 });
+                std::list<dl::detect::result_t>& detect_results = roi ? roi_candidates : detector.infer((uint16_t*)frame->buf, { (int)frame->height, (int)frame->width, 3 });
 #endif
+                if (s_roi_enabled) {
+                    // This frame's faces are the regions of the next one
+                    s_previous_faces.clear();
+                    for (const dl::detect::result_t& res : detect_results) {
+                        if (s_previous_faces.size() >= ROI_MAX_REGIONS) break;
+                        s_previous_faces.push_back({ res.box[0], res.box[1], res.box[2] - res.box[0], res.box[3] - res.box[1] });
+                    }
+                }
                 // Uncomment to print detection results
                 // print_detection_result(detect_results);
 
                 if (detect_results.size() > 0)
                 {
                     is_detected = true;
-                    ESP_LOGI(TAG, "Face DETECTED!");       
-                    
+                    ESP_LOGI(TAG, "%zu face(s) DETECTED!", detect_results.size());
+
                     if (xQueueFrameO)
                     {
-                        // CRITICAL FIX: Use 'new' instead of 'malloc' for C++ structs with std::vector
-                        face_to_send_t *face_data = new face_to_send_t();
-                        if(face_data) 
+                        // One item per face, all holding the frame: the last one released returns it
+                        int count = (int)std::min(detect_results.size(), (size_t)UINT8_MAX);
+                        face_frame_ref_t* shared = new (std::nothrow) face_frame_ref_t();
+                        if (shared)
                         {
-                            dl::detect::result_t first_face = detect_results.front();
-                            
-                            face_data->fb = frame;
-                            face_data->box.x = first_face.box[0];
-                            face_data->box.y = first_face.box[1];
-                            face_data->box.w = first_face.box[2] - first_face.box[0]; // Calculate width
-                            face_data->box.h = first_face.box[3] - first_face.box[1]; // Calculate height
-
-                            face_data->keypoint = first_face.keypoint; // Copy keypoint data (now safely calls std::vector::operator=)
-
-                            if (xQueueSend(xQueueFrameO, &face_data, 0) != pdTRUE)
+                            shared->fb = frame;
+                            shared->refs = count;
+                            s_face_frames++;
+                            int index = 0;
+                            for (const dl::detect::result_t& res : detect_results)
                             {
-                                ESP_LOGW(TAG, "Output frame queue is full. Dropping frame.");
-                                esp_camera_fb_return(frame);
-                                delete face_data; // Use 'delete' with 'new'
+                                if (index >= count) break;
+                                // CRITICAL FIX: Use 'new' instead of 'malloc' for C++ structs with std::vector
+                                face_to_send_t *face_data = new (std::nothrow) face_to_send_t();
+                                if (!face_data)
+                                {
+                                    ESP_LOGE(TAG, "Failed to allocate memory for face_data struct.");
+                                    frame_ref_release(shared);
+                                    index++;
+                                    continue;
+                                }
+                                face_data->fb = frame;
+                                face_data->frame = shared;
+                                face_data->box.x = res.box[0];
+                                face_data->box.y = res.box[1];
+                                face_data->box.w = res.box[2] - res.box[0]; // Calculate width
+                                face_data->box.h = res.box[3] - res.box[1]; // Calculate height
+                                face_data->keypoint = res.keypoint; // Copy keypoint data (now safely calls std::vector::operator=)
+                                face_data->score = res.score;
+                                face_data->id = s_face_frames;
+                                face_data->index = (uint8_t)index++;
+                                face_data->count = (uint8_t)count;
+
+                                if (xQueueSend(xQueueFrameO, &face_data, 0) != pdTRUE)
+                                {
+                                    ESP_LOGW(TAG, "Output frame queue is full. Dropping face.");
+                                    face_to_send_release(face_data);
+                                }
                             }
-                        } 
-                        else 
+                        }
+                        else
                         {
-                             ESP_LOGE(TAG, "Failed to allocate memory for face_data struct.");
+                             ESP_LOGE(TAG, "Failed to allocate memory for the frame reference.");
                              esp_camera_fb_return(frame);
                         }
                     }
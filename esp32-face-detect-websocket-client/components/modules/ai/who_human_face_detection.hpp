@@ -4,6 +4,7 @@
 #include "freertos/queue.h"
 #include "esp_camera.h"
 #include <vector> // for std::vector
+#include <atomic>
 
 // George struct for the bounding box.
 typedef struct {
@@ -14,13 +15,48 @@ typedef struct {
 } face_box_t;
 
 
+// George: camera frame shared by all the faces found in it, back to the camera with the last one
 typedef struct {
     camera_fb_t* fb;
+    std::atomic<int> refs;
+} face_frame_ref_t;
+
+// One face per queue item: a frame with N faces gives N items (index 0..count-1)
+typedef struct {
+    camera_fb_t* fb;        // == frame->fb, read only: release with face_to_send_release()
+    face_frame_ref_t* frame;
     face_box_t box;
-    uint32_t id; // The struct with a unique ID.
+    uint32_t id; // The struct with a unique ID. Same for all the faces of a frame
+    float score; // detector confidence
 	std::vector<int> keypoint; // keypoint member for bouncing box keypoints.
+    uint8_t index;          // face in its frame
+    uint8_t count;          // faces in the frame
 } face_to_send_t;
 
+/** @brief Frees a face from the detector; the frame goes back to the camera once all its faces are released. */
+void face_to_send_release(face_to_send_t* face);
+
+
+// George: regions of interest for ROI-restricted detection (human_face_detection_set_roi).
+// Fills up to max_regions boxes (frame pixels) for this frame, returns their number.
+typedef int (*face_roi_source_t)(const camera_fb_t* frame, face_box_t* regions, int max_regions);
+
+typedef struct {
+    int full_scan_every;      // a full-frame scan at least every N frames (new entrants), 0: always full frame
+    int margin;               // pixels added around every region
+    int min_size;             // regions grow to at least min_size x min_size (detector input)
+    int max_area_percent;     // regions covering more of the frame than this: full-frame scan instead
+    face_roi_source_t source; // extra regions, e.g. motion. May be NULL: previous faces only
+} face_roi_config_t;
+
+/**
+ * @brief ROI mode: the first stage (MSR01) runs only on the regions given by
+ * config->source plus the faces found in the previous frame, each cropped out
+ * of the frame; the results are mapped back to frame coordinates before the
+ * second stage. A frame without any region gets a full-frame scan.
+ * Call before register_human_face_detection(). NULL: always full frame (default).
+ */
+void human_face_detection_set_roi(const face_roi_config_t* config);
 
 void register_human_face_detection(const QueueHandle_t frame_i,
     const QueueHandle_t event,
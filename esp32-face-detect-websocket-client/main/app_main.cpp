@@ -16,13 +16,29 @@
 #include "websocket_client.h"
 #include "face_sender.h"
 #include "heartbeat.h"
+#include "motion_gate.h"
+#include "face_tracker.h"
 
 static EventGroupHandle_t s_app_event_group;
 static QueueHandle_t xQueueAIFrame = NULL;
+static QueueHandle_t xQueueCamFrame = NULL; // camera -> motion gate
 static QueueHandle_t xQueueFaceFrame = NULL;
+static QueueHandle_t xQueueTrackedFace = NULL; // tracker -> sender
 
 static const char* TAG = "MAIN";
 
+#if FACE_ROI_ENABLED && MOTION_GATE_ENABLED
+// Motion region of a frame as a detection region
+static int motion_roi_source(const camera_fb_t* frame, face_box_t* regions, int max_regions) {
+    motion_region_t region;
+    if (max_regions < 1 || !motion_gate_get_region(frame, &region)) {
+        return 0;
+    }
+    regions[0] = { region.x, region.y, region.w, region.h };
+    return 1;
+}
+#endif
+
 /**
  * @brief System/App-wide log levels.
  * Lowercase names are system apps
@@ -49,6 +65,8 @@ static void configure_system_logging() {
     esp_log_level_set("WEBSOCK_CLIENT", ESP_LOG_INFO);
     esp_log_level_set("FACE_SENDER", ESP_LOG_INFO);
     esp_log_level_set("MSG_HANDLER", ESP_LOG_INFO);
+    esp_log_level_set("MOTION_GATE", ESP_LOG_INFO);
+    esp_log_level_set("FACE_TRACKER", ESP_LOG_INFO);
 }
 
 /**
@@ -80,7 +98,8 @@ extern "C" void app_main() {
 
     s_app_event_group = xEventGroupCreate();
     xQueueAIFrame = xQueueCreate(FRAME_QUEUE_SIZE, sizeof(camera_fb_t*));
-    xQueueFaceFrame = xQueueCreate(FRAME_QUEUE_SIZE, sizeof(face_to_send_t*));
+    xQueueFaceFrame = xQueueCreate(FRAME_QUEUE_SIZE * FACE_TRACK_MAX, sizeof(face_to_send_t*)); // one item per face
+    xQueueTrackedFace = xQueueCreate(FACE_TRACK_MAX, sizeof(tracked_face_t*));
 
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &app_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &app_event_handler, NULL));
@@ -88,13 +107,37 @@ extern "C" void app_main() {
     wifi_init_sta();
 
     // camera registration. paraeters have huge impact on image quality & detection!
+#if MOTION_GATE_ENABLED
+    // only frames with activity reach the detector
+    xQueueCamFrame = xQueueCreate(FRAME_QUEUE_SIZE, sizeof(camera_fb_t*));
+    register_camera(PIXFORMAT_RGB565, FRAMESIZE_QVGA, 2, xQueueCamFrame);
+    register_motion_gate(xQueueCamFrame, xQueueAIFrame);
+#else
     register_camera(PIXFORMAT_RGB565, FRAMESIZE_QVGA, 2, xQueueAIFrame);
+#endif
     
     // find a face
+#if FACE_ROI_ENABLED
+    face_roi_config_t roi = {
+        .full_scan_every = FACE_ROI_FULL_SCAN_EVERY,
+        .margin = FACE_ROI_MARGIN,
+        .min_size = FACE_ROI_MIN_SIZE,
+        .max_area_percent = FACE_ROI_MAX_AREA_PERCENT,
+#if MOTION_GATE_ENABLED
+        .source = motion_roi_source,
+#else
+        .source = NULL,
+#endif
+    };
+    human_face_detection_set_roi(&roi);
+#endif
     register_human_face_detection(xQueueAIFrame, NULL, NULL, xQueueFaceFrame);
 
+    // one crop per face, not per frame: the camera keeps running
+    register_face_tracker(xQueueFaceFrame, xQueueTrackedFace);
+
     // send the detected face
-    face_sender_init(s_app_event_group, xQueueAIFrame, xQueueFaceFrame);
+    face_sender_init(s_app_event_group, xQueueTrackedFace);
 
 #if HEARTBEAT_ON
     heartbeat_init(s_app_event_group);
@@ -15,12 +15,105 @@
 #define HEARTBEAT_INTERVAL_S 300 
 
 /* Face Detection & Image Sending parameters */
-#define POST_DETECTION_COOLDOWN_S 20 // Stop camera for XX seconds after detection. Prevents duplicate images
 #define FACE_CROP_MARGIN_PIXELS 20   // Margin in pixels to add around the detected face
 #define FRAME_QUEUE_SIZE 2           // Size of the frames queue for processing
 #define WEBSOCKET_CHUNK_SIZE 8192    // Max size for each chunk of a binary WebSocket message
 #define SERVER_ACK_TIMEOUT_MS 5000   // Timeout to wait for a frame ACK from the server
 
+/* Face crop payload format.
+ * 1: JPEG encoded (frame2jpg/fmt2jpg), 5-10x fewer bytes on air than raw RGB565.
+ *    Used only if the server advertises "jpeg" in its welcome message.
+ * 0: raw RGB565 (w * h * 2 bytes). Also the fallback if encoding fails.
+ */
+#define FACE_PAYLOAD_JPEG 1
+#define FACE_JPEG_QUALITY 80         // 0-100, faces need detail: do not go too low
+
+/* Transfer framing.
+ * 1: binary frame_header_t (frame_header.h) in front of the payload, single
+ *    message for small crops, no frame_end. Used only if the server advertises
+ *    the same "framing=binN" version in its welcome message.
+ * 0: JSON frame_start / binary chunks / JSON frame_end (compatibility mode).
+ */
+#define FRAME_HEADER_BINARY 1
+
+/* Windowed transfer (needs binary framing and a server advertising "window=N").
+ * Chunks are streamed without sleeps while the server has credit, the server
+ * acks progress (frame_progress). No progress within FRAME_WINDOW_TIMEOUT_MS,
+ * or a failed chunk: resend from the last acked offset, up to FRAME_WINDOW_MAX_RESENDS times.
+ */
+#define FRAME_WINDOWED_TRANSFER 1
+#define FRAME_WINDOW_TIMEOUT_MS 1000
+#define FRAME_WINDOW_MAX_RESENDS 3
+
+/* Motion gate (motion_gate.cpp) between the camera and the face detector.
+ * The luma of every frame is sampled once per MOTION_GATE_STRIDE x STRIDE cell
+ * (QVGA, 8: 40x30 cells) and compared to a running background: only frames
+ * with at least MOTION_GATE_MIN_CELLS changed cells reach the detector, the
+ * others go back to the camera. A door camera mostly sees an empty scene.
+ * PIXEL_THRESHOLD: luma change (0-255) for a cell to count as changed.
+ * BG_SHIFT: background update, 1/2^BG_SHIFT of the difference per frame (3: ~8 frames).
+ * FORCE_EVERY: one frame in N reaches the detector anyway (a face standing still), 0: never.
+ * Counters are logged every LOG_INTERVAL_S and sent with the heartbeat.
+ * 0: every frame goes to the detector.
+ */
+#define MOTION_GATE_ENABLED 1
+#define MOTION_GATE_STRIDE 8
+#define MOTION_GATE_PIXEL_THRESHOLD 18
+#define MOTION_GATE_MIN_CELLS 8
+#define MOTION_GATE_BG_SHIFT 3
+#define MOTION_GATE_FORCE_EVERY 50
+#define MOTION_GATE_LOG_INTERVAL_S 60
+
+/* ROI-restricted detection: the first detector stage (MSR01) only scans the
+ * motion region (needs the motion gate) and the faces of the previous frame,
+ * each grown by FACE_ROI_MARGIN pixels and to at least FACE_ROI_MIN_SIZE square.
+ * Regions covering more than FACE_ROI_MAX_AREA_PERCENT of the frame, and one
+ * frame in FACE_ROI_FULL_SCAN_EVERY (new entrants), are scanned whole.
+ * 0: every frame is scanned whole.
+ */
+#define FACE_ROI_ENABLED 1
+#define FACE_ROI_FULL_SCAN_EVERY 10
+#define FACE_ROI_MARGIN 24
+#define FACE_ROI_MIN_SIZE 112
+#define FACE_ROI_MAX_AREA_PERCENT 60
+
+/* Face tracker (face_tracker.cpp) between the detector and the sender: the
+ * camera keeps running after a face, duplicates are avoided by sending one
+ * crop per track. A detection joins the track whose box it overlaps by at
+ * least FACE_TRACK_IOU_MIN, or whose keypoints are within FACE_TRACK_KEYPOINT_DIST
+ * eye distances (fast moves), else it starts a new track (up to FACE_TRACK_MAX).
+ * A track sends the crop of its best detection (score, size up to
+ * FACE_TRACK_GOOD_SIZE pixels, frontal keypoints) after FACE_TRACK_BEST_OF
+ * detections, or when it ends with at least FACE_TRACK_MIN_HITS (fewer: a
+ * false detection). It ends FACE_TRACK_LOST_MS after its last detection:
+ * keep it longer than the motion gate's forced frames take (MOTION_GATE_FORCE_EVERY)
+ * or a person standing still is sent again.
+ */
+#define FACE_TRACK_MAX 4
+#define FACE_TRACK_IOU_MIN 0.3f
+#define FACE_TRACK_KEYPOINT_DIST 0.5f
+#define FACE_TRACK_GOOD_SIZE 112
+#define FACE_TRACK_BEST_OF 5
+#define FACE_TRACK_MIN_HITS 2
+#define FACE_TRACK_LOST_MS 8000
+
+/* Batched transfer (binary framing, server advertises "batch=N"): crops that
+ * are ready within FACE_BATCH_GATHER_MS of each other (people arriving
+ * together) are sent back-to-back, up to FACE_BATCH_MAX and N, and recognized
+ * in one batch on the server. One acknowledgment for the whole batch.
+ */
+#define FACE_BATCH_MAX 4
+#define FACE_BATCH_GATHER_MS 50
+
+/* Face alignment on the CAM (face_align.h, server advertises "align=112").
+ * 1: the tracker keeps a 112x112 tile of the best detection, aligned on the
+ *    5-point template of the server's feature model, instead of a crop with
+ *    FACE_CROP_MARGIN_PIXELS: ~25KB raw whatever the face size, and the server
+ *    skips its warp. Faces without 5 keypoints still go as crops.
+ * 0: margin crops, the server aligns them.
+ */
+#define FACE_ALIGN_ON_CAM 0
+
 /* If automatic settings fail to (easily) detect a face, 
  * set to 1 and experiment with manual settings in app_main.cpp 
  * It seems that there is a big difference depending on ambient conditions!
@@ -31,5 +124,9 @@
 #define WIFI_CONNECTED_BIT        (1 << 0)
 #define WEBSOCKET_CONNECTED_BIT   (1 << 1)
 #define FRAME_ACK_BIT             (1 << 2)
+#define FRAME_BUSY_BIT            (1 << 3) // server queue full, frame rejected
+#define SERVER_JPEG_BIT           (1 << 4) // server decodes JPEG payloads
+#define SERVER_BIN_FRAMING_BIT    (1 << 5) // server accepts our binary frame header version
+#define FRAME_PROGRESS_BIT        (1 << 6) // frame_progress received (windowed transfer)
 
 #endif // CONFIG_H
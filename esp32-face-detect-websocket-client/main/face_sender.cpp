@@ -1,181 +1,390 @@
 #include "face_sender.h"
-#include "who_camera.h"
-#include "who_human_face_detection.hpp"
+#include "face_tracker.h"
 #include "websocket_client.h"
+#include "message_handler.h" // windowed transfer progress
+#include "img_converters.h" // fmt2jpg
+#include "frame_header.h"
 #include "esp_log.h"
 #include "config.h"
-#include <vector>
 #include <inttypes.h>
 #include <algorithm>
 #include <string.h>
 
 static EventGroupHandle_t s_app_event_group;
-static QueueHandle_t xQueueAIFrame;
-static QueueHandle_t xQueueFaceFrame;
+static QueueHandle_t xQueueTrackedFace;
 
 static const char* TAG = "FACE_SENDER";
 
 /**
- * @brief Converts a std::vector of integers to a JSON array formatted string.
- * @param vec The input vector of integers.
+ * @brief Converts an array of integers to a JSON array formatted string.
+ * @param vec The input integers.
+ * @param count Number of integers.
  * @param buffer The character buffer to store JSON string results.
  * @param buffer_len Output buffer size.
- * Formats the vector as a comma-separated list within square brackets for JSON compatibility.
+ * Formats the array as a comma-separated list within square brackets for JSON compatibility.
  */
-static void int_vector_to_json_string(const std::vector<int>& vec, 
+static void int_array_to_json_string(const int* vec, size_t count,
         char* buffer, size_t buffer_len) {
     size_t offset = 0;
     offset += snprintf(buffer + offset, buffer_len - offset, "[");
-    for (size_t i = 0; i < vec.size(); ++i) {
+    for (size_t i = 0; i < count; ++i) {
         offset += snprintf(buffer + offset, buffer_len - offset, "%d", vec[i]);
-        if (i < vec.size() - 1) {
+        if (i < count - 1) {
             offset += snprintf(buffer + offset, buffer_len - offset, ",");
         }
     }
     snprintf(buffer + offset, buffer_len - offset, "]");
 }
 
+/**
+ * @brief Windowed transfer of the payload that did not fit in the first (header) message.
+ * @param payload Whole payload.
+ * @param payload_len Payload size.
+ * @param sent Bytes already sent with the header.
+ * @param frame_id Frame id, stamped on every chunk.
+ * @param window Credit advertised by the server.
+ * Streams chunks without sleeping while less than window bytes are unacknowledged.
+ * On a resend request, a failed chunk or a silent server, continues from the last
+ * acked offset: the frame is never restarted from zero.
+ * @return ESP_OK once the server has answered with frame_ack/frame_busy (bits left set).
+ */
+static esp_err_t send_payload_windowed(const uint8_t *payload, size_t payload_len, size_t sent,
+        uint32_t frame_id, uint32_t window) {
+    const size_t max_data = WEBSOCKET_CHUNK_SIZE - sizeof(frame_chunk_header_t);
+    uint8_t *chunk_buf = (uint8_t *)malloc(WEBSOCKET_CHUNK_SIZE);
+    if (!chunk_buf) {
+        ESP_LOGE(TAG, "Failed to allocate the chunk buffer.");
+        return ESP_ERR_NO_MEM;
+    }
+    size_t acked = 0;
+    int resends = 0;
+    esp_err_t ret = ESP_OK;
+    frame_progress_t progress;
+    message_handler_take_progress(NULL); // forget progress of a previous frame
+
+    while (true) {
+        bool send_failed = false;
+        while (sent < payload_len && sent - acked < window) {
+            size_t len = std::min({max_data, payload_len - sent, (size_t)window - (sent - acked)});
+            frame_chunk_header_t chunk = {};
+            chunk.magic = FRAME_CHUNK_MAGIC;
+            chunk.id = frame_id;
+            chunk.offset = sent;
+            memcpy(chunk_buf, &chunk, sizeof(chunk));
+            memcpy(chunk_buf + sizeof(chunk), payload + sent, len);
+            if (websocket_send_frame(chunk_buf, sizeof(chunk) + len) != ESP_OK) {
+                send_failed = true;
+                break;
+            }
+            sent += len;
+        }
+
+        EventBits_t bits = 0;
+        if (!send_failed) {
+            bits = xEventGroupWaitBits(s_app_event_group, FRAME_PROGRESS_BIT | FRAME_ACK_BIT | FRAME_BUSY_BIT,
+                                       pdFALSE, pdFALSE, pdMS_TO_TICKS(FRAME_WINDOW_TIMEOUT_MS));
+        }
+        if (bits & (FRAME_ACK_BIT | FRAME_BUSY_BIT)) {
+            break; // everything arrived, the caller reads the bits
+        }
+        if (bits & FRAME_PROGRESS_BIT) {
+            xEventGroupClearBits(s_app_event_group, FRAME_PROGRESS_BIT);
+            if (message_handler_take_progress(&progress) && progress.frame_id == frame_id) {
+                if (progress.offset > acked) acked = progress.offset;
+                if (progress.resend && progress.offset < sent) {
+                    ESP_LOGW(TAG, "Frame %" PRIu32 ": server asks to resend from %" PRIu32, frame_id, progress.offset);
+                    sent = progress.offset;
+                    if (++resends > FRAME_WINDOW_MAX_RESENDS) {
+                        ret = ESP_FAIL;
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+        // Failed chunk or no news from the server: resume from the last acked offset
+        if (++resends > FRAME_WINDOW_MAX_RESENDS || !is_websocket_connected()) {
+            ret = ESP_FAIL;
+            break;
+        }
+        ESP_LOGW(TAG, "Frame %" PRIu32 ": %s, resending from offset %zu.", frame_id,
+                 send_failed ? "chunk send failed" : "no progress", acked);
+        sent = acked;
+        if (send_failed) {
+            vTaskDelay(pdMS_TO_TICKS(50)); // let the socket drain
+        }
+    }
+    free(chunk_buf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Windowed transfer of frame %" PRIu32 " failed after %d resends.", frame_id, resends);
+    }
+    return ret;
+}
+
+/**
+ * @brief Waits for the server answer to a transfer.
+ * @param frame_id Id of the frame, the last face of a batch.
+ * @param batched A batched transfer: one answer for all its faces.
+ */
+static void wait_frame_answer(uint32_t frame_id, bool batched) {
+    EventBits_t bits = xEventGroupWaitBits(s_app_event_group, FRAME_ACK_BIT | FRAME_BUSY_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(SERVER_ACK_TIMEOUT_MS));
+    if (bits & FRAME_ACK_BIT) {
+        ESP_LOGI(TAG, "ACK received for frame %" PRIu32 "%s!", frame_id, batched ? " (batch)" : "");
+    } else if (bits & FRAME_BUSY_BIT) {
+        ESP_LOGW(TAG, "Server busy, frame %" PRIu32 " not processed.", frame_id);
+    } else {
+        ESP_LOGE(TAG, "ACK timeout for frame %" PRIu32, frame_id);
+    }
+}
+
+/**
+ * @brief Batched transfer with binary framing, as send_face() decides it.
+ * @param batch_count Faces in the batch.
+ */
+static bool is_batched(int batch_count) {
+    return FRAME_HEADER_BINARY && batch_count > 1 && (xEventGroupGetBits(s_app_event_group) & SERVER_BIN_FRAMING_BIT);
+}
+
+/**
+ * @brief Closes a batched transfer whose last face did not go out (skipped,
+ * dropped or failed), then waits for the answer.
+ * @param last_id Id of the last face of the batch.
+ * The server answers with last_id for the faces it holds: otherwise they keep
+ * its pool slots until the next batch.
+ */
+static void close_batch(uint32_t last_id) {
+    char end_msg[64];
+    snprintf(end_msg, sizeof(end_msg), "{\"type\":\"batch_end\",\"id\":%" PRIu32 "}", last_id);
+    if (websocket_send_text(end_msg) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send batch_end for frame %" PRIu32 ".", last_id);
+        return;
+    }
+    ESP_LOGW(TAG, "Batch closed without its last face %" PRIu32 ".", last_id);
+    wait_frame_answer(last_id, true);
+}
+
 /**
  * @brief Initialize and provide the necessary handles to the face sender module.
  * @param app_event_group Handle to the main application event group.
- * @param ai_queue Handle to the queue for incoming AI frames.
- * @param face_queue Handle to the queue for detected faces to be sent.
+ * @param face_queue Handle to the queue of face crops to be sent (tracker output).
  */
-void face_sender_init(EventGroupHandle_t app_event_group, 
-        QueueHandle_t ai_queue, QueueHandle_t face_queue) {
+void face_sender_init(EventGroupHandle_t app_event_group, QueueHandle_t face_queue) {
     s_app_event_group = app_event_group;
-    xQueueAIFrame = ai_queue;
-    xQueueFaceFrame = face_queue;
+    xQueueTrackedFace = face_queue;
 }
 
 /**
- * @brief Process and send detected face data over WebSocket.
- * @param pvParameters Unused task parameters.
- * Waits for face data on the xQueueFaceFrame queue. When a face is received,
- * it stops the camera, crops the face from the full frame with a margin 
- * (can be adapted), adjusts keypoint coordinates, and transmits the cropped 
- * image and metadata in chunks over the WebSocket. 
- * After a successful transfer and server acknowledgment, t enters a cooldown 
- * period before restarting the camera to avoid multiple same face detections.
+ * @brief Sends one face crop of the tracker over WebSocket.
+ * @param face_data The crop, keypoints in crop coordinates.
+ * @param batch_index Position in a batched transfer.
+ * @param batch_count Faces in the batch, <= 1: a single transfer.
+ * Transmits the image and metadata in chunks. A single transfer (or the last
+ * face of a batch) then waits for the server acknowledgment; the other faces
+ * of a batch follow back-to-back. Batches need binary framing, without it
+ * every face is a single transfer. If the last face of a batch fails, the
+ * caller closes the batch (close_batch()).
+ * @return true if all the bytes were sent.
  */
-void face_sending_task(void* pvParameters) {
-    face_to_send_t *face_data = NULL;
+static bool send_face(const tracked_face_t *face_data, int batch_index, int batch_count) {
     const size_t CHUNK_SIZE = WEBSOCKET_CHUNK_SIZE;
     char keypoints_json_str[150];
     char start_msg[350];
+    bool sent_ok = false;
 
-    while (true) {
-        if (xQueueReceive(xQueueFaceFrame, &face_data, portMAX_DELAY)) {
-            if (!face_data || !face_data->fb) {
-                if (face_data) {
-                    if (face_data->fb) esp_camera_fb_return(face_data->fb);
-                    free(face_data);
-                }
-                continue;
+    uint8_t *cropped_buf = face_data->buf;
+    uint8_t *jpeg_buf = NULL; // fmt2jpg output, malloc'ed
+    size_t jpeg_len = 0;
+    do {
+        int original_face_x = face_data->box.x;
+        int original_face_y = face_data->box.y;
+        int original_face_w = face_data->box.w;
+        int original_face_h = face_data->box.h;
+        uint32_t frame_id = face_data->id;
+        int cropped_img_width = face_data->width;
+        int cropped_img_height = face_data->height;
+        size_t cropped_len = (size_t)cropped_img_width * (size_t)cropped_img_height * 2;
+        const int *adjusted_keypoints = face_data->keypoint;
+        size_t keypoint_count = face_data->keypoint_count;
+        int_array_to_json_string(adjusted_keypoints, keypoint_count, keypoints_json_str, sizeof(keypoints_json_str));
+
+        xEventGroupWaitBits(s_app_event_group, WIFI_CONNECTED_BIT | WEBSOCKET_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+        bool binary_framing = FRAME_HEADER_BINARY && (xEventGroupGetBits(s_app_event_group) & SERVER_BIN_FRAMING_BIT);
+        bool batched = is_batched(batch_count);
+        if (face_data->aligned && (!binary_framing || message_handler_get_align() != cropped_img_width)) {
+            // Reconnected to a server that only takes crops: it would misread the keypoints
+            ESP_LOGW(TAG, "Frame %" PRIu32 ": aligned tile not accepted by the server, dropped.", frame_id);
+            break;
+        }
+        bool last = !batched || batch_index + 1 >= batch_count;
+        if (!batched) { // a batch is set up by the caller, before its first face
+            message_handler_expect_answer(frame_id, false);
+            xEventGroupClearBits(s_app_event_group, FRAME_ACK_BIT | FRAME_BUSY_BIT | FRAME_PROGRESS_BIT);
+        }
+
+        // JPEG if the server can decode it, raw RGB565 otherwise (or if encoding fails)
+        uint8_t *payload = cropped_buf;
+        size_t payload_len = cropped_len;
+        const char *payload_format = "rgb565";
+#if FACE_PAYLOAD_JPEG
+        if (xEventGroupGetBits(s_app_event_group) & SERVER_JPEG_BIT) {
+            if (fmt2jpg(cropped_buf, cropped_len, cropped_img_width, cropped_img_height,
+                        PIXFORMAT_RGB565, FACE_JPEG_QUALITY, &jpeg_buf, &jpeg_len)) {
+                payload = jpeg_buf;
+                payload_len = jpeg_len;
+                payload_format = "jpeg";
+                ESP_LOGI(TAG, "Frame %" PRIu32 " JPEG encoded: %zu -> %zu Bytes", frame_id, cropped_len, jpeg_len);
+            } else {
+                ESP_LOGW(TAG, "JPEG encoding failed for frame %" PRIu32 ", sending raw.", frame_id);
             }
+        }
+#endif
 
-            camera_fb_t* full_frame = face_data->fb;
-            ESP_LOGI(TAG, "\033[1;33m*************************************\033[0m");
-            ESP_LOGI(TAG, "\033[1;32m       FACE DETECTED in frame %" PRIu32 "\033[0m", face_data->id);
-            ESP_LOGI(TAG, "\033[1;33m*************************************\033[0m");
-                        
-            camera_stop(); //prevent duplicates of the same face
-
-            uint8_t *cropped_buf = NULL;
-            do {
-                int original_face_x = face_data->box.x;
-                int original_face_y = face_data->box.y;
-                int original_face_w = face_data->box.w;
-                int original_face_h = face_data->box.h;
-                uint32_t frame_id = face_data->id;
-
-                int crop_x_start = std::max(0, original_face_x - FACE_CROP_MARGIN_PIXELS);
-                int crop_y_start = std::max(0, original_face_y - FACE_CROP_MARGIN_PIXELS);
-                int crop_x_end = std::min((int)full_frame->width, original_face_x + original_face_w + FACE_CROP_MARGIN_PIXELS);
-                int crop_y_end = std::min((int)full_frame->height, original_face_y + original_face_h + FACE_CROP_MARGIN_PIXELS);
-                int cropped_img_width = crop_x_end - crop_x_start;
-                int cropped_img_height = crop_y_end - crop_y_start;
-
-                if (cropped_img_width <= 0 || cropped_img_height <= 0) {
-                    ESP_LOGE(TAG, "Invalid crop dimensions for frame %" PRIu32, frame_id);
-                    break;
-                }
+        uint8_t *p_buffer = payload;
+        size_t remaining = payload_len;
+        uint32_t window = message_handler_get_window();
+        bool windowed = binary_framing && !batched && FRAME_WINDOWED_TRANSFER && window > 0;
 
-                std::vector<int> adjusted_keypoints = face_data->keypoint;
-                for (size_t i = 0; i < adjusted_keypoints.size(); i += 2) {
-                    adjusted_keypoints[i] -= crop_x_start;
-                    adjusted_keypoints[i+1] -= crop_y_start;
-                }
-                int_vector_to_json_string(adjusted_keypoints, keypoints_json_str, sizeof(keypoints_json_str));
+        if (batched) {
+            ESP_LOGI(TAG, "\033[1;33m↑↑↑ Sending frame %" PRIu32 " (%d/%d of a batch) ↑↑↑\033[0m", frame_id, batch_index + 1, batch_count);
+        } else {
+            ESP_LOGI(TAG, "\033[1;33m↑↑↑ Sending frame %" PRIu32 " ↑↑↑\033[0m", frame_id);
+        }
 
-                size_t cropped_len = (size_t)cropped_img_width * (size_t)cropped_img_height * 2;
-                cropped_buf = (uint8_t *)malloc(cropped_len);
-                if (!cropped_buf) {
-                    ESP_LOGE(TAG, "Failed to allocate memory for cropped frame: %zu Bytes", cropped_len);
-                    break;
-                }
+        if (binary_framing) {
+            // Header + first payload bytes in one message. Small crops: the whole transfer.
+            frame_header_t header = {};
+            header.format = (payload == jpeg_buf) ? FRAME_HEADER_FORMAT_JPEG : FRAME_HEADER_FORMAT_RGB565;
+            header.flags = (windowed ? FRAME_FLAG_WINDOWED : 0) | (face_data->aligned ? FRAME_FLAG_ALIGNED : 0);
+            header.id = frame_id;
+            header.batch_index = batched ? batch_index : 0;
+            header.batch_count = batched ? batch_count : 0;
+            header.payload_size = payload_len;
+            header.width = cropped_img_width;
+            header.height = cropped_img_height;
+            header.box_x = original_face_x;
+            header.box_y = original_face_y;
+            header.box_w = original_face_w;
+            header.box_h = original_face_h;
+            for (size_t i = 0; i < keypoint_count && i < FRAME_HEADER_KEYPOINTS; ++i) {
+                header.keypoints[i] = adjusted_keypoints[i];
+            }
+            header.payload_crc = esp_rom_crc32_le(0, payload, payload_len);
+            frame_header_seal(&header);
 
-                uint16_t *p_full = (uint16_t *)full_frame->buf;
-                uint16_t *p_cropped = (uint16_t *)cropped_buf;
-                for (int row = 0; row < cropped_img_height; ++row) {
-                    memcpy(p_cropped + (row * cropped_img_width), p_full + ((crop_y_start + row) * full_frame->width) + crop_x_start, cropped_img_width * sizeof(uint16_t));
-                }
-                
-                xEventGroupWaitBits(s_app_event_group, WIFI_CONNECTED_BIT | WEBSOCKET_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
-                xEventGroupClearBits(s_app_event_group, FRAME_ACK_BIT);
+            size_t first_len = std::min(payload_len, CHUNK_SIZE - sizeof(header));
+            uint8_t *first_msg = (uint8_t *)malloc(sizeof(header) + first_len);
+            if (!first_msg) {
+                ESP_LOGE(TAG, "Failed to allocate the first message of frame %" PRIu32, frame_id);
+                break;
+            }
+            memcpy(first_msg, &header, sizeof(header));
+            memcpy(first_msg + sizeof(header), payload, first_len);
+            esp_err_t sent = websocket_send_frame(first_msg, sizeof(header) + first_len);
+            free(first_msg);
+            if (sent != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to send frame header. Aborting!");
+                break;
+            }
+            p_buffer += first_len;
+            remaining -= first_len;
+        } else {
+            snprintf(start_msg, sizeof(start_msg), "{\"type\":\"frame_start\", \"size\":%zu, \"id\":%" PRIu32 ", \"format\":\"%s\", \"width\":%d, \"height\":%d, \"box_x\":%d, \"box_y\":%d, \"box_w\":%d, \"box_h\":%d, \"keypoints\":%s}",
+                     payload_len, frame_id, payload_format, cropped_img_width, cropped_img_height,
+                     original_face_x, original_face_y, original_face_w, original_face_h,
+                     keypoints_json_str);
+            if(websocket_send_text(start_msg) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to send frame_start. Aborting!");
+                break;
+            }
+        }
 
-                snprintf(start_msg, sizeof(start_msg), "{\"type\":\"frame_start\", \"size\":%zu, \"id\":%" PRIu32 ", \"width\":%d, \"height\":%d, \"box_x\":%d, \"box_y\":%d, \"box_w\":%d, \"box_h\":%d, \"keypoints\":%s}",
-                         cropped_len, frame_id, cropped_img_width, cropped_img_height,
-                         original_face_x, original_face_y, original_face_w, original_face_h,
-                         keypoints_json_str);
+        if (windowed && remaining > 0) {
+            if (send_payload_windowed(payload, payload_len, payload_len - remaining, frame_id, window) != ESP_OK) {
+                break;
+            }
+            remaining = 0;
+        }
+        // Plain chunks (no window, batch faces, JSON framing): no pacing sleep. The send
+        // blocks while the socket send buffer is full, TCP flow control from the server.
+        while (remaining > 0) {
+            size_t to_send = std::min(remaining, CHUNK_SIZE);
+            if (websocket_send_frame(p_buffer, to_send) != ESP_OK) {
+                ESP_LOGE(TAG, "Chunk send failed for frame %" PRIu32 ". Aborting.", frame_id);
+                remaining = 1; // Mark as failed
+                break;
+            }
+            p_buffer += to_send;
+            remaining -= to_send;
+        }
 
-                ESP_LOGI(TAG, "\033[1;33m↑↑↑ Sending frame %" PRIu32 " ↑↑↑\033[0m", frame_id);
+        if (remaining > 0) break; // Exit if transfer failed
 
-                if(websocket_send_text(start_msg) != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to send frame_start. Aborting!");
-                    break;
-                }
+        if (!binary_framing) {
+            websocket_send_text("{\"type\":\"frame_end\"}");
+        }
+        sent_ok = true;
+        if (!last) {
+            break; // back-to-back: the server answers once, after the last face of the batch
+        }
 
-                uint8_t *p_buffer = cropped_buf;
-                size_t remaining = cropped_len;
-                while (remaining > 0) {
-                    size_t to_send = std::min(remaining, CHUNK_SIZE);
-                    if (websocket_send_frame(p_buffer, to_send) != ESP_OK) {
-                        ESP_LOGE(TAG, "Chunk send failed for frame %" PRIu32 ". Aborting.", frame_id);
-                        remaining = 1; // Mark as failed
-                        break;
-                    }
-                    p_buffer += to_send;
-                    remaining -= to_send;
-                    vTaskDelay(pdMS_TO_TICKS(10));
-                }
+        wait_frame_answer(frame_id, batched);
 
-                if (remaining > 0) break; // Exit if transfer failed
+    } while(0);
 
-                websocket_send_text("{\"type\":\"frame_end\"}");
-                
-                EventBits_t bits = xEventGroupWaitBits(s_app_event_group, FRAME_ACK_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(SERVER_ACK_TIMEOUT_MS));
-                if (bits & FRAME_ACK_BIT) {
-                    ESP_LOGI(TAG, "ACK received for frame %" PRIu32 "!", frame_id);
-                } else {
-                    ESP_LOGE(TAG, "ACK timeout for frame %" PRIu32, frame_id);
-                }
+    if (jpeg_buf) free(jpeg_buf);
+    return sent_ok;
+}
+
+/**
+ * @brief Send the face crops of the tracker over WebSocket.
+ * @param pvParameters Unused task parameters.
+ * Waits for crops on the xQueueTrackedFace queue, one per new track: the
+ * best detection of a face, cropped with a margin (FACE_CROP_MARGIN_PIXELS)
+ * or aligned into a 112x112 tile (FACE_ALIGN_ON_CAM).
+ * Crops that are ready together (a group in front of the camera) are sent
+ * back-to-back in one batched transfer, up to FACE_BATCH_MAX and the batch
+ * size of the server. A batch always ends with its last face or a batch_end.
+ * The camera and the detector keep running meanwhile.
+ */
+void face_sending_task(void* pvParameters) {
+    tracked_face_t *batch[FACE_BATCH_MAX];
+
+    while (true) {
+        if (!xQueueReceive(xQueueTrackedFace, &batch[0], portMAX_DELAY)) {
+            continue;
+        }
+        int count = 1;
+        int batch_max = std::min(FACE_BATCH_MAX, message_handler_get_batch());
+        while (count < batch_max &&
+               xQueueReceive(xQueueTrackedFace, &batch[count], pdMS_TO_TICKS(FACE_BATCH_GATHER_MS)) == pdTRUE) {
+            count++;
+        }
 
-            } while(0);
-
-            esp_camera_fb_return(full_frame);
-            if (cropped_buf) free(cropped_buf);
-            free(face_data);
-            
-            ESP_LOGI(TAG, "Entering %d sec cooldown.", POST_DETECTION_COOLDOWN_S);
-            vTaskDelay(pdMS_TO_TICKS(POST_DETECTION_COOLDOWN_S * 1000));
-            
-            ESP_LOGD(TAG, "Cooldown ended. Flushing queues before restart.");
-            xQueueReset(xQueueAIFrame);
-            xQueueReset(xQueueFaceFrame);
-
-            camera_start();
-            ESP_LOGI(TAG, "Camera (re)started. Waiting to detect faces.");
+        ESP_LOGI(TAG, "\033[1;33m*************************************\033[0m");
+        ESP_LOGI(TAG, "\033[1;32m       %d FACE(S) DETECTED, track %" PRIu32 "%s\033[0m", count,
+                 batch[0] ? batch[0]->id : 0, count > 1 ? ".." : "");
+        ESP_LOGI(TAG, "\033[1;33m*************************************\033[0m");
+
+        int sent = 0;
+        bool last_sent = false;
+        uint32_t last_id = batch[count - 1] ? batch[count - 1]->id : 0;
+        if (is_batched(count)) {
+            // One answer for the batch, with the last id: nothing older or per face counts
+            message_handler_expect_answer(last_id, true);
+            xEventGroupClearBits(s_app_event_group, FRAME_ACK_BIT | FRAME_BUSY_BIT | FRAME_PROGRESS_BIT);
+        }
+        for (int i = 0; i < count; i++) {
+            last_sent = batch[i] && batch[i]->buf && send_face(batch[i], i, count);
+            if (last_sent) {
+                sent++;
+            }
+            face_tracker_free_face(batch[i]);
+        }
+        if (!last_sent && is_batched(count)) {
+            close_batch(last_id);
+        }
+        if (sent < count) {
+            ESP_LOGW(TAG, "%d of %d faces sent.", sent, count);
         }
     }
 }
\ No newline at end of file
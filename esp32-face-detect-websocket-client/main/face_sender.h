@@ -12,10 +12,9 @@ extern "C" {
 /**
  * @brief Initialize and provide handles to the face sender module.
  * @param app_event_group Handle to the main app event group.
- * @param ai_queue Handle to the incoming AI frames queue.
- * @param face_queue Handle to the detected faces to be sent queue.
+ * @param face_queue Handle to the face crops to be sent queue (tracked_face_t*).
  */
-void face_sender_init(EventGroupHandle_t app_event_group, QueueHandle_t ai_queue, QueueHandle_t face_queue);
+void face_sender_init(EventGroupHandle_t app_event_group, QueueHandle_t face_queue);
 
 /**
  * @brief Processing and sending face data.
@@ -0,0 +1,282 @@
+#include "face_tracker.h"
+#include "face_align.h"
+#include "message_handler.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <algorithm>
+
+static const char* TAG = "FACE_TRACKER";
+
+static QueueHandle_t xQueueFaceI = NULL;
+static QueueHandle_t xQueueFaceO = NULL;
+
+typedef struct {
+    uint32_t id;
+    face_box_t box;               // last detection
+    int keypoint[FACE_KEYPOINTS]; // last detection, frame coordinates
+    int keypoint_count;
+    int64_t last_seen_us;
+    uint32_t last_frame;          // detector frame id of the last detection
+    uint32_t hits;                // detections so far
+    bool sent;
+    tracked_face_t* best;         // crop of the best detection, NULL once sent
+} track_t;
+
+static track_t s_tracks[FACE_TRACK_MAX];
+static int s_track_count = 0;
+static uint32_t s_next_track_id = 1;
+
+/* Keypoints of the detector, frame coordinates:
+ * 0,1 left eye, 2,3 left mouth corner, 4,5 nose, 6,7 right eye, 8,9 right mouth corner */
+static inline float eye_distance(const int* k) {
+    return hypotf((float)(k[6] - k[0]), (float)(k[7] - k[1]));
+}
+
+static float box_iou(const face_box_t& a, const face_box_t& b) {
+    int w = std::min(a.x + a.w, b.x + b.w) - std::max(a.x, b.x);
+    int h = std::min(a.y + a.h, b.y + b.h) - std::max(a.y, b.y);
+    if (w <= 0 || h <= 0) return 0.0f;
+    float inter = (float)w * h;
+    return inter / ((float)a.w * a.h + (float)b.w * b.h - inter);
+}
+
+/* Mean distance between the keypoints of the track and of the detection,
+ * in eye distances: scale free, a head moving fast keeps a small value
+ * while its boxes no longer overlap. Large if a side has no keypoints. */
+static float keypoint_distance(const track_t& track, const face_to_send_t* face) {
+    if (track.keypoint_count < FACE_KEYPOINTS || face->keypoint.size() < FACE_KEYPOINTS) {
+        return 1e9f;
+    }
+    float eyes = std::max(eye_distance(face->keypoint.data()), 1.0f);
+    float sum = 0.0f;
+    for (int i = 0; i < FACE_KEYPOINTS; i += 2) {
+        sum += hypotf((float)(face->keypoint[i] - track.keypoint[i]), (float)(face->keypoint[i + 1] - track.keypoint[i + 1]));
+    }
+    return sum / (FACE_KEYPOINTS / 2) / eyes;
+}
+
+/* How good a crop this detection makes for recognition, 0-1:
+ * detector score x size (up to FACE_TRACK_GOOD_SIZE) x frontal geometry.
+ * The server aligns the face, so a tilted head (roll) costs little; a turned
+ * (yaw) or raised/lowered (pitch) one loses the features the model needs. */
+static float face_quality(const face_to_send_t* face) {
+    float size = std::min(1.0f, (float)std::min(face->box.w, face->box.h) / FACE_TRACK_GOOD_SIZE);
+    float frontal = 1.0f;
+    if (face->keypoint.size() >= FACE_KEYPOINTS) {
+        const int* k = face->keypoint.data();
+        float eyes = eye_distance(k);
+        if (eyes < 1.0f) return 0.0f;
+        float eye_x = (k[0] + k[6]) * 0.5f, eye_y = (k[1] + k[7]) * 0.5f;
+        float mouth_x = (k[2] + k[8]) * 0.5f, mouth_y = (k[3] + k[9]) * 0.5f;
+        // Nose off the eyes-mouth center line: yaw
+        float yaw = fabsf(k[4] - (eye_x + mouth_x) * 0.5f) / eyes;
+        // Nose height between eyes and mouth, ~0.5 when frontal: pitch
+        float pitch = mouth_y - eye_y > 1.0f ? fabsf((k[5] - eye_y) / (mouth_y - eye_y) - 0.5f) : 1.0f;
+        float roll = fabsf((float)(k[7] - k[1])) / eyes;
+        frontal = std::max(0.0f, 1.0f - 2.0f * yaw) * std::max(0.0f, 1.0f - 2.0f * pitch) * std::max(0.0f, 1.0f - 0.5f * roll);
+    }
+    return face->score * size * frontal;
+}
+
+/* Copy of the face plus FACE_CROP_MARGIN_PIXELS out of the frame, in PSRAM,
+ * so that the frame goes back to the camera at once. NULL on failure. */
+static tracked_face_t* crop_face(const camera_fb_t* frame, const face_to_send_t* face) {
+    int x0 = std::max(0, face->box.x - FACE_CROP_MARGIN_PIXELS);
+    int y0 = std::max(0, face->box.y - FACE_CROP_MARGIN_PIXELS);
+    int x1 = std::min((int)frame->width, face->box.x + face->box.w + FACE_CROP_MARGIN_PIXELS);
+    int y1 = std::min((int)frame->height, face->box.y + face->box.h + FACE_CROP_MARGIN_PIXELS);
+    if (x1 <= x0 || y1 <= y0) {
+        ESP_LOGE(TAG, "Invalid crop dimensions.");
+        return NULL;
+    }
+
+    tracked_face_t* crop = (tracked_face_t*)calloc(1, sizeof(tracked_face_t));
+    if (!crop) return NULL;
+    crop->width = x1 - x0;
+    crop->height = y1 - y0;
+    size_t len = (size_t)crop->width * crop->height * 2;
+    crop->buf = (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!crop->buf) {
+        ESP_LOGE(TAG, "Failed to allocate memory for cropped frame: %zu Bytes", len);
+        free(crop);
+        return NULL;
+    }
+    const uint16_t* p_full = (const uint16_t*)frame->buf;
+    uint16_t* p_cropped = (uint16_t*)crop->buf;
+    for (int row = 0; row < crop->height; ++row) {
+        memcpy(p_cropped + (size_t)row * crop->width, p_full + (size_t)(y0 + row) * frame->width + x0,
+               crop->width * sizeof(uint16_t));
+    }
+    crop->box = face->box;
+    crop->keypoint_count = (int)std::min(face->keypoint.size(), (size_t)FACE_KEYPOINTS);
+    for (int i = 0; i + 1 < crop->keypoint_count; i += 2) {
+        crop->keypoint[i] = face->keypoint[i] - x0;
+        crop->keypoint[i + 1] = face->keypoint[i + 1] - y0;
+    }
+    return crop;
+}
+
+static_assert(FACE_KEYPOINTS == 2 * FACE_ALIGN_POINTS, "tracker and template keypoints differ");
+
+/* The face warped into a FACE_ALIGN_SIZE tile, aligned on the template of the
+ * server's feature model (face_align.h), in PSRAM: a fixed size whatever the
+ * face size, and no warp left for the server. NULL on failure. */
+static tracked_face_t* align_face(const camera_fb_t* frame, const face_to_send_t* face) {
+    float m[6];
+    if (face->keypoint.size() < FACE_KEYPOINTS || !face_align_estimate(face->keypoint.data(), m)) {
+        return NULL;
+    }
+    tracked_face_t* tile = (tracked_face_t*)calloc(1, sizeof(tracked_face_t));
+    if (!tile) return NULL;
+    size_t len = FACE_ALIGN_SIZE * FACE_ALIGN_SIZE * 2;
+    tile->buf = (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!tile->buf) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the aligned face: %zu Bytes", len);
+        free(tile);
+        return NULL;
+    }
+    face_align_warp((const uint16_t*)frame->buf, frame->width, frame->height, m, (uint16_t*)tile->buf);
+    tile->width = FACE_ALIGN_SIZE;
+    tile->height = FACE_ALIGN_SIZE;
+    tile->box = face->box;
+    tile->keypoint_count = FACE_KEYPOINTS;
+    memcpy(tile->keypoint, FACE_ALIGN_KEYPOINTS, sizeof(tile->keypoint));
+    tile->aligned = true;
+    return tile;
+}
+
+void face_tracker_free_face(tracked_face_t* face) {
+    if (!face) return;
+    heap_caps_free(face->buf);
+    free(face);
+}
+
+/* Hands the best crop of the track to the sender. false if its queue is full (crop kept). */
+static bool send_best(track_t& track) {
+    if (!track.best) return false;
+    track.best->id = track.id;
+    if (xQueueSend(xQueueFaceO, &track.best, 0) != pdTRUE) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Track %" PRIu32 ": sending its best of %" PRIu32 " detections (quality %.2f).",
+             track.id, track.best->detections, track.best->quality);
+    track.best = NULL;
+    track.sent = true;
+    return true;
+}
+
+// Ends the tracks not seen for FACE_TRACK_LOST_MS, sending the short ones that were not sent yet
+static void expire_tracks(int64_t now_us) {
+    for (int i = 0; i < s_track_count;) {
+        track_t& track = s_tracks[i];
+        if (now_us - track.last_seen_us < (int64_t)FACE_TRACK_LOST_MS * 1000) {
+            i++;
+            continue;
+        }
+        if (!track.sent && track.hits >= FACE_TRACK_MIN_HITS && !send_best(track)) {
+            ESP_LOGW(TAG, "Track %" PRIu32 ": sender busy, face dropped.", track.id);
+        }
+        ESP_LOGD(TAG, "Track %" PRIu32 " lost after %" PRIu32 " detections.", track.id, track.hits);
+        face_tracker_free_face(track.best);
+        s_tracks[i] = s_tracks[--s_track_count];
+    }
+}
+
+/* The track this detection belongs to: the best box overlap, or for boxes
+ * that moved too far, the closest keypoints, among the tracks not matched
+ * by another face of the same frame. -1: a new face. Greedy, in detection
+ * order: the detector lists the most confident faces first. */
+static int associate(const face_to_send_t* face) {
+    int best = -1;
+    float best_affinity = 0.0f;
+    for (int i = 0; i < s_track_count; i++) {
+        if (s_tracks[i].hits > 0 && s_tracks[i].last_frame == face->id) continue; // one face per track and frame
+        float iou = box_iou(s_tracks[i].box, face->box);
+        float kp = keypoint_distance(s_tracks[i], face);
+        if (iou < FACE_TRACK_IOU_MIN && kp > FACE_TRACK_KEYPOINT_DIST) continue;
+        float affinity = iou + (kp <= FACE_TRACK_KEYPOINT_DIST ? 1.0f - kp / FACE_TRACK_KEYPOINT_DIST : 0.0f);
+        if (best < 0 || affinity > best_affinity) {
+            best = i;
+            best_affinity = affinity;
+        }
+    }
+    return best;
+}
+
+static void update_tracks(const camera_fb_t* frame, const face_to_send_t* face, int64_t now_us) {
+    int i = associate(face);
+    if (i < 0) {
+        if (s_track_count >= FACE_TRACK_MAX) {
+            ESP_LOGW(TAG, "%d faces tracked already, detection ignored.", FACE_TRACK_MAX);
+            return;
+        }
+        i = s_track_count++;
+        s_tracks[i] = {};
+        s_tracks[i].id = s_next_track_id++;
+        ESP_LOGI(TAG, "Track %" PRIu32 ": new face.", s_tracks[i].id);
+    }
+
+    track_t& track = s_tracks[i];
+    track.box = face->box;
+    track.keypoint_count = (int)std::min(face->keypoint.size(), (size_t)FACE_KEYPOINTS);
+    std::copy(face->keypoint.begin(), face->keypoint.begin() + track.keypoint_count, track.keypoint);
+    track.last_seen_us = now_us;
+    track.last_frame = face->id;
+    track.hits++;
+    if (track.sent) return;
+
+    float quality = face_quality(face);
+    if (!track.best || quality > track.best->quality) {
+        tracked_face_t* crop = NULL;
+        if (FACE_ALIGN_ON_CAM && message_handler_get_align() == FACE_ALIGN_SIZE) {
+            crop = align_face(frame, face); // the server takes aligned tiles
+        }
+        if (!crop) {
+            crop = crop_face(frame, face);
+        }
+        if (crop) {
+            crop->quality = quality;
+            face_tracker_free_face(track.best);
+            track.best = crop;
+        }
+    }
+    if (track.best) {
+        track.best->detections = track.hits;
+    }
+    if (track.hits >= FACE_TRACK_BEST_OF) {
+        send_best(track); // queue full: retried with the next detection or when the track ends
+    }
+}
+
+/**
+ * @brief Tracker task: associates the detections with the tracks, keeps the best
+ * crop of each and releases the faces (frames go back to the camera). Wakes up regularly to end
+ * the tracks that are no longer seen.
+ * @param arg Unused.
+ */
+static void face_tracker_task(void* arg) {
+    face_to_send_t* face = NULL;
+
+    while (true) {
+        if (xQueueReceive(xQueueFaceI, &face, pdMS_TO_TICKS(FACE_TRACK_LOST_MS / 4)) == pdTRUE && face) {
+            if (face->fb) {
+                update_tracks(face->fb, face, esp_timer_get_time());
+            }
+            face_to_send_release(face); // the frame goes back to the camera with its last face
+            face = NULL;
+        }
+        expire_tracks(esp_timer_get_time());
+    }
+}
+
+void register_face_tracker(QueueHandle_t face_i, QueueHandle_t face_o) {
+    xQueueFaceI = face_i;
+    xQueueFaceO = face_o;
+    xTaskCreatePinnedToCore(face_tracker_task, TAG, 4 * 1024, NULL, 5, NULL, 1);
+}
@@ -0,0 +1,57 @@
+/*
+ * Face tracker: pipeline stage between the face detector and the sender.
+ * Detections are associated with tracks (box overlap, keypoint distance),
+ * each track keeps the crop of its best detection and sends it once
+ * (an aligned tile with FACE_ALIGN_ON_CAM).
+ * The camera and the detector keep running, a face standing in front of
+ * the camera is not sent again. See FACE_TRACK_* in config.h.
+ */
+
+#ifndef FACE_TRACKER_H
+#define FACE_TRACKER_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "who_human_face_detection.hpp" // face_box_t, face_to_send_t
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FACE_KEYPOINTS 10 // 5 points, x and y
+
+// Best crop of a track, handed to the sender with its queue
+typedef struct {
+    uint8_t* buf;                 // RGB565 crop, width x height
+    int width;
+    int height;
+    face_box_t box;               // detected face, frame coordinates
+    int keypoint[FACE_KEYPOINTS]; // crop coordinates
+    int keypoint_count;
+    bool aligned;                 // FACE_ALIGN_SIZE tile aligned on the template (face_align.h), keypoints are the template
+    uint32_t id;                  // track id, also the frame id on the wire
+    uint32_t detections;          // detections of the track when it was sent
+    float quality;
+} tracked_face_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Creates the tracker task: detections from face_i (face_to_send_t*, one per
+ * face, released here), best crop of each new track to face_o (tracked_face_t*).
+ * @param face_i Detector output queue.
+ * @param face_o Sender input queue.
+ */
+void register_face_tracker(QueueHandle_t face_i, QueueHandle_t face_o);
+
+/**
+ * @brief Frees a crop received from the tracker.
+ * @param face The crop, may be NULL.
+ */
+void face_tracker_free_face(tracked_face_t* face);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FACE_TRACKER_H
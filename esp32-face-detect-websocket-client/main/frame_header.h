@@ -0,0 +1,128 @@
+/**
+ * @file frame_header.h
+ * @brief Binary face transfer header, shared by the CAM (client) and the S3 (server).
+ * KEEP BOTH COPIES IDENTICAL: esp32-face-detect-websocket-client/main/frame_header.h
+ * and esp32-s3-websocket_server/main/frame_header.h.
+ *
+ * Replaces the JSON frame_start/frame_end text messages (still accepted by
+ * the server, compatibility mode). The header is the first bytes of the first
+ * binary message, payload bytes follow in the same message. If the crop fits
+ * in one chunk, the whole transfer is ONE message. Otherwise the remaining
+ * payload follows in plain binary chunks, the transfer is complete when
+ * payload_size bytes have arrived: no frame_start_ack, no frame_end.
+ *
+ * Windowed mode (FRAME_FLAG_WINDOWED, server advertises "window=N"): every
+ * following chunk starts with a frame_chunk_header_t carrying its offset. The
+ * sender keeps at most N unacknowledged bytes in flight, the server reports
+ * its contiguous offset with frame_progress messages. After a gap or a failed
+ * send, the transfer resumes from that offset instead of restarting.
+ *
+ * Batched transfer (batch_count > 1, server advertises "batch=N"): the faces
+ * of one camera frame are sent back-to-back, one header each, batch_index
+ * 0..batch_count-1, no windowing. The server holds them until the last one
+ * is in, runs them through recognition together and answers once, with a
+ * frame_ack (or frame_busy) for the last id. If the last face does not go
+ * out, the CAM closes the batch with {"type":"batch_end","id":<last id>}:
+ * same answer, for the faces the server holds. A batch left open is closed
+ * by the server after a timeout.
+ *
+ * Aligned tile (FRAME_FLAG_ALIGNED, server advertises "align=112"): the CAM
+ * did the 5-point alignment (face_align.h), the payload is a 112x112 tile
+ * and the keypoints are the template (FACE_ALIGN_KEYPOINTS). The box stays
+ * the detected face in the camera frame. The server skips its warp.
+ *
+ * Fixed layout, little-endian (both ESP32 are little-endian, the struct is
+ * sent as is). Bump FRAME_HEADER_VERSION on ANY layout change.
+ */
+#ifndef FRAME_HEADER_H
+#define FRAME_HEADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_rom_crc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_HEADER_MAGIC 0x4846 // "FH"
+#define FRAME_HEADER_VERSION 3
+#define FRAME_CHUNK_MAGIC 0x4346 // "FC"
+#define FRAME_HEADER_KEYPOINTS 10 // 5 points, x/y
+
+// Payload formats (same values as the server frame_format_t)
+#define FRAME_HEADER_FORMAT_RGB565 0
+#define FRAME_HEADER_FORMAT_JPEG 1
+
+// flags
+#define FRAME_FLAG_WINDOWED 0x01 // chunks carry a frame_chunk_header_t, credit based flow control
+#define FRAME_FLAG_ALIGNED 0x02  // payload is a FACE_ALIGN_SIZE tile aligned on the template (face_align.h)
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;         // FRAME_HEADER_MAGIC
+    uint8_t version;        // FRAME_HEADER_VERSION
+    uint8_t format;         // FRAME_HEADER_FORMAT_*
+    uint8_t flags;          // FRAME_FLAG_*
+    uint8_t batch_index;    // position in the batch
+    uint8_t batch_count;    // faces in the batch, 0 or 1: a single transfer
+    uint8_t reserved;
+    uint32_t id;            // frame id
+    uint32_t payload_size;  // total payload bytes (all chunks)
+    uint16_t width;         // cropped image
+    uint16_t height;
+    int16_t box_x;          // face box, relative to the full camera frame
+    int16_t box_y;
+    int16_t box_w;
+    int16_t box_h;
+    int16_t keypoints[FRAME_HEADER_KEYPOINTS]; // relative to the cropped image
+    uint32_t payload_crc;   // CRC32 (esp_rom_crc32_le) of the payload, 0: not checked
+    uint32_t header_crc;    // CRC32 of all the bytes above
+} frame_header_t;
+
+// Windowed mode: in front of every chunk after the first message
+typedef struct __attribute__((packed)) {
+    uint16_t magic;         // FRAME_CHUNK_MAGIC
+    uint16_t reserved;
+    uint32_t id;            // frame id, chunks of an older frame are dropped
+    uint32_t offset;        // payload offset of the data that follows
+} frame_chunk_header_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(frame_header_t) == 56, "frame_header_t layout changed, bump FRAME_HEADER_VERSION");
+static_assert(sizeof(frame_chunk_header_t) == 12, "frame_chunk_header_t layout changed, bump FRAME_HEADER_VERSION");
+#else
+_Static_assert(sizeof(frame_header_t) == 56, "frame_header_t layout changed, bump FRAME_HEADER_VERSION");
+_Static_assert(sizeof(frame_chunk_header_t) == 12, "frame_chunk_header_t layout changed, bump FRAME_HEADER_VERSION");
+#endif
+
+static inline uint32_t frame_header_crc(const frame_header_t* header) {
+    return esp_rom_crc32_le(0, (const uint8_t*)header, offsetof(frame_header_t, header_crc));
+}
+
+/* Fills magic, version and header_crc. Call after setting all the other fields. */
+static inline void frame_header_seal(frame_header_t* header) {
+    header->magic = FRAME_HEADER_MAGIC;
+    header->version = FRAME_HEADER_VERSION;
+    header->header_crc = frame_header_crc(header);
+}
+
+/* True if data starts with a valid header of this version */
+static inline bool frame_header_check(const uint8_t* data, size_t len, frame_header_t* out) {
+    if (!data || len < sizeof(frame_header_t)) return false;
+    frame_header_t header;
+    memcpy(&header, data, sizeof(header)); // data may be unaligned
+    if (header.magic != FRAME_HEADER_MAGIC || header.version != FRAME_HEADER_VERSION ||
+        header.header_crc != frame_header_crc(&header)) {
+        return false;
+    }
+    if (out) *out = header;
+    return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_HEADER_H
@@ -1,6 +1,9 @@
 #include "heartbeat.h"
 #include "websocket_client.h"
 #include "config.h"
+#include "motion_gate.h"
+#include <stdio.h>
+#include <inttypes.h>
 
 static EventGroupHandle_t s_app_event_group;
 
@@ -26,6 +29,17 @@ void heartbeat_task(void* pvParameters) {
                 WIFI_CONNECTED_BIT | WEBSOCKET_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
         
         vTaskDelay(pdMS_TO_TICKS(HEARTBEAT_INTERVAL_S * 1000));
+#if MOTION_GATE_ENABLED
+        // the server only looks at "type", the gate counters ride along
+        motion_gate_stats_t gate;
+        motion_gate_get_stats(&gate);
+        char msg[160];
+        snprintf(msg, sizeof(msg), "{\"type\":\"heartbeat\",\"gate\":{\"frames\":%" PRIu32 ",\"forwarded\":%" PRIu32
+                 ",\"forced\":%" PRIu32 ",\"skipped\":%" PRIu32 "}}",
+                 gate.frames, gate.forwarded, gate.forced, gate.skipped);
+        websocket_send_text(msg);
+#else
         websocket_send_heartbeat();
+#endif
     }
 }
\ No newline at end of file
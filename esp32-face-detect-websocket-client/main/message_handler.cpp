@@ -1,12 +1,73 @@
 #include "message_handler.h"
 #include "esp_log.h"
+#include "freertos/task.h" // critical sections
 #include "cJSON.h"
 #include "config.h"
+#include "frame_header.h"
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 static const char* TAG = "MSG_HANDLER";
 
+// Written here (websocket task), read by the face sender task
+static uint32_t s_server_window = 0;
+static int s_server_batch = 1;
+static int s_server_align = 0;
+static frame_progress_t s_progress = {};
+static bool s_progress_pending = false;
+static portMUX_TYPE s_progress_lock = portMUX_INITIALIZER_UNLOCKED;
+// Written by the face sender task
+static uint32_t s_expected_id = 0;
+static bool s_expected_batch = false;
+static portMUX_TYPE s_answer_lock = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t message_handler_get_window(void) {
+    return s_server_window;
+}
+
+int message_handler_get_batch(void) {
+    return s_server_batch;
+}
+
+int message_handler_get_align(void) {
+    return s_server_align;
+}
+
+bool message_handler_take_progress(frame_progress_t *out) {
+    bool pending;
+    taskENTER_CRITICAL(&s_progress_lock);
+    pending = s_progress_pending;
+    if (pending && out) {
+        *out = s_progress;
+    }
+    s_progress_pending = false;
+    s_progress.resend = false;
+    taskEXIT_CRITICAL(&s_progress_lock);
+    return pending;
+}
+
+void message_handler_expect_answer(uint32_t frame_id, bool batch) {
+    taskENTER_CRITICAL(&s_answer_lock);
+    s_expected_id = frame_id;
+    s_expected_batch = batch;
+    taskEXIT_CRITICAL(&s_answer_lock);
+}
+
+// Answer to the transfer the sender waits on: same id, and a batch answer ("batch":n) for a batch
+static bool is_expected_answer(const char *message) {
+    const char *id_field = strstr(message, "\"id\":");
+    unsigned int id = 0;
+    if (!id_field || sscanf(id_field, "\"id\":%u", &id) != 1) {
+        return false;
+    }
+    bool batch = strstr(message, "\"batch\":") != NULL;
+    taskENTER_CRITICAL(&s_answer_lock);
+    bool expected = id == s_expected_id && (batch || !s_expected_batch);
+    taskEXIT_CRITICAL(&s_answer_lock);
+    return expected;
+}
+
 /**
  * @brief Parse incoming text messages from the WebSocket server.
  * @param message A null-terminated string received from the server.
@@ -22,14 +83,62 @@ void message_handler_process(const char *message, EventGroupHandle_t event_group
         return;
     }
 
+    // Windowed transfer progress, fixed format from the server: no JSON parsing
+    if (strstr(message, "frame_progress") != NULL) {
+        unsigned int id = 0, offset = 0, resend = 0;
+        int window = 0;
+        if (sscanf(message, "{\"type\":\"frame_progress\",\"id\":%u,\"offset\":%u,\"window\":%d,\"resend\":%u}",
+                   &id, &offset, &window, &resend) == 4) {
+            taskENTER_CRITICAL(&s_progress_lock);
+            if (s_progress_pending && s_progress.frame_id == id) {
+                s_progress.resend = s_progress.resend || resend; // keep a resend request until taken
+            } else {
+                s_progress.resend = resend;
+            }
+            s_progress.frame_id = id;
+            s_progress.offset = offset;
+            s_progress_pending = true;
+            taskEXIT_CRITICAL(&s_progress_lock);
+            ESP_LOGD(TAG, "Frame %u progress: %u bytes%s", id, offset, resend ? ", resend requested" : "");
+            if (event_group) {
+                xEventGroupSetBits(event_group, FRAME_PROGRESS_BIT);
+            }
+        } else {
+            ESP_LOGW(TAG, "Malformed frame_progress: %s", message);
+        }
+        return;
+    }
+
     // Check for simple, non-JSON messages first
     if (strstr(message, "frame_ack") != NULL) {
         ESP_LOGD(TAG, "Got frame ACK.");
-        if (event_group) {
+        if (!is_expected_answer(message)) {
+            ESP_LOGD(TAG, "Not for the current transfer: %s", message);
+        } else if (event_group) {
             xEventGroupSetBits(event_group, FRAME_ACK_BIT);
         }
         return; // Message handled, exit
     }
+    // Backpressure: the server inference queue is full, it did not keep the frame
+    if (strstr(message, "frame_busy") != NULL) {
+        ESP_LOGW(TAG, "Server busy, frame rejected: %s", message);
+        if (is_expected_answer(message) && event_group) {
+            xEventGroupSetBits(event_group, FRAME_BUSY_BIT);
+        }
+        return;
+    }
+    // Received but corrupted (binary header payload CRC): not processed, same as busy for the sender
+    if (strstr(message, "frame_error") != NULL) {
+        ESP_LOGE(TAG, "Server rejected the frame: %s", message);
+        if (is_expected_answer(message) && event_group) {
+            xEventGroupSetBits(event_group, FRAME_BUSY_BIT);
+        }
+        return;
+    }
+    if (strstr(message, "frame_dropped") != NULL) {
+        ESP_LOGW(TAG, "Server dropped a queued frame: %s", message);
+        return;
+    }
     if (strstr(message, "Welcome, client fd") != NULL) {
         int client_fd = 0;
         if (sscanf(message, "Welcome, client fd %d!", &client_fd) == 1) {
@@ -37,6 +146,52 @@ void message_handler_process(const char *message, EventGroupHandle_t event_group
         } else {
             ESP_LOGI(TAG, "Received welcome message: %s", message);
         }
+        // Payload negotiation: "formats=jpeg,rgb565". Older servers list nothing, raw only.
+        const char* formats = strstr(message, "formats=");
+        if (event_group) {
+            if (formats && strstr(formats, "jpeg")) {
+                xEventGroupSetBits(event_group, SERVER_JPEG_BIT);
+            } else {
+                xEventGroupClearBits(event_group, SERVER_JPEG_BIT);
+            }
+        }
+        ESP_LOGI(TAG, "Server payload formats: %s", formats ? formats + strlen("formats=") : "rgb565");
+        // Windowed transfer credit, 0 (absent): send frames as before
+        const char* window = strstr(message, "window=");
+        int window_bytes = 0;
+        if (window) {
+            sscanf(window, "window=%d", &window_bytes);
+        }
+        s_server_window = window_bytes > 0 ? (uint32_t)window_bytes : 0;
+        ESP_LOGI(TAG, "Server transfer window: %" PRIu32 " Bytes", s_server_window);
+        // Faces per batched transfer, 1 (absent): one face per transfer
+        const char* batch = strstr(message, "batch=");
+        int batch_faces = 1;
+        if (batch) {
+            sscanf(batch, "batch=%d", &batch_faces);
+        }
+        s_server_batch = batch_faces > 1 ? batch_faces : 1;
+        // Size of the aligned tiles it takes (FRAME_FLAG_ALIGNED), 0 (absent): crops only
+        const char* align = strstr(message, "align=");
+        int align_size = 0;
+        if (align) {
+            sscanf(align, "align=%d", &align_size);
+        }
+        s_server_align = align_size > 0 ? align_size : 0;
+
+        // Binary framing: only if the server speaks exactly our header version
+        const char* framing = strstr(message, "framing=bin");
+        int framing_version = 0;
+        if (framing) {
+            sscanf(framing, "framing=bin%d", &framing_version);
+        }
+        if (event_group) {
+            if (framing_version == FRAME_HEADER_VERSION) {
+                xEventGroupSetBits(event_group, SERVER_BIN_FRAMING_BIT);
+            } else {
+                xEventGroupClearBits(event_group, SERVER_BIN_FRAMING_BIT);
+            }
+        }
         return; // Message handled, exit
     }
 
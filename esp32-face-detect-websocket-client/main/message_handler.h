@@ -3,6 +3,8 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +21,48 @@ extern "C" {
  */
 void message_handler_process(const char *message, EventGroupHandle_t event_group);
 
+// Windowed transfer progress, from the server frame_progress messages
+typedef struct {
+    uint32_t frame_id;
+    uint32_t offset;  // payload bytes the server has received, contiguous
+    bool resend;      // the server saw a gap: continue from offset
+} frame_progress_t;
+
+/**
+ * @brief Transfer credit advertised in the server welcome message.
+ * @return Bytes the client may send ahead of the acked offset, 0 if no windowed transfer.
+ */
+uint32_t message_handler_get_window(void);
+
+/**
+ * @brief Faces per batched transfer advertised in the server welcome message.
+ * @return At most this many faces in one batch, 1 if the server takes one face per transfer.
+ */
+int message_handler_get_batch(void);
+
+/**
+ * @brief Size of the aligned face tiles advertised in the server welcome message.
+ * @return Tile width and height (FACE_ALIGN_SIZE), 0 if the server only takes crops.
+ */
+int message_handler_get_align(void);
+
+/**
+ * @brief Latest frame progress (a resend request stays flagged until taken).
+ * @param out Progress.
+ * @return false if nothing arrived since the last call.
+ */
+bool message_handler_take_progress(frame_progress_t *out);
+
+/**
+ * @brief Sets the transfer the sender waits on, before its first bytes go out.
+ * @param frame_id Id of the frame, the last face of a batch.
+ * @param batch A batched transfer: only its batch answer counts.
+ * frame_ack/frame_busy/frame_error raise FRAME_ACK_BIT/FRAME_BUSY_BIT only for
+ * this transfer: a late answer to a previous one, or the per-face answers inside
+ * a batch, are ignored.
+ */
+void message_handler_expect_answer(uint32_t frame_id, bool batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,207 @@
+#include "motion_gate.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <algorithm>
+
+static const char* TAG = "MOTION_GATE";
+
+static QueueHandle_t xQueueFrameI = NULL;
+static QueueHandle_t xQueueFrameO = NULL;
+
+/* Background: one luma sample per MOTION_GATE_STRIDE x MOTION_GATE_STRIDE cell,
+ * fixed point (luma << 4) so that the slow running average keeps its fraction. */
+static uint16_t* s_background = NULL;
+static int s_grid_w = 0;
+static int s_grid_h = 0;
+static uint32_t s_since_forward = 0; // frames skipped in a row
+
+static motion_gate_stats_t s_stats = {};
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Region of the frames forwarded last, by frame buffer: the detector looks them
+ * up (motion_gate_get_region). More slots than frames in flight between the two.
+ * The camera reuses its few buffers: a buffer has one slot, its latest frame. */
+#define REGION_SLOTS 4
+static struct {
+    const uint8_t* buf;
+    motion_region_t region;
+} s_regions[REGION_SLOTS] = {};
+static int s_next_region = 0;
+
+/* Luma (0-255) of a camera RGB565 pixel, big-endian byte order as in the frame buffer */
+static inline int pixel_luma(const uint8_t* p) {
+    int r = p[0] >> 3;
+    int g = ((p[0] & 0x07) << 3) | (p[1] >> 5);
+    int b = p[1] & 0x1F;
+    return (r * 616 + g * 600 + b * 232) >> 8; // 0.299 / 0.587 / 0.114 on the 5/6/5 bit values
+}
+
+/* Average luma of the 2x2 pixels at the center of cell (cx, cy): less sensor noise than one pixel */
+static inline int cell_luma(const camera_fb_t* frame, int cx, int cy) {
+    int x = std::min(cx * MOTION_GATE_STRIDE + MOTION_GATE_STRIDE / 2, (int)frame->width - 2);
+    int y = std::min(cy * MOTION_GATE_STRIDE + MOTION_GATE_STRIDE / 2, (int)frame->height - 2);
+    const uint8_t* row = frame->buf + ((size_t)y * frame->width + x) * 2;
+    const uint8_t* next = row + frame->width * 2;
+    return (pixel_luma(row) + pixel_luma(row + 2) + pixel_luma(next) + pixel_luma(next + 2)) >> 2;
+}
+
+/* (Re)builds the background from this frame. Returns false if out of memory. */
+static bool background_init(const camera_fb_t* frame) {
+    int grid_w = frame->width / MOTION_GATE_STRIDE;
+    int grid_h = frame->height / MOTION_GATE_STRIDE;
+    if (grid_w != s_grid_w || grid_h != s_grid_h || !s_background) {
+        free(s_background);
+        s_background = (uint16_t*)malloc((size_t)grid_w * grid_h * sizeof(uint16_t));
+        if (!s_background) {
+            ESP_LOGE(TAG, "Failed to allocate the background (%dx%d cells). Gate open.", grid_w, grid_h);
+            s_grid_w = s_grid_h = 0;
+            return false;
+        }
+        s_grid_w = grid_w;
+        s_grid_h = grid_h;
+    }
+    for (int cy = 0; cy < grid_h; cy++) {
+        for (int cx = 0; cx < grid_w; cx++) {
+            s_background[cy * grid_w + cx] = (uint16_t)(cell_luma(frame, cx, cy) << 4);
+        }
+    }
+    return true;
+}
+
+bool motion_gate_check(const camera_fb_t* frame, motion_region_t* out_region) {
+    if (out_region) {
+        *out_region = { 0, 0, frame ? (int)frame->width : 0, frame ? (int)frame->height : 0 };
+    }
+    if (!frame || frame->format != PIXFORMAT_RGB565 ||
+        frame->width < 2 * MOTION_GATE_STRIDE || frame->height < 2 * MOTION_GATE_STRIDE) {
+        return true; // nothing to compare: let the detector decide
+    }
+
+    bool first = !s_background || s_grid_w != (int)frame->width / MOTION_GATE_STRIDE ||
+                 s_grid_h != (int)frame->height / MOTION_GATE_STRIDE;
+    if (first) {
+        background_init(frame);
+        taskENTER_CRITICAL(&s_stats_lock);
+        s_stats.frames++;
+        s_stats.forwarded++;
+        s_stats.cells = s_grid_w * s_grid_h;
+        taskEXIT_CRITICAL(&s_stats_lock);
+        return true;
+    }
+
+    // Compare and update in one pass
+    const int threshold = MOTION_GATE_PIXEL_THRESHOLD << 4;
+    int changed = 0;
+    int min_x = s_grid_w, min_y = s_grid_h, max_x = -1, max_y = -1;
+    uint16_t* bg = s_background;
+    for (int cy = 0; cy < s_grid_h; cy++) {
+        for (int cx = 0; cx < s_grid_w; cx++, bg++) {
+            int luma = cell_luma(frame, cx, cy) << 4;
+            int diff = luma - *bg;
+            if (diff > threshold || diff < -threshold) {
+                changed++;
+                min_x = std::min(min_x, cx);
+                max_x = std::max(max_x, cx);
+                min_y = std::min(min_y, cy);
+                max_y = std::max(max_y, cy);
+            }
+            *bg = (uint16_t)(*bg + (diff >> MOTION_GATE_BG_SHIFT));
+        }
+    }
+
+    bool moved = changed >= MOTION_GATE_MIN_CELLS;
+    bool forced = !moved && MOTION_GATE_FORCE_EVERY > 0 && s_since_forward + 1 >= MOTION_GATE_FORCE_EVERY;
+    if (moved && out_region) {
+        out_region->x = min_x * MOTION_GATE_STRIDE;
+        out_region->y = min_y * MOTION_GATE_STRIDE;
+        out_region->w = std::min((max_x + 1) * MOTION_GATE_STRIDE, (int)frame->width) - out_region->x;
+        out_region->h = std::min((max_y + 1) * MOTION_GATE_STRIDE, (int)frame->height) - out_region->y;
+    }
+    s_since_forward = (moved || forced) ? 0 : s_since_forward + 1;
+
+    taskENTER_CRITICAL(&s_stats_lock);
+    s_stats.frames++;
+    s_stats.last_changed = changed;
+    if (moved || forced) {
+        s_stats.forwarded++;
+        if (forced) s_stats.forced++;
+    } else {
+        s_stats.skipped++;
+    }
+    taskEXIT_CRITICAL(&s_stats_lock);
+    return moved || forced;
+}
+
+bool motion_gate_get_region(const camera_fb_t* frame, motion_region_t* out_region) {
+    if (!frame || !out_region) return false;
+    bool found = false;
+    taskENTER_CRITICAL(&s_stats_lock);
+    // Newest first: the latest frame forwarded in this buffer
+    for (int n = 1; n <= REGION_SLOTS && !found; n++) {
+        int i = (s_next_region - n + REGION_SLOTS) % REGION_SLOTS;
+        if (s_regions[i].buf == frame->buf) {
+            *out_region = s_regions[i].region;
+            found = true;
+        }
+    }
+    taskEXIT_CRITICAL(&s_stats_lock);
+    return found;
+}
+
+void motion_gate_get_stats(motion_gate_stats_t* out_stats) {
+    if (!out_stats) return;
+    taskENTER_CRITICAL(&s_stats_lock);
+    *out_stats = s_stats;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
+
+/**
+ * @brief Gate task: forwards the frames with activity to the detector,
+ * returns the others to the camera at once (its buffers are few).
+ * @param arg Unused.
+ */
+static void motion_gate_task(void* arg) {
+    camera_fb_t* frame = NULL;
+    int64_t last_log_us = esp_timer_get_time();
+
+    while (true) {
+        if (xQueueReceive(xQueueFrameI, &frame, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        motion_region_t region;
+        if (motion_gate_check(frame, &region)) {
+            taskENTER_CRITICAL(&s_stats_lock);
+            for (int i = 0; i < REGION_SLOTS; i++) {
+                if (s_regions[i].buf == frame->buf) {
+                    s_regions[i].buf = NULL; // an older frame of the same buffer
+                }
+            }
+            s_regions[s_next_region].buf = frame->buf;
+            s_regions[s_next_region].region = region;
+            s_next_region = (s_next_region + 1) % REGION_SLOTS;
+            taskEXIT_CRITICAL(&s_stats_lock);
+            xQueueSend(xQueueFrameO, &frame, portMAX_DELAY);
+        } else {
+            esp_camera_fb_return(frame);
+        }
+        frame = NULL;
+
+        if (esp_timer_get_time() - last_log_us >= (int64_t)MOTION_GATE_LOG_INTERVAL_S * 1000000) {
+            last_log_us = esp_timer_get_time();
+            motion_gate_stats_t stats;
+            motion_gate_get_stats(&stats);
+            ESP_LOGI(TAG, "%" PRIu32 " frames: %" PRIu32 " to the detector (%" PRIu32 " forced), %" PRIu32 " skipped.",
+                     stats.frames, stats.forwarded, stats.forced, stats.skipped);
+        }
+    }
+}
+
+void register_motion_gate(QueueHandle_t frame_i, QueueHandle_t frame_o) {
+    xQueueFrameI = frame_i;
+    xQueueFrameO = frame_o;
+    xTaskCreatePinnedToCore(motion_gate_task, TAG, 3 * 1024, NULL, 5, NULL, 1);
+}
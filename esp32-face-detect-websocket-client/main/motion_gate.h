@@ -0,0 +1,72 @@
+/*
+ * Motion gate: pipeline stage between the camera and the face detector.
+ * Frames of a static scene are returned to the camera without running
+ * the (two-stage) detector on them. See MOTION_GATE_* in config.h.
+ */
+
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_camera.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bounding box of the changed cells, in frame pixels
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} motion_region_t;
+
+typedef struct {
+    uint32_t frames;       // frames checked
+    uint32_t forwarded;    // sent to the detector (motion or forced)
+    uint32_t skipped;      // returned to the camera, no motion
+    uint32_t forced;       // forwarded without motion (MOTION_GATE_FORCE_EVERY)
+    uint32_t last_changed; // changed cells in the last frame
+    uint32_t cells;        // cells per frame
+} motion_gate_stats_t;
+
+/**
+ * @brief Creates the gate task: frames from frame_i with activity go to frame_o,
+ * the others are returned to the camera.
+ * @param frame_i Camera frames (camera_fb_t*).
+ * @param frame_o Detector input queue (camera_fb_t*).
+ */
+void register_motion_gate(QueueHandle_t frame_i, QueueHandle_t frame_o);
+
+/**
+ * @brief Compares one RGB565 frame with the running background and updates it.
+ * @param frame Camera frame, other formats are always accepted.
+ * @param out_region Optional, bounding box of the changed area (whole frame if none).
+ * @return true if the frame should go to the detector.
+ */
+bool motion_gate_check(const camera_fb_t* frame, motion_region_t* out_region);
+
+/**
+ * @brief Changed area of a frame the gate task forwarded (the whole frame when
+ * it was forwarded without motion), e.g. for ROI-restricted detection.
+ * @param frame A frame from the gate's output queue, still held.
+ * @param out_region The region.
+ * @return false if the frame is unknown (not from the gate, or too old).
+ */
+bool motion_gate_get_region(const camera_fb_t* frame, motion_region_t* out_region);
+
+/**
+ * @brief Copy of the gate counters.
+ * @param out_stats Counters since boot.
+ */
+void motion_gate_get_stats(motion_gate_stats_t* out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MOTION_GATE_H
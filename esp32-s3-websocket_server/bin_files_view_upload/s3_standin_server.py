@@ -0,0 +1,88 @@
+"""
+Local stand-in for API Gateway + S3, to exercise the upload queue without AWS.
+
+Set S3_STANDIN_BASE_URL in main/config.h to "http://<this PC>:<port>".
+  GET  <API_GATEWAY_PATH>?filename=X  -> {"uploadUrl": "http://<host>:<port>/upload/X"}
+  PUT  /upload/X                      -> stores the body in --out-dir
+
+--fail-rate makes a share of the requests fail (HTTP 503) to see the retries/backoff.
+Stop the server (or the Wi-Fi) to see jobs spilled to flash and restored later.
+
+python s3_standin_server.py --port 8080 --api-path /prod/upload-url --fail-rate 0.2
+"""
+import argparse
+import json
+import os
+import random
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlparse, parse_qs
+
+
+class StandInHandler(BaseHTTPRequestHandler):
+    # Kept-alive connections, as on the device
+    protocol_version = "HTTP/1.1"
+
+    def _fail(self):
+        if random.random() < self.server.fail_rate:
+            self._reply(503, b"injected failure")
+            return True
+        return False
+
+    def _reply(self, status, body, content_type="text/plain"):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        if url.path != self.server.api_path:
+            self._reply(404, b"not found")
+            return
+        if self._fail():
+            return
+        filename = parse_qs(url.query).get("filename", [""])[0]
+        if not filename:
+            self._reply(400, b"missing filename")
+            return
+        host = self.headers.get("Host", "%s:%d" % self.server.server_address)
+        body = json.dumps({"uploadUrl": "http://%s/upload/%s" % (host, filename)}).encode()
+        self._reply(200, body, "application/json")
+
+    def do_PUT(self):
+        length = int(self.headers.get("Content-Length", 0))
+        data = self.rfile.read(length)  # always drain, the connection is reused
+        if not self.path.startswith("/upload/"):
+            self._reply(404, b"not found")
+            return
+        if self._fail():
+            return
+        filename = os.path.basename(self.path[len("/upload/"):])
+        with open(os.path.join(self.server.out_dir, filename), "wb") as f:
+            f.write(data)
+        print("%s stored %s (%d bytes, %s)" % (time.strftime("%H:%M:%S"), filename, len(data),
+                                               self.headers.get("Content-Type")))
+        self._reply(200, b"")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="API Gateway + S3 stand-in for the upload queue")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--api-path", default="/upload-url", help="must match API_GATEWAY_PATH")
+    parser.add_argument("--out-dir", default="standin_uploads")
+    parser.add_argument("--fail-rate", type=float, default=0.0, help="0..1, share of failed requests")
+    args = parser.parse_args()
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    server = ThreadingHTTPServer(("0.0.0.0", args.port), StandInHandler)
+    server.api_path = args.api_path
+    server.out_dir = args.out_dir
+    server.fail_rate = args.fail_rate
+    print("S3 stand-in on port %d, API path %s, fail rate %.2f" % (args.port, args.api_path, args.fail_rate))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
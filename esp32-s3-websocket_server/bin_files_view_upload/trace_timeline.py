@@ -0,0 +1,140 @@
+"""
+Latency timeline of the S3 pipeline, from the device trace (main/perf_trace.c).
+
+Polls the device with {"type":"stats","since":seq} over its WebSocket, or reads
+replies saved earlier (one JSON object per line), and writes a Chrome trace-event
+file: open it in https://ui.perfetto.dev or chrome://tracing. One track per core,
+one slice per stage of each frame (receive, queue, decode, align, each model
+module, postprocess, search, reply), heap levels as counters.
+Prints per-stage latencies (count, mean, p50, p95, max) at the end.
+
+Needs websocket-client (pip install websocket-client) for the live mode.
+
+python trace_timeline.py --url ws://192.168.1.50/ws --seconds 30 --out trace.json --save stats.jsonl
+python trace_timeline.py --load stats.jsonl --out trace.json
+"""
+import argparse
+import json
+import time
+
+HEAP_STAGES = ("heap_internal", "heap_psram")
+
+
+class Timeline:
+    """Turns the event rows of the stats replies into trace events."""
+
+    def __init__(self):
+        self.events = []
+        self.durations = {}
+        self.lost = 0
+        self.now = None      # device time of the last reply, low 32 bits
+        self.now_full = 0    # the same, unwrapped
+
+    def add_reply(self, reply):
+        now = reply["now"]
+        if self.now is not None:
+            self.now_full += (now - self.now) & 0xFFFFFFFF
+        self.now = now
+        self.lost += reply.get("lost", 0)
+        stages = reply["stages"]
+        for frame_id, stage, detail, core, start_us, value in reply["events"]:
+            name = stages[stage] if stage < len(stages) else "stage%d" % stage
+            # start_us is the low 32 bits of esp_timer, place it relative to "now"
+            ts = self.now_full - ((now - start_us) & 0xFFFFFFFF)
+            if name in HEAP_STAGES:
+                self.events.append({"name": name, "ph": "C", "ts": ts, "pid": 0,
+                                    "args": {"free_bytes": value}})
+                continue
+            if name == "module":
+                name = "module %d" % detail
+            self.events.append({"name": name, "ph": "X", "ts": ts, "dur": value, "pid": 0, "tid": core,
+                                "args": {"frame": frame_id}})
+            self.durations.setdefault(name, []).append(value)
+
+    def write(self, path):
+        meta = [{"name": "thread_name", "ph": "M", "pid": 0, "tid": core, "args": {"name": "core %d" % core}}
+                for core in (0, 1)]
+        with open(path, "w") as f:
+            json.dump({"traceEvents": meta + self.events, "displayTimeUnit": "ms"}, f)
+
+    def print_summary(self):
+        print("%-16s %7s %9s %9s %9s %9s" % ("stage", "count", "mean_us", "p50_us", "p95_us", "max_us"))
+        for name in sorted(self.durations, key=lambda n: -sum(self.durations[n])):
+            values = sorted(self.durations[name])
+            n = len(values)
+            print("%-16s %7d %9.0f %9d %9d %9d" % (name, n, sum(values) / n, values[n // 2],
+                                                  values[min(n - 1, n * 95 // 100)], values[-1]))
+        if self.lost:
+            print("%d events were overwritten before being read, poll faster or enlarge PERF_TRACE_EVENTS." % self.lost)
+
+
+def poll(url, seconds, interval, max_events, save):
+    import websocket  # websocket-client
+
+    ws = websocket.create_connection(url, timeout=5)
+    replies = []
+    since = 0
+    catching_up = True  # the ring holds what happened before, skip it
+    deadline = time.time() + seconds
+    try:
+        while time.time() < deadline:
+            ws.send(json.dumps({"type": "stats", "since": since, "max": max_events}))
+            while True:  # recognition results etc. are broadcast to every client, skip them
+                reply = json.loads(ws.recv())
+                if reply.get("type") == "stats":
+                    break
+            since = reply["seq"]
+            drained = len(reply["events"]) < max_events
+            if catching_up:
+                # A full reply only moved since by max events: ask again until
+                # one comes back short, then record from there on
+                catching_up = not drained
+                deadline = time.time() + seconds
+                continue
+            replies.append(reply)
+            if save:
+                save.write(json.dumps(reply) + "\n")
+            if drained:
+                time.sleep(interval)  # drained, else ask again right away
+    finally:
+        ws.close()
+    last = replies[-1] if replies else None
+    if last:
+        print("heap: %s\nworker: %s\npool: %s" % (last["heap"], last["worker"], last["pool"]))
+    return replies
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Device latency trace to a Chrome/Perfetto timeline.")
+    parser.add_argument("--url", help="device WebSocket, e.g. ws://192.168.1.50/ws")
+    parser.add_argument("--seconds", type=float, default=20.0, help="how long to record")
+    parser.add_argument("--interval", type=float, default=0.5, help="polling period when drained (s)")
+    parser.add_argument("--max", type=int, default=256, help="events per stats reply")
+    parser.add_argument("--save", help="also write the raw replies here (one JSON per line)")
+    parser.add_argument("--load", help="read saved replies instead of polling")
+    parser.add_argument("--out", default="trace.json", help="trace-event output file")
+    args = parser.parse_args()
+
+    if args.load:
+        with open(args.load) as f:
+            replies = [json.loads(line) for line in f if line.strip()]
+    elif args.url:
+        save = open(args.save, "w") if args.save else None
+        try:
+            replies = poll(args.url, args.seconds, args.interval, args.max, save)
+        finally:
+            if save:
+                save.close()
+    else:
+        parser.error("--url or --load")
+
+    timeline = Timeline()
+    for reply in replies:
+        timeline.add_reply(reply)
+    timeline.write(args.out)
+    print("%d events -> %s" % (len(timeline.events), args.out))
+    timeline.print_summary()
+
+
+if __name__ == "__main__":
+    main()
@@ -9,7 +9,7 @@
 namespace dl {
 /**
  * @brief Memory manager base class, each model has its own memory manager
- * TODO: share memory manager with different models
+ * To share memory between models, add the built models to a ModelArena (dl_model_arena.hpp)
  */
 class MemoryManagerBase {
 public:
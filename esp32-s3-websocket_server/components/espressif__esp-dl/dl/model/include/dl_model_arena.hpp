@@ -0,0 +1,181 @@
+#pragma once
+
+#include "dl_model_base.hpp"
+
+namespace dl {
+
+/**
+ * @brief Lifetime and placement of one buffer of a model arena: a variable tensor and the tensors computed inplace
+ * into it.
+ */
+typedef struct {
+    int begin;     /*!< First module of the execution plan which needs the buffer */
+    int end;       /*!< Last module of the execution plan which needs the buffer, inclusive */
+    size_t size;   /*!< Aligned size in bytes */
+    size_t offset; /*!< Offset in the internal or the PSRAM root */
+    bool internal; /*!< Placed in internal RAM */
+} arena_interval_t;
+
+/**
+ * @brief Memory usage of the variables of a model in a ModelArena, in bytes.
+ */
+typedef struct {
+    size_t greedy;     /*!< Internal + PSRAM planned by the model's own memory manager */
+    size_t best_fit;   /*!< Internal + PSRAM planned by the arena */
+    size_t lower_peak; /*!< Largest sum of the buffers alive at the same time, no plan can use less */
+    size_t internal;   /*!< Internal part of best_fit */
+    size_t psram;      /*!< PSRAM part of best_fit */
+} arena_usage_t;
+
+/**
+ * @brief One variable arena shared by several models which never run at the same time (e.g. run one after the other
+ * by the same task).
+ * Each model is planned again with an interval best-fit over the lifetimes of its execution plan, then its tensors
+ * point into the shared internal / PSRAM roots instead of its own, which are freed. The arena is as large as its
+ * largest member instead of the sum of them. Every model may use up to max_internal_size bytes of internal RAM.
+ *
+ * Add a model once it is built and before it runs, and before a ModelPipeline is created on it. The arena must
+ * outlive its models, or remove() them first. Tensor data do not survive add(): only the inputs written before a run
+ * and the outputs read after it are meaningful anyway.
+ */
+class ModelArena {
+public:
+    /**
+     * @brief Create an empty arena, roots are allocated by add().
+     *
+     * @param max_internal_size  In bytes. Internal RAM the models may use, capped by the largest free internal block.
+     *                           Only takes effect when there's a PSRAM, without one everything is internal.
+     * @param alignment          Alignment of every buffer in bytes, a power of two.
+     */
+    ModelArena(size_t max_internal_size = 0, int alignment = 16);
+
+    /**
+     * @brief Free the roots. The remaining models must not run anymore.
+     */
+    ~ModelArena();
+
+    /**
+     * @brief Plan a model into the arena, growing the roots if it needs more than the current members.
+     *
+     * @param model  Built model, may be minimized.
+     * @return ESP_OK, ESP_ERR_INVALID_ARG if it is already a member, ESP_ERR_NO_MEM if the roots can not grow (the
+     *         model then keeps its own arena).
+     */
+    esp_err_t add(Model *model);
+
+    /**
+     * @brief Detach a model before it is deleted. Its tensors keep pointing into the arena, which does not shrink.
+     *
+     * @param model  Member model.
+     */
+    void remove(Model *model);
+
+    /**
+     * @brief Get the memory usage of a member.
+     *
+     * @param model  Member model.
+     * @return Usage of the model, all zeros if it is not a member.
+     */
+    arena_usage_t get_usage(Model *model);
+
+    /**
+     * @brief Get the size of the shared roots in bytes.
+     *
+     * @param mem_info  Internal and PSRAM size.
+     * @return Total size in bytes.
+     */
+    size_t get_memory_size(mem_info_t &mem_info);
+
+    /**
+     * @brief Log the usage of each member and of the shared roots against separate arenas.
+     */
+    void print();
+
+    /**
+     * @brief Choose which buffers of a member go to internal RAM from their measured access cost.
+     * The model runs with all its buffers in PSRAM, then once per candidate buffer (one that fits the internal
+     * capacity) moved alone to internal RAM: the latency drop of the modules reading or writing it is its gain.
+     * A knapsack picks the set with the largest gain whose sizes fit the capacity, buffers which do not overlap in
+     * time are then added while the plan keeps them all internal. The model is placed with it and the result logged.
+     * Runs ~(buffers + 2) x repeats inferences, at boot before the model is used. Keep the placement with
+     * export_placement().
+     *
+     * @param model    Member model.
+     * @param repeats  Passes per measure, the fastest one is kept.
+     * @return ESP_OK, ESP_ERR_INVALID_ARG if it is not a member, ESP_ERR_NOT_SUPPORTED without PSRAM or internal
+     *         capacity, ESP_ERR_NO_MEM (the previous placement is kept).
+     */
+    esp_err_t optimize_placement(Model *model, int repeats = 2);
+
+    /**
+     * @brief Serialize the placement of a member, tied to the model by get_runtime_plan_key() and to the
+     * internal RAM size of the arena (a placement made for another size does not fit it, or wastes it).
+     *
+     * @param model  Member model.
+     * @return Blob for import_placement(), empty if the model has no optimized placement.
+     */
+    std::vector<uint8_t> export_placement(Model *model);
+
+    /**
+     * @brief Place a member with a placement from export_placement().
+     *
+     * @param model  Member model.
+     * @param blob   Serialized placement.
+     * @return ESP_OK, ESP_ERR_INVALID_VERSION if it was made for another model, arena size or version (optimize again),
+     *         ESP_ERR_INVALID_SIZE, ESP_ERR_INVALID_ARG, ESP_ERR_NO_MEM.
+     */
+    esp_err_t import_placement(Model *model, const std::vector<uint8_t> &blob);
+
+    /**
+     * @brief Place intervals: buffers alive at the same time do not overlap. Buffers are taken from the largest,
+     * each one goes into the smallest gap it fits between the placed buffers alive during its lifetime, in internal
+     * RAM first while it fits below max_internal_size.
+     *
+     * @param intervals          Buffers to place, offset and internal are written.
+     * @param max_internal_size  In bytes. Capacity of the internal root, SIZE_MAX for no limit.
+     * @param internal_size      Returns the internal extent.
+     * @param psram_size         Returns the PSRAM extent.
+     * @param placement          Optional, one flag per interval: only the flagged ones may go to internal RAM, they
+     *                           are placed first.
+     */
+    static void plan(std::vector<arena_interval_t> &intervals,
+                     size_t max_internal_size,
+                     size_t &internal_size,
+                     size_t &psram_size,
+                     const std::vector<uint8_t> *placement = nullptr);
+
+    /**
+     * @brief Lower bound of any plan: largest sum of the sizes of the intervals alive during the same module.
+     *
+     * @param intervals  Buffers.
+     * @return Size in bytes.
+     */
+    static size_t get_lower_peak(const std::vector<arena_interval_t> &intervals);
+
+private:
+    typedef struct {
+        Model *model;
+        std::vector<int> buffer;                /*!< Buffer index of each variable, -1 for none */
+        std::vector<arena_interval_t> buffers;  /*!< Placed buffers */
+        std::vector<uint8_t> placement;         /*!< Buffers allowed in internal RAM, empty: the largest first */
+        arena_usage_t usage;
+    } member_t;
+
+    size_t m_max_internal_size;
+    int m_alignment;
+    void *m_internal_root;
+    void *m_psram_root;
+    size_t m_internal_size;
+    size_t m_psram_size;
+    bool m_internal_in_psram;        /*!< The internal root fell back to PSRAM */
+    std::vector<member_t> m_members;
+
+    void get_intervals(Model *model, member_t &member);
+    member_t *find_member(Model *model);
+    size_t get_internal_capacity();
+    esp_err_t place(member_t &member);
+    void bind(member_t &member);
+    size_t align(size_t size) { return (size + m_alignment - 1) & ~((size_t)m_alignment - 1); }
+};
+
+} // namespace dl
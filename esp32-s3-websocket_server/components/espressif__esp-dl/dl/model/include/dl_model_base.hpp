@@ -7,6 +7,10 @@
 #include "fbs_loader.hpp"
 #include "fbs_model.hpp"
 
+#ifndef DL_RUNTIME_PLAN_MARGIN_PERCENT
+#define DL_RUNTIME_PLAN_MARGIN_PERCENT 10 ///< Speed-up a module needs on multi-core to get it in the runtime plan
+#endif
+
 #if DL_LOG_INFER_LATENCY
 #define DL_LOG_INFER_LATENCY_INIT_WITH_SIZE(size) DL_LOG_LATENCY_INIT_WITH_SIZE(size)
 #define DL_LOG_INFER_LATENCY_INIT() DL_LOG_LATENCY_INIT()
@@ -40,10 +44,27 @@ namespace dl {
 // currently only support MEMORY_MANAGER_GREEDY
 typedef enum { MEMORY_MANAGER_GREEDY = 0, LINEAR_MEMORY_MANAGER = 1 } memory_manager_t;
 
+#define MODEL_TRACE_PREPROCESS -1  ///< Trace step writing the model inputs (vision wrappers)
+#define MODEL_TRACE_POSTPROCESS -2 ///< Trace step reading the model outputs (vision wrappers)
+
+/**
+ * @brief Called after each step of an inference, see Model::set_trace().
+ *
+ * @param arg       Argument given to set_trace().
+ * @param input     Index of the input in a ModelPipeline::run() burst, 0 for Model::run().
+ * @param module    Index in the execution plan, or MODEL_TRACE_PREPROCESS / MODEL_TRACE_POSTPROCESS.
+ * @param start_us  esp_timer time the step started.
+ * @param end_us    esp_timer time the step ended.
+ */
+typedef void (*model_trace_t)(void *arg, int input, int module, int64_t start_us, int64_t end_us);
+
 /**
  * @brief Neural Network Model.
  */
 class Model {
+    friend class ModelPipeline; // runs the execution plan in two stages on its own context
+    friend class ModelArena;    // plans the variables into roots shared with other models
+
 private:
     fbs::FbsLoader *m_fbs_loader = nullptr; /*!< The instance of flatbuffers Loader */
     fbs::FbsModel *m_fbs_model = nullptr;   /*!< The instance of flatbuffers Model */
@@ -57,6 +78,12 @@ private:
     std::string m_doc_string;                      /*!< doc string of model */
     size_t m_internal_size;                        /*!< Internal RAM usage */
     size_t m_psram_size;                           /*!< PSRAM usage */
+    std::vector<runtime_mode_t> m_runtime_plan;    /*!< Calibrated mode of each module, empty if not calibrated */
+    uint32_t m_runtime_plan_key = 0;               /*!< Hash of the execution plan and tensor shapes */
+    model_trace_t m_trace = nullptr;               /*!< Step callback, nullptr: not traced */
+    void *m_trace_arg = nullptr;                   /*!< Argument of m_trace */
+
+    runtime_mode_t get_module_runtime_mode(int index, runtime_mode_t mode);
 
 public:
     Model() {}
@@ -252,7 +279,8 @@ public:
     /**
      * @brief Run the model module by module.
      *
-     * @param mode  Runtime mode.
+     * @param mode  Runtime mode. RUNTIME_MODE_AUTO uses the calibrated plan (calibrate_runtime_plan() or
+     *              import_runtime_plan()) if there is one, the per-module heuristics otherwise.
      */
     virtual void run(runtime_mode_t mode = RUNTIME_MODE_SINGLE_CORE);
 
@@ -277,6 +305,79 @@ public:
                      runtime_mode_t mode = RUNTIME_MODE_SINGLE_CORE,
                      std::map<std::string, TensorBase *> user_outputs = {});
 
+    /**
+     * @brief Time every module of the execution plan in single-core and multi-core mode, and keep the faster one
+     * per module for run(RUNTIME_MODE_AUTO). Multi-core has to win by DL_RUNTIME_PLAN_MARGIN_PERCENT.
+     * Runs the model (2 * repeats + 1) times on whatever the inputs hold: outputs are not valid afterwards.
+     *
+     * @param repeats  Timed runs per module and mode, the fastest one counts.
+     * @return ESP_OK, or ESP_ERR_INVALID_STATE if the model was not built.
+     */
+    esp_err_t calibrate_runtime_plan(int repeats = 3);
+
+    /**
+     * @brief Serialize the calibrated plan, to cache it (NVS, file) and skip the calibration on the next boot.
+     *
+     * @return The plan blob, empty if the model is not calibrated.
+     */
+    std::vector<uint8_t> export_runtime_plan();
+
+    /**
+     * @brief Restore a plan saved by export_runtime_plan().
+     *
+     * @param blob  The plan blob.
+     * @return ESP_OK, or ESP_ERR_INVALID_VERSION if it belongs to another model (key, module count or format).
+     */
+    esp_err_t import_runtime_plan(const std::vector<uint8_t> &blob);
+
+    /**
+     * @brief Get the calibrated plan.
+     *
+     * @return Mode of each module in execution order, empty if not calibrated.
+     */
+    const std::vector<runtime_mode_t> &get_runtime_plan() { return m_runtime_plan; }
+
+    /**
+     * @brief Get the hash identifying this model for a cached runtime plan.
+     *
+     * @return CRC32 of the model name, version, execution plan (names, types) and tensor shapes.
+     */
+    uint32_t get_runtime_plan_key() { return m_runtime_plan_key; }
+
+    /**
+     * @brief Trace the inferences: trace is called after every module of run(RUNTIME_MODE) and of a ModelPipeline on
+     * this model, from the task running it (stage 2 of a pipeline runs on the other core). Costs two esp_timer reads
+     * per module, nothing when not set. It must be short and must not block.
+     *
+     * @param trace  Callback, nullptr to stop tracing.
+     * @param arg    Passed to trace.
+     */
+    void set_trace(model_trace_t trace, void *arg = nullptr)
+    {
+        m_trace = trace;
+        m_trace_arg = arg;
+    }
+
+    /**
+     * @brief Whether set_trace() installed a callback.
+     */
+    bool is_traced() { return m_trace != nullptr; }
+
+    /**
+     * @brief Report a step to the trace callback, if any. For the code around the model (pre/postprocess).
+     *
+     * @param input     Index of the input in a burst, 0 for a single inference.
+     * @param module    MODEL_TRACE_PREPROCESS, MODEL_TRACE_POSTPROCESS, or a module index.
+     * @param start_us  esp_timer time the step started.
+     * @param end_us    esp_timer time the step ended.
+     */
+    void trace(int input, int module, int64_t start_us, int64_t end_us)
+    {
+        if (m_trace) {
+            m_trace(m_trace_arg, input, module, start_us, end_us);
+        }
+    }
+
     /**
      * @brief Minimize the model.
      */
@@ -289,7 +390,7 @@ public:
      *
      * @return esp_err_t
      */
-    esp_err_t test();
+    esp_err_t test(runtime_mode_t mode = RUNTIME_MODE_SINGLE_CORE);
 
     /**
      * @brief Get memory info
@@ -303,7 +404,7 @@ public:
      *
      * @return return Type and latency of each module.
      */
-    std::map<std::string, module_info> get_module_info();
+    std::map<std::string, module_info> get_module_info(runtime_mode_t mode = RUNTIME_MODE_SINGLE_CORE);
 
     /**
      * @brief Print the module info obtained by get_module_info function.
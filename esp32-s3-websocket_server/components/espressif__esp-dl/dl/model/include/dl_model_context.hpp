@@ -20,6 +20,7 @@ private:
     void *m_internal_root;                   /*!< Internal root pointer */
     int m_psram_size;                        /*!< In bytes. PSRAM size usage. Only take effect when there's a PSRAM */
     int m_internal_size;                     /*!< In bytes. Internal size usage. */
+    bool m_root_shared;                      /*!< Roots belong to a ModelArena, not freed here */
     std::map<std::string, int> m_name2index; /*!< Tensor name to index map
                                                >=0: variable tensor
                                                <0: parameter tensor */
@@ -50,6 +51,7 @@ public:
         m_internal_root = nullptr;
         m_psram_size = 0;
         m_internal_size = 0;
+        m_root_shared = false;
     }
 
     /**
@@ -143,6 +145,25 @@ public:
      */
     bool root_alloc(size_t internal_size, size_t psram_size, int alignment = 16);
 
+    /**
+     * @brief Uses roots owned by someone else (ModelArena) instead of its own, which are freed.
+     * The variable tensors must already point into them.
+     *
+     * @param internal_root The internal root.
+     * @param internal_size The internal memory used by this model in bytes.
+     * @param psram_root The PSRAM root.
+     * @param psram_size The PSRAM memory used by this model in bytes.
+     */
+    void root_share(void *internal_root, size_t internal_size, void *psram_root, size_t psram_size)
+    {
+        root_free();
+        m_internal_root = internal_root;
+        m_internal_size = internal_size;
+        m_psram_root = psram_root;
+        m_psram_size = psram_size;
+        m_root_shared = true;
+    }
+
     /**
      * @brief Gets the pointer to the PSRAM root.
      *
@@ -180,6 +201,12 @@ public:
      */
     void root_free()
     {
+        if (m_root_shared) {
+            m_internal_root = nullptr;
+            m_psram_root = nullptr;
+            m_root_shared = false;
+            return;
+        }
         // In IDF, free(p) is equivalent to heap_caps_free(p).
         if (m_internal_root) {
             free(m_internal_root);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "dl_model_base.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <functional>
+
+#ifndef DL_MODEL_PIPELINE_STACK_SIZE
+#define DL_MODEL_PIPELINE_STACK_SIZE 4096 ///< Stack of the second stage task, the collect callback runs on it
+#endif
+
+namespace dl {
+
+/**
+ * @brief Two-stage executor for bursts of inputs of the same model.
+ * The execution plan is cut in two stages of about the same latency. Stage 1 runs in the calling task on the model
+ * context, stage 2 in a task pinned to the other core on a second variable arena with the same layout, so input k+1
+ * goes through stage 1 while input k goes through stage 2. The tensors crossing the cut are copied from the first
+ * arena to the second one when an input moves on to stage 2. Parameters are shared, the kernels are unchanged and
+ * every module runs on one core, in RUNTIME_MODE_SINGLE_CORE. The modules are shared too: a module caching forward
+ * args (Div) keys them on the context it ran with.
+ */
+class ModelPipeline {
+public:
+    /**
+     * @brief Write the model inputs (Model::get_inputs()) for input index. Runs in the calling task.
+     * Return false to skip the input.
+     */
+    typedef std::function<bool(int index)> feed_t;
+
+    /**
+     * @brief Read the model outputs for input index. Runs in the stage 2 task, in input order, the outputs are
+     * only valid during the call.
+     */
+    typedef std::function<void(int index, std::map<std::string, TensorBase *> &outputs)> collect_t;
+
+    /**
+     * @brief Create the second arena and the stage 2 task.
+     *
+     * @param model  Built model, not minimized by the pipeline but must outlive it.
+     * @param split  Index in the execution plan of the first stage 2 module, -1 to balance the stages with the
+     *               latencies of Model::get_module_info() (runs the model once per module).
+     * @param core   Core of the stage 2 task, -1 for the core the pipeline is created on plus one.
+     */
+    ModelPipeline(Model *model, int split = -1, int core = -1);
+
+    /**
+     * @brief Stop the stage 2 task and free the second arena. The model is not deleted.
+     */
+    ~ModelPipeline();
+
+    /**
+     * @brief Run count inputs through both stages.
+     *
+     * @param count    Number of inputs.
+     * @param feed     Writes the inputs of each index.
+     * @param collect  Reads the outputs of each index.
+     * @return ESP_OK, or ESP_ERR_INVALID_STATE if the pipeline could not be created.
+     */
+    esp_err_t run(int count, const feed_t &feed, const collect_t &collect);
+
+    /**
+     * @brief Get the cut of the execution plan.
+     *
+     * @return Index of the first module of stage 2, 0 if the pipeline is not usable.
+     */
+    int get_split() { return m_split; }
+
+private:
+    Model *m_model;
+    ModelContext *m_context;                        /*!< Stage 2 context, parameters shared with the model */
+    void *m_internal_root;                          /*!< Stage 2 arena, same layout as the model one */
+    void *m_psram_root;                             /*!< Stage 2 arena, same layout as the model one */
+    std::map<std::string, TensorBase *> m_outputs;  /*!< Model outputs in the stage 2 context */
+    std::vector<int> m_boundary;                    /*!< Variables copied from stage 1 to stage 2 */
+    int m_split;                                    /*!< First module of stage 2 */
+    TaskHandle_t m_task;                            /*!< Stage 2 task */
+    SemaphoreHandle_t m_done;                       /*!< Given by stage 2 after each input */
+    SemaphoreHandle_t m_lock;                       /*!< One run() at a time */
+    const collect_t *m_collect;                     /*!< Callback of the current run() */
+    int m_index;                                    /*!< Input in stage 2 */
+    volatile bool m_exit;
+
+    int balance_split();
+    bool create_context(int split);
+    void stage2_loop();
+    static void stage2_task(void *arg);
+};
+
+} // namespace dl
@@ -0,0 +1,678 @@
+#include "dl_model_arena.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <numeric>
+#include <string.h>
+
+static const char *TAG = "dl::ModelArena";
+
+#define DL_ARENA_PLACEMENT_MAGIC 0x4c504141 /*!< "AAPL" */
+#define DL_ARENA_PLACEMENT_VERSION 2
+#define DL_ARENA_KNAPSACK_UNITS 1024 /*!< Granularity of the knapsack: capacity / units bytes */
+
+/**
+ * @brief Header of the blob written by ModelArena::export_placement(), one byte per buffer follows (1: internal).
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t buffer_count;
+    uint32_t key;
+    uint32_t internal_size; /*!< max_internal_size of the arena it was optimized for */
+} arena_placement_header_t;
+
+namespace dl {
+
+ModelArena::ModelArena(size_t max_internal_size, int alignment) :
+    m_max_internal_size(max_internal_size),
+    m_alignment(alignment),
+    m_internal_root(nullptr),
+    m_psram_root(nullptr),
+    m_internal_size(0),
+    m_psram_size(0),
+    m_internal_in_psram(false)
+{
+}
+
+ModelArena::~ModelArena()
+{
+    heap_caps_free(m_internal_root);
+    heap_caps_free(m_psram_root);
+}
+
+void ModelArena::get_intervals(Model *model, member_t &member)
+{
+    ModelContext *context = model->m_model_context;
+    std::vector<module::Module *> &plan = model->m_execution_plan;
+    int variable_count = context->m_variables.size();
+    int last = plan.size() - 1;
+    std::vector<int> begin(variable_count, -1), end(variable_count, -1), leader(variable_count);
+    std::iota(leader.begin(), leader.end(), 0);
+    auto find = [&](int index) {
+        while (leader[index] != index) {
+            leader[index] = leader[leader[index]];
+            index = leader[index];
+        }
+        return index;
+    };
+    auto is_variable = [&](int index) {
+        return index >= 0 && index < variable_count && context->m_variables[index] &&
+            context->m_variables[index]->get_bytes() > 0;
+    };
+
+    for (int i = 0; i <= last; i++) {
+        module::Module *module = plan[i];
+        for (int index : module->m_inputs_index) {
+            if (is_variable(index)) {
+                // Read before any module writes it: a graph input, written before the run.
+                if (begin[index] < 0) {
+                    begin[index] = 0;
+                }
+                end[index] = std::max(end[index], i);
+            }
+        }
+        for (int index : module->m_outputs_index) {
+            if (is_variable(index)) {
+                if (begin[index] < 0) {
+                    begin[index] = i;
+                }
+                end[index] = std::max(end[index], i);
+            }
+        }
+        // The model's memory manager put inplace outputs on their input, they stay one buffer.
+        if (module->inplace == MODULE_NON_INPLACE) {
+            continue;
+        }
+        for (int output : module->m_outputs_index) {
+            for (int input : module->m_inputs_index) {
+                if (is_variable(output) && is_variable(input) &&
+                    context->m_variables[output]->data == context->m_variables[input]->data) {
+                    leader[find(output)] = find(input);
+                }
+            }
+        }
+    }
+    // Outputs are read after the run, inputs written before it.
+    for (int index = 0; index < variable_count; index++) {
+        if (!is_variable(index)) {
+            continue;
+        }
+        for (auto &output : model->m_outputs) {
+            if (output.second == context->m_variables[index]) {
+                end[index] = last;
+            }
+        }
+        for (auto &input : model->m_inputs) {
+            if (input.second == context->m_variables[index]) {
+                begin[index] = 0;
+            }
+        }
+        if (begin[index] < 0) {
+            begin[index] = 0;
+        }
+        if (end[index] < begin[index]) {
+            end[index] = begin[index];
+        }
+    }
+
+    member.buffer.assign(variable_count, -1);
+    member.buffers.clear();
+    std::vector<int> group_buffer(variable_count, -1);
+    for (int index = 0; index < variable_count; index++) {
+        if (!is_variable(index)) {
+            continue;
+        }
+        int group = find(index);
+        if (group_buffer[group] < 0) {
+            group_buffer[group] = member.buffers.size();
+            member.buffers.push_back({begin[index], end[index], 0, 0, false});
+        }
+        arena_interval_t &buffer = member.buffers[group_buffer[group]];
+        buffer.begin = std::min(buffer.begin, begin[index]);
+        buffer.end = std::max(buffer.end, end[index]);
+        buffer.size = std::max(buffer.size, align(context->m_variables[index]->get_bytes()));
+        member.buffer[index] = group_buffer[group];
+    }
+}
+
+/**
+ * @brief Smallest gap of one memory where a buffer fits next to the placed buffers alive with it.
+ *
+ * @return false if it does not fit below capacity.
+ */
+static bool best_fit(const std::vector<arena_interval_t> &intervals,
+                     const std::vector<int> &placed,
+                     const arena_interval_t &buffer,
+                     bool internal,
+                     size_t capacity,
+                     size_t &offset)
+{
+    std::vector<std::pair<size_t, size_t>> busy;
+    for (int index : placed) {
+        const arena_interval_t &other = intervals[index];
+        if (other.internal == internal && other.begin <= buffer.end && buffer.begin <= other.end) {
+            busy.push_back({other.offset, other.offset + other.size});
+        }
+    }
+    std::sort(busy.begin(), busy.end());
+
+    size_t top = 0, best_gap = SIZE_MAX;
+    offset = SIZE_MAX;
+    for (auto &range : busy) {
+        if (range.first > top) {
+            size_t gap = range.first - top;
+            if (gap >= buffer.size && gap < best_gap) {
+                best_gap = gap;
+                offset = top;
+            }
+        }
+        top = std::max(top, range.second);
+    }
+    if (offset == SIZE_MAX) {
+        if (top > capacity || capacity - top < buffer.size) {
+            return false;
+        }
+        offset = top;
+    }
+    return true;
+}
+
+void ModelArena::plan(std::vector<arena_interval_t> &intervals,
+                      size_t max_internal_size,
+                      size_t &internal_size,
+                      size_t &psram_size,
+                      const std::vector<uint8_t> *placement)
+{
+    std::vector<int> order(intervals.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        const arena_interval_t &x = intervals[a], &y = intervals[b];
+        // With a placement, the buffers chosen for internal RAM are placed first.
+        if (placement && (*placement)[a] != (*placement)[b]) {
+            return (*placement)[a] > (*placement)[b];
+        }
+        if (x.size != y.size) {
+            return x.size > y.size;
+        }
+        if (x.end - x.begin != y.end - y.begin) {
+            return x.end - x.begin > y.end - y.begin;
+        }
+        return x.begin < y.begin;
+    });
+
+    internal_size = 0;
+    psram_size = 0;
+    std::vector<int> placed;
+    placed.reserve(intervals.size());
+    for (int index : order) {
+        arena_interval_t &buffer = intervals[index];
+        size_t offset;
+        buffer.internal = max_internal_size > 0 && (!placement || (*placement)[index]) &&
+            best_fit(intervals, placed, buffer, true, max_internal_size, offset);
+        if (!buffer.internal) {
+            best_fit(intervals, placed, buffer, false, SIZE_MAX, offset);
+        }
+        buffer.offset = offset;
+        placed.push_back(index);
+        if (buffer.internal) {
+            internal_size = std::max(internal_size, offset + buffer.size);
+        } else {
+            psram_size = std::max(psram_size, offset + buffer.size);
+        }
+    }
+}
+
+size_t ModelArena::get_lower_peak(const std::vector<arena_interval_t> &intervals)
+{
+    int steps = 0;
+    for (const arena_interval_t &buffer : intervals) {
+        steps = std::max(steps, buffer.end + 2);
+    }
+    std::vector<long long> delta(steps, 0);
+    for (const arena_interval_t &buffer : intervals) {
+        delta[buffer.begin] += buffer.size;
+        delta[buffer.end + 1] -= buffer.size;
+    }
+    long long live = 0, peak = 0;
+    for (long long change : delta) {
+        live += change;
+        peak = std::max(peak, live);
+    }
+    return peak;
+}
+
+void ModelArena::bind(member_t &member)
+{
+    ModelContext *context = member.model->m_model_context;
+    for (int index = 0; index < member.buffer.size(); index++) {
+        if (member.buffer[index] < 0) {
+            continue;
+        }
+        arena_interval_t &buffer = member.buffers[member.buffer[index]];
+        char *root = (char *)(buffer.internal ? m_internal_root : m_psram_root);
+        context->m_variables[index]->set_element_ptr(root + buffer.offset);
+    }
+    context->root_share(m_internal_root, member.usage.internal, m_psram_root, member.usage.psram);
+    for (module::Module *module : member.model->m_execution_plan) {
+        module->reset_args(); // args cached by a forward point to the old tensors
+    }
+}
+
+size_t ModelArena::get_internal_capacity()
+{
+#if CONFIG_SPIRAM
+    // The internal root already allocated is free for every model, growing it needs a free block.
+    if (m_internal_in_psram) {
+        return m_internal_size;
+    }
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    return std::max(std::min(m_max_internal_size, largest), m_internal_size);
+#else
+    return SIZE_MAX;
+#endif
+}
+
+esp_err_t ModelArena::place(member_t &member)
+{
+    std::vector<arena_interval_t> buffers = member.buffers;
+    size_t internal_size, psram_size;
+    plan(buffers,
+         get_internal_capacity(),
+         internal_size,
+         psram_size,
+         member.placement.empty() ? nullptr : &member.placement);
+
+    // Grow the roots, the members already placed keep their offsets.
+    void *internal_root = m_internal_root;
+    void *psram_root = m_psram_root;
+    bool internal_in_psram = m_internal_in_psram;
+    if (internal_size > m_internal_size) {
+        internal_root = tool::calloc_aligned(m_alignment, internal_size, 1, MALLOC_CAP_INTERNAL);
+        internal_in_psram = false;
+#if CONFIG_SPIRAM
+        if (!internal_root) {
+            internal_root = tool::calloc_aligned(m_alignment, internal_size, 1, MALLOC_CAP_SPIRAM);
+            internal_in_psram = true;
+        }
+#endif
+    }
+    if (psram_size > m_psram_size) {
+        psram_root = tool::calloc_aligned(m_alignment, psram_size, 1, MALLOC_CAP_SPIRAM);
+    }
+    if ((!internal_root && internal_size > 0) || (!psram_root && psram_size > 0)) {
+        ESP_LOGE(TAG,
+                 "Failed to grow the arena to %zu + %zu bytes for %s.",
+                 internal_size,
+                 psram_size,
+                 member.model->m_name.c_str());
+        if (internal_root != m_internal_root) {
+            heap_caps_free(internal_root);
+        }
+        if (psram_root != m_psram_root) {
+            heap_caps_free(psram_root);
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    if (internal_in_psram && internal_root != m_internal_root) {
+        ESP_LOGW(TAG, "No internal block of %zu bytes, the internal part is in PSRAM.", internal_size);
+    }
+    std::swap(internal_root, m_internal_root);
+    std::swap(psram_root, m_psram_root);
+    m_internal_size = std::max(m_internal_size, internal_size);
+    m_psram_size = std::max(m_psram_size, psram_size);
+    m_internal_in_psram = internal_in_psram;
+
+    member.buffers = buffers;
+    member.usage.best_fit = internal_size + psram_size;
+    member.usage.internal = internal_size;
+    member.usage.psram = psram_size;
+    for (member_t &other : m_members) {
+        if (&other != &member) {
+            bind(other);
+        }
+    }
+    bind(member);
+    if (internal_root != m_internal_root) {
+        heap_caps_free(internal_root);
+    }
+    if (psram_root != m_psram_root) {
+        heap_caps_free(psram_root);
+    }
+    return ESP_OK;
+}
+
+esp_err_t ModelArena::add(Model *model)
+{
+    if (find_member(model)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    member_t member = {};
+    member.model = model;
+    get_intervals(model, member);
+
+    mem_info_t greedy = {};
+    model->m_model_context->get_variable_memory_size(greedy);
+    member.usage.greedy = greedy.internal + greedy.psram;
+    member.usage.lower_peak = get_lower_peak(member.buffers);
+
+    esp_err_t ret = place(member);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    m_members.push_back(member);
+    ESP_LOGI(TAG,
+             "%s: %zu buffers, %zu bytes (internal %zu, PSRAM %zu), was %zu, lower bound %zu.",
+             model->m_name.c_str(),
+             member.buffers.size(),
+             member.usage.best_fit,
+             member.usage.internal,
+             member.usage.psram,
+             member.usage.greedy,
+             member.usage.lower_peak);
+    return ESP_OK;
+}
+
+ModelArena::member_t *ModelArena::find_member(Model *model)
+{
+    for (member_t &member : m_members) {
+        if (member.model == model) {
+            return &member;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Run modules 0 to last of the plan in whole passes, keep the fastest latency of the modules flagged in
+ * measure.
+ */
+static void time_modules(Model *model,
+                         std::vector<module::Module *> &plan,
+                         ModelContext *context,
+                         int last,
+                         int repeats,
+                         const std::vector<bool> &measure,
+                         std::vector<uint32_t> &best)
+{
+    dl::tool::Latency latency;
+    best.assign(plan.size(), UINT32_MAX);
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i <= last; i++) {
+            latency.start();
+            plan[i]->forward(context, RUNTIME_MODE_SINGLE_CORE);
+            latency.end();
+            if (measure[i]) {
+                best[i] = std::min(best[i], latency.get_period());
+            }
+        }
+    }
+}
+
+esp_err_t ModelArena::optimize_placement(Model *model, int repeats)
+{
+    member_t *member = find_member(model);
+    if (!member) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    repeats = std::max(repeats, 1);
+    ModelContext *context = model->m_model_context;
+    std::vector<module::Module *> &plan = model->m_execution_plan;
+    int buffer_count = member->buffers.size();
+    int module_count = plan.size();
+    size_t capacity = get_internal_capacity();
+    if (capacity == 0 || capacity == SIZE_MAX || m_internal_in_psram) {
+        // Everything is internal already (no PSRAM), or nothing can be.
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // Modules reading or writing each buffer
+    std::vector<std::vector<int>> modules(buffer_count);
+    for (int i = 0; i < module_count; i++) {
+        std::vector<int> indexes = plan[i]->m_inputs_index;
+        indexes.insert(indexes.end(), plan[i]->m_outputs_index.begin(), plan[i]->m_outputs_index.end());
+        for (int index : indexes) {
+            if (index >= 0 && index < member->buffer.size() && member->buffer[index] >= 0) {
+                std::vector<int> &list = modules[member->buffer[index]];
+                if (list.empty() || list.back() != i) {
+                    list.push_back(i);
+                }
+            }
+        }
+    }
+
+    // Reference: every buffer in PSRAM. Warm-up pass first, the first forward of a module is always slower.
+    std::vector<uint8_t> previous = member->placement;
+    member->placement.assign(buffer_count, 0);
+    esp_err_t ret = place(*member);
+    if (ret != ESP_OK) {
+        member->placement = previous;
+        return ret;
+    }
+    std::vector<bool> all(module_count, true);
+    std::vector<uint32_t> reference, latency;
+    time_modules(model, plan, context, module_count - 1, 1, all, reference);
+    time_modules(model, plan, context, module_count - 1, repeats, all, reference);
+
+    // Gain of each buffer alone in internal RAM: its tensors move to a scratch block for the passes.
+    size_t scratch_size = 0;
+    for (arena_interval_t &buffer : member->buffers) {
+        if (buffer.size <= capacity) {
+            scratch_size = std::max(scratch_size, buffer.size);
+        }
+    }
+    void *scratch =
+        scratch_size > 0 ? tool::calloc_aligned(m_alignment, scratch_size, 1, MALLOC_CAP_INTERNAL) : nullptr;
+    if (!scratch) {
+        ESP_LOGE(TAG, "No internal block of %zu bytes to profile %s.", scratch_size, model->m_name.c_str());
+        member->placement = previous;
+        place(*member);
+        return ESP_ERR_NO_MEM;
+    }
+    std::vector<int64_t> gain(buffer_count, 0);
+    int profiled = 0;
+    for (int b = 0; b < buffer_count; b++) {
+        arena_interval_t &buffer = member->buffers[b];
+        if (buffer.size > capacity || modules[b].empty()) {
+            continue;
+        }
+        std::vector<bool> measure(module_count, false);
+        for (int i : modules[b]) {
+            measure[i] = true;
+        }
+        for (int index = 0; index < member->buffer.size(); index++) {
+            if (member->buffer[index] == b) {
+                context->m_variables[index]->set_element_ptr(scratch);
+            }
+        }
+        for (module::Module *module : plan) {
+            module->reset_args();
+        }
+        time_modules(model, plan, context, modules[b].back(), repeats, measure, latency);
+        for (int i : modules[b]) {
+            gain[b] += (int64_t)reference[i] - (int64_t)latency[i];
+        }
+        bind(*member);
+        profiled++;
+        vTaskDelay(1); // keep the idle task (and its watchdog) alive
+    }
+    heap_caps_free(scratch);
+
+    // 0/1 knapsack on the gains: a set whose sizes add up to the capacity fits whatever the lifetimes.
+    size_t unit = std::max((size_t)m_alignment, align(capacity / DL_ARENA_KNAPSACK_UNITS + 1));
+    int units = capacity / unit;
+    std::vector<int> items;
+    for (int b = 0; b < buffer_count; b++) {
+        if (gain[b] > 0 && member->buffers[b].size <= capacity) {
+            items.push_back(b);
+        }
+    }
+    std::vector<int64_t> value(units + 1, 0);
+    std::vector<std::vector<bool>> taken(items.size(), std::vector<bool>(units + 1, false));
+    for (int k = 0; k < items.size(); k++) {
+        int weight = (member->buffers[items[k]].size + unit - 1) / unit;
+        for (int w = units; w >= weight; w--) {
+            if (value[w - weight] + gain[items[k]] > value[w]) {
+                value[w] = value[w - weight] + gain[items[k]];
+                taken[k][w] = true;
+            }
+        }
+    }
+    std::vector<uint8_t> placement(buffer_count, 0);
+    for (int k = items.size() - 1, w = units; k >= 0; k--) {
+        if (taken[k][w]) {
+            placement[items[k]] = 1;
+            w -= (member->buffers[items[k]].size + unit - 1) / unit;
+        }
+    }
+
+    // Buffers alive at different times share internal RAM: add the others by gain per byte while they still fit.
+    std::sort(items.begin(), items.end(), [&](int a, int b) {
+        return gain[a] * (int64_t)member->buffers[b].size > gain[b] * (int64_t)member->buffers[a].size;
+    });
+    for (int b : items) {
+        if (placement[b]) {
+            continue;
+        }
+        placement[b] = 1;
+        std::vector<arena_interval_t> buffers = member->buffers;
+        size_t internal_size, psram_size;
+        ModelArena::plan(buffers, capacity, internal_size, psram_size, &placement);
+        for (int other = 0; other < buffer_count; other++) {
+            if (placement[other] && !buffers[other].internal) {
+                placement[b] = 0;
+                break;
+            }
+        }
+    }
+
+    int64_t reference_total = 0, predicted = 0;
+    for (int i = 0; i < module_count; i++) {
+        reference_total += reference[i];
+    }
+    predicted = reference_total;
+    for (int b = 0; b < buffer_count; b++) {
+        if (placement[b]) {
+            predicted -= gain[b];
+        }
+    }
+    member->placement = placement;
+    ret = place(*member);
+    if (ret != ESP_OK) {
+        member->placement = previous;
+        place(*member);
+        return ret;
+    }
+    time_modules(model, plan, context, module_count - 1, repeats, all, latency);
+    int64_t total = 0;
+    for (int i = 0; i < module_count; i++) {
+        total += latency[i];
+    }
+    ESP_LOGI(TAG,
+             "Placement of %s: %d buffers profiled, %d in internal RAM (%zu bytes), %lld us -> %lld us "
+             "(predicted %lld us).",
+             model->m_name.c_str(),
+             profiled,
+             (int)std::count(placement.begin(), placement.end(), 1),
+             member->usage.internal,
+             reference_total,
+             total,
+             predicted);
+    return ESP_OK;
+}
+
+std::vector<uint8_t> ModelArena::export_placement(Model *model)
+{
+    std::vector<uint8_t> blob;
+    member_t *member = find_member(model);
+    if (!member || member->placement.empty()) {
+        return blob;
+    }
+    arena_placement_header_t header = {};
+    header.magic = DL_ARENA_PLACEMENT_MAGIC;
+    header.version = DL_ARENA_PLACEMENT_VERSION;
+    header.buffer_count = member->placement.size();
+    header.key = model->get_runtime_plan_key();
+    header.internal_size = m_max_internal_size;
+    blob.resize(sizeof(header));
+    memcpy(blob.data(), &header, sizeof(header));
+    blob.insert(blob.end(), member->placement.begin(), member->placement.end());
+    return blob;
+}
+
+esp_err_t ModelArena::import_placement(Model *model, const std::vector<uint8_t> &blob)
+{
+    member_t *member = find_member(model);
+    if (!member) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    arena_placement_header_t header;
+    if (blob.size() < sizeof(header)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&header, blob.data(), sizeof(header));
+    if (header.magic != DL_ARENA_PLACEMENT_MAGIC || header.version != DL_ARENA_PLACEMENT_VERSION ||
+        header.key != model->get_runtime_plan_key() || header.internal_size != m_max_internal_size ||
+        header.buffer_count != member->buffers.size() ||
+        blob.size() != sizeof(header) + header.buffer_count) {
+        ESP_LOGW(TAG, "Placement does not match model %s or the arena size, optimize it again.", model->m_name.c_str());
+        return ESP_ERR_INVALID_VERSION;
+    }
+    std::vector<uint8_t> previous = member->placement;
+    member->placement.assign(blob.begin() + sizeof(header), blob.end());
+    esp_err_t ret = place(*member);
+    if (ret != ESP_OK) {
+        member->placement = previous;
+    }
+    return ret;
+}
+
+void ModelArena::remove(Model *model)
+{
+    for (auto it = m_members.begin(); it != m_members.end(); ++it) {
+        if (it->model == model) {
+            m_members.erase(it);
+            return;
+        }
+    }
+}
+
+arena_usage_t ModelArena::get_usage(Model *model)
+{
+    member_t *member = find_member(model);
+    return member ? member->usage : arena_usage_t{};
+}
+
+size_t ModelArena::get_memory_size(mem_info_t &mem_info)
+{
+    mem_info.flash = 0;
+    mem_info.internal = m_internal_size;
+    mem_info.psram = m_psram_size;
+    return m_internal_size + m_psram_size;
+}
+
+void ModelArena::print()
+{
+    size_t separate = 0, lower_peak = 0;
+    for (member_t &member : m_members) {
+        separate += member.usage.greedy;
+        lower_peak = std::max(lower_peak, member.usage.lower_peak);
+        ESP_LOGI(TAG,
+                 "%-24s greedy %8zu, best-fit %8zu (internal %zu), lower bound %8zu",
+                 member.model->m_name.c_str(),
+                 member.usage.greedy,
+                 member.usage.best_fit,
+                 member.usage.internal,
+                 member.usage.lower_peak);
+    }
+    ESP_LOGI(TAG,
+             "%d models: shared arena %zu bytes (internal %zu%s, PSRAM %zu), separate arenas %zu, lower bound %zu.",
+             (int)m_members.size(),
+             m_internal_size + m_psram_size,
+             m_internal_size,
+             m_internal_in_psram ? " in PSRAM" : "",
+             m_psram_size,
+             separate,
+             lower_peak);
+}
+
+} // namespace dl
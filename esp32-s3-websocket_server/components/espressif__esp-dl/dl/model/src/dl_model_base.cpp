@@ -1,13 +1,28 @@
+#include <inttypes.h>
 #include <stdint.h>
 
 #include "dl_memory_manager_greedy.hpp"
 #include "dl_model_base.hpp"
 #include "dl_module_creator.hpp"
+#include "esp_rom_crc.h"
 #include "fbs_model.hpp"
 #include <format>
 
 static const char *TAG = "dl::Model";
 
+#define DL_RUNTIME_PLAN_MAGIC 0x4c50524d /*!< "MRPL" */
+#define DL_RUNTIME_PLAN_VERSION 1
+
+/**
+ * @brief Header of the blob written by Model::export_runtime_plan(), one runtime_mode_t byte per module follows.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t module_count;
+    uint32_t key;
+} runtime_plan_header_t;
+
 namespace dl {
 
 Model::Model(const char *rodata_address_or_partition_label_or_path,
@@ -197,6 +212,26 @@ void Model::build(size_t max_internal_size, memory_manager_t mm_type, bool prelo
     }
     memory_manager->alloc(m_fbs_model, m_execution_plan, m_model_context);
 
+    // Identify this model + input shapes for cached runtime plans, the graph is only readable while the map is loaded
+    uint32_t key = esp_rom_crc32_le(0, (const uint8_t *)m_name.c_str(), m_name.size());
+    key = esp_rom_crc32_le(key, (const uint8_t *)&m_version, sizeof(m_version));
+    std::vector<std::string> sorted_nodes = m_fbs_model->topological_sort();
+    for (const auto &node_name : sorted_nodes) {
+        std::string op_type = m_fbs_model->get_operation_type(node_name);
+        key = esp_rom_crc32_le(key, (const uint8_t *)node_name.c_str(), node_name.size());
+        key = esp_rom_crc32_le(key, (const uint8_t *)op_type.c_str(), op_type.size());
+    }
+    for (TensorBase *variable : m_model_context->m_variables) {
+        if (variable) {
+            std::vector<int> shape = variable->get_shape();
+            key = esp_rom_crc32_le(key, (const uint8_t *)shape.data(), shape.size() * sizeof(int));
+        }
+    }
+    if (key != m_runtime_plan_key) {
+        m_runtime_plan.clear();
+    }
+    m_runtime_plan_key = key;
+
     // get the TensorBase* of inputs and outputs
     std::vector<std::string> inputs_tmp = m_fbs_model->get_graph_inputs();
     std::vector<std::string> outputs_tmp = m_fbs_model->get_graph_outputs();
@@ -215,13 +250,27 @@ void Model::build(size_t max_internal_size, memory_manager_t mm_type, bool prelo
     delete memory_manager;
 }
 
+runtime_mode_t Model::get_module_runtime_mode(int index, runtime_mode_t mode)
+{
+    if (mode == RUNTIME_MODE_AUTO && index < m_runtime_plan.size()) {
+        return m_runtime_plan[index];
+    }
+    return mode;
+}
+
 void Model::run(runtime_mode_t mode)
 {
     // execute each module.
     for (int i = 0; i < m_execution_plan.size(); i++) {
         dl::module::Module *module = m_execution_plan[i];
         if (module) {
-            module->forward(m_model_context, mode);
+            if (m_trace) {
+                int64_t start_us = esp_timer_get_time();
+                module->forward(m_model_context, get_module_runtime_mode(i, mode));
+                m_trace(m_trace_arg, 0, i, start_us, esp_timer_get_time());
+            } else {
+                module->forward(m_model_context, get_module_runtime_mode(i, mode));
+            }
         } else {
             break;
         }
@@ -275,7 +324,7 @@ void Model::run(std::map<std::string, TensorBase *> &user_inputs,
     for (int i = 0; i < m_execution_plan.size(); i++) {
         dl::module::Module *module = m_execution_plan[i];
         if (module) {
-            module->forward(m_model_context, mode);
+            module->forward(m_model_context, get_module_runtime_mode(i, mode));
             // get the intermediate tensor for debug.
             if (!user_outputs.empty()) {
                 for (auto user_outputs_iter = user_outputs.begin(); user_outputs_iter != user_outputs.end();
@@ -382,6 +431,102 @@ void Model::print()
     }
 }
 
+esp_err_t Model::calibrate_runtime_plan(int repeats)
+{
+    if (m_execution_plan.empty() || m_inputs.empty()) {
+        ESP_LOGE(TAG, "Build the model before calibrating the runtime plan.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    repeats = std::max(repeats, 1);
+
+    // Warm up caches and the module worker pool, the first forward of a module is always slower.
+    m_runtime_plan.clear();
+    this->run(RUNTIME_MODE_MULTI_CORE);
+
+    // Each mode runs whole passes, so every module sees the intermediate tensors a real inference gives it.
+    const runtime_mode_t modes[2] = {RUNTIME_MODE_SINGLE_CORE, RUNTIME_MODE_MULTI_CORE};
+    std::vector<uint32_t> best[2];
+    dl::tool::Latency latency;
+    for (int m = 0; m < 2; m++) {
+        best[m].assign(m_execution_plan.size(), UINT32_MAX);
+        for (int r = 0; r < repeats; r++) {
+            for (int i = 0; i < m_execution_plan.size(); i++) {
+                latency.start();
+                m_execution_plan[i]->forward(m_model_context, modes[m]);
+                latency.end();
+                best[m][i] = std::min(best[m][i], latency.get_period());
+            }
+        }
+    }
+
+    uint32_t single_total = 0, auto_total = 0;
+    int multi_count = 0;
+    std::vector<runtime_mode_t> plan(m_execution_plan.size(), RUNTIME_MODE_SINGLE_CORE);
+    for (int i = 0; i < m_execution_plan.size(); i++) {
+        // The second core has to pay for its wake-up: ties and tiny wins stay on one core.
+        if ((uint64_t)best[1][i] * 100 < (uint64_t)best[0][i] * (100 - DL_RUNTIME_PLAN_MARGIN_PERCENT)) {
+            plan[i] = RUNTIME_MODE_MULTI_CORE;
+            multi_count++;
+        }
+        single_total += best[0][i];
+        auto_total += best[plan[i] == RUNTIME_MODE_MULTI_CORE][i];
+    }
+    m_runtime_plan = plan;
+
+    ESP_LOGI(TAG,
+             "Runtime plan of %s: %d/%d modules on multi-core, %" PRIu32 " us -> %" PRIu32 " us.",
+             m_name.c_str(),
+             multi_count,
+             (int)m_execution_plan.size(),
+             single_total,
+             auto_total);
+    return ESP_OK;
+}
+
+std::vector<uint8_t> Model::export_runtime_plan()
+{
+    std::vector<uint8_t> blob;
+    if (m_runtime_plan.empty()) {
+        return blob;
+    }
+    runtime_plan_header_t header = {};
+    header.magic = DL_RUNTIME_PLAN_MAGIC;
+    header.version = DL_RUNTIME_PLAN_VERSION;
+    header.module_count = m_runtime_plan.size();
+    header.key = m_runtime_plan_key;
+    blob.resize(sizeof(header) + m_runtime_plan.size());
+    memcpy(blob.data(), &header, sizeof(header));
+    for (int i = 0; i < m_runtime_plan.size(); i++) {
+        blob[sizeof(header) + i] = (uint8_t)m_runtime_plan[i];
+    }
+    return blob;
+}
+
+esp_err_t Model::import_runtime_plan(const std::vector<uint8_t> &blob)
+{
+    runtime_plan_header_t header;
+    if (blob.size() < sizeof(header)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&header, blob.data(), sizeof(header));
+    if (header.magic != DL_RUNTIME_PLAN_MAGIC || header.version != DL_RUNTIME_PLAN_VERSION ||
+        header.key != m_runtime_plan_key || header.module_count != m_execution_plan.size() ||
+        blob.size() != sizeof(header) + header.module_count) {
+        ESP_LOGW(TAG, "Runtime plan does not match model %s, calibrate it again.", m_name.c_str());
+        return ESP_ERR_INVALID_VERSION;
+    }
+    std::vector<runtime_mode_t> plan(header.module_count);
+    for (int i = 0; i < header.module_count; i++) {
+        uint8_t mode = blob[sizeof(header) + i];
+        if (mode != RUNTIME_MODE_SINGLE_CORE && mode != RUNTIME_MODE_MULTI_CORE) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        plan[i] = (runtime_mode_t)mode;
+    }
+    m_runtime_plan = plan;
+    return ESP_OK;
+}
+
 void Model::minimize()
 {
     ESP_LOGW(TAG,
@@ -395,7 +540,7 @@ void Model::minimize()
     dl::module::ModuleCreator::get_instance()->clear();
 }
 
-esp_err_t Model::test()
+esp_err_t Model::test(runtime_mode_t mode)
 {
     printf("\n");
     std::vector<TensorBase *> test_tensors_cache;
@@ -433,7 +578,7 @@ esp_err_t Model::test()
     }
     for (int i = 0; i < m_execution_plan.size(); i++) {
         dl::module::Module *module = m_execution_plan[i];
-        module->forward(m_model_context, RUNTIME_MODE_SINGLE_CORE);
+        module->forward(m_model_context, get_module_runtime_mode(i, mode));
         std::vector<int> module_outputs_index = module->get_outputs_index();
         for (int index : module_outputs_index) {
             auto iter = std::find(test_outputs_index.begin(), test_outputs_index.end(), index);
@@ -506,7 +651,7 @@ std::map<std::string, mem_info_t> Model::get_memory_info()
     return info;
 }
 
-std::map<std::string, module_info> Model::get_module_info()
+std::map<std::string, module_info> Model::get_module_info(runtime_mode_t mode)
 {
     std::map<std::string, module_info> module_info;
     std::vector<std::string> sorted_nodes = m_fbs_model->topological_sort();
@@ -518,7 +663,7 @@ std::map<std::string, module_info> Model::get_module_info()
         std::string module_name = sorted_nodes[i];
         std::string module_type = m_fbs_model->get_operation_type(module_name);
         DL_LOG_LATENCY_START();
-        m_execution_plan[i]->forward(m_model_context, RUNTIME_MODE_SINGLE_CORE);
+        m_execution_plan[i]->forward(m_model_context, get_module_runtime_mode(i, mode));
         DL_LOG_LATENCY_END();
         uint32_t module_latency = DL_LOG_LATENCY_GET();
         total_latency += module_latency;
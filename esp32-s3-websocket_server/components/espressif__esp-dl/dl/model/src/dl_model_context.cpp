@@ -149,6 +149,9 @@ size_t ModelContext::get_variable_memory_size(mem_info_t &mem_info)
 
 bool ModelContext::root_alloc(size_t internal_size, size_t psram_size, int alignment)
 {
+    if (m_root_shared) {
+        root_free();
+    }
     m_internal_size = internal_size;
     m_psram_size = psram_size;
     if (m_psram_size > 0) {
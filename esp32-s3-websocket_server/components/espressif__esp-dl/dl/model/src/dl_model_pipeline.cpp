@@ -0,0 +1,260 @@
+#include "dl_model_pipeline.hpp"
+#include <inttypes.h>
+#include <string.h>
+
+static const char *TAG = "dl::ModelPipeline";
+
+namespace dl {
+
+ModelPipeline::ModelPipeline(Model *model, int split, int core) :
+    m_model(model),
+    m_context(nullptr),
+    m_internal_root(nullptr),
+    m_psram_root(nullptr),
+    m_split(0),
+    m_task(nullptr),
+    m_done(nullptr),
+    m_lock(nullptr),
+    m_collect(nullptr),
+    m_index(0),
+    m_exit(false)
+{
+    int module_count = m_model->m_execution_plan.size();
+    if (module_count < 2) {
+        ESP_LOGE(TAG, "A pipeline needs at least 2 modules.");
+        return;
+    }
+    if (split < 1 || split >= module_count) {
+        split = balance_split();
+    }
+    if (!create_context(split)) {
+        return;
+    }
+
+    m_done = xSemaphoreCreateBinary();
+    m_lock = xSemaphoreCreateMutex();
+    if (core < 0) {
+        core = (xPortGetCoreID() + 1) % portNUM_PROCESSORS;
+    }
+    if (!m_done || !m_lock ||
+        xTaskCreatePinnedToCore(ModelPipeline::stage2_task,
+                                "dl_pipeline",
+                                DL_MODEL_PIPELINE_STACK_SIZE,
+                                this,
+                                uxTaskPriorityGet(NULL),
+                                &m_task,
+                                core) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the stage 2 task.");
+        m_task = nullptr;
+        return;
+    }
+    m_split = split;
+    ESP_LOGI(TAG,
+             "%s: modules 0-%d on core %d, %d-%d on core %d, %d boundary tensors.",
+             m_model->m_name.c_str(),
+             split - 1,
+             xPortGetCoreID(),
+             split,
+             module_count - 1,
+             core,
+             (int)m_boundary.size());
+}
+
+ModelPipeline::~ModelPipeline()
+{
+    if (m_task) {
+        m_exit = true;
+        xTaskNotifyGive(m_task);
+        xSemaphoreTake(m_done, portMAX_DELAY);
+    }
+    if (m_done) {
+        vSemaphoreDelete(m_done);
+    }
+    if (m_lock) {
+        vSemaphoreDelete(m_lock);
+    }
+    if (m_context) {
+        // The tensors only point into the arenas below, the parameters belong to the model.
+        for (TensorBase *variable : m_context->m_variables) {
+            delete variable;
+        }
+        m_context->m_variables.clear();
+        m_context->m_parameters.clear();
+        delete m_context;
+    }
+    heap_caps_free(m_internal_root);
+    heap_caps_free(m_psram_root);
+}
+
+int ModelPipeline::balance_split()
+{
+    std::map<std::string, module_info> info = m_model->get_module_info(RUNTIME_MODE_SINGLE_CORE);
+    std::vector<std::string> sorted_nodes = m_model->m_fbs_model->topological_sort();
+    uint32_t total = info["total"].latency;
+
+    // A burst goes as fast as the slower stage: cut where max(stage 1, stage 2) is the lowest.
+    int split = 1;
+    uint32_t prefix = 0, best = UINT32_MAX, best_prefix = 0;
+    for (int i = 0; i + 1 < sorted_nodes.size(); i++) {
+        prefix += info[sorted_nodes[i]].latency;
+        uint32_t stage = std::max(prefix, total - prefix);
+        if (stage < best) {
+            best = stage;
+            best_prefix = prefix;
+            split = i + 1;
+        }
+    }
+    ESP_LOGI(TAG, "Balanced stages: %" PRIu32 " us + %" PRIu32 " us.", best_prefix, total - best_prefix);
+    return split;
+}
+
+bool ModelPipeline::create_context(int split)
+{
+    ModelContext *model_context = m_model->m_model_context;
+    mem_info_t arena = {};
+    model_context->get_variable_memory_size(arena);
+    char *internal_root = (char *)model_context->get_internal_root();
+    char *psram_root = (char *)model_context->get_psram_root();
+
+    // Same sizes and alignment as ModelContext::root_alloc(), the internal part may fall back to PSRAM.
+    if (arena.internal > 0) {
+        m_internal_root = tool::calloc_aligned(16, arena.internal, 1, MALLOC_CAP_INTERNAL);
+        if (!m_internal_root) {
+            m_internal_root = tool::calloc_aligned(16, arena.internal, 1, MALLOC_CAP_SPIRAM);
+        }
+    }
+    if (arena.psram > 0) {
+        m_psram_root = tool::calloc_aligned(16, arena.psram, 1, MALLOC_CAP_SPIRAM);
+    }
+    if ((arena.internal > 0 && !m_internal_root) || (arena.psram > 0 && !m_psram_root)) {
+        ESP_LOGE(TAG, "Failed to alloc the stage 2 arena: %zu + %zu bytes.", arena.internal, arena.psram);
+        return false;
+    }
+
+    // Every variable keeps its offset, so in-place modules and reused chunks behave as in the model arena.
+    m_context = new ModelContext();
+    m_context->m_parameters = model_context->m_parameters;
+    for (TensorBase *variable : model_context->m_variables) {
+        if (!variable) {
+            m_context->m_variables.push_back(nullptr);
+            continue;
+        }
+        char *data = (char *)variable->data;
+        void *stage2_data = data;
+        if (internal_root && data >= internal_root && data < internal_root + arena.internal) {
+            stage2_data = (char *)m_internal_root + (data - internal_root);
+        } else if (psram_root && data >= psram_root && data < psram_root + arena.psram) {
+            stage2_data = (char *)m_psram_root + (data - psram_root);
+        } else {
+            ESP_LOGE(TAG, "Variable outside of the model arena, can not pipeline %s.", m_model->m_name.c_str());
+            return false;
+        }
+        m_context->m_variables.push_back(
+            new TensorBase(variable->shape, stage2_data, variable->exponent, variable->dtype, false, variable->caps));
+    }
+
+    // Boundary: variables stage 2 reads but does not write, and model outputs written by stage 1.
+    int variable_count = model_context->m_variables.size();
+    std::vector<bool> written(variable_count, false), boundary(variable_count, false);
+    std::vector<module::Module *> &plan = m_model->m_execution_plan;
+    for (int i = split; i < plan.size(); i++) {
+        for (int index : plan[i]->m_outputs_index) {
+            if (index >= 0 && index < variable_count) {
+                written[index] = true;
+            }
+        }
+    }
+    for (int i = split; i < plan.size(); i++) {
+        for (int index : plan[i]->m_inputs_index) {
+            if (index >= 0 && index < variable_count && model_context->m_variables[index] && !written[index]) {
+                boundary[index] = true;
+            }
+        }
+    }
+    for (auto &output : m_model->m_outputs) {
+        for (int index = 0; index < variable_count; index++) {
+            if (model_context->m_variables[index] == output.second) {
+                m_outputs[output.first] = m_context->m_variables[index];
+                boundary[index] = boundary[index] || !written[index];
+                break;
+            }
+        }
+    }
+    for (int index = 0; index < variable_count; index++) {
+        if (boundary[index]) {
+            m_boundary.push_back(index);
+        }
+    }
+    return true;
+}
+
+void ModelPipeline::stage2_task(void *arg)
+{
+    ((ModelPipeline *)arg)->stage2_loop();
+}
+
+void ModelPipeline::stage2_loop()
+{
+    std::vector<module::Module *> &plan = m_model->m_execution_plan;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (m_exit) {
+            break;
+        }
+        for (int i = m_split; i < plan.size(); i++) {
+            int64_t start_us = m_model->is_traced() ? esp_timer_get_time() : 0;
+            plan[i]->forward(m_context, RUNTIME_MODE_SINGLE_CORE);
+            if (start_us) {
+                m_model->trace(m_index, i, start_us, esp_timer_get_time());
+            }
+        }
+        (*m_collect)(m_index, m_outputs);
+        xSemaphoreGive(m_done);
+    }
+    xSemaphoreGive(m_done);
+    vTaskDelete(NULL);
+}
+
+esp_err_t ModelPipeline::run(int count, const feed_t &feed, const collect_t &collect)
+{
+    if (!m_split) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    std::vector<module::Module *> &plan = m_model->m_execution_plan;
+    ModelContext *model_context = m_model->m_model_context;
+    m_collect = &collect;
+
+    bool stage2_busy = false;
+    for (int k = 0; k < count; k++) {
+        if (!feed(k)) {
+            continue;
+        }
+        for (int i = 0; i < m_split; i++) {
+            int64_t start_us = m_model->is_traced() ? esp_timer_get_time() : 0;
+            plan[i]->forward(model_context, RUNTIME_MODE_SINGLE_CORE);
+            if (start_us) {
+                m_model->trace(k, i, start_us, esp_timer_get_time());
+            }
+        }
+        // Stage 2 still reads the boundary of input k - 1 until it is done.
+        if (stage2_busy) {
+            xSemaphoreTake(m_done, portMAX_DELAY);
+        }
+        for (int index : m_boundary) {
+            TensorBase *variable = model_context->m_variables[index];
+            memcpy(m_context->m_variables[index]->data, variable->data, variable->get_bytes());
+        }
+        m_index = k;
+        stage2_busy = true;
+        xTaskNotifyGive(m_task);
+    }
+    if (stage2_busy) {
+        xSemaphoreTake(m_done, portMAX_DELAY);
+    }
+    m_collect = nullptr;
+    xSemaphoreGive(m_lock);
+    return ESP_OK;
+}
+
+} // namespace dl
@@ -69,14 +69,7 @@ public:
 
         std::vector<base::elemwiseArgsType<T>> m_args =
             base::get_elemwise_operation_args<T>(output, input0, input1, mode);
-        int task_size = m_args.size();
-        if (task_size == 1) { // single task
-            forward_args((void *)&m_args[0]);
-        } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-            module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-        } else {
-            ESP_LOGE("Add2D", "Only support task size is 1 or 2, currently task size is %d", task_size);
-        }
+        module_forward_parallel(this, m_args);
     }
 
     /**
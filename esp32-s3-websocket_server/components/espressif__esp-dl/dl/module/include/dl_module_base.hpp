@@ -107,6 +107,12 @@ public:
      */
     virtual void preload() {}
 
+    /**
+     * @brief Drop forward args cached with tensor pointers. Called when the tensors of the
+     *        model move (arena placement), the next forward builds them again.
+     */
+    virtual void reset_args() {}
+
     /**
      * @brief reset all state of module, include inputs， outputs and preload cache setting
      */
@@ -137,65 +143,70 @@ public:
                      runtime_mode_t mode = RUNTIME_MODE_SINGLE_CORE);
 };
 
+#ifndef DL_MODULE_MAX_TASKS
+#define DL_MODULE_MAX_TASKS 8 ///< Parts handed over in one module_forward_tasks() call
+#endif
+
+#ifndef DL_MODULE_WORKER_STACK_SIZE
+#define DL_MODULE_WORKER_STACK_SIZE 2048 ///< Stack of each persistent module worker task
+#endif
+
+/**
+ * @brief Run the parts of a split operation in parallel and return when all of them are done.
+ * Part i runs op->forward_args(args[i]). The calling task runs one share itself, the other shares go to the
+ * persistent workers pinned to the other cores (created on first use, woken by task notifications, never
+ * deleted). The parts run one after another in the calling task when task_size is 1 or when the workers are
+ * already serving another caller.
+ *
+ * @param op         Module instance
+ * @param args       Args of each part: ArgsType, arithArgsType, resizeArgsType and so on
+ * @param task_size  Number of parts
+ */
+void module_forward_tasks(Module *op, void *const *args, int task_size);
+
 /**
- * @brief The data struct of module task. Pack all necessary information as the input for module task.
+ * @brief Select how split operations are dispatched.
+ *
+ * @param enable  true: persistent workers (default). false: create and delete one task per part for every
+ *                forward, as esp-dl used to. Only meant for benchmarking.
  */
-typedef struct {
-    Module *op;                   ///< Module instance pointer
-    void *args;                   ///< ArgsType, arithArgsType, resizeArgsType and so on
-    SemaphoreHandle_t &semaphore; ///< recommend xSemaphoreCreateCounting
-} module_task_data_t;
+void module_worker_pool_enable(bool enable);
 
 /**
- * @brief The function of module task.
- * @param args The data of module task.
+ * @brief Run all the parts an operation was split into (get_*_operation_args), whatever their number.
+ *
+ * @param op    Module instance
+ * @param args  One args struct per part: ArgsType, arithArgsType, resizeArgsType and so on
  */
-static void module_forward_task(void *args)
+template <typename args_t>
+void module_forward_parallel(Module *op, std::vector<args_t> &args)
 {
-    module_task_data_t *task = (module_task_data_t *)args;
-    task->op->forward_args(task->args);
-    xSemaphoreGive(task->semaphore);
-    vTaskSuspend(NULL);
+    void *tasks[DL_MODULE_MAX_TASKS];
+    int task_size = 0;
+    for (args_t &part : args) {
+        if (task_size == DL_MODULE_MAX_TASKS) {
+            module_forward_tasks(op, tasks, task_size);
+            task_size = 0;
+        }
+        tasks[task_size++] = (void *)&part;
+    }
+    if (task_size > 0) {
+        module_forward_tasks(op, tasks, task_size);
+    }
 }
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-function"
+
 /**
- * @brief Run the module with dual core and use semaphores to keep tasks in sync
+ * @brief Run the module with dual core
  *
  * @param op            Module instance
  * @param args1         Task1 args: ArgsType, arithArgsType, resizeArgsType and so on
  * @param args2         Task2 args: ArgsType, arithArgsType, resizeArgsType and so on
  */
-static void module_forward_dual_core(Module *op, void *args1, void *args2)
+inline void module_forward_dual_core(Module *op, void *args1, void *args2)
 {
-    BaseType_t current_core_id = xPortGetCoreID();
-    UBaseType_t current_priority = uxTaskPriorityGet(xTaskGetCurrentTaskHandle());
-    SemaphoreHandle_t semaphore = xSemaphoreCreateCounting(2, 0);
-    TaskHandle_t xHandleTask1, xHandleTask2;
-
-    module_task_data_t task_data1 = {
-        .op = op,
-        .args = args1,
-        .semaphore = semaphore,
-    };
-    xTaskCreatePinnedToCore(
-        module_forward_task, NULL, 2048, &task_data1, current_priority, &xHandleTask1, (current_core_id + 1) % 2);
-
-    module_task_data_t task_data2 = {
-        .op = op,
-        .args = args2,
-        .semaphore = semaphore,
-    };
-    xTaskCreatePinnedToCore(
-        module_forward_task, NULL, 2048, &task_data2, current_priority, &xHandleTask2, current_core_id);
-
-    xSemaphoreTake(semaphore, portMAX_DELAY);
-    xSemaphoreTake(semaphore, portMAX_DELAY);
-    vSemaphoreDelete(semaphore);
-    vTaskDelete(xHandleTask1);
-    vTaskDelete(xHandleTask2);
+    void *tasks[2] = {args1, args2};
+    module_forward_tasks(op, tasks, 2);
 }
-#pragma GCC diagnostic pop
 
 } // namespace module
 } // namespace dl
@@ -13,7 +13,8 @@ namespace module {
 
 class Div : public Module {
 private:
-    void *m_args;
+    void *m_args;                   /*!< built at the first forward, holds the tensor pointers */
+    ModelContext *m_args_context;   /*!< context m_args was built for */
 
 public:
     /**
@@ -30,12 +31,15 @@ public:
         Module(name, inplace, quant_type)
     {
         m_args = nullptr;
+        m_args_context = nullptr;
     }
 
     /**
      * @brief Destroy the Div object.
      */
-    ~Div()
+    ~Div() { reset_args(); }
+
+    void reset_args()
     {
         if (m_args) {
             if (quant_type == QUANT_TYPE_SYMM_8BIT) {
@@ -52,6 +56,8 @@ public:
                 free(args);
             }
         }
+        m_args = nullptr;
+        m_args_context = nullptr;
     }
 
     std::vector<std::vector<int>> get_output_shape(std::vector<std::vector<int>> &input_shapes)
@@ -86,11 +92,15 @@ public:
         TensorBase *input1 = context->get_tensor(m_inputs_index[1]);
         TensorBase *output = context->get_tensor(m_outputs_index[0]);
 
+        if (m_args_context != context) {
+            reset_args(); // another context (pipeline stage 2): other tensors
+        }
         if (m_args) {
             forward_args(m_args);
         } else {
             m_args =
                 (void *)base::get_elemwise_div_args<T>(output, input0, input1, mode); // get element-wise operation args
+            m_args_context = context;
             forward_args(m_args);
         }
     }
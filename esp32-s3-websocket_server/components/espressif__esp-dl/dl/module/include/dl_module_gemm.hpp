@@ -110,15 +110,7 @@ public:
                                              this->activation,
                                              nullptr,
                                              mode); // do not support PReLU and Leaky RelU
-        int task_size = m_args.size();
-        if (task_size == 1) { // single task
-            forward_args((void *)&m_args[0]);
-        } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-            ESP_LOGI("Gemm", "two task...");
-            module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-        } else {
-            ESP_LOGE("Gemm", "Only support task size is 1 or 2, currently task size is %d", task_size);
-        }
+        module_forward_parallel(this, m_args);
         input0->set_shape(origin_input_shape);
         output->set_shape(origin_output_shape);
     }
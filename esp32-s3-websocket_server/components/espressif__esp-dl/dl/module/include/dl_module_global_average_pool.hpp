@@ -67,14 +67,7 @@ public:
             m_args =
                 base::get_pool_args<T>(output, input, {0, 0, 0, 0}, {input->shape[1], input->shape[2]}, {1, 1}, mode);
         }
-        int task_size = m_args.size();
-        if (task_size == 1) { // single task
-            forward_args((void *)&m_args[0]);
-        } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-            module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-        } else {
-            ESP_LOGE("GlobalAveragePool", "Only support task size is 1 or 2, currently task size is %d", task_size);
-        }
+        module_forward_parallel(this, m_args);
     }
 
     /**
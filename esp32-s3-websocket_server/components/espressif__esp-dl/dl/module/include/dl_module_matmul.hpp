@@ -182,15 +182,7 @@ public:
                                                  m_activation,
                                                  nullptr,
                                                  mode); // do not support PReLU and Leaky RelU
-            int task_size = m_args.size();
-            if (task_size == 1) { // single task
-                forward_args((void *)&m_args[0]);
-            } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-                ESP_LOGI("MatMul", "two task...");
-                module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-            } else {
-                ESP_LOGE("MatMul", "Only support task size is 1 or 2, currently task size is %d", task_size);
-            }
+            module_forward_parallel(this, m_args);
 
         } else {
             // batched matrix multiply
@@ -259,15 +251,7 @@ public:
                                                          m_activation,
                                                          nullptr,
                                                          mode); // do not support PReLU and Leaky RelU
-                    int task_size = m_args.size();
-                    if (task_size == 1) { // single task
-                        forward_args((void *)&m_args[0]);
-                    } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-                        ESP_LOGI("MatMul", "two task...");
-                        module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-                    } else {
-                        ESP_LOGE("MatMul", "Only support task size is 1 or 2, currently task size is %d", task_size);
-                    }
+                    module_forward_parallel(this, m_args);
                 }
 
             } else if (origin_input0_shape.size() > 2 && origin_input1_shape.size() == 1) {
@@ -316,15 +300,7 @@ public:
                                                          m_activation,
                                                          nullptr,
                                                          mode); // do not support PReLU and Leaky RelU
-                    int task_size = m_args.size();
-                    if (task_size == 1) { // single task
-                        forward_args((void *)&m_args[0]);
-                    } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-                        ESP_LOGI("MatMul", "two task...");
-                        module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-                    } else {
-                        ESP_LOGE("MatMul", "Only support task size is 1 or 2, currently task size is %d", task_size);
-                    }
+                    module_forward_parallel(this, m_args);
                 }
 
             } else if (std::max(origin_input0_shape.size(), origin_input1_shape.size()) == 3) {
@@ -400,15 +376,7 @@ public:
                                                          m_activation,
                                                          nullptr,
                                                          mode); // do not support PReLU and Leaky RelU
-                    int task_size = m_args.size();
-                    if (task_size == 1) { // single task
-                        forward_args((void *)&m_args[0]);
-                    } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-                        ESP_LOGI("MatMul", "two task...");
-                        module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-                    } else {
-                        ESP_LOGE("MatMul", "Only support task size is 1 or 2, currently task size is %d", task_size);
-                    }
+                    module_forward_parallel(this, m_args);
                 }
 
             } else if (std::max(origin_input0_shape.size(), origin_input1_shape.size()) == 4) {
@@ -504,16 +472,7 @@ public:
                                                              m_activation,
                                                              nullptr,
                                                              mode); // do not support PReLU and Leaky RelU
-                        int task_size = m_args.size();
-                        if (task_size == 1) { // single task
-                            forward_args((void *)&m_args[0]);
-                        } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-                            ESP_LOGI("MatMul", "two task...");
-                            module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-                        } else {
-                            ESP_LOGE(
-                                "MatMul", "Only support task size is 1 or 2, currently task size is %d", task_size);
-                        }
+                        module_forward_parallel(this, m_args);
                     }
                 }
 
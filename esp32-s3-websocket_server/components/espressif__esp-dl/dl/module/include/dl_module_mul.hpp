@@ -66,14 +66,7 @@ public:
 
         std::vector<base::elemwiseArgsType<T>> m_args =
             base::get_elemwise_operation_args<T>(output, input0, input1, mode); // get element-wise operation args
-        int task_size = m_args.size();
-        if (task_size == 1) {
-            forward_args((void *)&m_args[0]); // single task
-        } else if (task_size == 2) {
-            module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]); // two task
-        } else {
-            ESP_LOGE("Mul", "Only support task size is 1 or 2, currently task size is %d", task_size);
-        }
+        module_forward_parallel(this, m_args);
     }
 
     /**
@@ -111,14 +111,7 @@ public:
 
         std::vector<base::resizeArgsType<T>> m_args =
             base::get_resize_operation_args<T>(output, input, m_resize_mode, m_scales, m_align_corners, m_cache);
-        int task_size = m_args.size();
-        if (task_size == 1) { // single task
-            forward_args((void *)&m_args[0]);
-        } else if (task_size == 2) { // multi task, use semaphore to maintain synchronization.
-            module_forward_dual_core(this, (void *)&m_args[0], (void *)&m_args[1]);
-        } else {
-            ESP_LOGE("Resize", "Only support task size is 1 or 2, currently task size is %d", task_size);
-        }
+        module_forward_parallel(this, m_args);
     }
 
     /**
@@ -0,0 +1,217 @@
+#include "dl_module_base.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+using namespace dl;
+
+namespace dl {
+namespace module {
+Module::Module(const char *name, module_inplace_t inplace, quant_type_t quant_type) :
+    inplace(inplace), quant_type(quant_type)
+{
+#if DL_LOG_MODULE_NAME
+    if (name) {
+        int length = strlen(name) + 1;
+        this->name = (char *)malloc(sizeof(char) * length);
+        memcpy(this->name, name, length);
+    } else {
+        this->name = NULL;
+    }
+#else
+    this->name = NULL;
+#endif
+}
+
+Module::~Module()
+{
+    if (this->name) {
+        free((void *)this->name);
+    }
+}
+
+void Module::run(TensorBase *input, TensorBase *output, runtime_mode_t mode)
+{
+    ModelContext context;
+    m_inputs_index.push_back(context.push_back_tensor(input));
+    m_outputs_index.push_back(context.push_back_tensor(output));
+    forward(&context, mode);
+}
+
+void Module::run(std::vector<dl::TensorBase *> inputs, std::vector<dl::TensorBase *> outputs, runtime_mode_t mode)
+{
+    ModelContext context;
+    for (int i = 0; i < inputs.size(); i++) {
+        m_inputs_index.push_back(context.push_back_tensor(inputs[i]));
+    }
+
+    for (int i = 0; i < outputs.size(); i++) {
+        m_outputs_index.push_back(context.push_back_tensor(outputs[i]));
+    }
+
+    forward(&context, mode);
+}
+
+/**
+ * @brief Persistent worker pinned to one core. It sleeps on its task notification, runs its share of the parts
+ * (first, first + step, ...) and gives done. done is a semaphore rather than a notification back to the caller,
+ * whose notification value may be in use by the application.
+ */
+typedef struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t done;
+    Module *op;
+    void *const *args;
+    int first;
+    int step;
+    int task_size;
+} module_worker_t;
+
+static module_worker_t s_workers[portNUM_PROCESSORS] = {};
+static bool s_worker_pool_enabled = true;
+
+static void module_worker_task(void *arg)
+{
+    module_worker_t *worker = (module_worker_t *)arg;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (int i = worker->first; i < worker->task_size; i += worker->step) {
+            worker->op->forward_args(worker->args[i]);
+        }
+        xSemaphoreGive(worker->done);
+    }
+}
+
+// One caller at a time owns the workers. Created on first use (thread-safe static initialization).
+static SemaphoreHandle_t module_worker_pool_lock()
+{
+    static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    return lock;
+}
+
+// Called with the pool lock held
+static module_worker_t *module_worker_get(int core_id, UBaseType_t priority)
+{
+    module_worker_t *worker = &s_workers[core_id];
+    if (!worker->task) {
+        worker->done = xSemaphoreCreateBinary();
+        if (!worker->done) {
+            return nullptr;
+        }
+        if (xTaskCreatePinnedToCore(module_worker_task,
+                                    "dl_worker",
+                                    DL_MODULE_WORKER_STACK_SIZE,
+                                    worker,
+                                    priority,
+                                    &worker->task,
+                                    core_id) != pdPASS) {
+            vSemaphoreDelete(worker->done);
+            worker->done = nullptr;
+            worker->task = nullptr;
+            ESP_LOGE("Module", "Failed to create the module worker on core %d", core_id);
+            return nullptr;
+        }
+    } else if (uxTaskPriorityGet(worker->task) != priority) {
+        vTaskPrioritySet(worker->task, priority); // same priority as the caller, as the per-forward tasks had
+    }
+    return worker;
+}
+
+static void module_forward_task(void *args)
+{
+    module_worker_t *task = (module_worker_t *)args;
+    task->op->forward_args(task->args[task->first]);
+    xSemaphoreGive(task->done);
+    vTaskSuspend(NULL);
+}
+
+// Former dispatch: one task created and deleted per part, on every forward. Kept for benchmarking.
+static void module_forward_tasks_per_call(Module *op, void *const *args, int task_size)
+{
+    BaseType_t current_core_id = xPortGetCoreID();
+    UBaseType_t current_priority = uxTaskPriorityGet(xTaskGetCurrentTaskHandle());
+    SemaphoreHandle_t semaphore = xSemaphoreCreateCounting(task_size, 0);
+    std::vector<module_worker_t> task_data(task_size);
+    std::vector<TaskHandle_t> handles(task_size);
+
+    for (int i = 0; i < task_size; i++) {
+        task_data[i].op = op;
+        task_data[i].args = args;
+        task_data[i].first = i;
+        task_data[i].done = semaphore;
+        xTaskCreatePinnedToCore(module_forward_task,
+                                NULL,
+                                DL_MODULE_WORKER_STACK_SIZE,
+                                &task_data[i],
+                                current_priority,
+                                &handles[i],
+                                (current_core_id + 1 + i) % portNUM_PROCESSORS);
+    }
+    for (int i = 0; i < task_size; i++) {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+    }
+    vSemaphoreDelete(semaphore);
+    for (int i = 0; i < task_size; i++) {
+        vTaskDelete(handles[i]);
+    }
+}
+
+void module_worker_pool_enable(bool enable)
+{
+    s_worker_pool_enabled = enable;
+}
+
+void module_forward_tasks(Module *op, void *const *args, int task_size)
+{
+    if (task_size <= 0) {
+        return;
+    }
+    if (task_size > 1 && !s_worker_pool_enabled) {
+        module_forward_tasks_per_call(op, args, task_size);
+        return;
+    }
+
+    SemaphoreHandle_t lock = portNUM_PROCESSORS > 1 && task_size > 1 ? module_worker_pool_lock() : nullptr;
+    if (!lock || xSemaphoreTake(lock, 0) != pdTRUE) {
+        // Single part, single core, or the workers are busy with another caller: no point in waiting
+        for (int i = 0; i < task_size; i++) {
+            op->forward_args(args[i]);
+        }
+        return;
+    }
+
+    int core_id = xPortGetCoreID();
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
+    int executors = task_size < portNUM_PROCESSORS ? task_size : portNUM_PROCESSORS;
+    module_worker_t *helpers[portNUM_PROCESSORS];
+    int helper_count = 0;
+
+    // Shares 0 .. executors - 2 go to the workers of the other cores, the last one stays here
+    for (int e = 0; e < executors - 1; e++) {
+        module_worker_t *worker = module_worker_get((core_id + 1 + e) % portNUM_PROCESSORS, priority);
+        if (!worker) {
+            break;
+        }
+        worker->op = op;
+        worker->args = args;
+        worker->first = e;
+        worker->step = executors;
+        worker->task_size = task_size;
+        xTaskNotifyGive(worker->task);
+        helpers[helper_count++] = worker;
+    }
+    // Own share, plus the shares of workers that could not be created
+    for (int e = helper_count; e < executors; e++) {
+        for (int i = e; i < task_size; i += executors) {
+            op->forward_args(args[i]);
+        }
+    }
+    for (int h = 0; h < helper_count; h++) {
+        xSemaphoreTake(helpers[h]->done, portMAX_DELAY);
+    }
+    xSemaphoreGive(lock);
+}
+
+} // namespace module
+} // namespace dl
@@ -10,6 +10,26 @@
 
 namespace fbs {
 
+/**
+ * @brief Zero-copy loading of the models in flash, for every FbsLoader::load() from now on.
+ * When enabled, the parameters of an unencrypted EDL2/PDL2 model whose data is 16-byte aligned in the mapped flash
+ * (MODEL_LOCATION_IN_FLASH_RODATA, MODEL_LOCATION_IN_FLASH_PARTITION) are used in place, whatever param_copy the
+ * caller passes: the model takes no PSRAM for its parameters and loads faster. Only the tensors whose layout changes
+ * at runtime (the Conv/Gemm biases, see TensorBase::reset_bias_layout) are copied, on the first inference.
+ * Inference reads the parameters through the flash cache, which is slower than PSRAM: measure both.
+ * EDL1/PDL1 models, encrypted ones and misaligned ones are still copied.
+ *
+ * @param enable  true: zero-copy when possible. false (default): param_copy of the caller.
+ */
+void set_param_zero_copy(bool enable);
+
+/**
+ * @brief Get the zero-copy setting, see set_param_zero_copy().
+ *
+ * @return true if zero-copy loading is enabled.
+ */
+bool get_param_zero_copy();
+
 /**
  * @brief Class for parser the flatbuffers.
  *
@@ -43,6 +43,16 @@ def get_model_format(filename):
         return format
 
 
+def warn_param_copy(format):
+    """
+    EDL1/PDL1 parameters are not 16-byte aligned, they are always copied to RAM at load (no zero-copy)
+    """
+    if format == "EDL1":
+        print(
+            "Warning: EDL1 models are copied to RAM when loaded, export them as EDL2 to use their parameters in place."
+        )
+
+
 def read_data(filename, format):
     """
     Read binary data, like index and mndata
@@ -106,6 +116,7 @@ def pack_models(model_path_or_dir, out_file="models.espdl"):
     if len(model_path_or_dir) == 1:
         model_path_or_dir = Path(model_path_or_dir[0])
         if model_path_or_dir.is_file():
+            warn_param_copy(get_model_format(model_path_or_dir))
             shutil.copyfile(model_path_or_dir, out_file)
             return
         else:
@@ -122,6 +133,7 @@ def pack_models(model_path_or_dir, out_file="models.espdl"):
     for i in range(1, len(model_formats)):
         if format != model_formats[i]:
             raise RuntimeError("All packed model format should be same.")
+    warn_param_copy(format)
 
     model_names = []
     model_bins = []
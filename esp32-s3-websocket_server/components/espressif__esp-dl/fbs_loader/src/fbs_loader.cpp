@@ -5,6 +5,18 @@ static const char *TAG = "FbsLoader";
 
 namespace fbs {
 
+static bool s_param_zero_copy = false;
+
+void set_param_zero_copy(bool enable)
+{
+    s_param_zero_copy = enable;
+}
+
+bool get_param_zero_copy()
+{
+    return s_param_zero_copy;
+}
+
 /**
  * @brief This function is used to decrypt the AES 128-bit CTR mode encrypted data.
  * AES (Advanced Encryption Standard) is a widely-used symmetric encryption algorithm that provides strong security for
@@ -278,6 +290,9 @@ FbsModel *create_fbs_model(const char *fbs_buf,
         auto_free = (model_location == MODEL_LOCATION_IN_SDCARD) ? true : false;
         bool address_align = !(reinterpret_cast<uintptr_t>(model_buf) & 0xf);
         if (format == FBS_FILE_FORMAT_EDL1 || format == FBS_FILE_FORMAT_PDL1) {
+            if (s_param_zero_copy) {
+                ESP_LOGW(TAG, "EDL1/PDL1 model, parameters are copied. Pack it as EDL2/PDL2 for zero-copy.");
+            }
             param_copy = true;
         } else if (!address_align) {
             ESP_LOGW(TAG, "The address of fbs model in flash is not aligned with 16 bytes.");
@@ -287,6 +302,10 @@ FbsModel *create_fbs_model(const char *fbs_buf,
                 param_copy = false;
             } else if (dl::tool::memory_addr_type(model_buf) == dl::MEMORY_ADDR_PSRAM) {
                 param_copy = false;
+            } else if (s_param_zero_copy) {
+                // Parameters are read in place through the flash cache, only the re-laid biases are copied.
+                ESP_LOGI(TAG, "Zero-copy: %.2fKB of parameters used in place from flash.", size / 1024.f);
+                param_copy = false;
             }
         }
     } else { // 128-bit AES encryption
@@ -196,6 +196,286 @@ void nearest_interpolate_gray(
     convert_pixel(Q, pix, 0, norm_lut);
 }
 
+// Fixed-point kernels: Q16 source coordinates, Q11 bilinear weights.
+#define DL_IMAGE_Q16_SHIFT 16
+#define DL_IMAGE_Q16_HALF (1 << 15)
+#define DL_IMAGE_Q16_MAX 32767
+#define DL_IMAGE_WEIGHT_SHIFT 11
+#define DL_IMAGE_WEIGHT_ONE (1 << DL_IMAGE_WEIGHT_SHIFT)
+
+static inline int32_t to_q16(float x)
+{
+    return (int32_t)lroundf(x * (1 << DL_IMAGE_Q16_SHIFT));
+}
+
+static inline int clamp_index(int x, int lo, int hi)
+{
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+/**
+ * @brief Same rounding as nearest_interpolate_rgb565(): clamp, then round half up.
+ */
+static inline int nearest_index(int32_t xq, int lo, int hi)
+{
+    return clamp_index((xq + DL_IMAGE_Q16_HALF) >> DL_IMAGE_Q16_SHIFT, lo, hi);
+}
+
+/**
+ * @brief Bilinear corners and weight along one axis, clamped like bilinear_interpolate_rgb565().
+ */
+static inline void bilinear_index(int32_t xq, int lo, int hi, int &x1, int &x2, uint32_t &w)
+{
+    xq = std::max(std::min(xq, hi << DL_IMAGE_Q16_SHIFT), lo << DL_IMAGE_Q16_SHIFT);
+    x1 = xq >> DL_IMAGE_Q16_SHIFT;
+    x2 = std::min(x1 + 1, hi);
+    w = (uint32_t)(xq & ((1 << DL_IMAGE_Q16_SHIFT) - 1)) >> (DL_IMAGE_Q16_SHIFT - DL_IMAGE_WEIGHT_SHIFT);
+}
+
+/**
+ * @brief One bilinear RGB888 quant pixel from an RGB565 image, as bilinear_interpolate_rgb565(): the caps apply to the
+ * corners, the norm LUT to the interpolated pixel.
+ */
+template <typename T, uint32_t CAPS>
+inline void bilinear_rgb565_quant(
+    const uint16_t *row1, const uint16_t *row2, int x1, int x2, uint32_t wx, uint32_t wy, T *dst_ptr, const T *norm_lut)
+{
+    uint8_t Q[12];
+    convert_pixel_from_rgb565_to_rgb888((uint16_t *)row1 + x1, Q, CAPS);
+    convert_pixel_from_rgb565_to_rgb888((uint16_t *)row1 + x2, Q + 3, CAPS);
+    convert_pixel_from_rgb565_to_rgb888((uint16_t *)row2 + x1, Q + 6, CAPS);
+    convert_pixel_from_rgb565_to_rgb888((uint16_t *)row2 + x2, Q + 9, CAPS);
+    uint32_t wx1 = DL_IMAGE_WEIGHT_ONE - wx;
+    uint32_t wy1 = DL_IMAGE_WEIGHT_ONE - wy;
+    for (int i = 0; i < 3; i++) {
+        uint32_t top = Q[i] * wx1 + Q[3 + i] * wx;
+        uint32_t bottom = Q[6 + i] * wx1 + Q[9 + i] * wx;
+        uint32_t v = (top * wy1 + bottom * wy + (1 << (2 * DL_IMAGE_WEIGHT_SHIFT - 1))) >> (2 * DL_IMAGE_WEIGHT_SHIFT);
+        dst_ptr[i] = (norm_lut + 256 * i)[v];
+    }
+}
+
+/**
+ * @brief resize() kernel. The source column of every destination column is the same on each row, computed once,
+ * then whole rows are written.
+ */
+template <typename T, uint32_t CAPS>
+void resize_rgb565_quant(const img_t &src_img,
+                         img_t &dst_img,
+                         interpolate_type_t interpolate_type,
+                         const T *norm_lut,
+                         const std::vector<int> &crop_area,
+                         float scale_x,
+                         float scale_y)
+{
+    int x_lo = 0, y_lo = 0, x_hi = src_img.width - 1, y_hi = src_img.height - 1;
+    if (!crop_area.empty()) {
+        x_lo = crop_area[0];
+        y_lo = crop_area[1];
+        x_hi = crop_area[2] - 1;
+        y_hi = crop_area[3] - 1;
+    }
+    float scale_x_inv = 1.f / scale_x;
+    float scale_y_inv = 1.f / scale_y;
+    int32_t x0 = to_q16(0.5f * scale_x_inv - 0.5f + x_lo), x_step = to_q16(scale_x_inv);
+    int32_t y0 = to_q16(0.5f * scale_y_inv - 0.5f + y_lo), y_step = to_q16(scale_y_inv);
+    const uint16_t *src = (const uint16_t *)src_img.data;
+    T *dst_ptr = (T *)dst_img.data;
+
+    if (interpolate_type == DL_IMAGE_INTERPOLATE_NEAREST) {
+        std::vector<int> xs(dst_img.width);
+        for (int j = 0; j < dst_img.width; j++) {
+            xs[j] = nearest_index(x0 + j * x_step, x_lo, x_hi);
+        }
+        for (int i = 0; i < dst_img.height; i++) {
+            const uint16_t *row = src + nearest_index(y0 + i * y_step, y_lo, y_hi) * src_img.width;
+            for (int j = 0; j < dst_img.width; j++) {
+                convert_pixel_from_rgb565_to_rgb888_quant<T>((uint16_t *)row + xs[j], dst_ptr, CAPS, (T *)norm_lut);
+                dst_ptr += 3;
+            }
+        }
+    } else {
+        std::vector<int> x1s(dst_img.width), x2s(dst_img.width);
+        std::vector<uint32_t> wxs(dst_img.width);
+        for (int j = 0; j < dst_img.width; j++) {
+            bilinear_index(x0 + j * x_step, x_lo, x_hi, x1s[j], x2s[j], wxs[j]);
+        }
+        for (int i = 0; i < dst_img.height; i++) {
+            int y1, y2;
+            uint32_t wy;
+            bilinear_index(y0 + i * y_step, y_lo, y_hi, y1, y2, wy);
+            const uint16_t *row1 = src + y1 * src_img.width;
+            const uint16_t *row2 = src + y2 * src_img.width;
+            for (int j = 0; j < dst_img.width; j++) {
+                bilinear_rgb565_quant<T, CAPS>(row1, row2, x1s[j], x2s[j], wxs[j], wy, dst_ptr, norm_lut);
+                dst_ptr += 3;
+            }
+        }
+    }
+}
+
+/**
+ * @brief warp_affine() kernel. The source coordinates of a row start at M_inv * (0, i) and are stepped by the first
+ * column of M_inv for each destination pixel.
+ */
+template <typename T, uint32_t CAPS>
+void warp_affine_rgb565_quant(const img_t &src_img,
+                              img_t &dst_img,
+                              interpolate_type_t interpolate_type,
+                              dl::math::Matrix<float> *M_inv,
+                              const T *norm_lut)
+{
+    int x_hi = src_img.width - 1, y_hi = src_img.height - 1;
+    int32_t dx = to_q16(M_inv->array[0][0]);
+    int32_t dy = to_q16(M_inv->array[1][0]);
+    const uint16_t *src = (const uint16_t *)src_img.data;
+    T *dst_ptr = (T *)dst_img.data;
+
+    for (int i = 0; i < dst_img.height; i++) {
+        int32_t xq = to_q16(M_inv->array[0][1] * i + M_inv->array[0][2]);
+        int32_t yq = to_q16(M_inv->array[1][1] * i + M_inv->array[1][2]);
+        if (interpolate_type == DL_IMAGE_INTERPOLATE_NEAREST) {
+            for (int j = 0; j < dst_img.width; j++) {
+                const uint16_t *src_ptr =
+                    src + nearest_index(yq, 0, y_hi) * src_img.width + nearest_index(xq, 0, x_hi);
+                convert_pixel_from_rgb565_to_rgb888_quant<T>((uint16_t *)src_ptr, dst_ptr, CAPS, (T *)norm_lut);
+                dst_ptr += 3;
+                xq += dx;
+                yq += dy;
+            }
+        } else {
+            for (int j = 0; j < dst_img.width; j++) {
+                int x1, x2, y1, y2;
+                uint32_t wx, wy;
+                bilinear_index(xq, 0, x_hi, x1, x2, wx);
+                bilinear_index(yq, 0, y_hi, y1, y2, wy);
+                bilinear_rgb565_quant<T, CAPS>(
+                    src + y1 * src_img.width, src + y2 * src_img.width, x1, x2, wx, wy, dst_ptr, norm_lut);
+                dst_ptr += 3;
+                xq += dx;
+                yq += dy;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Whether the fixed-point kernels apply: RGB565 source, RGB888 quant destination with a norm LUT, and Q16
+ * coordinates can not overflow.
+ */
+static bool fixed_point_supported(const img_t &src_img, const img_t &dst_img, void *norm_lut)
+{
+    return src_img.pix_type == DL_IMAGE_PIX_TYPE_RGB565 &&
+        (dst_img.pix_type == DL_IMAGE_PIX_TYPE_RGB888_QINT8 || dst_img.pix_type == DL_IMAGE_PIX_TYPE_RGB888_QINT16) &&
+        norm_lut && src_img.width <= DL_IMAGE_Q16_MAX && src_img.height <= DL_IMAGE_Q16_MAX &&
+        dst_img.width <= DL_IMAGE_Q16_MAX && dst_img.height <= DL_IMAGE_Q16_MAX;
+}
+
+template <typename T>
+static void resize_fixed_caps(const img_t &src_img,
+                              img_t &dst_img,
+                              interpolate_type_t interpolate_type,
+                              uint32_t caps,
+                              const T *norm_lut,
+                              const std::vector<int> &crop_area,
+                              float scale_x,
+                              float scale_y)
+{
+    switch (caps & (DL_IMAGE_CAP_RGB565_BIG_ENDIAN | DL_IMAGE_CAP_RGB_SWAP)) {
+    case 0:
+        resize_rgb565_quant<T, 0>(src_img, dst_img, interpolate_type, norm_lut, crop_area, scale_x, scale_y);
+        break;
+    case DL_IMAGE_CAP_RGB_SWAP:
+        resize_rgb565_quant<T, DL_IMAGE_CAP_RGB_SWAP>(
+            src_img, dst_img, interpolate_type, norm_lut, crop_area, scale_x, scale_y);
+        break;
+    case DL_IMAGE_CAP_RGB565_BIG_ENDIAN:
+        resize_rgb565_quant<T, DL_IMAGE_CAP_RGB565_BIG_ENDIAN>(
+            src_img, dst_img, interpolate_type, norm_lut, crop_area, scale_x, scale_y);
+        break;
+    default:
+        resize_rgb565_quant<T, DL_IMAGE_CAP_RGB565_BIG_ENDIAN | DL_IMAGE_CAP_RGB_SWAP>(
+            src_img, dst_img, interpolate_type, norm_lut, crop_area, scale_x, scale_y);
+        break;
+    }
+}
+
+template <typename T>
+static void warp_affine_fixed_caps(const img_t &src_img,
+                                   img_t &dst_img,
+                                   interpolate_type_t interpolate_type,
+                                   dl::math::Matrix<float> *M_inv,
+                                   uint32_t caps,
+                                   const T *norm_lut)
+{
+    switch (caps & (DL_IMAGE_CAP_RGB565_BIG_ENDIAN | DL_IMAGE_CAP_RGB_SWAP)) {
+    case 0:
+        warp_affine_rgb565_quant<T, 0>(src_img, dst_img, interpolate_type, M_inv, norm_lut);
+        break;
+    case DL_IMAGE_CAP_RGB_SWAP:
+        warp_affine_rgb565_quant<T, DL_IMAGE_CAP_RGB_SWAP>(src_img, dst_img, interpolate_type, M_inv, norm_lut);
+        break;
+    case DL_IMAGE_CAP_RGB565_BIG_ENDIAN:
+        warp_affine_rgb565_quant<T, DL_IMAGE_CAP_RGB565_BIG_ENDIAN>(
+            src_img, dst_img, interpolate_type, M_inv, norm_lut);
+        break;
+    default:
+        warp_affine_rgb565_quant<T, DL_IMAGE_CAP_RGB565_BIG_ENDIAN | DL_IMAGE_CAP_RGB_SWAP>(
+            src_img, dst_img, interpolate_type, M_inv, norm_lut);
+        break;
+    }
+}
+
+bool resize_fixed(const img_t &src_img,
+                  img_t &dst_img,
+                  interpolate_type_t interpolate_type,
+                  uint32_t caps,
+                  void *norm_lut,
+                  const std::vector<int> &crop_area,
+                  float scale_x,
+                  float scale_y)
+{
+    if (!fixed_point_supported(src_img, dst_img, norm_lut)) {
+        return false;
+    }
+    if (dst_img.pix_type == DL_IMAGE_PIX_TYPE_RGB888_QINT8) {
+        resize_fixed_caps<int8_t>(
+            src_img, dst_img, interpolate_type, caps, (int8_t *)norm_lut, crop_area, scale_x, scale_y);
+    } else {
+        resize_fixed_caps<int16_t>(
+            src_img, dst_img, interpolate_type, caps, (int16_t *)norm_lut, crop_area, scale_x, scale_y);
+    }
+    return true;
+}
+
+bool warp_affine_fixed(const img_t &src_img,
+                       img_t &dst_img,
+                       interpolate_type_t interpolate_type,
+                       dl::math::Matrix<float> *M_inv,
+                       uint32_t caps,
+                       void *norm_lut)
+{
+    if (!fixed_point_supported(src_img, dst_img, norm_lut)) {
+        return false;
+    }
+    // Every source coordinate of the destination lies between those of its corners.
+    for (int corner = 0; corner < 4; corner++) {
+        float j = (corner & 1) ? dst_img.width - 1 : 0;
+        float i = (corner & 2) ? dst_img.height - 1 : 0;
+        float x = M_inv->array[0][0] * j + M_inv->array[0][1] * i + M_inv->array[0][2];
+        float y = M_inv->array[1][0] * j + M_inv->array[1][1] * i + M_inv->array[1][2];
+        if (fabsf(x) >= DL_IMAGE_Q16_MAX || fabsf(y) >= DL_IMAGE_Q16_MAX) {
+            return false;
+        }
+    }
+    if (dst_img.pix_type == DL_IMAGE_PIX_TYPE_RGB888_QINT8) {
+        warp_affine_fixed_caps<int8_t>(src_img, dst_img, interpolate_type, M_inv, caps, (int8_t *)norm_lut);
+    } else {
+        warp_affine_fixed_caps<int16_t>(src_img, dst_img, interpolate_type, M_inv, caps, (int16_t *)norm_lut);
+    }
+    return true;
+}
+
 template <typename T>
 void resize_loop(const img_t &src_img,
                  img_t &dst_img,
@@ -360,6 +640,9 @@ void resize(const img_t &src_img,
         convert_img(src_img, dst_img, caps, norm_lut, crop_area);
         return;
     }
+    if (resize_fixed(src_img, dst_img, interpolate_type, caps, norm_lut, crop_area, scale_x, scale_y)) {
+        return;
+    }
 
     switch (dst_img.pix_type) {
     case DL_IMAGE_PIX_TYPE_RGB888:
@@ -683,6 +966,9 @@ void warp_affine(const img_t &src_img,
     assert(src_img.height > 0 && src_img.width > 0);
     assert(dst_img.height > 0 && dst_img.width > 0);
 
+    if (warp_affine_fixed(src_img, dst_img, interpolate_type, M_inv, caps, norm_lut)) {
+        return;
+    }
     switch (dst_img.pix_type) {
     case DL_IMAGE_PIX_TYPE_RGB888:
     case DL_IMAGE_PIX_TYPE_GRAY:
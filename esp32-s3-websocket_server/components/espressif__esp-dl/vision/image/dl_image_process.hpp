@@ -54,6 +54,21 @@ void resize_loop(const img_t &src_img,
                  const std::vector<int> &crop_area,
                  float scale_x,
                  float scale_y);
+/**
+ * @brief Fixed-point resize of an RGB565 image to RGB888_QINT8 / RGB888_QINT16 through norm_lut, used by resize().
+ * Q16 source coordinates computed once per row and column, caps resolved at compile time, whole rows written.
+ * resize_loop() is the reference: same pixels for NEAREST, at most one level off per channel for BILINEAR.
+ *
+ * @return false if the images are not supported, nothing is written then.
+ */
+bool resize_fixed(const img_t &src_img,
+                  img_t &dst_img,
+                  interpolate_type_t interpolate_type,
+                  uint32_t caps,
+                  void *norm_lut,
+                  const std::vector<int> &crop_area,
+                  float scale_x,
+                  float scale_y);
 void resize(const img_t &src_img,
             img_t &dst_img,
             interpolate_type_t interpolate_type,
@@ -78,6 +93,27 @@ esp_err_t resize_ppa(const img_t &src_img,
                      float *scale_y_ret = nullptr,
                      float ppa_error_thr = 0.3);
 #endif
+template <typename T>
+void warp_affine_loop(const img_t &src_img,
+                      img_t &dst_img,
+                      interpolate_type_t interpolate_type,
+                      dl::math::Matrix<float> *M_inv,
+                      uint32_t caps,
+                      void *norm_lut);
+/**
+ * @brief Fixed-point warp_affine() of an RGB565 image to RGB888_QINT8 / RGB888_QINT16 through norm_lut, used by
+ * warp_affine(). Q16 source coordinates stepped along each destination row, caps resolved at compile time.
+ * warp_affine_loop() is the reference: same pixels for NEAREST up to rounding ties, at most one level off per
+ * channel for BILINEAR.
+ *
+ * @return false if the images are not supported, nothing is written then.
+ */
+bool warp_affine_fixed(const img_t &src_img,
+                       img_t &dst_img,
+                       interpolate_type_t interpolate_type,
+                       dl::math::Matrix<float> *M_inv,
+                       uint32_t caps,
+                       void *norm_lut);
 void warp_affine(const img_t &src_img,
                  img_t &dst_img,
                  interpolate_type_t interpolate_type,
@@ -0,0 +1,79 @@
+#include "dl_feat_base.hpp"
+
+namespace dl {
+namespace feat {
+
+FeatImpl::~FeatImpl()
+{
+    delete m_pipeline;
+    delete m_model;
+    delete m_image_preprocessor;
+    delete m_postprocessor;
+}
+
+TensorBase *FeatImpl::run(const dl::image::img_t &img, const std::vector<int> &landmarks)
+{
+    DL_LOG_INFER_LATENCY_INIT();
+    DL_LOG_INFER_LATENCY_START();
+    int64_t start_us = m_model->is_traced() ? esp_timer_get_time() : 0;
+    m_image_preprocessor->preprocess(img, landmarks);
+    if (start_us) {
+        m_model->trace(0, MODEL_TRACE_PREPROCESS, start_us, esp_timer_get_time());
+    }
+    DL_LOG_INFER_LATENCY_END_PRINT("feat", "pre");
+
+    DL_LOG_INFER_LATENCY_START();
+    m_model->run(m_runtime_mode);
+    DL_LOG_INFER_LATENCY_END_PRINT("feat", "model");
+
+    DL_LOG_INFER_LATENCY_START();
+    start_us = m_model->is_traced() ? esp_timer_get_time() : 0;
+    dl::TensorBase *feat = m_postprocessor->postprocess();
+    if (start_us) {
+        m_model->trace(0, MODEL_TRACE_POSTPROCESS, start_us, esp_timer_get_time());
+    }
+    DL_LOG_INFER_LATENCY_END_PRINT("feat", "post");
+
+    return feat;
+}
+
+esp_err_t FeatImpl::run_pipelined(const std::vector<dl::image::img_t> &imgs,
+                                  const std::vector<std::vector<int>> &landmarks,
+                                  const std::function<void(int, TensorBase *)> &on_feat)
+{
+    if (imgs.size() != landmarks.size()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!m_pipeline && !m_pipeline_failed) {
+        m_pipeline = new dl::ModelPipeline(m_model);
+        if (!m_pipeline->get_split()) {
+            delete m_pipeline;
+            m_pipeline = nullptr;
+            m_pipeline_failed = true;
+        }
+    }
+    if (!m_pipeline) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return m_pipeline->run(
+        imgs.size(),
+        [&](int i) {
+            int64_t start_us = m_model->is_traced() ? esp_timer_get_time() : 0;
+            m_image_preprocessor->preprocess(imgs[i], landmarks[i]);
+            if (start_us) {
+                m_model->trace(i, MODEL_TRACE_PREPROCESS, start_us, esp_timer_get_time());
+            }
+            return true;
+        },
+        [&](int i, std::map<std::string, TensorBase *> &outputs) {
+            int64_t start_us = m_model->is_traced() ? esp_timer_get_time() : 0;
+            TensorBase *feat = m_postprocessor->postprocess(outputs);
+            if (start_us) {
+                m_model->trace(i, MODEL_TRACE_POSTPROCESS, start_us, esp_timer_get_time());
+            }
+            on_feat(i, feat);
+        });
+}
+
+} // namespace feat
+} // namespace dl
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "dl_feat_image_preprocessor.hpp"
+#include "dl_feat_postprocessor.hpp"
+#include "dl_model_base.hpp"
+#include "dl_model_pipeline.hpp"
+#include <functional>
+
+namespace dl {
+namespace feat {
+class Feat {
+public:
+    virtual ~Feat() {};
+    virtual TensorBase *run(const dl::image::img_t &img, const std::vector<int> &landmarks) = 0;
+    /**
+     * @brief Run a burst of faces through the two stages of a dl::ModelPipeline, one per core.
+     * on_feat gets the L2 normalized feature of each face, in order, from the stage 2 task; the tensor is reused
+     * for the next face. Do not call run() meanwhile, both share the model context.
+     *
+     * @return ESP_OK, or ESP_ERR_INVALID_STATE if the pipeline can not be created (use run() then).
+     */
+    virtual esp_err_t run_pipelined(const std::vector<dl::image::img_t> &imgs,
+                                    const std::vector<std::vector<int>> &landmarks,
+                                    const std::function<void(int, TensorBase *)> &on_feat) = 0;
+    /**
+     * @brief Runtime mode of the following run() calls, RUNTIME_MODE_SINGLE_CORE by default.
+     */
+    virtual void set_runtime_mode(runtime_mode_t mode) { m_runtime_mode = mode; }
+    /**
+     * @brief The underlying model, to calibrate or import its runtime plan for RUNTIME_MODE_AUTO.
+     */
+    virtual dl::Model *get_raw_model() = 0;
+    int m_feat_len;
+
+protected:
+    runtime_mode_t m_runtime_mode = RUNTIME_MODE_SINGLE_CORE;
+};
+
+class FeatWrapper : public Feat {
+protected:
+    Feat *m_model;
+
+public:
+    ~FeatWrapper() { delete m_model; }
+    TensorBase *run(const dl::image::img_t &img, const std::vector<int> &landmarks)
+    {
+        return m_model->run(img, landmarks);
+    }
+    esp_err_t run_pipelined(const std::vector<dl::image::img_t> &imgs,
+                            const std::vector<std::vector<int>> &landmarks,
+                            const std::function<void(int, TensorBase *)> &on_feat) override
+    {
+        return m_model->run_pipelined(imgs, landmarks, on_feat);
+    }
+    void set_runtime_mode(runtime_mode_t mode) override { m_model->set_runtime_mode(mode); }
+    dl::Model *get_raw_model() override { return m_model->get_raw_model(); }
+};
+
+class FeatImpl : public Feat {
+protected:
+    dl::Model *m_model;
+    dl::image::FeatImagePreprocessor *m_image_preprocessor;
+    dl::feat::FeatPostprocessor *m_postprocessor;
+    dl::ModelPipeline *m_pipeline = nullptr; /*!< Created by the first run_pipelined() */
+    bool m_pipeline_failed = false;
+
+public:
+    ~FeatImpl();
+    TensorBase *run(const dl::image::img_t &img, const std::vector<int> &landmarks) override;
+    esp_err_t run_pipelined(const std::vector<dl::image::img_t> &imgs,
+                            const std::vector<std::vector<int>> &landmarks,
+                            const std::function<void(int, TensorBase *)> &on_feat) override;
+    dl::Model *get_raw_model() override { return m_model; }
+};
+} // namespace feat
+} // namespace dl
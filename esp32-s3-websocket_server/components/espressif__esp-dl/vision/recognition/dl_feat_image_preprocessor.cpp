@@ -12,6 +12,11 @@ FeatImagePreprocessor::~FeatImagePreprocessor()
 
 void FeatImagePreprocessor::preprocess(const dl::image::img_t &img, const std::vector<int> &landmarks)
 {
+    if (landmarks.empty()) {
+        // already aligned on the template (e.g. by the camera): no warp, a plain conversion at 112x112
+        m_image_preprocessor->preprocess(img);
+        return;
+    }
     assert(landmarks.size() == 10);
     // align face
     float h_scale = (float)m_image_preprocessor->m_model_input->shape[1] / 112.0;
@@ -15,6 +15,12 @@ public:
 
     ~FeatImagePreprocessor();
 
+    /**
+     * @brief Aligns the face on the 112x112 landmark template into the model input.
+     * @param img Source image.
+     * @param landmarks 5 points (x, y), or empty if img is already aligned on the template:
+     *                  it is then only resized (converted, at the input size) without a warp.
+     */
     void preprocess(const dl::image::img_t &img, const std::vector<int> &landmarks);
 
 private:
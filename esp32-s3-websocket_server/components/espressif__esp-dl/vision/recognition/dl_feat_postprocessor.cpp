@@ -6,6 +6,7 @@ namespace feat {
 FeatPostprocessor::FeatPostprocessor(Model *model, const std::string &output_name)
 {
     m_model_output = model->get_output(output_name);
+    m_output_name = output_name.empty() ? model->get_outputs().begin()->first : output_name;
     m_feat = new TensorBase(m_model_output->shape, nullptr, 0, DATA_TYPE_FLOAT);
 }
 
@@ -16,6 +17,13 @@ TensorBase *FeatPostprocessor::postprocess()
     return m_feat;
 }
 
+TensorBase *FeatPostprocessor::postprocess(std::map<std::string, TensorBase *> &outputs)
+{
+    m_feat->assign(outputs[m_output_name]);
+    l2_norm();
+    return m_feat;
+}
+
 void FeatPostprocessor::l2_norm()
 {
     float norm = 0;
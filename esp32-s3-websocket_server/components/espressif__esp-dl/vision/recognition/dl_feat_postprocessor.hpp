@@ -9,12 +9,15 @@ namespace feat {
 class FeatPostprocessor {
 private:
     TensorBase *m_model_output;
+    std::string m_output_name;
     TensorBase *m_feat;
     void l2_norm();
 
 public:
     FeatPostprocessor(Model *model, const std::string &output_name = "");
     TensorBase *postprocess();
+    // Same on the outputs of another context of the model (dl::ModelPipeline stage 2)
+    TensorBase *postprocess(std::map<std::string, TensorBase *> &outputs);
     ~FeatPostprocessor() { delete m_feat; }
 };
 } // namespace feat
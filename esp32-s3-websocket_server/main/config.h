@@ -35,6 +35,72 @@
 #define WEBSOCKET_ENABLED 1
 #define WEBSOCKET_PORT 80 
 
+/* Inference pipeline (inference_worker.cpp).
+ * The WebSocket server (httpd task, core 0) only receives frames and queues
+ * them. A worker pinned to the other core runs recognition + upload.
+ * QUEUE_DEPTH: frames waiting for the worker. Each one holds its image buffer!
+ * DROP_POLICY when the queue is full:
+ *   INFERENCE_DROP_NEWEST: reject the incoming frame (client gets frame_busy)
+ *   INFERENCE_DROP_OLDEST: evict the oldest waiting frame (its client gets frame_dropped)
+ * BATCH_MAX: frames the worker takes from the queue at once. Their embeddings
+ *   are extracted in one burst through the two-stage esp-dl pipeline (face
+ *   k+1 on one core while face k finishes on the other). 1: one by one.
+ * BATCH_WAIT_MS: the worker waits this long for the rest of a batched
+ *   transfer (FRAME_BATCH_MAX) that is still being queued.
+ */
+#define INFERENCE_DROP_NEWEST 0
+#define INFERENCE_DROP_OLDEST 1
+#define INFERENCE_QUEUE_DEPTH 2
+#define INFERENCE_DROP_POLICY INFERENCE_DROP_OLDEST
+#define INFERENCE_BATCH_MAX (INFERENCE_QUEUE_DEPTH + 1)
+#define INFERENCE_BATCH_WAIT_MS 100
+#define INFERENCE_WORKER_CORE 1
+#define INFERENCE_WORKER_PRIORITY 5
+#define INFERENCE_WORKER_STACK_SIZE 24576 // feature extraction runs here (uploads: UPLOAD_TASK_*)
+#define WEBSOCKET_SERVER_CORE 0
+
+/* Face payload formats accepted from the CAM, advertised in the welcome message.
+ * Raw RGB565 is always accepted. JPEG (5-10x fewer bytes on air) is decoded
+ * here by the inference worker into reused RGB565 buffers (one per frame of
+ * a batch, INFERENCE_BATCH_MAX).
+ */
+#define FRAME_JPEG_ENABLED 1
+
+/* Windowed transfer (binary framing): bytes the CAM may send ahead of our
+ * frame_progress acknowledgements, advertised in the welcome message.
+ * A gap or failed send resumes from the last acked offset. 0: disabled.
+ */
+#define FRAME_RECV_WINDOW 16384
+
+/* Batched transfer (binary framing): the CAM sends up to FRAME_BATCH_MAX faces
+ * of one camera frame back-to-back, advertised in the welcome message ("batch=N").
+ * They are held until the last one arrived and recognized in one worker batch.
+ * Held faces keep their pool slots and all are queued at once: at most
+ * INFERENCE_QUEUE_DEPTH (and INFERENCE_BATCH_MAX). 1: one face per transfer.
+ * TIMEOUT_MS: a batch without its last face nor a batch_end for this long is
+ *   closed anyway, its held faces go to the worker and free their slots.
+ */
+#define FRAME_BATCH_MAX INFERENCE_QUEUE_DEPTH
+#define FRAME_BATCH_TIMEOUT_MS 5000
+
+/* Frame buffer pool (PSRAM). Incoming faces are received straight into fixed
+ * slots: no malloc/free per frame, no heap fragmentation over long uptimes.
+ * A slot is held from the first bytes until the inference worker is done.
+ * SLOTS: one receiving + INFERENCE_QUEUE_DEPTH queued + one in the worker
+ *   (a worker batch holds the slots it took from the queue).
+ *   More clients sending at once need more slots, otherwise they get frame_busy.
+ * SLOT_SIZE: largest accepted payload, a full QVGA RGB565 frame.
+ * HEADROOM: in front of each slot, takes the binary frame header of the first
+ *   message so the payload is received in place (>= sizeof(frame_header_t)).
+ * DRAIN_BUFFER_SIZE: static scratch to discard unwanted messages, frames refused
+ *   for lack of a slot included: no allocation under backpressure. At least the
+ *   CAM's WEBSOCKET_CHUNK_SIZE, a longer message closes its session.
+ */
+#define FRAME_POOL_SLOTS (INFERENCE_QUEUE_DEPTH + 2)
+#define FRAME_POOL_SLOT_SIZE (320 * 240 * 2)
+#define FRAME_POOL_HEADROOM 64
+#define FRAME_DRAIN_BUFFER_SIZE 8192
+
 /* Threshold for face comparison. 
  * NEEDS DISCUSSION AND TUNING! 
  * DEPENDS HEAVILY ON AMBIENT CONDITIONS!
@@ -45,12 +111,186 @@
 #define ENABLE_ENROLLMENT 0 // USE ONLY TO INSERT NEW FACES, WITH DB ERASE ON STARTUP
 #define SEND_UNKNOWN_FACES_TO_AWS 1 // Send unknowns to AWS S3 for further processing. 
 
+/* Feature extractor soak test on startup (face_recognizer.cpp).
+ * The HumanFaceFeat model is loaded once at boot and reused for every face.
+ * Set iterations > 0 (e.g. 5000) to run repeated inferences on a synthetic
+ * face and fail if the free heap drifts more than the tolerance.
+ * 0: No test performed on startup.
+ */
+#define FEAT_SOAK_TEST_ITERATIONS 0
+#define FEAT_SOAK_HEAP_TOLERANCE_BYTES 1024
+
+/* Feature extractor runtime benchmark on startup (face_recognizer.cpp).
+ * Average latency of the HumanFaceFeat model over N inferences in each mode:
+ * single core, dual core with a task created per layer (former esp-dl
+ * dispatch) and dual core on the persistent esp-dl worker pool.
+ * Then the per-face latency of bursts of FEAT_BENCHMARK_BURST faces through
+ * the two-stage pipeline (one half of the model per core, face k+1 in the
+ * first half while face k is in the second one).
+ * 0: No benchmark on startup.
+ */
+#define FEAT_BENCHMARK_ITERATIONS 0
+#define FEAT_BENCHMARK_BURST 4
+
+/* Preprocess kernel self test on startup (face_recognizer.cpp).
+ * Face alignment (warp_affine) and resize of an RGB565 crop into the
+ * quantized model input run on esp-dl fixed-point kernels. Set iterations
+ * > 0 (e.g. 100) to compare them with the float reference loops on a random
+ * crop and log the latency of both.
+ * 0: No test performed on startup.
+ */
+#define PREPROCESS_SELF_TEST_ITERATIONS 0
+
+/* Alignment self test on startup (face_recognizer.cpp).
+ * The CAM may send faces it aligned itself (face_align.h, FRAME_FLAG_ALIGNED):
+ * a 112x112 tile that is only converted here, no warp. Set N > 0 (e.g. 20)
+ * to draw the synthetic face at N random poses and compare the embedding of
+ * the aligned tile with the one through the esp-dl warp, cosine >= MIN_COSINE.
+ * 0: No test performed on startup.
+ */
+#define FACE_ALIGN_SELF_TEST_FACES 0
+#define FACE_ALIGN_MIN_COSINE 0.98f
+
+/* Feature extractor runtime plan (face_recognizer.cpp).
+ * 1: every layer of the HumanFaceFeat model is timed on one and on both cores
+ *    on the first boot, each one then runs in its faster mode
+ *    (RUNTIME_MODE_AUTO). The plan is kept in NVS and reused until the
+ *    model changes, the calibration (~2 x REPEATS + 1 inferences) only runs
+ *    once.
+ * 0: single core for every layer.
+ */
+#define FEAT_RUNTIME_AUTO 1
+#define FEAT_RUNTIME_CALIBRATION_REPEATS 3
+
+/* Zero-copy model load (face_recognizer.cpp).
+ * 1: the parameters of the esp-dl models packed in flash (.rodata, EDL2) are
+ *    used in place through the flash cache instead of being copied to PSRAM
+ *    at boot: ~1.3MB less PSRAM for HumanFaceFeat and a faster load. Only the
+ *    biases re-laid for the S3 kernels are copied, on the first inference.
+ *    Flash (DIO) is slower than the octal PSRAM, every inference reads the
+ *    weights again: enable it only when PSRAM is short, and compare the
+ *    latency with FEAT_BENCHMARK_ITERATIONS first.
+ * 0: parameters are copied to PSRAM (esp-dl default), the faster inference.
+ */
+#define MODEL_PARAM_ZERO_COPY 0
+
+/* Shared model arena (face_recognizer.cpp).
+ * 1: the activations of the esp-dl models are planned again with an interval
+ *    best-fit and placed in one arena shared by all of them (they never run
+ *    at the same time), instead of one arena per model. The boot log shows
+ *    the planned size against the former one and the lower bound.
+ * INTERNAL_SIZE: internal RAM of the arena, every model can place its tensors
+ *    there (faster than PSRAM). Capped by the largest free internal block.
+ * 0: every model keeps its own arena (esp-dl greedy planner, PSRAM only).
+ */
+#define MODEL_ARENA_ENABLED 1
+#define MODEL_ARENA_INTERNAL_SIZE (32 * 1024)
+
+/* Internal RAM placement of the arena (face_recognizer.cpp, needs MODEL_ARENA_ENABLED).
+ * Opt-in, its profiling delays the first boot.
+ * 1: instead of the largest tensors, MODEL_ARENA_INTERNAL_SIZE holds the ones
+ *    whose move out of PSRAM measurably speeds up the layers using them. On the
+ *    first boot the model is timed with every tensor in PSRAM, then with each
+ *    one alone in internal RAM (~(tensors + 2) x REPEATS inferences, a few
+ *    seconds). The placement is kept in NVS and reused until the model or
+ *    MODEL_ARENA_INTERNAL_SIZE changes; profiling it again also recalibrates
+ *    the runtime plan (FEAT_RUNTIME_AUTO).
+ *    A bigger MODEL_ARENA_INTERNAL_SIZE gains more, if the heap allows it.
+ * 0: largest tensors first.
+ */
+#define MODEL_ARENA_PLACEMENT_PROFILE 0
+#define MODEL_ARENA_PROFILE_REPEATS 2
+
+/* Latency trace (perf_trace.c), read with a {"type":"stats"} WebSocket message.
+ * EVENTS: ring size (16 bytes each, PSRAM), a power of two. A frame with one face
+ *   leaves about 10 events + one per module of the feature model.
+ * MAX_EVENTS_PER_MESSAGE: events per stats reply (~50 bytes of JSON each),
+ *   the client asks again with "since" for the rest.
+ * See bin_files_view_upload/trace_timeline.py for the timeline view.
+ */
+#define PERF_TRACE_ENABLED 1
+#define PERF_TRACE_EVENTS 2048
+#define PERF_TRACE_MAX_EVENTS_PER_MESSAGE 256
+
+/* Embedding index (face_database.c, embedding_search.c).
+ * 1: rows are stored as int8 with a per-row scale, ~4x less memory per face.
+ * 0: rows are stored as float (exact similarities).
+ */
+#define EMBEDDING_INDEX_INT8 1
+
+/* Cascaded matching (face_database.c). From CASCADE_MIN_FACES faces on, a first scan
+ * over the first COARSE_DIM dims of every row (int8, COARSE_DIM + 4 bytes per face)
+ * keeps the CASCADE_CANDIDATES best rows, only those are scored at full dimension
+ * (COSINE_SIMILARITY_THRESHOLD applies to that score, as before).
+ * A candidate missed by the first scan is a missed match: check the recall with
+ * EMBEDDING_CASCADE_BENCHMARK before lowering COARSE_DIM or CANDIDATES.
+ * 0: always a full scan.
+ */
+#define EMBEDDING_CASCADE_ENABLED 1
+#define EMBEDDING_CASCADE_COARSE_DIM 64
+#define EMBEDDING_CASCADE_CANDIDATES 64
+#define EMBEDDING_CASCADE_MIN_FACES 1024
+
+/* Binary face store (face_database.c, /spiffs/faces.bin).
+ * Compaction rewrites the store when at least MIN_DEAD records are dead
+ * (deleted/replaced) AND they are at least half of the file.
+ * FACE_DB_EXPORT_JSON 1: also write /spiffs/faces_meta.json on init (human readable export).
+ */
+#define FACE_STORE_COMPACT_MIN_DEAD 16
+#define FACE_DB_EXPORT_JSON 0
+
+/* Similarity kernel self test on startup: random gallery of N faces,
+ * compares the optimized and int8 top-k against the float reference.
+ * 0: No test performed on startup.
+ */
+#define EMBEDDING_SEARCH_SELF_TEST 0
+#define EMBEDDING_SEARCH_TEST_FACES 2000
+#define EMBEDDING_SEARCH_TEST_DIM 512
+#define EMBEDDING_SEARCH_TEST_TOP_K 5
+
+/* Cascade recall-vs-speed benchmark on startup: synthetic gallery of N identities
+ * (dim EMBEDDING_SEARCH_TEST_DIM, ~(dim + COARSE_DIM + 8) bytes each in PSRAM:
+ * 10000 x 512 needs ~5.8MB, lower N if it does not fit).
+ * 0: No test performed on startup.
+ */
+#define EMBEDDING_CASCADE_BENCHMARK 0
+#define EMBEDDING_CASCADE_BENCH_FACES 10000
+
 /* S3 Uploader Startup Test Configuration. Advised to start with 2! */
 // 0: No test performed on startup.
 // 1: (Default) Check connection ONBLY to AWS API Gateway.
 // 2: File upload to S3 for full test (It was very difficult to connect to AWS S3 API!)
 #define S3_STARTUP_TEST_MODE 1
 
+/* Background S3 upload + MQTT notify (upload_queue.c).
+ * Unknown faces are queued, the recognition worker never waits for TLS.
+ * QUEUE_DEPTH: jobs waiting for the upload task (each one holds an image copy in PSRAM).
+ * PENDING_MAX: jobs the task keeps in RAM (in flight + waiting for a retry).
+ * BATCH_MAX: pre-signed URLs fetched back-to-back on one kept-alive connection,
+ *   then the PUTs on one kept-alive bucket connection.
+ * Retries: RETRY_BASE_MS, doubled per attempt up to RETRY_MAX_MS, dropped after MAX_RETRIES.
+ * SPILL_MAX_FILES: jobs kept on flash (/spiffs/upq_N.bin) while Wi-Fi/MQTT is down.
+ *   The SPIFFS partition is small, keep it low!
+ * IDLE_CLOSE_MS: kept-alive connections are closed after this much idle time.
+ */
+#define UPLOAD_QUEUE_DEPTH 4
+#define UPLOAD_PENDING_MAX 6
+#define UPLOAD_BATCH_MAX 4
+#define UPLOAD_RETRY_BASE_MS 2000
+#define UPLOAD_RETRY_MAX_MS 60000
+#define UPLOAD_MAX_RETRIES 6
+#define UPLOAD_SPILL_MAX_FILES 4
+#define UPLOAD_IDLE_CLOSE_MS 30000
+#define UPLOAD_POLL_MS 1000
+#define UPLOAD_TASK_CORE 0
+#define UPLOAD_TASK_PRIORITY 4
+#define UPLOAD_TASK_STACK_SIZE 8192
+
+/* Plain HTTP stand-in for API Gateway + S3, e.g. "http://192.168.1.10:8080".
+ * See bin_files_view_upload/s3_standin_server.py. Empty: use API_GATEWAY_HOST over TLS.
+ */
+#define S3_STANDIN_BASE_URL ""
+
 /* Time & Timezone setting. 
  * For AWS, UTC is strongly recommended.
  * A list of timezone strings:
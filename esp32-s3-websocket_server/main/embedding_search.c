@@ -0,0 +1,397 @@
+/**
+ * @file embedding_search.c
+ * @brief Batched top-k cosine similarity kernels (float and int8) for the face database.
+ */
+#include "embedding_search.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+static const char* TAG = "EMB_SEARCH";
+
+/* ---------- Reference (plain C) ---------- */
+
+float embedding_dot_f32_ref(const float* a, const float* b, int dim) {
+    float dot = 0.0f;
+    for (int i = 0; i < dim; i++) {
+        dot += a[i] * b[i];
+    }
+    return dot;
+}
+
+int32_t embedding_dot_s8_ref(const int8_t* a, const int8_t* b, int dim) {
+    int32_t dot = 0;
+    for (int i = 0; i < dim; i++) {
+        dot += (int32_t)a[i] * (int32_t)b[i];
+    }
+    return dot;
+}
+
+/* ---------- Optimized path ----------
+ * Four independent accumulators break the add dependency chain, so the
+ * LX7 can keep its pipeline full (MADD.S for float, MULL+ADD for int8).
+ * Handles any dim, the tail is processed one element at a time.
+ */
+
+float embedding_dot_f32(const float* a, const float* b, int dim) {
+    float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        acc0 += a[i] * b[i];
+        acc1 += a[i + 1] * b[i + 1];
+        acc2 += a[i + 2] * b[i + 2];
+        acc3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < dim; i++) {
+        acc0 += a[i] * b[i];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+int32_t embedding_dot_s8(const int8_t* a, const int8_t* b, int dim) {
+    int32_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+    int i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        acc0 += (int16_t)a[i] * b[i] + (int16_t)a[i + 4] * b[i + 4];
+        acc1 += (int16_t)a[i + 1] * b[i + 1] + (int16_t)a[i + 5] * b[i + 5];
+        acc2 += (int16_t)a[i + 2] * b[i + 2] + (int16_t)a[i + 6] * b[i + 6];
+        acc3 += (int16_t)a[i + 3] * b[i + 3] + (int16_t)a[i + 7] * b[i + 7];
+    }
+    for (; i < dim; i++) {
+        acc0 += (int16_t)a[i] * b[i];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+void embedding_quantize_s8(const float* in, int dim, int8_t* out, float* out_scale) {
+    float max_abs = 0.0f;
+    for (int i = 0; i < dim; i++) {
+        float v = fabsf(in[i]);
+        if (v > max_abs) max_abs = v;
+    }
+    if (max_abs == 0.0f) {
+        memset(out, 0, dim);
+        *out_scale = 0.0f;
+        return;
+    }
+    float inv_scale = EMBEDDING_S8_MAX / max_abs;
+    for (int i = 0; i < dim; i++) {
+        long q = lrintf(in[i] * inv_scale);
+        if (q > EMBEDDING_S8_MAX) q = EMBEDDING_S8_MAX;
+        if (q < -EMBEDDING_S8_MAX) q = -EMBEDDING_S8_MAX;
+        out[i] = (int8_t)q;
+    }
+    *out_scale = max_abs / EMBEDDING_S8_MAX;
+}
+
+/* Keep out[0..count) sorted by decreasing similarity, at most k entries */
+static int topk_insert(embedding_match_t* out, int count, int k, int index, float similarity) {
+    if (count == k && similarity <= out[k - 1].similarity) {
+        return count;
+    }
+    int pos = (count < k) ? count++ : k - 1;
+    while (pos > 0 && out[pos - 1].similarity < similarity) {
+        out[pos] = out[pos - 1];
+        pos--;
+    }
+    out[pos].index = index;
+    out[pos].similarity = similarity;
+    return count;
+}
+
+int embedding_search_topk_f32(const float* query, const float* rows, int n, int dim,
+                              int k, embedding_match_t* out) {
+    if (!query || !rows || !out || n <= 0 || dim <= 0 || k <= 0) return 0;
+    int count = 0;
+    const float* row = rows;
+    for (int i = 0; i < n; i++, row += dim) {
+        count = topk_insert(out, count, k, i, embedding_dot_f32(query, row, dim));
+    }
+    return count;
+}
+
+int embedding_search_topk_s8(const int8_t* query, float query_scale,
+                             const int8_t* rows, const float* row_scales, int n, int dim,
+                             int k, embedding_match_t* out) {
+    if (!query || !rows || !row_scales || !out || n <= 0 || dim <= 0 || k <= 0) return 0;
+    int count = 0;
+    const int8_t* row = rows;
+    for (int i = 0; i < n; i++, row += dim) {
+        float similarity = (float)embedding_dot_s8(query, row, dim) * query_scale * row_scales[i];
+        count = topk_insert(out, count, k, i, similarity);
+    }
+    return count;
+}
+
+int embedding_rescore_f32(const float* query, const float* rows, int dim,
+                          const embedding_match_t* candidates, int count, int k, embedding_match_t* out) {
+    if (!query || !rows || !candidates || !out || count <= 0 || dim <= 0 || k <= 0) return 0;
+    int found = 0;
+    for (int c = 0; c < count; c++) {
+        int i = candidates[c].index;
+        found = topk_insert(out, found, k, i, embedding_dot_f32(query, rows + (size_t)i * dim, dim));
+    }
+    return found;
+}
+
+int embedding_rescore_s8(const int8_t* query, float query_scale, const int8_t* rows, const float* row_scales, int dim,
+                         const embedding_match_t* candidates, int count, int k, embedding_match_t* out) {
+    if (!query || !rows || !row_scales || !candidates || !out || count <= 0 || dim <= 0 || k <= 0) return 0;
+    int found = 0;
+    for (int c = 0; c < count; c++) {
+        int i = candidates[c].index;
+        float similarity = (float)embedding_dot_s8(query, rows + (size_t)i * dim, dim) * query_scale * row_scales[i];
+        found = topk_insert(out, found, k, i, similarity);
+    }
+    return found;
+}
+
+/* ---------- Self test ---------- */
+
+static float random_uniform(void) {
+    return ((float)esp_random() / (float)UINT32_MAX) * 2.0f - 1.0f;
+}
+
+static void normalize(float* v, int dim) {
+    float norm = sqrtf(embedding_dot_f32_ref(v, v, dim));
+    if (norm > 0.0f) {
+        for (int i = 0; i < dim; i++) v[i] /= norm;
+    }
+}
+
+/* Reference top-k: reference dot product, same selection */
+static int topk_f32_ref(const float* query, const float* rows, int n, int dim, int k, embedding_match_t* out) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        count = topk_insert(out, count, k, i, embedding_dot_f32_ref(query, rows + (size_t)i * dim, dim));
+    }
+    return count;
+}
+
+esp_err_t embedding_search_self_test(int n, int dim, int k) {
+    const int num_queries = 32;
+    const float min_recall = 0.95f;
+    const float max_s8_error = 0.02f;
+    const float max_f32_error = 1e-4f;
+    esp_err_t ret = ESP_FAIL;
+
+    if (n <= 0 || dim <= 0 || k <= 0) return ESP_ERR_INVALID_ARG;
+    if (k > n) k = n;
+
+    float* rows = (float*)heap_caps_aligned_alloc(16, (size_t)n * dim * sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    int8_t* rows_q = (int8_t*)heap_caps_aligned_alloc(16, (size_t)n * dim, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    float* scales = (float*)heap_caps_malloc((size_t)n * sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    float* query = (float*)heap_caps_aligned_alloc(16, dim * sizeof(float), MALLOC_CAP_8BIT);
+    int8_t* query_q = (int8_t*)heap_caps_aligned_alloc(16, dim, MALLOC_CAP_8BIT);
+    embedding_match_t* ref = (embedding_match_t*)malloc(k * sizeof(embedding_match_t));
+    embedding_match_t* opt = (embedding_match_t*)malloc(k * sizeof(embedding_match_t));
+    embedding_match_t* q8 = (embedding_match_t*)malloc(k * sizeof(embedding_match_t));
+    if (!rows || !rows_q || !scales || !query || !query_q || !ref || !opt || !q8) {
+        ESP_LOGE(TAG, "Self test: out of memory (n=%d, dim=%d).", n, dim);
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < n; i++) {
+        float* row = rows + (size_t)i * dim;
+        for (int j = 0; j < dim; j++) row[j] = random_uniform();
+        normalize(row, dim);
+        embedding_quantize_s8(row, dim, rows_q + (size_t)i * dim, &scales[i]);
+    }
+
+    int hits = 0, total = 0, top1_hits = 0;
+    float worst_f32 = 0.0f, worst_s8 = 0.0f;
+    int64_t t_ref = 0, t_f32 = 0, t_s8 = 0;
+
+    for (int q = 0; q < num_queries; q++) {
+        // noisy copy of a gallery row: a realistic "same person" probe
+        const float* target = rows + (size_t)(esp_random() % n) * dim;
+        for (int j = 0; j < dim; j++) query[j] = target[j] + 0.05f * random_uniform();
+        normalize(query, dim);
+        float query_scale;
+        embedding_quantize_s8(query, dim, query_q, &query_scale);
+
+        int64_t t0 = esp_timer_get_time();
+        int n_ref = topk_f32_ref(query, rows, n, dim, k, ref);
+        int64_t t1 = esp_timer_get_time();
+        int n_opt = embedding_search_topk_f32(query, rows, n, dim, k, opt);
+        int64_t t2 = esp_timer_get_time();
+        int n_q8 = embedding_search_topk_s8(query_q, query_scale, rows_q, scales, n, dim, k, q8);
+        int64_t t3 = esp_timer_get_time();
+        t_ref += t1 - t0;
+        t_f32 += t2 - t1;
+        t_s8 += t3 - t2;
+
+        for (int i = 0; i < n_ref && i < n_opt; i++) {
+            float err = fabsf(opt[i].similarity - ref[i].similarity);
+            if (err > worst_f32) worst_f32 = err;
+        }
+        if (n_q8 > 0 && n_ref > 0 && q8[0].index == ref[0].index) top1_hits++;
+        for (int i = 0; i < n_ref; i++) {
+            for (int j = 0; j < n_q8; j++) {
+                if (q8[j].index == ref[i].index) {
+                    hits++;
+                    float err = fabsf(q8[j].similarity - ref[i].similarity);
+                    if (err > worst_s8) worst_s8 = err;
+                    break;
+                }
+            }
+            total++;
+        }
+    }
+
+    float recall = total > 0 ? (float)hits / total : 0.0f;
+    ESP_LOGI(TAG, "Self test: n=%d dim=%d k=%d, %d queries.", n, dim, k, num_queries);
+    ESP_LOGI(TAG, "  avg us/query: ref %lld, f32 %lld, s8 %lld",
+             (long long)(t_ref / num_queries), (long long)(t_f32 / num_queries), (long long)(t_s8 / num_queries));
+    ESP_LOGI(TAG, "  f32 max error %.6f, s8 top-1 %d/%d, s8 recall@%d %.3f, s8 max error %.4f",
+             worst_f32, top1_hits, num_queries, k, recall, worst_s8);
+    ESP_LOGI(TAG, "  Bytes per face: f32 %d, s8 %d", (int)(dim * sizeof(float)), (int)(dim + sizeof(float)));
+
+    if (worst_f32 <= max_f32_error && top1_hits == num_queries && recall >= min_recall && worst_s8 <= max_s8_error) {
+        ESP_LOGI(TAG, "Self test passed.");
+        ret = ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Self test FAILED!");
+    }
+
+cleanup:
+    heap_caps_free(rows);
+    heap_caps_free(rows_q);
+    heap_caps_free(scales);
+    heap_caps_free(query);
+    heap_caps_free(query_q);
+    free(ref);
+    free(opt);
+    free(q8);
+    return ret;
+}
+
+/* ---------- Cascade benchmark ---------- */
+
+#define CASCADE_BENCH_COUNTS 7
+
+esp_err_t embedding_cascade_benchmark(int n, int dim, int coarse_dim, int m) {
+    static const int sweep[] = { 8, 16, 32, 64, 128, 256 };
+    const int num_queries = 64;
+    const float probe_noise = 1.33f; // |noise| / |identity|: cosine 1 / sqrt(1 + 1.33^2) ~= 0.6
+    const float min_recall = 0.99f;
+    esp_err_t ret = ESP_FAIL;
+
+    if (n <= 0 || dim <= 0 || coarse_dim <= 0 || m <= 0) return ESP_ERR_INVALID_ARG;
+    if (coarse_dim > dim) coarse_dim = dim;
+
+    // Candidate counts: the sweep, plus the runtime one
+    int counts[CASCADE_BENCH_COUNTS];
+    int num_counts = 0;
+    int max_count = 0;
+    bool listed = false;
+    for (int c = 0; c < (int)(sizeof(sweep) / sizeof(sweep[0])) && sweep[c] <= n; c++) {
+        counts[num_counts++] = sweep[c];
+        listed |= sweep[c] == m;
+    }
+    if (!listed && m <= n) counts[num_counts++] = m;
+    for (int c = 0; c < num_counts; c++) {
+        if (counts[c] > max_count) max_count = counts[c];
+    }
+    int agree[CASCADE_BENCH_COUNTS] = { 0 };   // same top-1 as the full scan
+    int correct[CASCADE_BENCH_COUNTS] = { 0 }; // top-1 is the probe's identity
+    int64_t elapsed[CASCADE_BENCH_COUNTS] = { 0 };
+    int full_correct = 0;
+    int64_t full_elapsed = 0;
+    float genuine = 0.0f;
+
+    int8_t* rows = (int8_t*)heap_caps_aligned_alloc(16, (size_t)n * dim, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    float* scales = (float*)heap_caps_malloc((size_t)n * sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    int8_t* coarse = (int8_t*)heap_caps_aligned_alloc(16, (size_t)n * coarse_dim, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    float* coarse_scales = (float*)heap_caps_malloc((size_t)n * sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    float* query = (float*)heap_caps_aligned_alloc(16, dim * sizeof(float), MALLOC_CAP_8BIT);
+    int8_t* query_q = (int8_t*)heap_caps_aligned_alloc(16, dim, MALLOC_CAP_8BIT);
+    int8_t* query_coarse = (int8_t*)heap_caps_aligned_alloc(16, coarse_dim, MALLOC_CAP_8BIT);
+    embedding_match_t* candidates = (embedding_match_t*)malloc((max_count > 0 ? max_count : 1) * sizeof(embedding_match_t));
+    if (!rows || !scales || !coarse || !coarse_scales || !query || !query_q || !query_coarse || !candidates) {
+        ESP_LOGE(TAG, "Cascade benchmark: out of memory (n=%d, dim=%d: %d KB of PSRAM).", n, dim,
+                 (int)((size_t)n * (dim + coarse_dim + 2 * sizeof(float)) / 1024));
+        ret = ESP_ERR_NO_MEM;
+        goto cleanup;
+    }
+
+    // Gallery, stored as the face database stores it: int8 full rows and int8 prefix rows
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < dim; j++) query[j] = random_uniform();
+        normalize(query, dim);
+        embedding_quantize_s8(query, dim, rows + (size_t)i * dim, &scales[i]);
+        embedding_quantize_s8(query, coarse_dim, coarse + (size_t)i * coarse_dim, &coarse_scales[i]);
+    }
+
+    for (int q = 0; q < num_queries; q++) {
+        // Probe: the identity (dequantized) plus an independent noise vector, normalized
+        int identity = esp_random() % n;
+        const int8_t* target = rows + (size_t)identity * dim;
+        float noise_norm = 0.0f;
+        for (int j = 0; j < dim; j++) {
+            query[j] = random_uniform();
+            noise_norm += query[j] * query[j];
+        }
+        noise_norm = probe_noise / sqrtf(noise_norm);
+        for (int j = 0; j < dim; j++) query[j] = target[j] * scales[identity] + query[j] * noise_norm;
+        normalize(query, dim);
+        float query_scale, query_coarse_scale;
+        embedding_quantize_s8(query, dim, query_q, &query_scale);
+        genuine += (float)embedding_dot_s8(query_q, target, dim) * query_scale * scales[identity];
+
+        // Full linear scan: the reference
+        embedding_match_t best, cascade_best;
+        int64_t t0 = esp_timer_get_time();
+        embedding_search_topk_s8(query_q, query_scale, rows, scales, n, dim, 1, &best);
+        full_elapsed += esp_timer_get_time() - t0;
+        if (best.index == identity) full_correct++;
+
+        for (int c = 0; c < num_counts; c++) {
+            int64_t t1 = esp_timer_get_time();
+            embedding_quantize_s8(query, coarse_dim, query_coarse, &query_coarse_scale);
+            int found = embedding_search_topk_s8(query_coarse, query_coarse_scale, coarse, coarse_scales, n, coarse_dim,
+                                                 counts[c], candidates);
+            found = embedding_rescore_s8(query_q, query_scale, rows, scales, dim, candidates, found, 1, &cascade_best);
+            elapsed[c] += esp_timer_get_time() - t1;
+            if (found > 0 && cascade_best.index == best.index) agree[c]++;
+            if (found > 0 && cascade_best.index == identity) correct[c]++;
+        }
+    }
+
+    ESP_LOGI(TAG, "Cascade benchmark: %d identities, dim %d, prefix %d, %d probes (genuine cosine ~%.2f).",
+             n, dim, coarse_dim, num_queries, genuine / num_queries);
+    ESP_LOGI(TAG, "  full scan:     %lld us/query, top-1 correct %d/%d",
+             (long long)(full_elapsed / num_queries), full_correct, num_queries);
+    float runtime_recall = 0.0f;
+    for (int c = 0; c < num_counts; c++) {
+        float recall = (float)agree[c] / num_queries;
+        ESP_LOGI(TAG, "  cascade M=%3d: %lld us/query, recall vs full %.3f, top-1 correct %d/%d",
+                 counts[c], (long long)(elapsed[c] / num_queries), recall, correct[c], num_queries);
+        if (counts[c] == m) runtime_recall = recall;
+    }
+    ESP_LOGI(TAG, "  Bytes per face: full %d, prefix %d", (int)(dim + sizeof(float)), (int)(coarse_dim + sizeof(float)));
+
+    if (m > n || runtime_recall >= min_recall) {
+        ESP_LOGI(TAG, "Cascade benchmark passed (M=%d).", m);
+        ret = ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Cascade recall %.3f at M=%d is too low: raise the candidates or the prefix dims!", runtime_recall, m);
+    }
+
+cleanup:
+    heap_caps_free(rows);
+    heap_caps_free(scales);
+    heap_caps_free(coarse);
+    heap_caps_free(coarse_scales);
+    heap_caps_free(query);
+    heap_caps_free(query_q);
+    heap_caps_free(query_coarse);
+    free(candidates);
+    return ret;
+}
@@ -0,0 +1,106 @@
+#ifndef EMBEDDING_SEARCH_H
+#define EMBEDDING_SEARCH_H
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Similarity kernels for the face embedding index.
+ * All embeddings are expected to be L2 normalized, so the dot product
+ * IS the cosine similarity (no norms are computed here).
+ * _ref functions are the plain C reference, the others are the optimized
+ * path used at runtime. Rows should be 16-byte aligned for best speed.
+ */
+
+#define EMBEDDING_S8_MAX 127
+
+typedef struct {
+    int index;        // row index in the searched matrix
+    float similarity; // cosine similarity
+} embedding_match_t;
+
+float embedding_dot_f32_ref(const float* a, const float* b, int dim);
+float embedding_dot_f32(const float* a, const float* b, int dim);
+
+int32_t embedding_dot_s8_ref(const int8_t* a, const int8_t* b, int dim);
+int32_t embedding_dot_s8(const int8_t* a, const int8_t* b, int dim);
+
+/**
+ * @brief Symmetric int8 quantization of one row: in[i] ~= out[i] * scale.
+ * @param in Float row (dim elements).
+ * @param dim Number of elements.
+ * @param out int8 row (dim elements).
+ * @param out_scale Per-row scale.
+ */
+void embedding_quantize_s8(const float* in, int dim, int8_t* out, float* out_scale);
+
+/**
+ * @brief Scores one query against n float rows and keeps the k best.
+ * @param query L2 normalized query (dim floats).
+ * @param rows Row-major matrix, n x dim.
+ * @param n Number of rows.
+ * @param dim Embedding dimension.
+ * @param k Number of matches to keep.
+ * @param out At least k entries, sorted by decreasing similarity.
+ * @return Number of valid entries in out (min(k, n)).
+ */
+int embedding_search_topk_f32(const float* query, const float* rows, int n, int dim,
+                              int k, embedding_match_t* out);
+
+/**
+ * @brief Same as embedding_search_topk_f32, on int8 rows with a per-row scale.
+ * @param query Quantized query (see embedding_quantize_s8).
+ * @param query_scale Scale of the query.
+ * @param rows Row-major int8 matrix, n x dim.
+ * @param row_scales n per-row scales.
+ */
+int embedding_search_topk_s8(const int8_t* query, float query_scale,
+                             const int8_t* rows, const float* row_scales, int n, int dim,
+                             int k, embedding_match_t* out);
+
+/**
+ * @brief Second stage of a cascaded search: scores only the candidate rows
+ * (found by a coarse first stage) at full dimension and keeps the k best.
+ * @param query L2 normalized query (dim floats).
+ * @param rows Row-major matrix, dim elements per row.
+ * @param dim Embedding dimension.
+ * @param candidates Row indexes to score (the similarity field is ignored).
+ * @param count Number of candidates.
+ * @param k Number of matches to keep.
+ * @param out At least k entries, sorted by decreasing similarity.
+ * @return Number of valid entries in out (min(k, count)).
+ */
+int embedding_rescore_f32(const float* query, const float* rows, int dim,
+                          const embedding_match_t* candidates, int count, int k, embedding_match_t* out);
+
+// Same as embedding_rescore_f32, on int8 rows with a per-row scale
+int embedding_rescore_s8(const int8_t* query, float query_scale, const int8_t* rows, const float* row_scales, int dim,
+                         const embedding_match_t* candidates, int count, int k, embedding_match_t* out);
+
+/**
+ * @brief Verifies the optimized/int8 kernels against the float reference.
+ * Builds a random gallery of n normalized embeddings, queries it with noisy
+ * copies and reports recall@k, max similarity error and timings.
+ * @return ESP_OK if recall and accuracy are within limits.
+ */
+esp_err_t embedding_search_self_test(int n, int dim, int k);
+
+/**
+ * @brief Recall vs speed of the cascaded search on a synthetic gallery of n identities.
+ * Probes are noisy views of an identity (cosine ~0.6 to it, as a real second photo).
+ * For several candidate counts, compares the top-1 of the cascade (int8 prefix of
+ * coarse_dim dims, then int8 full rows) with the full linear int8 scan.
+ * @param m Candidate count used at runtime: the test fails if its recall is below 99%.
+ * @return ESP_OK, ESP_FAIL on low recall, ESP_ERR_NO_MEM if the gallery does not fit.
+ */
+esp_err_t embedding_cascade_benchmark(int n, int dim, int coarse_dim, int m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EMBEDDING_SEARCH_H
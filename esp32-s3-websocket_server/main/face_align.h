@@ -0,0 +1,107 @@
+/**
+ * @file face_align.h
+ * @brief 5-point face alignment into the 112x112 input tile of the feature model,
+ * shared by the CAM (client) and the S3 (server).
+ * KEEP BOTH COPIES IDENTICAL: esp32-face-detect-websocket-client/main/face_align.h
+ * and esp32-s3-websocket_server/main/face_align.h.
+ *
+ * Same alignment as the esp-dl FeatImagePreprocessor on the S3: similarity
+ * transform (rotation, uniform scale, translation) of the s_std_ldks_112
+ * template onto the detected keypoints, least squares, then a nearest
+ * neighbour warp clamped to the image borders. A tile aligned on the CAM is
+ * sent with FRAME_FLAG_ALIGNED and FACE_ALIGN_KEYPOINTS: the S3 only converts
+ * it to the model input, no second warp.
+ *
+ * Keypoints, x/y: left eye, left mouth corner, nose, right eye, right mouth corner.
+ */
+#ifndef FACE_ALIGN_H
+#define FACE_ALIGN_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FACE_ALIGN_SIZE 112   // tile width and height, the feature model input
+#define FACE_ALIGN_POINTS 5
+
+// s_std_ldks_112 of esp-dl (dl_feat_image_preprocessor.cpp)
+static const float FACE_ALIGN_TEMPLATE[2 * FACE_ALIGN_POINTS] = {
+    38.2946f, 51.6963f, 41.5493f, 92.3655f, 56.0252f, 71.7366f, 73.5318f, 51.5014f, 70.7299f, 92.2041f };
+
+// The template rounded: keypoints of an aligned tile on the wire
+static const int FACE_ALIGN_KEYPOINTS[2 * FACE_ALIGN_POINTS] = { 38, 52, 42, 92, 56, 72, 74, 52, 71, 92 };
+
+/* Tile to image transform, least squares fit of the template on the keypoints:
+ * x = m[0] * u + m[1] * v + m[2], y = m[3] * u + m[4] * v + m[5] for the tile pixel (u, v).
+ * Closed form of the 2D similarity: esp-dl gets the same (Umeyama) solution from
+ * a numerical SVD, the two agree to a fraction of a pixel.
+ * Returns false if the keypoints are degenerate (all equal). */
+static inline bool face_align_estimate(const int* keypoints, float m[6]) {
+    float mu = 0.0f, mv = 0.0f, mx = 0.0f, my = 0.0f;
+    for (int i = 0; i < FACE_ALIGN_POINTS; i++) {
+        mu += FACE_ALIGN_TEMPLATE[2 * i];
+        mv += FACE_ALIGN_TEMPLATE[2 * i + 1];
+        mx += keypoints[2 * i];
+        my += keypoints[2 * i + 1];
+    }
+    mu /= FACE_ALIGN_POINTS;
+    mv /= FACE_ALIGN_POINTS;
+    mx /= FACE_ALIGN_POINTS;
+    my /= FACE_ALIGN_POINTS;
+
+    // (x + iy) = (a + ib)(u + iv) + t: a, b by complex linear regression on the centered points
+    float num_a = 0.0f, num_b = 0.0f, den = 0.0f;
+    for (int i = 0; i < FACE_ALIGN_POINTS; i++) {
+        float u = FACE_ALIGN_TEMPLATE[2 * i] - mu;
+        float v = FACE_ALIGN_TEMPLATE[2 * i + 1] - mv;
+        float x = keypoints[2 * i] - mx;
+        float y = keypoints[2 * i + 1] - my;
+        num_a += u * x + v * y;
+        num_b += u * y - v * x;
+        den += u * u + v * v;
+    }
+    float a = num_a / den;
+    float b = num_b / den;
+    if (a * a + b * b < 1e-6f) {
+        return false;
+    }
+    m[0] = a;
+    m[1] = -b;
+    m[2] = mx - a * mu + b * mv;
+    m[3] = b;
+    m[4] = a;
+    m[5] = my - b * mu - a * mv;
+    return true;
+}
+
+/* Nearest neighbour warp of an RGB565 image (any byte order, pixels are copied
+ * as is) into a FACE_ALIGN_SIZE x FACE_ALIGN_SIZE tile, m from face_align_estimate().
+ * Same sampling as the esp-dl warp: clamped to the image, rounded half up.
+ * 16.16 fixed point along each row. */
+static inline void face_align_warp(const uint16_t* src, int src_w, int src_h, const float m[6], uint16_t* tile) {
+    const float one = 65536.0f;
+    const int32_t dx = (int32_t)lroundf(m[0] * one);
+    const int32_t dy = (int32_t)lroundf(m[3] * one);
+    for (int v = 0; v < FACE_ALIGN_SIZE; v++) {
+        int32_t xq = (int32_t)lroundf((m[1] * v + m[2]) * one);
+        int32_t yq = (int32_t)lroundf((m[4] * v + m[5]) * one);
+        for (int u = 0; u < FACE_ALIGN_SIZE; u++, xq += dx, yq += dy) {
+            int x = (xq + 0x8000) >> 16;
+            int y = (yq + 0x8000) >> 16;
+            x = x < 0 ? 0 : (x >= src_w ? src_w - 1 : x);
+            y = y < 0 ? 0 : (y >= src_h ? src_h - 1 : y);
+            *tile++ = src[(size_t)y * src_w + x];
+        }
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FACE_ALIGN_H
@@ -5,114 +5,606 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include "esp_log.h"
 #include "cJSON.h"
 #include "storage_manager.h"
 #include "face_database.h"
 #include <sys/stat.h>
-#include <errno.h> 
+#include <unistd.h> // truncate, fsync
+#include <errno.h>
+#include <math.h>
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "embedding_search.h"
+#include "config.h" // EMBEDDING_INDEX_INT8, EMBEDDING_CASCADE_*, FACE_STORE_*
 
 static const char* TAG = "FACE_DB";
-static const char* METADATA_PATH = "/spiffs/faces_meta.json";
+static const char* STORE_PATH = "/spiffs/faces.bin";
+static const char* STORE_TMP_PATH = "/spiffs/faces.tmp";
+static const char* METADATA_PATH = "/spiffs/faces_meta.json"; // legacy store, now export/import only
 
+#define EMBEDDING_ROW_ALIGN 16 // PIE/SIMD friendly row alignment
+
+/* Binary, append-only face store (faces.bin):
+ *
+ *   header | record 0 | record 1 | ...
+ *   record = type | face_record_t | float embedding[dim] | crc32
+ *
+ * All records have the same size, so the record count is derived from the
+ * file size: enrolling a face is ONE append, never a rewrite.
+ * A delete appends a tombstone record with the id. A valid record for an id
+ * already seen replaces it. Dead records are dropped by compaction, which
+ * copies the live records to a new file and renames it.
+ * A record with a bad CRC (or a truncated last record after a power cut)
+ * is skipped and forces a compaction, so the file is always re-aligned.
+ * A failed append at runtime is cut off at once (or compacted away).
+ * SPIFFS rename does not overwrite: compaction removes faces.bin before
+ * renaming faces.tmp. In between, faces.tmp is the store, and the load
+ * recovers it if faces.bin is missing or invalid.
+ */
+#define FACE_STORE_MAGIC 0x31424446 // "FDB1"
+#define FACE_STORE_VERSION 1
+#define FACE_STORE_REC_VALID 0x444C4156     // "VALD"
+#define FACE_STORE_REC_TOMBSTONE 0x44414544 // "DEAD"
+#define FACE_STORE_RENAME_ATTEMPTS 3
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t dim;         // floats per embedding
+    uint32_t record_size; // bytes per record, crc included
+    uint32_t reserved[5];
+} face_store_header_t;
+
+typedef struct {
+    uint32_t type;
+    face_record_t meta;
+} face_store_record_head_t;
+
+#define STORE_RECORD_SIZE(dim) (sizeof(face_store_record_head_t) + (size_t)(dim) * sizeof(float) + sizeof(uint32_t))
+
+#if EMBEDDING_INDEX_INT8
+typedef int8_t embedding_elem_t; // row i ~= embeddings[i] * scales[i]
+#else
+typedef float embedding_elem_t;
+#endif
+
+/* The database stays resident in RAM after database_init().
+ * records[i] metadata belongs to row i of the embeddings matrix:
+ * row-major, dim elements per row, aligned, in PSRAM.
+ * offsets[i] is the position of record i in the store file.
+ * coarse row i is the int8 prefix of row i (its own scale), scanned first
+ * by the cascaded search, see database_find_top_k().
+ */
 static struct {
     face_record_t* records;
+    uint32_t* offsets;
     int count;
-} s_db = { .records = NULL, .count = 0 };
+    int records_capacity;
+    bool loaded;
+    embedding_elem_t* embeddings;
+    float* scales;     // per-row scale, int8 index only
+    int8_t* query_q;   // dim bytes, the quantized query, int8 index only
+    int8_t* coarse;    // capacity x coarse_dim, EMBEDDING_CASCADE_ENABLED only
+    float* coarse_scales;
+    int coarse_dim;
+    int capacity;      // rows allocated in embeddings
+    int dim;           // elements per row, 0 until the store has a header
+    int file_records;  // records in the store file, live + dead
+    int next_id;
+    bool tmp_pending;  // compacted faces.tmp not renamed yet: it is the store
+} s_db = { 0 };
 
-esp_err_t database_init(void) {
-    if (s_db.records) {
-        // If already initialized, de-initialize first to reload fresh
-        database_deinit();
+/* Grow the embeddings matrix to hold at least min_rows rows.
+ * Aligned memory cannot be realloc'ed, so allocate/copy/free. */
+static esp_err_t embeddings_reserve(int min_rows) {
+    if (min_rows <= s_db.capacity) return ESP_OK;
+    if (s_db.dim <= 0) return ESP_ERR_INVALID_STATE;
+
+    int new_capacity = s_db.capacity > 0 ? s_db.capacity : 16;
+    while (new_capacity < min_rows) new_capacity *= 2;
+
+    size_t row_bytes = (size_t)s_db.dim * sizeof(embedding_elem_t);
+    embedding_elem_t* new_rows = (embedding_elem_t*)heap_caps_aligned_alloc(EMBEDDING_ROW_ALIGN, new_capacity * row_bytes,
+                                                                            MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!new_rows) {
+        // No PSRAM? try internal RAM before giving up
+        new_rows = (embedding_elem_t*)heap_caps_aligned_alloc(EMBEDDING_ROW_ALIGN, new_capacity * row_bytes, MALLOC_CAP_8BIT);
+    }
+    if (!new_rows) {
+        ESP_LOGE(TAG, "Failed to allocate embedding index for %d rows.", new_capacity);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(new_rows, 0, new_capacity * row_bytes);
+#if EMBEDDING_INDEX_INT8
+    float* new_scales = (float*)heap_caps_calloc(new_capacity, sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!new_scales) new_scales = (float*)heap_caps_calloc(new_capacity, sizeof(float), MALLOC_CAP_8BIT);
+    if (!new_scales) {
+        ESP_LOGE(TAG, "Failed to allocate embedding scales for %d rows.", new_capacity);
+        heap_caps_free(new_rows);
+        return ESP_ERR_NO_MEM;
+    }
+    if (!s_db.query_q) {
+        // The dim is fixed once the store has a header: one buffer serves every query
+        s_db.query_q = (int8_t*)heap_caps_malloc(s_db.dim, MALLOC_CAP_8BIT);
+        if (!s_db.query_q) {
+            ESP_LOGE(TAG, "Failed to allocate the query buffer (%d bytes).", s_db.dim);
+            heap_caps_free(new_scales);
+            heap_caps_free(new_rows);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (s_db.scales) {
+        memcpy(new_scales, s_db.scales, s_db.capacity * sizeof(float));
+        heap_caps_free(s_db.scales);
+    }
+    s_db.scales = new_scales;
+#endif
+#if EMBEDDING_CASCADE_ENABLED
+    // Once dropped, the coarse index stays off: the rows stored meanwhile have no prefix
+    if (s_db.capacity == 0 || s_db.coarse) {
+        s_db.coarse_dim = s_db.dim < EMBEDDING_CASCADE_COARSE_DIM ? s_db.dim : EMBEDDING_CASCADE_COARSE_DIM;
+        size_t coarse_bytes = (size_t)s_db.coarse_dim;
+        int8_t* new_coarse = (int8_t*)heap_caps_aligned_alloc(EMBEDDING_ROW_ALIGN, new_capacity * coarse_bytes,
+                                                              MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!new_coarse) new_coarse = (int8_t*)heap_caps_aligned_alloc(EMBEDDING_ROW_ALIGN, new_capacity * coarse_bytes, MALLOC_CAP_8BIT);
+        float* new_coarse_scales = (float*)heap_caps_calloc(new_capacity, sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!new_coarse_scales) new_coarse_scales = (float*)heap_caps_calloc(new_capacity, sizeof(float), MALLOC_CAP_8BIT);
+        if (!new_coarse || !new_coarse_scales) {
+            // Not fatal: the search falls back to the full scan
+            ESP_LOGW(TAG, "No memory for the coarse index of %d rows, cascaded search disabled.", new_capacity);
+            heap_caps_free(new_coarse);
+            heap_caps_free(new_coarse_scales);
+            new_coarse = NULL;
+            new_coarse_scales = NULL;
+        } else if (s_db.coarse) {
+            memcpy(new_coarse, s_db.coarse, s_db.capacity * coarse_bytes);
+            memcpy(new_coarse_scales, s_db.coarse_scales, s_db.capacity * sizeof(float));
+        }
+        heap_caps_free(s_db.coarse);
+        heap_caps_free(s_db.coarse_scales);
+        s_db.coarse = new_coarse;
+        s_db.coarse_scales = new_coarse_scales;
+    }
+#endif
+    if (s_db.embeddings) {
+        memcpy(new_rows, s_db.embeddings, s_db.capacity * row_bytes);
+        heap_caps_free(s_db.embeddings);
+    }
+    s_db.embeddings = new_rows;
+    s_db.capacity = new_capacity;
+    return ESP_OK;
+}
+
+/* Grow records/offsets geometrically, so N appends cost O(N) in total */
+static esp_err_t records_reserve(int min_records) {
+    if (min_records <= s_db.records_capacity) return ESP_OK;
+    int new_capacity = s_db.records_capacity > 0 ? s_db.records_capacity * 2 : 16;
+    while (new_capacity < min_records) new_capacity *= 2;
+
+    face_record_t* new_records = (face_record_t*)realloc(s_db.records, new_capacity * sizeof(face_record_t));
+    if (!new_records) return ESP_ERR_NO_MEM;
+    s_db.records = new_records;
+    uint32_t* new_offsets = (uint32_t*)realloc(s_db.offsets, new_capacity * sizeof(uint32_t));
+    if (!new_offsets) return ESP_ERR_NO_MEM;
+    s_db.offsets = new_offsets;
+    s_db.records_capacity = new_capacity;
+    return ESP_OK;
+}
+
+/* Store one embedding in row 'row'. values are L2 normalized in place,
+ * so that a dot product is the cosine similarity, then quantized
+ * if the index is int8. */
+static esp_err_t store_embedding_row(int row, float* values) {
+    if (embeddings_reserve(row + 1) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    float norm = sqrtf(embedding_dot_f32(values, values, s_db.dim));
+    if (norm > 0.0f) {
+        for (int i = 0; i < s_db.dim; i++) values[i] /= norm;
+    }
+
+    embedding_elem_t* dst = s_db.embeddings + (size_t)row * s_db.dim;
+#if EMBEDDING_INDEX_INT8
+    embedding_quantize_s8(values, s_db.dim, dst, &s_db.scales[row]);
+#else
+    memcpy(dst, values, s_db.dim * sizeof(float));
+#endif
+#if EMBEDDING_CASCADE_ENABLED
+    if (s_db.coarse) {
+        embedding_quantize_s8(values, s_db.coarse_dim, s_db.coarse + (size_t)row * s_db.coarse_dim, &s_db.coarse_scales[row]);
+    }
+#endif
+    return ESP_OK;
+}
+
+static int find_record_index(int id) {
+    for (int i = 0; i < s_db.count; i++) {
+        if (s_db.records[i].id == id) return i;
+    }
+    return -1;
+}
+
+/* Remove record i from memory, keeping rows and records aligned */
+static void remove_record_at(int i) {
+    int tail = s_db.count - i - 1;
+    if (tail > 0) {
+        memmove(&s_db.records[i], &s_db.records[i + 1], tail * sizeof(face_record_t));
+        memmove(&s_db.offsets[i], &s_db.offsets[i + 1], tail * sizeof(uint32_t));
+        memmove(s_db.embeddings + (size_t)i * s_db.dim, s_db.embeddings + (size_t)(i + 1) * s_db.dim,
+                (size_t)tail * s_db.dim * sizeof(embedding_elem_t));
+#if EMBEDDING_INDEX_INT8
+        memmove(&s_db.scales[i], &s_db.scales[i + 1], tail * sizeof(float));
+#endif
+#if EMBEDDING_CASCADE_ENABLED
+        if (s_db.coarse) {
+            memmove(s_db.coarse + (size_t)i * s_db.coarse_dim, s_db.coarse + (size_t)(i + 1) * s_db.coarse_dim,
+                    (size_t)tail * s_db.coarse_dim);
+            memmove(&s_db.coarse_scales[i], &s_db.coarse_scales[i + 1], tail * sizeof(float));
+        }
+#endif
+    }
+    s_db.count--;
+}
+
+/* Apply one valid record to the resident database: new id or replacement */
+static esp_err_t apply_record(const face_record_t* meta, float* embedding, uint32_t offset) {
+    int i = find_record_index(meta->id);
+    if (i < 0) {
+        if (records_reserve(s_db.count + 1) != ESP_OK) return ESP_ERR_NO_MEM;
+        i = s_db.count;
+    }
+    if (store_embedding_row(i, embedding) != ESP_OK) return ESP_ERR_NO_MEM;
+    s_db.records[i] = *meta;
+    s_db.offsets[i] = offset;
+    if (i == s_db.count) s_db.count++;
+    if (meta->id >= s_db.next_id) s_db.next_id = meta->id + 1;
+    return ESP_OK;
+}
+
+static uint32_t record_crc(const uint8_t* record, size_t record_size) {
+    return esp_rom_crc32_le(0, record, record_size - sizeof(uint32_t));
+}
+
+/* Moves the compacted faces.tmp into place, faces.bin removed first. On failure
+ * faces.tmp is kept as the store and the move is retried before the next write. */
+static esp_err_t store_commit_tmp(void) {
+    for (int attempt = 0; attempt < FACE_STORE_RENAME_ATTEMPTS; attempt++) {
+        remove(STORE_PATH);
+        if (rename(STORE_TMP_PATH, STORE_PATH) == 0) {
+            s_db.tmp_pending = false;
+            return ESP_OK;
+        }
+    }
+    ESP_LOGE(TAG, "Compaction: rename failed (errno %d), %s kept as the store.", errno, STORE_TMP_PATH);
+    s_db.tmp_pending = true;
+    return ESP_FAIL;
+}
+
+static esp_err_t store_compact(void); // re-aligns the store when a torn append cannot be cut off
+
+/* Build one record (head, embedding, crc) in a buffer and append it to the store */
+static esp_err_t store_append(uint32_t type, const face_record_t* meta, const float* embedding, uint32_t* out_offset) {
+    if (s_db.tmp_pending && store_commit_tmp() != ESP_OK) {
+        return ESP_FAIL; // never append to a faces.bin that is not the store
+    }
+    size_t record_size = STORE_RECORD_SIZE(s_db.dim);
+    uint8_t* buf = (uint8_t*)calloc(1, record_size);
+    if (!buf) return ESP_ERR_NO_MEM;
+
+    face_store_record_head_t head = { .type = type, .meta = *meta };
+    memcpy(buf, &head, sizeof(head));
+    if (embedding) {
+        memcpy(buf + sizeof(head), embedding, s_db.dim * sizeof(float));
+    }
+    uint32_t crc = record_crc(buf, record_size);
+    memcpy(buf + record_size - sizeof(uint32_t), &crc, sizeof(crc));
+
+    esp_err_t err = storage_append_file_binary(STORE_PATH, buf, record_size);
+    free(buf);
+    if (err != ESP_OK) {
+        // Cut a torn record off, or the next appends land after it and are lost on reload
+        off_t good_size = sizeof(face_store_header_t) + (off_t)s_db.file_records * record_size;
+        if (truncate(STORE_PATH, good_size) != 0) {
+            ESP_LOGW(TAG, "Failed to truncate the store after a failed append (errno %d), compacting.", errno);
+            store_compact();
+        }
+        return err;
+    }
+
+    if (out_offset) *out_offset = sizeof(face_store_header_t) + (uint32_t)s_db.file_records * record_size;
+    s_db.file_records++;
+    return ESP_OK;
+}
+
+static esp_err_t store_create(int dim) {
+    face_store_header_t header = {
+        .magic = FACE_STORE_MAGIC,
+        .version = FACE_STORE_VERSION,
+        .dim = (uint16_t)dim,
+        .record_size = STORE_RECORD_SIZE(dim),
+    };
+    esp_err_t err = storage_write_file_binary(STORE_PATH, (const uint8_t*)&header, sizeof(header));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create face store %s.", STORE_PATH);
+        return err;
+    }
+    s_db.dim = dim;
+    s_db.file_records = 0;
+    ESP_LOGI(TAG, "Created face store %s (dim %d, %d bytes/record).", STORE_PATH, dim, (int)header.record_size);
+    return ESP_OK;
+}
+
+/* Rewrite the store with the live records only. They are copied from the old
+ * file: the resident rows may be int8, the file keeps the float embeddings. */
+static esp_err_t store_compact(void) {
+    if (s_db.tmp_pending && store_commit_tmp() != ESP_OK) {
+        return ESP_FAIL; // faces.tmp is already compacted, it stays the store
+    }
+    size_t record_size = STORE_RECORD_SIZE(s_db.dim);
+    ESP_LOGI(TAG, "Compacting face store: %d live, %d dead records.", s_db.count, s_db.file_records - s_db.count);
+
+    FILE* src = fopen(STORE_PATH, "rb");
+    FILE* dst = fopen(STORE_TMP_PATH, "wb");
+    uint8_t* buf = (uint8_t*)malloc(record_size);
+    esp_err_t err = ESP_FAIL;
+    if (!src || !dst || !buf) {
+        ESP_LOGE(TAG, "Compaction: failed to open store files or allocate buffer.");
+        goto cleanup;
+    }
+
+    face_store_header_t header;
+    if (fread(&header, 1, sizeof(header), src) != sizeof(header) ||
+        fwrite(&header, 1, sizeof(header), dst) != sizeof(header)) {
+        goto cleanup;
+    }
+    for (int i = 0; i < s_db.count; i++) {
+        if (fseek(src, s_db.offsets[i], SEEK_SET) != 0 ||
+            fread(buf, 1, record_size, src) != record_size ||
+            fwrite(buf, 1, record_size, dst) != record_size) {
+            ESP_LOGE(TAG, "Compaction: failed to copy record ID %d.", s_db.records[i].id);
+            goto cleanup;
+        }
+    }
+    // SPIFFS full shows up in the final flush: check it, faces.tmp replaces the store
+    if (fflush(dst) != 0 || fsync(fileno(dst)) != 0) {
+        ESP_LOGE(TAG, "Compaction: failed to flush %s (errno %d).", STORE_TMP_PATH, errno);
+        goto cleanup;
+    }
+    err = fclose(dst) == 0 ? ESP_OK : ESP_FAIL;
+    dst = NULL;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Compaction: failed to close %s (errno %d).", STORE_TMP_PATH, errno);
+    }
+
+cleanup:
+    if (src) fclose(src);
+    if (dst) fclose(dst);
+    free(buf);
+    if (err != ESP_OK) {
+        remove(STORE_TMP_PATH);
+        return err;
+    }
+    // From here faces.tmp holds the live records, in order
+    for (int i = 0; i < s_db.count; i++) {
+        s_db.offsets[i] = sizeof(face_store_header_t) + (uint32_t)i * record_size;
+    }
+    s_db.file_records = s_db.count;
+    return store_commit_tmp();
+}
+
+static bool compaction_due(void) {
+    int dead = s_db.file_records - s_db.count;
+    return dead >= FACE_STORE_COMPACT_MIN_DEAD && dead * 2 >= s_db.file_records;
+}
+
+static bool store_read_header(FILE* f, face_store_header_t* header) {
+    return fread(header, 1, sizeof(*header), f) == sizeof(*header) &&
+           header->magic == FACE_STORE_MAGIC && header->version == FACE_STORE_VERSION &&
+           header->dim != 0 && header->record_size == STORE_RECORD_SIZE(header->dim);
+}
+
+/* faces.bin missing or invalid: a compaction was interrupted between the remove
+ * and the rename (or the rename failed). A valid faces.tmp is the store. */
+static bool store_recover_tmp(void) {
+    FILE* f = fopen(STORE_TMP_PATH, "rb");
+    if (!f) return false;
+    face_store_header_t header;
+    bool valid = store_read_header(f, &header);
+    fclose(f);
+    if (!valid || store_commit_tmp() != ESP_OK) {
+        return false;
+    }
+    ESP_LOGW(TAG, "Face store recovered from %s (interrupted compaction).", STORE_TMP_PATH);
+    return true;
+}
+
+/* Read the whole store sequentially, one record at a time */
+static esp_err_t store_load(bool* out_needs_compaction) {
+    *out_needs_compaction = false;
+    face_store_header_t header;
+    FILE* f = fopen(STORE_PATH, "rb");
+    bool valid = f && store_read_header(f, &header);
+    if (!valid) {
+        if (f) fclose(f);
+        f = store_recover_tmp() ? fopen(STORE_PATH, "rb") : NULL;
+        valid = f && store_read_header(f, &header);
+    }
+    if (!f) return ESP_ERR_NOT_FOUND;
+    if (!valid) {
+        ESP_LOGE(TAG, "Face store header is invalid.");
+        fclose(f);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    s_db.dim = header.dim;
+
+    size_t record_size = header.record_size;
+    uint8_t* buf = (uint8_t*)malloc(record_size);
+    if (!buf) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
     }
 
+    int corrupted = 0;
+    uint32_t offset = sizeof(header);
+    size_t got;
+    while ((got = fread(buf, 1, record_size, f)) > 0) {
+        if (got != record_size) {
+            ESP_LOGW(TAG, "Truncated record at the end of the store (interrupted write?). Ignored.");
+            corrupted++;
+            break;
+        }
+        s_db.file_records++;
+        uint32_t crc;
+        memcpy(&crc, buf + record_size - sizeof(uint32_t), sizeof(crc));
+        face_store_record_head_t head;
+        memcpy(&head, buf, sizeof(head));
+
+        if (crc != record_crc(buf, record_size)) {
+            ESP_LOGW(TAG, "CRC mismatch in record at offset %u. Skipped.", (unsigned)offset);
+            corrupted++;
+        } else if (head.type == FACE_STORE_REC_TOMBSTONE) {
+            int i = find_record_index(head.meta.id);
+            if (i >= 0) remove_record_at(i);
+            if (head.meta.id >= s_db.next_id) s_db.next_id = head.meta.id + 1; // never reuse a deleted id
+        } else if (head.type == FACE_STORE_REC_VALID) {
+            // buf comes from malloc, the embedding right after the head is float aligned
+            if (apply_record(&head.meta, (float*)(buf + sizeof(head)), offset) != ESP_OK) {
+                ESP_LOGE(TAG, "Out of memory loading ID %d.", head.meta.id);
+                free(buf);
+                fclose(f);
+                return ESP_ERR_NO_MEM;
+            }
+        } else {
+            corrupted++;
+        }
+        offset += record_size;
+    }
+    free(buf);
+    fclose(f);
+
+    if (corrupted > 0) {
+        ESP_LOGW(TAG, "%d corrupted record(s) dropped.", corrupted);
+        *out_needs_compaction = true; // re-aligns the file after a torn write
+    }
+    return ESP_OK;
+}
+
+/* One-time import of the legacy faces_meta.json + person_N.db files */
+static void import_legacy_json(void) {
+    struct stat st;
+    if (stat(METADATA_PATH, &st) != 0) return;
+
     char* json_string = NULL;
     size_t json_string_len = 0;
-    storage_read_file(METADATA_PATH, &json_string, &json_string_len);
-    
-    if (!json_string || json_string_len < 2) {
-        if (json_string) free(json_string);
-        ESP_LOGW(TAG, "Metadata file not found or empty. Creating new one.");
-        
-        storage_write_file(METADATA_PATH, "[]");
-        
-        // Re-read after creation to ensure loading
-        storage_read_file(METADATA_PATH, &json_string, &json_string_len);
-    }
-    
-    if (!json_string) {
-        ESP_LOGE(TAG, "Failed to read/create metadata file.");
-        return ESP_FAIL;
+    if (storage_read_file(METADATA_PATH, &json_string, &json_string_len) != ESP_OK || !json_string) {
+        return;
     }
-    
     cJSON* root = cJSON_Parse(json_string);
     free(json_string);
-
-    if (!root || !cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "Metadata file is corrupted or not a JSON array. Resetting.");
+    if (!root || !cJSON_IsArray(root) || cJSON_GetArraySize(root) == 0) {
         cJSON_Delete(root);
-        // Try to reset to an empty array
-        storage_write_file(METADATA_PATH, "[]");
-        // Re-try read (recursive call, but safe)
-        return database_init(); 
+        return;
     }
 
-    s_db.count = cJSON_GetArraySize(root);
-    ESP_LOGI(TAG, "Found %d face metadata records.", s_db.count);
+    ESP_LOGI(TAG, "Importing %d legacy JSON records into %s.", cJSON_GetArraySize(root), STORE_PATH);
+    int imported = 0;
+    cJSON* elem = NULL;
+    cJSON_ArrayForEach(elem, root) {
+        face_record_t rec = { 0 };
+        cJSON* item;
+        item = cJSON_GetObjectItem(elem, "id");
+        rec.id = item ? item->valueint : -1;
+        item = cJSON_GetObjectItem(elem, "access_level");
+        rec.access_level = item ? item->valueint : 0;
+        item = cJSON_GetObjectItem(elem, "name");
+        strncpy(rec.name, item ? item->valuestring : "", MAX_NAME_LEN - 1);
+        item = cJSON_GetObjectItem(elem, "title");
+        strncpy(rec.title, item ? item->valuestring : "", MAX_TITLE_LEN - 1);
+        item = cJSON_GetObjectItem(elem, "status");
+        strncpy(rec.status, item ? item->valuestring : "", MAX_STATUS_LEN - 1);
+        item = cJSON_GetObjectItem(elem, "embedding_file");
+        strncpy(rec.embedding_file, item ? item->valuestring : "", MAX_FILENAME_LEN - 1);
 
-    if (s_db.count > 0) {
-        s_db.records = (face_record_t*)calloc(s_db.count, sizeof(face_record_t));
-        if (!s_db.records) {
-            s_db.count = 0; cJSON_Delete(root); return ESP_ERR_NO_MEM;
+        if (rec.id < 0 || rec.embedding_file[0] == '\0' || database_add_face(&rec) != ESP_OK) {
+            ESP_LOGW(TAG, "Legacy record ID %d (%s) not imported.", rec.id, rec.embedding_file);
+        } else {
+            imported++;
         }
+    }
+    cJSON_Delete(root);
+    ESP_LOGI(TAG, "Imported %d legacy records.", imported);
+}
+
+esp_err_t database_init(void) {
+    if (s_db.loaded) {
+        // If already initialized, de-initialize first to reload fresh
+        database_deinit();
+    }
 
-        cJSON* elem = NULL;
-        int i = 0;
-        cJSON_ArrayForEach(elem, root) {
-            cJSON* item;
-            item = cJSON_GetObjectItem(elem, "id");
-            s_db.records[i].id = item ? item->valueint : -1;
-            item = cJSON_GetObjectItem(elem, "access_level");
-            s_db.records[i].access_level = item ? item->valueint : 0;
-            item = cJSON_GetObjectItem(elem, "name");
-            strncpy(s_db.records[i].name, item ? item->valuestring : "", MAX_NAME_LEN - 1);
-            s_db.records[i].name[MAX_NAME_LEN - 1] = '\0';
-            item = cJSON_GetObjectItem(elem, "title");
-            strncpy(s_db.records[i].title, item ? item->valuestring : "", MAX_TITLE_LEN - 1);
-            s_db.records[i].title[MAX_TITLE_LEN - 1] = '\0';
-            item = cJSON_GetObjectItem(elem, "status");
-            strncpy(s_db.records[i].status, item ? item->valuestring : "", MAX_STATUS_LEN - 1);
-            s_db.records[i].status[MAX_STATUS_LEN - 1] = '\0';
-            item = cJSON_GetObjectItem(elem, "embedding_file");
-            strncpy(s_db.records[i].embedding_file, item ? item->valuestring : "", MAX_FILENAME_LEN - 1);
-            s_db.records[i].embedding_file[MAX_FILENAME_LEN - 1] = '\0';
-            i++;
+    bool needs_compaction = false;
+    esp_err_t err = store_load(&needs_compaction);
+    if (err == ESP_ERR_NO_MEM) {
+        database_deinit();
+        return err;
+    }
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_INVALID_VERSION) {
+            ESP_LOGE(TAG, "Face store is corrupted. Starting with an empty database.");
+            storage_delete_file(STORE_PATH);
+        } else {
+            ESP_LOGW(TAG, "Face store not found. Starting with an empty database.");
         }
+        database_deinit();
+        s_db.loaded = true; // the store itself is created by the first enrollment
+        import_legacy_json();
     }
-    cJSON_Delete(root);
+    s_db.loaded = true;
+
+    if (needs_compaction || compaction_due()) {
+        store_compact();
+    }
+    ESP_LOGI(TAG, "Found %d face records (%d in store), dim %d, %d bytes/face in RAM.",
+             s_db.count, s_db.file_records, s_db.dim,
+             (int)(s_db.dim * sizeof(embedding_elem_t) + (EMBEDDING_INDEX_INT8 ? sizeof(float) : 0) +
+                   (s_db.coarse ? s_db.coarse_dim + sizeof(float) : 0)));
+
+#if FACE_DB_EXPORT_JSON
+    database_export_json(METADATA_PATH);
+#endif
     return ESP_OK;
 }
 
 void database_deinit(void) {
     if (s_db.records) {
         free(s_db.records);
-        s_db.records = NULL;
     }
-    s_db.count = 0;
+    if (s_db.offsets) {
+        free(s_db.offsets);
+    }
+    if (s_db.embeddings) {
+        heap_caps_free(s_db.embeddings);
+    }
+    if (s_db.scales) {
+        heap_caps_free(s_db.scales);
+    }
+    if (s_db.query_q) {
+        heap_caps_free(s_db.query_q);
+    }
+    if (s_db.coarse) {
+        heap_caps_free(s_db.coarse);
+    }
+    if (s_db.coarse_scales) {
+        heap_caps_free(s_db.coarse_scales);
+    }
+    memset(&s_db, 0, sizeof(s_db));
     ESP_LOGD(TAG, "Database deinitialized. Memory freed."); // Added log
 }
 
 esp_err_t database_get_all_faces(face_record_t** out_faces, int* out_count) {
-    // database has to be initialized before returning records
-    if (!s_db.records && s_db.count > 0) { // If records is NULL but count suggests there should be data, re-init
-        ESP_LOGW(TAG, "dB records NULL but count > 0. Re-initializing dB.");
-        if (database_init() != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to re-initialize database in get_all_faces.");
-            *out_faces = NULL;
-            *out_count = 0;
-            return ESP_FAIL;
-        }
-    } else if (!s_db.records && s_db.count == 0) { // If not initialized at all, init it.
+    // database has to be initialized (once) before returning records
+    if (!s_db.loaded) {
          ESP_LOGI(TAG, "dB not initialized. Initializing in get_all_faces.");
          if (database_init() != ESP_OK) {
             ESP_LOGE(TAG, "Failed to initialize dB in get_all_faces.");
@@ -121,72 +613,228 @@ esp_err_t database_get_all_faces(face_record_t** out_faces, int* out_count) {
             return ESP_FAIL;
         }
     }
-    
+
     *out_faces = s_db.records;
     *out_count = s_db.count;
     return ESP_OK;
 }
 
+esp_err_t database_get_embeddings(const float** out_embeddings, int* out_dim) {
+    if (!out_embeddings || !out_dim) return ESP_ERR_INVALID_ARG;
+    *out_embeddings = NULL;
+    *out_dim = 0;
+#if EMBEDDING_INDEX_INT8
+    return ESP_ERR_NOT_SUPPORTED; // rows are int8, use database_find_top_k() or database_read_embedding()
+#else
+    if (!s_db.loaded && database_init() != ESP_OK) return ESP_FAIL;
+    *out_embeddings = s_db.embeddings;
+    *out_dim = s_db.dim;
+    return ESP_OK;
+#endif
+}
+
+esp_err_t database_read_embedding(int index, float* out, int dim) {
+    if (!out || index < 0) return ESP_ERR_INVALID_ARG;
+    if (!s_db.loaded && database_init() != ESP_OK) return ESP_FAIL;
+    if (index >= s_db.count || dim != s_db.dim) return ESP_ERR_INVALID_ARG;
+
+    // After a failed rename the offsets point into the compacted faces.tmp
+    if (s_db.tmp_pending) {
+        store_commit_tmp();
+    }
+    FILE* f = fopen(s_db.tmp_pending ? STORE_TMP_PATH : STORE_PATH, "rb");
+    if (!f) return ESP_FAIL;
+    size_t len = dim * sizeof(float);
+    bool ok = fseek(f, s_db.offsets[index] + sizeof(face_store_record_head_t), SEEK_SET) == 0 &&
+              fread(out, 1, len, f) == len;
+    fclose(f);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+int database_get_dim(void) {
+    if (!s_db.loaded && database_init() != ESP_OK) return 0;
+    return s_db.dim;
+}
+
+#if EMBEDDING_CASCADE_ENABLED
+/* First stage of the cascaded search: the EMBEDDING_CASCADE_CANDIDATES rows whose
+ * int8 prefix is the most similar to the query prefix. Returns their number. */
+static int find_coarse_candidates(const float* query, int rows, embedding_match_t* candidates) {
+    int8_t query_q[EMBEDDING_CASCADE_COARSE_DIM];
+    float query_scale;
+    embedding_quantize_s8(query, s_db.coarse_dim, query_q, &query_scale);
+    return embedding_search_topk_s8(query_q, query_scale, s_db.coarse, s_db.coarse_scales, rows, s_db.coarse_dim,
+                                    EMBEDDING_CASCADE_CANDIDATES, candidates);
+}
+#endif
+
+int database_find_top_k(const float* query, int dim, int k, embedding_match_t* out) {
+    if (!query || dim <= 0 || k <= 0 || !out) return 0;
+    if (!s_db.loaded && database_init() != ESP_OK) return 0;
+    if (!s_db.embeddings || dim != s_db.dim) {
+        if (s_db.count > 0) {
+            ESP_LOGE(TAG, "Query has %d dims, index has %d. No match possible.", dim, s_db.dim);
+        }
+        return 0;
+    }
+
+    // Single pass over the contiguous matrix. Rows and query are L2 normalized.
+    // A large database is scanned on the coarse prefix first, then only the
+    // candidates are scored on the full rows.
+    int rows = s_db.count < s_db.capacity ? s_db.count : s_db.capacity;
+    int candidate_count = 0;
+#if EMBEDDING_CASCADE_ENABLED
+    // Only the inference worker searches, so the scratch can be static
+    static embedding_match_t candidates[EMBEDDING_CASCADE_CANDIDATES];
+    if (s_db.coarse && rows >= EMBEDDING_CASCADE_MIN_FACES && k < EMBEDDING_CASCADE_CANDIDATES) {
+        candidate_count = find_coarse_candidates(query, rows, candidates);
+    }
+#else
+    embedding_match_t* candidates = NULL;
+#endif
+#if EMBEDDING_INDEX_INT8
+    float query_scale;
+    embedding_quantize_s8(query, dim, s_db.query_q, &query_scale);
+    return candidate_count > 0
+        ? embedding_rescore_s8(s_db.query_q, query_scale, s_db.embeddings, s_db.scales, dim, candidates, candidate_count, k, out)
+        : embedding_search_topk_s8(s_db.query_q, query_scale, s_db.embeddings, s_db.scales, rows, dim, k, out);
+#else
+    return candidate_count > 0
+        ? embedding_rescore_f32(query, s_db.embeddings, dim, candidates, candidate_count, k, out)
+        : embedding_search_topk_f32(query, s_db.embeddings, rows, dim, k, out);
+#endif
+}
+
+int database_find_best_match(const float* query, int dim, float* out_similarity) {
+    embedding_match_t best;
+    if (out_similarity) *out_similarity = 0.0f;
+    if (database_find_top_k(query, dim, 1, &best) < 1 || best.similarity <= 0.0f) {
+        return -1;
+    }
+    if (out_similarity) *out_similarity = best.similarity;
+    return best.index;
+}
+
 int database_get_next_available_id(void) {
-    int max_id = -1;
     // Ensure records are loaded before checking
-    if (s_db.records == NULL && database_init() != ESP_OK) {
+    if (!s_db.loaded && database_init() != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize database for get_next_available_id.");
         return 0; // Return 0 as a safe default if database cannot be read
     }
+    return s_db.next_id; // kept up to date on load/add, no scan
+}
 
-    for (int i = 0; i < s_db.count; i++) {
-        if (s_db.records[i].id > max_id) max_id = s_db.records[i].id;
+esp_err_t database_add_face_embedding(const face_record_t* new_record, const float* embedding, int dim) {
+    if (!new_record || !embedding || dim <= 0 || dim > UINT16_MAX) return ESP_ERR_INVALID_ARG;
+    if (!s_db.loaded && database_init() != ESP_OK) return ESP_FAIL;
+    ESP_LOGI(TAG, "Adding face '%s' (ID: %d).", new_record->name, new_record->id);
+
+    if (s_db.dim == 0) {
+        esp_err_t err = store_create(dim);
+        if (err != ESP_OK) return err;
+    } else if (dim != s_db.dim) {
+        ESP_LOGE(TAG, "Embedding has %d dims, store has %d.", dim, s_db.dim);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Persist first (one append), then update the resident database
+    uint32_t offset = 0;
+    esp_err_t err = store_append(FACE_STORE_REC_VALID, new_record, embedding, &offset);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to append face to the store.");
+        return err;
     }
-    return max_id + 1;
+
+    float* values = (float*)malloc(dim * sizeof(float));
+    if (!values) return ESP_ERR_NO_MEM;
+    memcpy(values, embedding, dim * sizeof(float));
+    err = apply_record(new_record, values, offset);
+    free(values);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Out of memory adding ID %d. It is stored and will be loaded on reboot.", new_record->id);
+        return err;
+    }
+    ESP_LOGI(TAG, "Face store updated. %d faces in memory.", s_db.count);
+    return ESP_OK;
 }
 
 esp_err_t database_add_face(const face_record_t* new_record) {
     if (!new_record) return ESP_ERR_INVALID_ARG;
-    ESP_LOGI(TAG, "Adding metadata for face '%s' (ID: %d).", new_record->name, new_record->id);
-    
-    char* json_string = NULL;
-    size_t json_string_len = 0;
-    storage_read_file(METADATA_PATH, &json_string, &json_string_len);
-    
-    cJSON* root = cJSON_Parse(json_string ? json_string : "[]");
-    if (json_string) free(json_string);
-    if (!root || !cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "Corrupted metadata while adding. Recreating.");
-        cJSON_Delete(root); 
-        root = cJSON_CreateArray(); // Start with an empty array if corrupted
-    }
-    /* added here some primitive characteristics of the person in photo 
-     * Remember to change the JSON bffer size if altered
-     * Jus use a default value if you dont want to bother
-     */
-    cJSON* new_face_json = cJSON_CreateObject();
-    cJSON_AddNumberToObject(new_face_json, "id", new_record->id);
-    cJSON_AddNumberToObject(new_face_json, "access_level", new_record->access_level);
-    cJSON_AddStringToObject(new_face_json, "name", new_record->name);
-    cJSON_AddStringToObject(new_face_json, "title", new_record->title);
-    cJSON_AddStringToObject(new_face_json, "status", new_record->status);
-    cJSON_AddStringToObject(new_face_json, "embedding_file", new_record->embedding_file);
-    cJSON_AddItemToArray(root, new_face_json);
-    
-    char* new_json_string = cJSON_Print(root);
+
+    char* raw = NULL;
+    size_t raw_len = 0;
+    if (storage_read_file(new_record->embedding_file, &raw, &raw_len) != ESP_OK || !raw) {
+        if (raw) free(raw);
+        return ESP_FAIL;
+    }
+    if (raw_len == 0 || raw_len % sizeof(float) != 0) {
+        ESP_LOGE(TAG, "Embedding file %s has invalid size %zu.", new_record->embedding_file, raw_len);
+        free(raw);
+        return ESP_FAIL;
+    }
+    esp_err_t err = database_add_face_embedding(new_record, (const float*)raw, raw_len / sizeof(float));
+    free(raw);
+    return err;
+}
+
+esp_err_t database_delete_face(int id) {
+    if (!s_db.loaded && database_init() != ESP_OK) return ESP_FAIL;
+    int i = find_record_index(id);
+    if (i < 0) return ESP_ERR_NOT_FOUND;
+
+    face_record_t tombstone = { 0 };
+    tombstone.id = id;
+    esp_err_t err = store_append(FACE_STORE_REC_TOMBSTONE, &tombstone, NULL, NULL);
+    if (err != ESP_OK) return err;
+    remove_record_at(i);
+    ESP_LOGI(TAG, "Face ID %d deleted. %d faces in memory.", id, s_db.count);
+
+    if (compaction_due()) {
+        store_compact();
+    }
+    return ESP_OK;
+}
+
+esp_err_t database_compact(void) {
+    if (!s_db.loaded && database_init() != ESP_OK) return ESP_FAIL;
+    if (s_db.dim == 0 || s_db.file_records == s_db.count) return ESP_OK; // nothing to drop
+    return store_compact();
+}
+
+esp_err_t database_export_json(const char* path) {
+    if (!path) return ESP_ERR_INVALID_ARG;
+    if (!s_db.loaded && database_init() != ESP_OK) return ESP_FAIL;
+
+    cJSON* root = cJSON_CreateArray();
+    if (!root) return ESP_ERR_NO_MEM;
+    for (int i = 0; i < s_db.count; i++) {
+        cJSON* face_json = cJSON_CreateObject();
+        cJSON_AddNumberToObject(face_json, "id", s_db.records[i].id);
+        cJSON_AddNumberToObject(face_json, "access_level", s_db.records[i].access_level);
+        cJSON_AddStringToObject(face_json, "name", s_db.records[i].name);
+        cJSON_AddStringToObject(face_json, "title", s_db.records[i].title);
+        cJSON_AddStringToObject(face_json, "status", s_db.records[i].status);
+        cJSON_AddStringToObject(face_json, "embedding_file", s_db.records[i].embedding_file);
+        cJSON_AddItemToArray(root, face_json);
+    }
+    char* json_string = cJSON_Print(root);
     cJSON_Delete(root);
-    if (!new_json_string) return ESP_FAIL;
-    
-    esp_err_t err = storage_write_file(METADATA_PATH, new_json_string);
-    free(new_json_string);
+    if (!json_string) return ESP_ERR_NO_MEM;
+
+    esp_err_t err = storage_write_file(path, json_string);
+    free(json_string);
     if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Metadata file updated. Re-initializing database in memory.");
-        return database_init(); // Re-initialize to update in-memory state
+        ESP_LOGI(TAG, "Exported %d records to %s.", s_db.count, path);
     }
     return err;
 }
+
 /* Needless to say that this will clear the whole database! */
 esp_err_t database_clear_all(void) {
     ESP_LOGI(TAG, "Starting to clear all face dB entries.");
     face_record_t* faces_to_delete = NULL;
     int count = 0;
-    
+
     // First, load all current records to get file paths
     esp_err_t get_err = database_get_all_faces(&faces_to_delete, &count);
     if (get_err != ESP_OK) {
@@ -194,16 +842,10 @@ esp_err_t database_clear_all(void) {
         return ESP_FAIL;
     }
 
-    if (count == 0) {
-        ESP_LOGI(TAG, "Database is empty. No files to delete.");
-        // make sure metadata file is empty
-        storage_write_file(METADATA_PATH, "[]");
-        database_deinit(); // make sure in-memory state is empty
-        return ESP_OK;
-    }
-
     ESP_LOGI(TAG, "Found %d entries to delete.", count);
     for (int i = 0; i < count; ++i) {
+        // Only legacy records have their own embedding file
+        if (faces_to_delete[i].embedding_file[0] == '\0') continue;
         ESP_LOGI(TAG, "Deleting embedding file: %s for ID: %d", faces_to_delete[i].embedding_file, faces_to_delete[i].id);
         esp_err_t del_err = storage_delete_file(faces_to_delete[i].embedding_file);
         if (del_err != ESP_OK) {
@@ -211,16 +853,18 @@ esp_err_t database_clear_all(void) {
         }
     }
 
-    // Write an empty JSON array to the metadata file
-    ESP_LOGI(TAG, "Writing empty metadata to %s.", METADATA_PATH);
-    esp_err_t write_err = storage_write_file(METADATA_PATH, "[]");
-    if (write_err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to write empty metadata file: %s", esp_err_to_name(write_err));
+    struct stat st;
+    if (stat(STORE_PATH, &st) == 0 && storage_delete_file(STORE_PATH) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to delete face store %s.", STORE_PATH);
         return ESP_FAIL;
     }
-    
-    // Done all, de-initialize the databaser in-memory
+    if (stat(METADATA_PATH, &st) == 0) {
+        storage_delete_file(METADATA_PATH); // or it would be imported again on next boot
+    }
+
+    // Done all, the in-memory database is empty (and still usable)
     database_deinit();
+    s_db.loaded = true;
     ESP_LOGI(TAG, "DATABASE IS NOW EMPTY.");
     return ESP_OK;
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 #define FACE_DATABASE_H
 
 #include "esp_err.h"
+#include "embedding_search.h"
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -15,6 +16,7 @@ extern "C" {
 #define MAX_FILENAME_LEN 64
 
 // metadata for each enrolled face. CAN BE EXTENDED AS YOU WISH
+// (it is stored as-is in the binary face store: changing it needs a new store version)
 typedef struct {
     int id;
     int access_level;
@@ -24,10 +26,36 @@ typedef struct {
     char embedding_file[MAX_FILENAME_LEN];
 } face_record_t;
 
+// Loads the binary face store (/spiffs/faces.bin) into RAM. A legacy faces_meta.json is imported once.
 esp_err_t database_init(void);
 void database_deinit(void);
 esp_err_t database_get_all_faces(face_record_t** out_faces, int* out_count);
+
+// Resident embedding index: row-major matrix, row i belongs to record i of database_get_all_faces()
+// ESP_ERR_NOT_SUPPORTED when the index is stored as int8 (EMBEDDING_INDEX_INT8).
+esp_err_t database_get_embeddings(const float** out_embeddings, int* out_dim);
+
+// k best cosine similarities of an L2 normalized query, sorted. Returns the number of entries in out.
+int database_find_top_k(const float* query, int dim, int k, embedding_match_t* out);
+
+// Best cosine similarity of an L2 normalized query. Returns the record index, or -1.
+int database_find_best_match(const float* query, int dim, float* out_similarity);
+
+// Float embedding of record 'index', read back from the store (exact even with an int8 index)
+esp_err_t database_read_embedding(int index, float* out, int dim);
+// Embedding dimension of the store, 0 while it is empty
+int database_get_dim(void);
+
+// Appends one record + embedding to the store (one flash append, no rewrite)
+esp_err_t database_add_face_embedding(const face_record_t* new_record, const float* embedding, int dim);
+// Same, embedding read from new_record->embedding_file (legacy person_N.db files)
 esp_err_t database_add_face(const face_record_t* new_record);
+// Appends a tombstone. Dead records are dropped by compaction.
+esp_err_t database_delete_face(int id);
+// Rewrites the store with the live records only
+esp_err_t database_compact(void);
+// Optional human readable export (same format as the legacy faces_meta.json)
+esp_err_t database_export_json(const char* path);
 int database_get_next_available_id(void);
 
 // Clear all entries and files in database. USE WITH CAUTION!
@@ -21,8 +21,12 @@ esp_err_t enroll_new_face(uint8_t *image_buffer, size_t image_len, int width, in
     ESP_LOGI(TAG, "Starting new face enrollment process for image with Box: [%d,%d,%d,%d], Keypoints size: %zu",
              face_x, face_y, face_w, face_h, keypoints.size());
 
-    // Local instance, will create/delete HumanFaceFeat internally (avoid crashes)
+    // Local instance, attaches to the shared (already loaded) HumanFaceFeat model
     FaceRecognizer enroller_recognizer_client;
+    if (enroller_recognizer_client.init() != ESP_OK) {
+        ESP_LOGE(TAG, "Feature extraction model not available.");
+        return ESP_FAIL;
+    }
 
     // The image_buffer passed here is already cropped (from the initiating camera)
     // Face is at 0 of both x,y. face_w and face_h are ok
@@ -53,39 +57,25 @@ esp_err_t enroll_new_face(uint8_t *image_buffer, size_t image_len, int width, in
     int new_id = database_get_next_available_id();
     ESP_LOGI(TAG, "Assign new metadata ID: %d", new_id);
 
-    char new_embedding_path[MAX_FILENAME_LEN];
-    snprintf(new_embedding_path, sizeof(new_embedding_path), "/spiffs/person_%d.db", new_id);
-
-    esp_err_t write_err = storage_write_file_binary(
-        new_embedding_path,
-        (const uint8_t*)new_face_embedding->data(),
-        new_face_embedding->size() * sizeof(float)
-    );
-    delete new_face_embedding;
-
-    if (write_err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to save new embedding to %s. Aborting.", new_embedding_path);
-        return ESP_FAIL;
-    }
-    ESP_LOGI(TAG, "Saved new embedding to %s", new_embedding_path);
-
-    face_record_t new_face_meta;
+    // Metadata and embedding go into the binary face store as ONE record (one append)
+    face_record_t new_face_meta = {};
     new_face_meta.id = new_id;
     new_face_meta.access_level = 1;
     snprintf(new_face_meta.name, MAX_NAME_LEN, "Person %d", new_id);
     snprintf(new_face_meta.title, MAX_TITLE_LEN, "New User");
     snprintf(new_face_meta.status, MAX_STATUS_LEN, "Active");
-    strncpy(new_face_meta.embedding_file, new_embedding_path, MAX_FILENAME_LEN - 1);
-    new_face_meta.embedding_file[MAX_NAME_LEN - 1] = '\0'; // Ensure null termination
 
-    if (database_add_face(&new_face_meta) == ESP_OK) {
+    esp_err_t add_err = database_add_face_embedding(&new_face_meta,
+        new_face_embedding->data(), (int)new_face_embedding->size());
+    delete new_face_embedding;
+
+    if (add_err == ESP_OK) {
         ESP_LOGI(TAG, "**********************************************");
         ESP_LOGI(TAG, "    NEW FACE ENROLLED! ID: %d (%s) *", new_face_meta.id, new_face_meta.name);
         ESP_LOGI(TAG, "**********************************************");
         return ESP_OK;
     } else {
-        ESP_LOGE(TAG, "Failed to add new face metadata. Cleaning up embedding file.");
-        remove(new_embedding_path);
+        ESP_LOGE(TAG, "Failed to add new face to the store: %s", esp_err_to_name(add_err));
         return ESP_FAIL;
     }
 }
\ No newline at end of file
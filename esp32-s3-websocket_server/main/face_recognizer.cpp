@@ -11,8 +11,14 @@
 #include <vector> 
 #include <limits> // std::numeric_limits (for epsilon)
 #include <algorithm> // std::min
+#include <inttypes.h> // PRIx32
 
 #include "esp_heap_caps.h" 
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 // HumanFaceFeat, MFN, HumanFaceRecognizer, etc.
 #include "human_face_recognition.hpp"
@@ -21,42 +27,254 @@
 #include "dl_detect_define.hpp"   // dl::detect::result_t
 #include "dl_tensor_base.hpp"     // dl::TensorBase
 #include "dl_image_define.hpp"    // dl::image::DL_IMAGE_PIX_TYPE_RGB565
+#include "dl_module_base.hpp"     // dl::module::module_worker_pool_enable (benchmark)
+#include "dl_model_arena.hpp"     // dl::ModelArena
+#include "fbs_loader.hpp"         // fbs::set_param_zero_copy
+
+#include "config.h" // FEAT_SOAK_HEAP_TOLERANCE_BYTES
+#include "face_align.h"
+#include "embedding_search.h"
+#include "perf_trace.h"
 
 static const char *TAG = "FACE_RECOGN";
 
+/* The HumanFaceFeat model is loaded ONCE and shared by every FaceRecognizer
+ * instance (image processor, enroller). Parsing the .espdl flatbuffer and
+ * running the memory planner per frame was the biggest chunk of the latency.
+ * It is never deleted: it lives as long as the firmware does.
+ */
+static HumanFaceFeat* s_feat_model = nullptr;
+
+#if MODEL_ARENA_ENABLED
+/* Variable arena shared by the esp-dl models of the firmware (they run one
+ * after the other on the inference worker), see config.h. Never deleted.
+ */
+static dl::ModelArena* s_model_arena = nullptr;
+#endif
+
+// Synthetic 112x112 RGB565 face for the soak test, the benchmark and the runtime plan calibration
+static const int TEST_FACE_SIZE = 112;
+// 5 points on the standard 112x112 template, in its order (s_std_ldks_112):
+// left eye, left mouth corner, nose, right eye, right mouth corner
+static const std::vector<int> TEST_FACE_KEYPOINTS = { 38, 52, 42, 92, 56, 72, 74, 51, 71, 92 };
+
+static uint16_t* alloc_test_face() {
+    uint16_t* img = (uint16_t*)heap_caps_malloc(TEST_FACE_SIZE * TEST_FACE_SIZE * sizeof(uint16_t),
+                                                MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!img) {
+        return NULL;
+    }
+    for (int y = 0; y < TEST_FACE_SIZE; y++) {
+        for (int x = 0; x < TEST_FACE_SIZE; x++) {
+            img[y * TEST_FACE_SIZE + x] = (uint16_t)(((x >> 3) << 11) | ((y >> 2) << 5) | ((x + y) >> 4));
+        }
+    }
+    return img;
+}
+
+#define RUNTIME_PLAN_NVS_NAMESPACE "dl_runtime"
+#define RUNTIME_PLAN_NVS_KEY "feat_plan"
+#define ARENA_PLACEMENT_NVS_KEY "feat_place"
+
+/* Runtime mode of the shared model once init() is done */
+#if FEAT_RUNTIME_AUTO
+static const dl::runtime_mode_t FEAT_RUNTIME_MODE = dl::RUNTIME_MODE_AUTO;
+#else
+static const dl::runtime_mode_t FEAT_RUNTIME_MODE = dl::RUNTIME_MODE_SINGLE_CORE;
+#endif
+
 /**
  * @brief FaceRecognizer Constructor.
- * Calls multiple ESP-WHO components.
- * Internal ESP-WHO models are not initialized here, but within
- * extract_embedding_from_cropped_box (to avoid crashes)
+ * Nothing is allocated here: a static instance is constructed before
+ * app_main, too early for the model (PSRAM, partitions). Call init().
  */
 FaceRecognizer::FaceRecognizer() {
-    ESP_LOGD(TAG, "FaceRecognizer constructor called (no internal ESP-WHO model initialized here).");
+    ESP_LOGD(TAG, "FaceRecognizer constructor called (model is loaded in init()).");
     m_detector = nullptr; 
-    m_feat_model = nullptr; // created/deleted per-run to avoid crashes
+    m_feat_model = nullptr;
     m_recognizer = nullptr;
 }
 
 /**
  * @brief FaceRecognizer Destructor.
- * Deallocates any member pointers, if they were managed by this class.
- * this is a relic, remained for compatibility... 
- * There were several crashing cases, ABANDONED!
+ * The shared feature model is NOT deleted, other instances may use it.
  */
 FaceRecognizer::~FaceRecognizer() {
-    ESP_LOGD(TAG, "FaceRecognizer destructor called (no ESP-WHO model deinit active).");
+    ESP_LOGD(TAG, "FaceRecognizer destructor called (shared model kept alive).");
     // if you manage those here, they seemm to cause crashes.
     // delete m_detector; 
     // delete m_recognizer; 
 }
 
+/**
+ * @brief Loads the feature extraction model and builds its tensor arena.
+ * Only the first call does real work, the rest just attach to the shared model.
+ * @return ESP_OK on success, ESP_FAIL if the model could not be created.
+ */
+esp_err_t FaceRecognizer::init() {
+    if (m_feat_model) {
+        return ESP_OK;
+    }
+    if (!s_feat_model) {
+        size_t free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        size_t free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        int64_t start_us = esp_timer_get_time();
+
+        fbs::set_param_zero_copy(MODEL_PARAM_ZERO_COPY);
+        s_feat_model = new HumanFaceFeat();
+        if (!s_feat_model) {
+            ESP_LOGE(TAG, "Failed to create HumanFaceFeat model!");
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "HumanFaceFeat model loaded in %lld ms. Used INTERNAL: %zu, PSRAM: %zu Bytes",
+                 (esp_timer_get_time() - start_us) / 1000,
+                 free_internal - heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+                 free_psram - heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+        m_feat_model = s_feat_model;
+#if MODEL_ARENA_ENABLED
+        // Before the runtime plan: its timings depend on where the tensors live
+        if (!s_model_arena) {
+            s_model_arena = new dl::ModelArena(MODEL_ARENA_INTERNAL_SIZE);
+        }
+        if (s_model_arena->add(s_feat_model->get_raw_model()) == ESP_OK) {
+#if MODEL_ARENA_PLACEMENT_PROFILE
+            load_arena_placement();
+#endif
+            s_model_arena->print();
+        } else {
+            ESP_LOGW(TAG, "HumanFaceFeat keeps its own tensor arena.");
+        }
+#endif
+#if FEAT_RUNTIME_AUTO
+        load_runtime_plan();
+#endif
+        s_feat_model->set_runtime_mode(FEAT_RUNTIME_MODE);
+#if PERF_TRACE_ENABLED
+        // After the profiling runs above, only real frames go to the trace
+        s_feat_model->get_raw_model()->set_trace(perf_trace_model_step);
+#endif
+    }
+    m_feat_model = s_feat_model;
+    return ESP_OK;
+}
+
+/**
+ * @brief Gives the shared model its per-layer runtime plan for RUNTIME_MODE_AUTO.
+ * Reads it from NVS; if there is none or it belongs to another model
+ * (different key), times every layer on the test face and stores the result.
+ * Without a plan, AUTO falls back to the esp-dl per-layer defaults.
+ * @return ESP_OK if the model has a plan.
+ */
+esp_err_t FaceRecognizer::load_runtime_plan() {
+    dl::Model* model = m_feat_model->get_raw_model();
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(RUNTIME_PLAN_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    bool cached = ret == ESP_OK;
+    if (!cached) {
+        ESP_LOGW(TAG, "Runtime plan: NVS unavailable (%s), calibrating without caching.", esp_err_to_name(ret));
+    } else {
+        size_t len = 0;
+        if (nvs_get_blob(nvs, RUNTIME_PLAN_NVS_KEY, NULL, &len) == ESP_OK && len > 0) {
+            std::vector<uint8_t> blob(len);
+            if (nvs_get_blob(nvs, RUNTIME_PLAN_NVS_KEY, blob.data(), &len) == ESP_OK &&
+                model->import_runtime_plan(blob) == ESP_OK) {
+                nvs_close(nvs);
+                ESP_LOGI(TAG, "Runtime plan loaded from NVS (key 0x%08" PRIx32 ").", model->get_runtime_plan_key());
+                return ESP_OK;
+            }
+        }
+    }
+
+    // Calibrate on realistic activations: one inference of the test face fills the tensors
+    uint16_t* img = alloc_test_face();
+    if (img) {
+        std::vector<float>* embedding = extract_embedding_from_cropped_box(
+            (uint8_t*)img, TEST_FACE_SIZE, TEST_FACE_SIZE, 0, 0, TEST_FACE_SIZE, TEST_FACE_SIZE, TEST_FACE_KEYPOINTS);
+        delete embedding;
+        heap_caps_free(img);
+    }
+    int64_t start_us = esp_timer_get_time();
+    ret = model->calibrate_runtime_plan(FEAT_RUNTIME_CALIBRATION_REPEATS);
+    ESP_LOGI(TAG, "Runtime plan calibrated in %lld ms.", (esp_timer_get_time() - start_us) / 1000);
+
+    if (ret == ESP_OK && cached) {
+        std::vector<uint8_t> blob = model->export_runtime_plan();
+        esp_err_t err = nvs_set_blob(nvs, RUNTIME_PLAN_NVS_KEY, blob.data(), blob.size());
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Runtime plan not saved: %s", esp_err_to_name(err));
+        }
+    }
+    if (cached) {
+        nvs_close(nvs);
+    }
+    return ret;
+}
+
+#if MODEL_ARENA_ENABLED
+/**
+ * @brief Gives the shared model its internal RAM placement in the model arena.
+ * Reads it from NVS; if there is none or it belongs to another model or
+ * arena size (MODEL_ARENA_INTERNAL_SIZE), profiles the access cost of every
+ * tensor and stores the result, dropping the runtime plan timed with the
+ * former placement. Without a placement, the largest tensors take the internal RAM.
+ * @return ESP_OK if the model has a placement.
+ */
+esp_err_t FaceRecognizer::load_arena_placement() {
+    dl::Model* model = m_feat_model->get_raw_model();
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(RUNTIME_PLAN_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    bool cached = ret == ESP_OK;
+    if (!cached) {
+        ESP_LOGW(TAG, "Arena placement: NVS unavailable (%s), profiling without caching.", esp_err_to_name(ret));
+    } else {
+        size_t len = 0;
+        if (nvs_get_blob(nvs, ARENA_PLACEMENT_NVS_KEY, NULL, &len) == ESP_OK && len > 0) {
+            std::vector<uint8_t> blob(len);
+            if (nvs_get_blob(nvs, ARENA_PLACEMENT_NVS_KEY, blob.data(), &len) == ESP_OK &&
+                s_model_arena->import_placement(model, blob) == ESP_OK) {
+                nvs_close(nvs);
+                ESP_LOGI(TAG, "Arena placement loaded from NVS (key 0x%08" PRIx32 ").", model->get_runtime_plan_key());
+                return ESP_OK;
+            }
+        }
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    ret = s_model_arena->optimize_placement(model, MODEL_ARENA_PROFILE_REPEATS);
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Arena placement profiled in %lld ms.", (esp_timer_get_time() - start_us) / 1000);
+    } else {
+        ESP_LOGW(TAG, "Arena placement not profiled: %s", esp_err_to_name(ret));
+    }
+
+    if (ret == ESP_OK && cached) {
+        std::vector<uint8_t> blob = s_model_arena->export_placement(model);
+        esp_err_t err = nvs_set_blob(nvs, ARENA_PLACEMENT_NVS_KEY, blob.data(), blob.size());
+        // The runtime plan was timed with the former placement: calibrate it again
+        nvs_erase_key(nvs, RUNTIME_PLAN_NVS_KEY);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Arena placement not saved: %s", esp_err_to_name(err));
+        }
+    }
+    if (cached) {
+        nvs_close(nvs);
+    }
+    return ret;
+}
+#endif
+
 /**
  * @brief Extracts a face embedding from a cropped image buffer.
  *
  * Takes a cropped face image and its bounding box and keypoints 
- * adjusted to the cropped image. It instantiates a HumanFaceFeat
- * model to generate a facial embedding, and then deallocates it. 
- * Otherwise crazy memory leaks and crashes occured...
+ * adjusted to the cropped image. It runs the shared (preloaded)
+ * HumanFaceFeat model, so no model memory is allocated per call.
  *
  * @param image_buffer Pointer to the RGB565 cropped image data.
  * @param cropped_img_width Width of the cropped image.
@@ -66,6 +284,7 @@ FaceRecognizer::~FaceRecognizer() {
  * @param face_w Width of the face in the cropped image.
  * @param face_h Height of the face in the cropped image.
  * @param adjusted_keypoints Keypoints adjusted to be relative to the cropped image.
+ * Empty for a FACE_ALIGN_SIZE tile already aligned on the template (face_align.h): no warp.
  * @return A dynamically allocated std::vector<float>* containing the embedding, or nullptr on failure.
  * The caller is responsible for deleting the returned vector.
  */
@@ -78,8 +297,14 @@ std::vector<float>* FaceRecognizer::extract_embedding_from_cropped_box(
         ESP_LOGE(TAG, "Invalid input for extract_embedding_from_cropped_box.");
         return NULL;
     }
-    if (adjusted_keypoints.empty() || adjusted_keypoints.size() != 10) {
-        ESP_LOGE(TAG, "Adjusted keypoints vector is empty or has incorrect size (%zu). Expected 10 elements.", adjusted_keypoints.size());
+    bool aligned = adjusted_keypoints.empty();
+    if (aligned && (cropped_img_width != FACE_ALIGN_SIZE || cropped_img_height != FACE_ALIGN_SIZE)) {
+        ESP_LOGE(TAG, "No keypoints and not an aligned %dx%d tile (%dx%d).",
+                 FACE_ALIGN_SIZE, FACE_ALIGN_SIZE, cropped_img_width, cropped_img_height);
+        return NULL;
+    }
+    if (!aligned && adjusted_keypoints.size() != 10) {
+        ESP_LOGE(TAG, "Adjusted keypoints vector has incorrect size (%zu). Expected 10 elements.", adjusted_keypoints.size());
         return NULL;
     }
 
@@ -97,21 +322,12 @@ std::vector<float>* FaceRecognizer::extract_embedding_from_cropped_box(
     face_result.box[3] = adjusted_face_y + face_h; // Should be face_h
     face_result.keypoint = adjusted_keypoints;
 
-    ESP_LOGD(TAG, "Free heap (INTERNAL) before new HumanFaceFeat (per-run): %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
-    ESP_LOGD(TAG, "Free heap (PSRAM) before new HumanFaceFeat (per-run): %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
-    // Instantiate HumanFaceFeat LOCALLY for each inference. Crashes occured othewise! 
-    HumanFaceFeat* local_feat_model = new HumanFaceFeat();
-    if (local_feat_model == NULL) {
-        ESP_LOGE(TAG, "Failed to create HumanFaceFeat model for inference!");
+    if (init() != ESP_OK) {
+        ESP_LOGE(TAG, "Feature extraction model not available!");
         return NULL;
     }
-    // Mutliple memory printouts remain from when trying to deal with crashes!
-    ESP_LOGD(TAG, "Local HumanFaceFeat model created.");
-    ESP_LOGD(TAG, "Free heap (INTERNAL) after new HumanFaceFeat (per-run): %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
-    ESP_LOGD(TAG, "Free heap (PSRAM) after new HumanFaceFeat (per-run): %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
-    ESP_LOGD(TAG, "Calling local_feat_model->run() for embedding extraction...");
-    // Use inference via the locally allocated model
-    dl::TensorBase* feat_tensor = local_feat_model->run(image_dl, face_result.keypoint);
+    ESP_LOGD(TAG, "Calling m_feat_model->run() for embedding extraction...");
+    dl::TensorBase* feat_tensor = m_feat_model->run(image_dl, face_result.keypoint);
 
 
     if (feat_tensor != NULL && feat_tensor->get_size() > 0) {
@@ -136,18 +352,14 @@ std::vector<float>* FaceRecognizer::extract_embedding_from_cropped_box(
             if (has_inf) { ESP_LOGE(TAG, "Tensor with Inf values! Did a crash happen?"); }
         }
     }
-    ESP_LOGD(TAG, "Free heap (INTERNAL) after local_feat_model->run(): %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
-    ESP_LOGD(TAG, "Free heap (PSRAM) after local_feat_model->run(): %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
     if (feat_tensor == NULL) {
-        ESP_LOGE(TAG, "NULL returned from local_feat_model->run().");
-        delete local_feat_model; // local model is deleted on failure
+        ESP_LOGE(TAG, "NULL returned from m_feat_model->run().");
         return NULL;
     }
 
     std::vector<float>* embedding = new std::vector<float>(feat_tensor->get_size());
     if (!embedding) {
         ESP_LOGE(TAG, "Failed to allocate embedding vector memory (size %zu).", feat_tensor->get_size());
-        delete local_feat_model; // local model is deleted only on failure
         return NULL;
     }
 
@@ -155,7 +367,6 @@ std::vector<float>* FaceRecognizer::extract_embedding_from_cropped_box(
     if (raw_data == NULL) {
         ESP_LOGE(TAG, "Failed to get raw float pointer from feature tensor.");
         delete embedding;
-        delete local_feat_model; // Local model is deleted ONLY on failure
         return NULL;
     }
 
@@ -175,16 +386,81 @@ std::vector<float>* FaceRecognizer::extract_embedding_from_cropped_box(
         ESP_LOGD(TAG, "Embedding L2 normalized (manually). Original norm: %.4f", norm);
     }
 
-    ESP_LOGD(TAG, "feat_tensor (implicitly) handled by local_feat_model's destructor.");
-    // Delete the local HumanFaceFeat model after use
-    delete local_feat_model;
-    ESP_LOGD(TAG, "Local HumanFaceFeat model deleted after inference.");
-    ESP_LOGD(TAG, "Free heap (INTERNAL) after deleting local HumanFaceFeat: %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
-    ESP_LOGD(TAG, "Free heap (PSRAM) after deleting local HumanFaceFeat: %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
     ESP_LOGD(TAG, "Embedding extracted successfully (size: %zu).", embedding->size());
     return embedding;
 }
 
+/**
+ * @brief Extracts the embeddings of a burst of face crops (several clients, or several faces of one frame).
+ * Two or more crops go through the two-stage feature model pipeline: stage 1 of
+ * face k+1 runs here while stage 2 of face k runs on the other core. One crop,
+ * or no pipeline (not enough memory for its second arena), runs them one by one.
+ * @param crops Faces, keypoints relative to each crop.
+ * @return One embedding per crop, in order. An empty one for an invalid crop.
+ */
+std::vector<std::vector<float>> FaceRecognizer::extract_embeddings(const std::vector<face_crop_t>& crops) {
+    std::vector<std::vector<float>> embeddings(crops.size());
+    if (init() != ESP_OK) {
+        ESP_LOGE(TAG, "Feature extraction model not available!");
+        return embeddings;
+    }
+
+    std::vector<int> valid; // crops index of each pipelined face
+    std::vector<dl::image::img_t> images;
+    std::vector<std::vector<int>> keypoints;
+    for (size_t i = 0; i < crops.size(); i++) {
+        const face_crop_t& crop = crops[i];
+        bool tile = crop.width == FACE_ALIGN_SIZE && crop.height == FACE_ALIGN_SIZE;
+        if (!crop.image_buffer || crop.width <= 0 || crop.height <= 0 ||
+            (crop.aligned ? !tile : crop.keypoints.size() != 10)) {
+            ESP_LOGE(TAG, "Invalid crop %zu in the batch (%dx%d, %zu keypoints%s).",
+                     i, crop.width, crop.height, crop.keypoints.size(), crop.aligned ? ", aligned" : "");
+            continue;
+        }
+        valid.push_back(i);
+        images.push_back({ crop.image_buffer, (uint16_t)crop.width, (uint16_t)crop.height,
+                           dl::image::DL_IMAGE_PIX_TYPE_RGB565 });
+        keypoints.push_back(crop.aligned ? std::vector<int>() : crop.keypoints); // none: no warp
+    }
+
+    esp_err_t ret = ESP_ERR_INVALID_SIZE;
+    if (valid.size() > 1) {
+        int64_t start_us = esp_timer_get_time();
+        uint32_t frame_ids[INFERENCE_BATCH_MAX];
+        int traced = std::min((int)valid.size(), INFERENCE_BATCH_MAX);
+        for (int k = 0; k < traced; k++) {
+            frame_ids[k] = crops[valid[k]].frame_id;
+        }
+        perf_trace_set_inputs(frame_ids, traced);
+        // Runs in the stage 2 task: the feature tensor is reused by the next face, copy it
+        ret = m_feat_model->run_pipelined(images, keypoints, [&](int index, dl::TensorBase* feat) {
+            float* data = feat->get_element_ptr<float>();
+            embeddings[valid[index]].assign(data, data + feat->get_size());
+        });
+        if (ret == ESP_OK) {
+            ESP_LOGD(TAG, "%zu embeddings extracted in %lld us (pipelined).",
+                     valid.size(), esp_timer_get_time() - start_us);
+        } else {
+            ESP_LOGW(TAG, "Feature pipeline unavailable (%s), extracting one by one.", esp_err_to_name(ret));
+        }
+    }
+    if (ret != ESP_OK) {
+        for (int i : valid) {
+            const face_crop_t& crop = crops[i];
+            perf_trace_set_inputs(&crop.frame_id, 1);
+            std::vector<float>* embedding = extract_embedding_from_cropped_box(
+                crop.image_buffer, crop.width, crop.height, 0, 0, crop.width, crop.height,
+                crop.aligned ? std::vector<int>() : crop.keypoints);
+            if (embedding) {
+                embeddings[i].swap(*embedding);
+                delete embedding;
+            }
+        }
+    }
+    perf_trace_set_inputs(NULL, 0); // other inferences (enrollment) are frame 0
+    return embeddings;
+}
+
 /**
  * @brief Placeholder for face recognition utilizing an embedding.
  * @param embedding The face embedding to recognize.
@@ -197,8 +473,8 @@ int FaceRecognizer::recognize_face_from_embedding(const std::vector<float>& embe
 
 /**
  * @brief Compares two face embeddings using cosine similarity.
- * @param embedding1 First embedding.
- * @param embedding2 Second embedding.
+ * @param embedding1 First embedding (L2 normalized).
+ * @param embedding2 Second embedding (L2 normalized).
  * @return Cosine similarity score in (0.0, 1.0].
  */
 float FaceRecognizer::compare_embeddings(
@@ -208,22 +484,411 @@ float FaceRecognizer::compare_embeddings(
         ESP_LOGE(TAG, "Invalid embeddings for comparison (empty or size mismatch).");
         return 0.0f;
     }
-    ESP_LOGD(TAG, "Comparing embeddings using cosine similarity.");
-    float dot_product = 0.0f;
-    float norm_a = 0.0f;
-    float norm_b = 0.0f;
+    // Embeddings from the feature model are L2 normalized (FeatPostprocessor),
+    // so the dot product is the cosine similarity: no norms to compute.
+    float similarity = embedding_dot_f32(embedding1.data(), embedding2.data(), embedding1.size());
+    ESP_LOGD(TAG, "Embeddings compared. Cosine similarity: %f", similarity);
+    return similarity; // this will be compared with the similarity threshold in config.h
+}
+
+/**
+ * @brief Soak test of the persistent feature extractor.
+ * Runs repeated inferences on a synthetic 112x112 face and compares the
+ * free heap (INTERNAL and PSRAM) after a warm-up run with the free heap
+ * at the end. Any drift above FEAT_SOAK_HEAP_TOLERANCE_BYTES fails the test.
+ * @param iterations Number of inferences to run.
+ * @return ESP_OK if the heap did not grow, ESP_FAIL otherwise.
+ */
+esp_err_t FaceRecognizer::soak_test(int iterations) {
+    const int img_w = TEST_FACE_SIZE;
+    const int img_h = TEST_FACE_SIZE;
+    const std::vector<int>& keypoints = TEST_FACE_KEYPOINTS;
+
+    if (iterations <= 0) {
+        return ESP_OK;
+    }
+    if (init() != ESP_OK) {
+        return ESP_FAIL;
+    }
 
-    for (size_t i = 0; i < embedding1.size(); ++i) {
-        dot_product += embedding1[i] * embedding2[i];
-        norm_a += embedding1[i] * embedding1[i];
-        norm_b += embedding2[i] * embedding2[i];
+    uint16_t* img = alloc_test_face();
+    if (!img) {
+        ESP_LOGE(TAG, "Soak test: failed to allocate test image.");
+        return ESP_ERR_NO_MEM;
     }
 
-    if (norm_a == 0.0f || norm_b == 0.0f) {
-        return 0.0f; // division by zero
+    // Warm-up: lazy allocations of the first run are not a leak
+    std::vector<float>* embedding = extract_embedding_from_cropped_box(
+        (uint8_t*)img, img_w, img_h, 0, 0, img_w, img_h, keypoints);
+    delete embedding;
+
+    size_t start_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    size_t start_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    size_t low_internal = start_internal;
+    size_t low_psram = start_psram;
+    int failures = 0;
+    int64_t start_us = esp_timer_get_time();
+
+    for (int i = 0; i < iterations; i++) {
+        embedding = extract_embedding_from_cropped_box(
+            (uint8_t*)img, img_w, img_h, 0, 0, img_w, img_h, keypoints);
+        if (!embedding) {
+            failures++;
+        }
+        delete embedding;
+
+        low_internal = std::min(low_internal, heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        low_psram = std::min(low_psram, heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+        if ((i + 1) % 500 == 0) {
+            ESP_LOGI(TAG, "Soak test: %d/%d, free INTERNAL: %zu, PSRAM: %zu", i + 1, iterations,
+                     heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+                     heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+            vTaskDelay(1); // keep the idle task (and its watchdog) alive
+        }
     }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    heap_caps_free(img);
 
-    float similarity = dot_product / (std::sqrt(norm_a) * std::sqrt(norm_b));
-    ESP_LOGD(TAG, "Embeddings compared. Cosine similarity: %f", similarity);
-    return similarity; // this will be compared with the similarity threshold in config.h
-}
\ No newline at end of file
+    size_t end_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    size_t end_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    long drift_internal = (long)start_internal - (long)end_internal;
+    long drift_psram = (long)start_psram - (long)end_psram;
+
+    ESP_LOGI(TAG, "Soak test: %d inferences, %lld us avg, %d failures.",
+             iterations, elapsed_us / iterations, failures);
+    ESP_LOGI(TAG, "Soak test: INTERNAL drift %ld (low watermark %zu), PSRAM drift %ld (low watermark %zu).",
+             drift_internal, low_internal, drift_psram, low_psram);
+
+    if (failures > 0 || drift_internal > FEAT_SOAK_HEAP_TOLERANCE_BYTES || drift_psram > FEAT_SOAK_HEAP_TOLERANCE_BYTES) {
+        ESP_LOGE(TAG, "Soak test FAILED!");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Soak test passed.");
+    return ESP_OK;
+}
+
+/**
+ * @brief Self test of the fixed-point preprocess kernels of esp-dl.
+ * Aligns a random RGB565 crop to a 112x112 int8 input (a similarity
+ * transform like the feat preprocessor) and downscales it with resize,
+ * once with the fixed-point kernels and once with the float per-pixel
+ * reference loops. NEAREST must match up to rounding ties, BILINEAR
+ * within one quantization level. Logs the average time of both.
+ * @param iterations Runs of each kernel for the timing.
+ * @return ESP_OK if the outputs match, ESP_FAIL otherwise.
+ */
+esp_err_t FaceRecognizer::preprocess_self_test(int iterations) {
+    const int src_w = 160;
+    const int src_h = 120;
+    const int dst_size = TEST_FACE_SIZE;
+    const size_t dst_bytes = dst_size * dst_size * 3;
+    const int max_tie_bytes = dst_bytes / 1000;
+
+    if (iterations <= 0) {
+        return ESP_OK;
+    }
+    uint16_t* src = (uint16_t*)heap_caps_malloc(src_w * src_h * sizeof(uint16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    int8_t* ref = (int8_t*)heap_caps_malloc(dst_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    int8_t* out = (int8_t*)heap_caps_malloc(dst_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    int8_t* lut = (int8_t*)heap_caps_malloc(3 * 256, MALLOC_CAP_8BIT);
+    if (!src || !ref || !out || !lut) {
+        ESP_LOGE(TAG, "Preprocess self test: out of memory.");
+        heap_caps_free(src);
+        heap_caps_free(ref);
+        heap_caps_free(out);
+        heap_caps_free(lut);
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < src_w * src_h; i++) {
+        src[i] = (uint16_t)esp_random();
+    }
+    // (x - 127.5) / 127.5 with exponent -7, the same for every channel
+    for (int i = 0; i < 3 * 256; i++) {
+        lut[i] = (int8_t)std::max(-128, std::min(127, (int)lroundf(((i & 0xff) - 127.5f) * 128.0f / 127.5f)));
+    }
+
+    // 15 degrees, 1.2x: a tilted face
+    dl::math::Matrix<float> M_inv(2, 3);
+    M_inv.array[0][0] = 1.2f * cosf(0.26f);
+    M_inv.array[0][1] = -1.2f * sinf(0.26f);
+    M_inv.array[0][2] = 35.3f;
+    M_inv.array[1][0] = 1.2f * sinf(0.26f);
+    M_inv.array[1][1] = 1.2f * cosf(0.26f);
+    M_inv.array[1][2] = -12.6f;
+    float scale_x = (float)dst_size / src_w;
+    float scale_y = (float)dst_size / src_h;
+
+    dl::image::img_t src_img = { src, src_w, src_h, dl::image::DL_IMAGE_PIX_TYPE_RGB565 };
+    dl::image::img_t ref_img = { ref, dst_size, dst_size, dl::image::DL_IMAGE_PIX_TYPE_RGB888_QINT8 };
+    dl::image::img_t out_img = { out, dst_size, dst_size, dl::image::DL_IMAGE_PIX_TYPE_RGB888_QINT8 };
+    const dl::image::interpolate_type_t interpolations[] = { dl::image::DL_IMAGE_INTERPOLATE_NEAREST,
+                                                             dl::image::DL_IMAGE_INTERPOLATE_BILINEAR };
+    const uint32_t caps = DL_IMAGE_CAP_RGB565_BIG_ENDIAN;
+
+    esp_err_t ret = ESP_OK;
+    for (int kernel = 0; kernel < 2; kernel++) {
+        for (dl::image::interpolate_type_t interpolation : interpolations) {
+            bool warp = kernel == 0;
+            int64_t ref_us = 0, fixed_us = 0;
+            for (int i = 0; i < iterations; i++) {
+                int64_t start_us = esp_timer_get_time();
+                if (warp) {
+                    dl::image::warp_affine_loop<int8_t>(src_img, ref_img, interpolation, &M_inv, caps, lut);
+                } else {
+                    dl::image::resize_loop<int8_t>(src_img, ref_img, interpolation, caps, lut, {}, scale_x, scale_y);
+                }
+                int64_t mid_us = esp_timer_get_time();
+                if (warp) {
+                    dl::image::warp_affine_fixed(src_img, out_img, interpolation, &M_inv, caps, lut);
+                } else {
+                    dl::image::resize_fixed(src_img, out_img, interpolation, caps, lut, {}, scale_x, scale_y);
+                }
+                ref_us += mid_us - start_us;
+                fixed_us += esp_timer_get_time() - mid_us;
+                if ((i + 1) % 50 == 0) {
+                    vTaskDelay(1); // keep the idle task (and its watchdog) alive
+                }
+            }
+
+            int mismatches = 0, max_diff = 0;
+            for (size_t i = 0; i < dst_bytes; i++) {
+                int diff = std::abs(ref[i] - out[i]);
+                if (diff) {
+                    mismatches++;
+                    max_diff = std::max(max_diff, diff);
+                }
+            }
+            bool nearest = interpolation == dl::image::DL_IMAGE_INTERPOLATE_NEAREST;
+            bool ok = nearest ? mismatches <= max_tie_bytes : max_diff <= 1;
+            ESP_LOGI(TAG, "Preprocess: %-11s %-8s %6lld us -> %6lld us (x%.2f), %d bytes differ (max %d)",
+                     warp ? "warp_affine" : "resize", nearest ? "nearest" : "bilinear",
+                     ref_us / iterations, fixed_us / iterations,
+                     fixed_us > 0 ? (float)ref_us / fixed_us : 0.0f, mismatches, max_diff);
+            if (!ok) {
+                ret = ESP_FAIL;
+            }
+        }
+    }
+
+    heap_caps_free(src);
+    heap_caps_free(ref);
+    heap_caps_free(out);
+    heap_caps_free(lut);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Preprocess self test FAILED!");
+    } else {
+        ESP_LOGI(TAG, "Preprocess self test passed.");
+    }
+    return ret;
+}
+
+/**
+ * @brief Self test of the alignment done on the CAM (face_align.h, FRAME_FLAG_ALIGNED).
+ * The synthetic face is drawn into a QVGA frame at a random pose (scale,
+ * roll, position) with the template keypoints moved along. Its embedding is
+ * extracted twice: from the frame through the esp-dl warp (what a margin
+ * crop gets here), and from the 112x112 tile aligned by face_align.h and
+ * converted without warp. Logs both latencies and the alignment cost.
+ * @param faces Poses to test.
+ * @return ESP_OK if every pair reaches FACE_ALIGN_MIN_COSINE, ESP_FAIL otherwise.
+ */
+esp_err_t FaceRecognizer::align_self_test(int faces) {
+    const int src_w = 320;
+    const int src_h = 240;
+
+    if (faces <= 0) {
+        return ESP_OK;
+    }
+    if (init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    uint16_t* face = alloc_test_face();
+    uint16_t* src = (uint16_t*)heap_caps_malloc(src_w * src_h * sizeof(uint16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint16_t* tile = (uint16_t*)heap_caps_malloc(FACE_ALIGN_SIZE * FACE_ALIGN_SIZE * sizeof(uint16_t),
+                                                 MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!face || !src || !tile) {
+        ESP_LOGE(TAG, "Align self test: out of memory.");
+        heap_caps_free(face);
+        heap_caps_free(src);
+        heap_caps_free(tile);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = ESP_OK;
+    int64_t warp_us = 0, tile_us = 0, align_us = 0;
+    float min_similarity = 1.0f;
+    for (int n = 0; n < faces; n++) {
+        // Test face to frame: scale 1-2 (a 112-224 px face), +-15 degrees, around the center
+        float scale = 1.0f + (esp_random() % 1000) / 1000.0f;
+        float roll = ((int)(esp_random() % 1000) - 500) / 1000.0f * 0.52f;
+        float c = scale * cosf(roll), s = scale * sinf(roll);
+        float cx = src_w / 2 + (int)(esp_random() % 41) - 20;
+        float cy = src_h / 2 + (int)(esp_random() % 41) - 20;
+        float tx = cx - (c * 56.0f - s * 56.0f);
+        float ty = cy - (s * 56.0f + c * 56.0f);
+        for (int y = 0; y < src_h; y++) {
+            for (int x = 0; x < src_w; x++) {
+                // Inverse mapping, nearest: frame pixel -> test face pixel, background outside
+                float dx = x - tx, dy = y - ty;
+                int u = (int)lroundf((c * dx + s * dy) / (scale * scale));
+                int v = (int)lroundf((c * dy - s * dx) / (scale * scale));
+                bool inside = u >= 0 && u < TEST_FACE_SIZE && v >= 0 && v < TEST_FACE_SIZE;
+                src[y * src_w + x] = inside ? face[v * TEST_FACE_SIZE + u]
+                                            : (uint16_t)(((x >> 4) << 11) | ((y >> 3) << 5) | 16);
+            }
+        }
+        std::vector<int> keypoints(2 * FACE_ALIGN_POINTS);
+        for (int i = 0; i < FACE_ALIGN_POINTS; i++) {
+            float u = FACE_ALIGN_TEMPLATE[2 * i], v = FACE_ALIGN_TEMPLATE[2 * i + 1];
+            keypoints[2 * i] = (int)lroundf(c * u - s * v + tx);
+            keypoints[2 * i + 1] = (int)lroundf(s * u + c * v + ty);
+        }
+
+        int64_t start_us = esp_timer_get_time();
+        std::vector<float>* warped = extract_embedding_from_cropped_box(
+            (uint8_t*)src, src_w, src_h, 0, 0, src_w, src_h, keypoints);
+        int64_t mid_us = esp_timer_get_time();
+        float m[6];
+        bool estimated = face_align_estimate(keypoints.data(), m);
+        if (estimated) {
+            face_align_warp(src, src_w, src_h, m, tile);
+        }
+        int64_t aligned_us = esp_timer_get_time();
+        std::vector<float>* aligned = estimated ? extract_embedding_from_cropped_box(
+            (uint8_t*)tile, FACE_ALIGN_SIZE, FACE_ALIGN_SIZE, 0, 0, FACE_ALIGN_SIZE, FACE_ALIGN_SIZE, {}) : nullptr;
+        int64_t end_us = esp_timer_get_time();
+        warp_us += mid_us - start_us;
+        align_us += aligned_us - mid_us;
+        tile_us += end_us - aligned_us;
+
+        float similarity = (warped && aligned) ? compare_embeddings(*warped, *aligned) : 0.0f;
+        min_similarity = std::min(min_similarity, similarity);
+        ESP_LOGD(TAG, "Align: face %d, x%.2f, %+.1f deg, cosine %.4f", n, scale, roll * 57.3f, similarity);
+        if (similarity < FACE_ALIGN_MIN_COSINE) {
+            ESP_LOGE(TAG, "Align: face %d (x%.2f, %+.1f deg) cosine %.4f < %.2f",
+                     n, scale, roll * 57.3f, similarity, FACE_ALIGN_MIN_COSINE);
+            ret = ESP_FAIL;
+        }
+        delete warped;
+        delete aligned;
+        vTaskDelay(1); // keep the idle task (and its watchdog) alive
+    }
+
+    heap_caps_free(face);
+    heap_caps_free(src);
+    heap_caps_free(tile);
+    ESP_LOGI(TAG, "Align: %d faces, embedding %lld us with the warp, %lld us from the aligned tile "
+             "(aligned in %lld us), lowest cosine %.4f.",
+             faces, warp_us / faces, tile_us / faces, align_us / faces, min_similarity);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Align self test FAILED!");
+    } else {
+        ESP_LOGI(TAG, "Align self test passed.");
+    }
+    return ret;
+}
+
+/**
+ * @brief Benchmark of the feature extractor in each esp-dl runtime mode.
+ * Same synthetic face as the soak test. Logs the average latency of
+ * single core, dual core with per-layer task creation (former esp-dl
+ * dispatch), dual core on the persistent worker pool and the per-layer
+ * runtime plan (AUTO), then bursts of faces through the two-stage
+ * pipeline, and checks that their embeddings match the single core one.
+ * The model is left in its configured mode, with the worker pool enabled.
+ * @param iterations Inferences per mode.
+ * @return ESP_OK, or an error if an inference failed.
+ */
+esp_err_t FaceRecognizer::benchmark_runtime_modes(int iterations) {
+    struct bench_mode_t {
+        const char* name;
+        dl::runtime_mode_t mode;
+        bool worker_pool;
+    };
+    const bench_mode_t modes[] = {
+        { "single core", dl::RUNTIME_MODE_SINGLE_CORE, true },
+        { "dual core, task per layer", dl::RUNTIME_MODE_MULTI_CORE, false },
+        { "dual core, worker pool", dl::RUNTIME_MODE_MULTI_CORE, true },
+        { "auto, runtime plan", dl::RUNTIME_MODE_AUTO, true },
+    };
+
+    if (iterations <= 0) {
+        return ESP_OK;
+    }
+    if (init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    uint16_t* img = alloc_test_face();
+    if (!img) {
+        ESP_LOGE(TAG, "Benchmark: failed to allocate test image.");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = ESP_OK;
+    std::vector<float> reference;
+    int64_t single_core_us = 0;
+    for (const bench_mode_t& m : modes) {
+        dl::module::module_worker_pool_enable(m.worker_pool);
+        m_feat_model->set_runtime_mode(m.mode);
+
+        // Warm-up: first run of a mode creates the pool workers
+        std::vector<float>* embedding = extract_embedding_from_cropped_box(
+            (uint8_t*)img, TEST_FACE_SIZE, TEST_FACE_SIZE, 0, 0, TEST_FACE_SIZE, TEST_FACE_SIZE, TEST_FACE_KEYPOINTS);
+        if (!embedding) {
+            ret = ESP_FAIL;
+            break;
+        }
+        float similarity = reference.empty() ? 1.0f : compare_embeddings(reference, *embedding);
+        if (reference.empty()) {
+            reference = *embedding;
+        }
+        delete embedding;
+
+        int64_t start_us = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++) {
+            embedding = extract_embedding_from_cropped_box(
+                (uint8_t*)img, TEST_FACE_SIZE, TEST_FACE_SIZE, 0, 0, TEST_FACE_SIZE, TEST_FACE_SIZE, TEST_FACE_KEYPOINTS);
+            delete embedding;
+            if ((i + 1) % 50 == 0) {
+                vTaskDelay(1); // keep the idle task (and its watchdog) alive
+            }
+        }
+        int64_t avg_us = (esp_timer_get_time() - start_us) / iterations;
+        if (m.mode == dl::RUNTIME_MODE_SINGLE_CORE) {
+            single_core_us = avg_us;
+        }
+        ESP_LOGI(TAG, "Benchmark: %-26s %6lld us avg (x%.2f), similarity to single core %.4f",
+                 m.name, avg_us, avg_us > 0 ? (float)single_core_us / avg_us : 0.0f, similarity);
+    }
+
+    dl::module::module_worker_pool_enable(true);
+    m_feat_model->set_runtime_mode(FEAT_RUNTIME_MODE);
+
+    // Bursts through the two-stage pipeline, the first one creates it (stage balancing runs the model once)
+    if (ret == ESP_OK) {
+        dl::image::img_t face = { img, TEST_FACE_SIZE, TEST_FACE_SIZE, dl::image::DL_IMAGE_PIX_TYPE_RGB565 };
+        std::vector<dl::image::img_t> faces(FEAT_BENCHMARK_BURST, face);
+        std::vector<std::vector<int>> landmarks(FEAT_BENCHMARK_BURST, TEST_FACE_KEYPOINTS);
+        float similarity = 1.0f;
+        auto on_feat = [&](int index, dl::TensorBase* feat) {
+            std::vector<float> embedding(feat->get_element_ptr<float>(), feat->get_element_ptr<float>() + feat->get_size());
+            similarity = std::min(similarity, compare_embeddings(reference, embedding));
+        };
+        int bursts = std::max(1, iterations / FEAT_BENCHMARK_BURST);
+        esp_err_t err = m_feat_model->run_pipelined(faces, landmarks, on_feat);
+        int64_t start_us = esp_timer_get_time();
+        for (int i = 0; i < bursts && err == ESP_OK; i++) {
+            err = m_feat_model->run_pipelined(faces, landmarks, on_feat);
+            vTaskDelay(1);
+        }
+        if (err == ESP_OK) {
+            int64_t avg_us = (esp_timer_get_time() - start_us) / (bursts * FEAT_BENCHMARK_BURST);
+            ESP_LOGI(TAG, "Benchmark: pipeline, bursts of %-11d %6lld us avg (x%.2f), similarity to single core %.4f",
+                     FEAT_BENCHMARK_BURST, avg_us, avg_us > 0 ? (float)single_core_us / avg_us : 0.0f, similarity);
+        } else {
+            ESP_LOGW(TAG, "Benchmark: pipeline not available (%s).", esp_err_to_name(err));
+        }
+    }
+    heap_caps_free(img);
+    return ret;
+}
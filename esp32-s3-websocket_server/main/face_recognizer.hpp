@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <vector> // std::vector
+#include "esp_err.h"
 
 // Include full definitions for ESP-DL/ESP-WHO types used in the header. Othewise linker errors occur
 // maybe, it would be better to include libraries in idf_component.yml, never investigated...
@@ -14,17 +15,45 @@ class HumanFaceDetect;
 class HumanFaceFeat;
 class HumanFaceRecognizer;
 
+// One face for extract_embeddings(): RGB565 crop and its 10 keypoints, relative to the crop
+typedef struct {
+    uint8_t* image_buffer;
+    int width;
+    int height;
+    std::vector<int> keypoints;
+    uint32_t frame_id; // latency trace (perf_trace.h), 0: unknown
+    bool aligned;      // FACE_ALIGN_SIZE tile aligned by the CAM (face_align.h): converted only, no warp
+} face_crop_t;
+
 class FaceRecognizer {
 public:
     FaceRecognizer();
     ~FaceRecognizer();
 
-    // extract embedding from a cropped image, adjusted parameters
+    // Load the feature extraction model once (boot time). Safe to call again.
+    esp_err_t init();
+
+    // Repeated inferences on a synthetic face, checking heap watermarks (see config.h)
+    esp_err_t soak_test(int iterations);
+
+    // Fixed-point preprocess kernels (warp_affine, resize) against the float reference, with their latency
+    esp_err_t preprocess_self_test(int iterations);
+
+    // Embeddings of faces aligned with face_align.h (as on the CAM) against the esp-dl warp, with the preprocess latency
+    esp_err_t align_self_test(int faces);
+
+    // Latency of the feature model per runtime mode: single core, dual core per-call tasks, dual core pool, auto, pipelined bursts
+    esp_err_t benchmark_runtime_modes(int iterations);
+
+    // extract embedding from a cropped image, adjusted parameters (no keypoints: an aligned FACE_ALIGN_SIZE tile)
     std::vector<float>* extract_embedding_from_cropped_box(
         uint8_t *image_buffer, int cropped_img_width, int cropped_img_height,
         int adjusted_face_x, int adjusted_face_y, int face_w, int face_h,
         const std::vector<int>& adjusted_keypoints);
 
+    // L2 normalized embeddings of several crops in one burst, pipelined over both cores (empty: that face failed)
+    std::vector<std::vector<float>> extract_embeddings(const std::vector<face_crop_t>& crops);
+
     // Placeholder for face recognition from an embedding
     int recognize_face_from_embedding(const std::vector<float>& embedding);
 
@@ -32,7 +61,13 @@ public:
     float compare_embeddings(const std::vector<float>& embedding1, const std::vector<float>& embedding2);
 
 private:
+    // Per-layer runtime plan of the shared model: from NVS, calibrated if missing (see config.h)
+    esp_err_t load_runtime_plan();
+
+    // Internal RAM placement of the shared model in the model arena: from NVS, profiled if missing (see config.h)
+    esp_err_t load_arena_placement();
+
     HumanFaceDetect* m_detector;       // face detection
-    HumanFaceFeat* m_feat_model;       // feature extraction (embedding generation)
+    HumanFaceFeat* m_feat_model;       // feature extraction (shared, loaded once in init())
     HumanFaceRecognizer* m_recognizer; // recognition/comparison with database
 };
\ No newline at end of file
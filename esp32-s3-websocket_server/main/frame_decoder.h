@@ -0,0 +1,51 @@
+/**
+ * @file frame_decoder.h
+ * @brief Face payload formats received from the CAM, and their decoding.
+ * The recognition pipeline always works on RGB565. A JPEG payload is
+ * decoded (esp_new_jpeg) into one of INFERENCE_BATCH_MAX buffers, reused in turn.
+ */
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FRAME_FORMAT_RGB565 = 0, // raw camera crop (w * h * 2 bytes), default
+    FRAME_FORMAT_JPEG = 1,
+    FRAME_FORMAT_UNKNOWN = -1,
+} frame_format_t;
+
+/**
+ * @brief Maps the "format" field of a frame_start message.
+ * @param name Format name, NULL (field absent) means raw RGB565.
+ * @return The format, FRAME_FORMAT_UNKNOWN if not supported by this build.
+ */
+frame_format_t frame_format_from_string(const char* name);
+
+/**
+ * @brief Decodes a JPEG face crop to RGB565 (same byte order as the camera raw frames).
+ * The output buffer belongs to the decoder and is reused INFERENCE_BATCH_MAX
+ * calls later: call from ONE task only (the inference worker), and use it
+ * before decoding a whole batch again.
+ * @param jpeg JPEG data.
+ * @param jpeg_len JPEG size.
+ * @param width Expected width (from frame_start), checked against the JPEG header.
+ * @param height Expected height.
+ * @param out_rgb565 Decoded image.
+ * @param out_len Decoded image size (width * height * 2).
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE on a dimension mismatch, ESP_ERR_NO_MEM, or ESP_FAIL on bad data.
+ */
+esp_err_t frame_decoder_jpeg_to_rgb565(const uint8_t* jpeg, size_t jpeg_len, int width, int height,
+                                       uint8_t** out_rgb565, size_t* out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_DECODER_H
@@ -0,0 +1,103 @@
+/**
+ * @file frame_pool.c
+ * @brief Frame slots carved out of ONE PSRAM block, tracked by a bitmask.
+ * Acquired in the httpd task, released there or in the inference worker.
+ */
+#include "frame_pool.h"
+#include "config.h"
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "FRAME_POOL";
+
+#if FRAME_POOL_SLOTS > 32
+#error "FRAME_POOL_SLOTS: at most 32 (bitmask)"
+#endif
+#if FRAME_POOL_HEADROOM % 16 != 0 || FRAME_POOL_SLOT_SIZE % 16 != 0
+#error "FRAME_POOL_HEADROOM and FRAME_POOL_SLOT_SIZE: multiples of 16 (aligned payloads)"
+#endif
+
+#define SLOT_STRIDE ((size_t)FRAME_POOL_HEADROOM + FRAME_POOL_SLOT_SIZE)
+
+static uint8_t* s_block = NULL;
+static uint32_t s_free_mask = 0; // bit set: slot free
+static frame_pool_stats_t s_stats = { 0 };
+static portMUX_TYPE s_pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t frame_pool_init(void) {
+    if (s_block) return ESP_OK;
+
+    size_t total = (size_t)FRAME_POOL_SLOTS * SLOT_STRIDE;
+    s_block = (uint8_t*)heap_caps_aligned_alloc(16, total, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!s_block) {
+        ESP_LOGE(TAG, "Failed to allocate %d frame slots (%zu bytes) in PSRAM.", FRAME_POOL_SLOTS, total);
+        return ESP_ERR_NO_MEM;
+    }
+    s_free_mask = (FRAME_POOL_SLOTS == 32) ? 0xFFFFFFFFu : ((1u << FRAME_POOL_SLOTS) - 1);
+    s_stats.slots = FRAME_POOL_SLOTS;
+    ESP_LOGI(TAG, "%d frame slots of %d bytes in PSRAM.", FRAME_POOL_SLOTS, FRAME_POOL_SLOT_SIZE);
+    return ESP_OK;
+}
+
+uint8_t* frame_pool_acquire(size_t size) {
+    if (!s_block) return NULL;
+
+    uint8_t* slot = NULL;
+    taskENTER_CRITICAL(&s_pool_lock);
+    if (size > FRAME_POOL_SLOT_SIZE) {
+        s_stats.oversized++;
+    }
+    else if (s_free_mask == 0) {
+        s_stats.exhausted++;
+    }
+    else {
+        int index = __builtin_ctz(s_free_mask);
+        s_free_mask &= ~(1u << index);
+        slot = s_block + (size_t)index * SLOT_STRIDE + FRAME_POOL_HEADROOM;
+        s_stats.acquired++;
+        s_stats.in_use++;
+        if (s_stats.in_use > s_stats.max_in_use) s_stats.max_in_use = s_stats.in_use;
+    }
+    taskEXIT_CRITICAL(&s_pool_lock);
+
+    if (!slot) {
+        ESP_LOGW(TAG, "No frame slot for %zu bytes (%s).", size,
+                 size > FRAME_POOL_SLOT_SIZE ? "bigger than a slot" : "all slots busy");
+    }
+    return slot;
+}
+
+void frame_pool_release(uint8_t* buffer) {
+    if (!buffer) return;
+
+    size_t offset = (size_t)(buffer - s_block) - FRAME_POOL_HEADROOM;
+    if (!s_block || buffer < s_block + FRAME_POOL_HEADROOM || offset % SLOT_STRIDE != 0 ||
+        offset / SLOT_STRIDE >= FRAME_POOL_SLOTS) {
+        ESP_LOGE(TAG, "Release of %p: not a frame slot!", buffer);
+        return;
+    }
+    uint32_t bit = 1u << (offset / SLOT_STRIDE);
+    taskENTER_CRITICAL(&s_pool_lock);
+    if (s_free_mask & bit) {
+        taskEXIT_CRITICAL(&s_pool_lock);
+        ESP_LOGE(TAG, "Double release of slot %u!", (unsigned)(offset / SLOT_STRIDE));
+        return;
+    }
+    s_free_mask |= bit;
+    s_stats.in_use--;
+    taskEXIT_CRITICAL(&s_pool_lock);
+}
+
+size_t frame_pool_slot_size(void) {
+    return FRAME_POOL_SLOT_SIZE;
+}
+
+void frame_pool_get_stats(frame_pool_stats_t* out_stats) {
+    if (!out_stats) return;
+    taskENTER_CRITICAL(&s_pool_lock);
+    *out_stats = s_stats;
+    taskEXIT_CRITICAL(&s_pool_lock);
+}
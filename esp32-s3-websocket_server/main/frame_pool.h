@@ -0,0 +1,62 @@
+/**
+ * @file frame_pool.h
+ * @brief Fixed pool of PSRAM frame slots for the incoming faces.
+ * A slot is taken when a frame starts, travels with the frame through the
+ * inference queue and recognition, and is released by whoever ends the
+ * frame's life (worker, eviction, or a reset of the receive state).
+ * No malloc/free per frame: the heap does not fragment over days of uptime.
+ *
+ * Each slot has FRAME_POOL_HEADROOM bytes in front of the returned pointer.
+ * esp_http_server reads a WebSocket message only as a whole, so the receiver
+ * reads [header][payload] at (slot - header size): the header lands in the
+ * headroom (or on bytes it saves/restores) and the payload lands in place.
+ */
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t slots;
+    uint32_t in_use;
+    uint32_t max_in_use; // high watermark
+    uint32_t acquired;
+    uint32_t exhausted;  // acquire failed, all slots busy
+    uint32_t oversized;  // acquire failed, frame bigger than a slot
+} frame_pool_stats_t;
+
+/**
+ * @brief Allocates FRAME_POOL_SLOTS slots of FRAME_POOL_SLOT_SIZE bytes, once.
+ * @return ESP_OK, or ESP_ERR_NO_MEM.
+ */
+esp_err_t frame_pool_init(void);
+
+/**
+ * @brief Takes a free slot. Never blocks.
+ * @param size Bytes needed.
+ * @return 16-byte aligned slot (FRAME_POOL_HEADROOM writable bytes before it),
+ *         NULL if size > slot size or none is free.
+ */
+uint8_t* frame_pool_acquire(size_t size);
+
+/**
+ * @brief Gives a slot back. NULL is ignored.
+ * @param buffer Pointer returned by frame_pool_acquire().
+ */
+void frame_pool_release(uint8_t* buffer);
+
+size_t frame_pool_slot_size(void);
+
+void frame_pool_get_stats(frame_pool_stats_t* out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_POOL_H
@@ -14,11 +14,11 @@
 #include <cstring>
 #include "esp_heap_caps.h" 
 #include "esp_timer.h"
-#include "s3_uploader.h"
-#include "mqtt.h"
+#include "upload_queue.h"
 #include "cJSON.h"
 #include "config.h" // Includes secret.h
 #include "websocket_server.h"
+#include "perf_trace.h"
 
 #if ENABLE_ENROLLMENT 
 #include "face_enroller.h" // For enroll_new_face function
@@ -50,50 +50,54 @@ esp_err_t image_processor_init(void) {
     }
 #endif
 
+    // Load the feature extraction model once. Reused for every incoming face.
+    if (s_face_recognizer.init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to load the feature extraction model!");
+        return ESP_FAIL;
+    }
+#if FEAT_SOAK_TEST_ITERATIONS > 0
+    if (s_face_recognizer.soak_test(FEAT_SOAK_TEST_ITERATIONS) != ESP_OK) {
+        ESP_LOGE(TAG, "Feature extractor soak test failed. Heap is not stable!");
+    }
+#endif
+#if PREPROCESS_SELF_TEST_ITERATIONS > 0
+    if (s_face_recognizer.preprocess_self_test(PREPROCESS_SELF_TEST_ITERATIONS) != ESP_OK) {
+        ESP_LOGE(TAG, "Preprocess self test failed!");
+    }
+#endif
+#if FACE_ALIGN_SELF_TEST_FACES > 0
+    if (s_face_recognizer.align_self_test(FACE_ALIGN_SELF_TEST_FACES) != ESP_OK) {
+        ESP_LOGE(TAG, "Alignment self test failed!");
+    }
+#endif
+#if FEAT_BENCHMARK_ITERATIONS > 0
+    s_face_recognizer.benchmark_runtime_modes(FEAT_BENCHMARK_ITERATIONS);
+#endif
+#if EMBEDDING_SEARCH_SELF_TEST
+    if (embedding_search_self_test(EMBEDDING_SEARCH_TEST_FACES, EMBEDDING_SEARCH_TEST_DIM,
+                                   EMBEDDING_SEARCH_TEST_TOP_K) != ESP_OK) {
+        ESP_LOGE(TAG, "Embedding search self test failed!");
+    }
+#endif
+#if EMBEDDING_CASCADE_BENCHMARK
+    if (embedding_cascade_benchmark(EMBEDDING_CASCADE_BENCH_FACES, EMBEDDING_SEARCH_TEST_DIM,
+                                    EMBEDDING_CASCADE_COARSE_DIM, EMBEDDING_CASCADE_CANDIDATES) != ESP_OK) {
+        ESP_LOGE(TAG, "Cascaded search benchmark failed!");
+    }
+#endif
+
     ESP_LOGD(TAG, "Opening face metadata database for initial load.");
-    // Load the face metadata database. Reads records from SPIFFS.
+    // Load the face database ONCE: metadata and all embeddings stay resident in RAM.
     if (database_init() != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize database!");
         return ESP_FAIL; // Return failure if database init fails
     }
-    ESP_LOGD(TAG, "Face metadata database opened successfully for initial load.");
-    // De-initialize database after initial setup. It will be re-initialized in handle_new_image if needed.
-    database_deinit();
-    ESP_LOGD(TAG, "Image processor init complete. Database deinitialized after startup load.");
+    ESP_LOGD(TAG, "Image processor init complete. Database resident in memory.");
     return ESP_OK;
 }
 
-/**
- * @brief Workes upon an incoming (face detected) image for face recognition.
- *
- * Receives a cropped image buffer and metadata (face bounding box, keypoints) from
- * the client. It adjusts the coordinates for the esp-who AI model and
- * extracts an embedding. The cropped image has some buffer-zone around it (20px).
- *
- * @param image_buffer Pointer to the received image data (RGB565 format, already cropped).
- * @param image_len Length of the image_buffer in Bytes.
- * @param cropped_img_width Width of the cropped face image_buffer
- * @param cropped_img_height Height of the cropped face image_buffer
- * @param original_face_x X-coordinate of the bounding box relative to the *original full camera frame*.
- * @param original_face_y Y-coordinate of the bounding box relative to the *original full camera frame*.
- * @param face_w Width of the face bounding box (same as cropped_img_width).
- * @param face_h Height of the face bounding box (same as cropped_img_height).
- * @param keypoints A vector of integers for facial keypoints, relative to the *original full camera frame*.
- * @return ESP_OK if processing is successful, error code otherwise.
- */
-esp_err_t image_processor_handle_new_image(
-    uint8_t* image_buffer, size_t image_len, int cropped_img_width, int cropped_img_height,
-    int original_face_x, int original_face_y, int face_w, int face_h,
-    const std::vector<int>& keypoints) {
-
-    // Log the initial received data for verification
-    ESP_LOGD(TAG, "New image Buffer Address: %p", image_buffer);
-    ESP_LOGD(TAG, "  Buffer Length (bytes): %zu", image_len);
-    ESP_LOGD(TAG, "  Cropped Image Width x Height: %d x %d", cropped_img_width, cropped_img_height);
-    ESP_LOGD(TAG, "  Original Face Box (relative to full frame) - X:%d, Y:%d, W:%d, H:%d",
-        original_face_x, original_face_y, face_w, face_h);
-    ESP_LOGD(TAG, "  Keypoints received (count: %zu):", keypoints.size());
-
+// Keypoints as "[x,y,...]" for the debug logs
+static void log_keypoints(const char* label, const std::vector<int>& keypoints) {
     char kp_buf[200]; // Buffer for keypoints string
     int offset = snprintf(kp_buf, sizeof(kp_buf) - 1, "[");
     for (size_t i = 0; i < keypoints.size(); ++i) {
@@ -102,117 +106,53 @@ esp_err_t image_processor_handle_new_image(
             offset += snprintf(kp_buf + offset, sizeof(kp_buf) - offset - 1, ",");
         }
     }
-
     snprintf(kp_buf + offset, sizeof(kp_buf) - offset, "]");
+    ESP_LOGD(TAG, "%s (count: %zu):", label, keypoints.size());
     ESP_LOGD(TAG, "    %s", kp_buf);
-    ESP_LOGD(TAG, " ---- End Received Data Log for Incoming Image ---");
-    ESP_LOGD(TAG, "Starting AI model feature extraction for incoming image.");
-
-    // Adjust face box and keypoints to the cropped image, not to the original frame.
-    int adjusted_face_x = 0;
-    int adjusted_face_y = 0;
-
-    std::vector<int> adjusted_keypoints = keypoints;
-    for (size_t i = 0; i < adjusted_keypoints.size(); i += 2) {
-        adjusted_keypoints[i] -= original_face_x;
-        adjusted_keypoints[i + 1] -= original_face_y;
-    }
-    ESP_LOGD(TAG, "Adjusted Face Box for FaceRecognizer: X:%d, Y:%d, W:%d, H:%d",
-        adjusted_face_x, adjusted_face_y, face_w, face_h);
-    ESP_LOGD(TAG, "Adjusted Keypoints (count: %zu):", adjusted_keypoints.size());
-
-    offset = snprintf(kp_buf, sizeof(kp_buf) - 1, "[");
-    for (size_t i = 0; i < adjusted_keypoints.size(); ++i) {
-        offset += snprintf(kp_buf + offset, sizeof(kp_buf) - offset - 1, "%d", adjusted_keypoints[i]);
-        if (i < keypoints.size() - 1) {
-            offset += snprintf(kp_buf + offset, sizeof(kp_buf) - offset - 1, ",");
-        }
-    }
-    snprintf(kp_buf + offset, sizeof(kp_buf) - offset, "]");
-    ESP_LOGD(TAG, "    %s", kp_buf);
-
-    // Use the global/static s_face_recognizer instance to extract the embedding.
-    std::vector<float>* incoming_embedding = s_face_recognizer.extract_embedding_from_cropped_box(
-        image_buffer, cropped_img_width, cropped_img_height,
-        adjusted_face_x, adjusted_face_y, face_w, face_h,
-        adjusted_keypoints
-    );
+}
 
-    if (!incoming_embedding) {
-        ESP_LOGE(TAG, "Incoming image features extraction error...");
-        return ESP_FAIL;
-    }
-    ESP_LOGD(TAG, "Successfully extracted embedding from incoming image (size: %zu).", incoming_embedding->size());
+/**
+ * @brief Database match, result broadcast, S3 upload and enrollment of one face.
+ * @param face The received face.
+ * @param adjusted_keypoints Keypoints relative to the cropped image.
+ * @param incoming_embedding Its L2 normalized embedding.
+ */
+static void handle_face_embedding(const image_processor_face_t& face, const std::vector<int>& adjusted_keypoints,
+                                  const std::vector<float>& incoming_embedding) {
+    ESP_LOGD(TAG, "Successfully extracted embedding from incoming image (size: %zu).", incoming_embedding.size());
 
-    // Database Comparison Loop
+    // Database Comparison: single pass over the resident embedding index, no SPIFFS I/O
     face_record_t* db_faces_ptr = NULL;
     int db_face_count = 0;
     int recognized_id = -1;
     const char* recognized_name = "Unknown";
     float max_similarity = 0.0f;
     ESP_LOGD(TAG, "Starting DB comparison for incoming image.");
-
-    // Re-initialize the fresh database
-    if (database_init() != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to re-initialize database.");
-        delete incoming_embedding;
-        return ESP_FAIL;
-    }
-    ESP_LOGD(TAG, "Database re-initialized for comparison loop.");
+    int64_t search_start = esp_timer_get_time();
 
     if (database_get_all_faces(&db_faces_ptr, &db_face_count) == ESP_OK) {
         if (db_face_count == 0) {
             ESP_LOGW(TAG, "Empty dB!");
         }
         else {
-            for (int i = 0; i < db_face_count; i++) {
-                const face_record_t* current_face = &db_faces_ptr[i];
-                ESP_LOGD(TAG, "--- Comparing with dB face #%d (ID: %d, Name: %s) from file: %s ---",
-                    i, current_face->id, current_face->name, current_face->embedding_file);
-
-                char* stored_embedding_bytes_raw = NULL;
-                size_t stored_embedding_len = 0;
-
-                esp_err_t read_err = storage_read_file(current_face->embedding_file, &stored_embedding_bytes_raw, &stored_embedding_len);
-
-                if (read_err == ESP_OK && stored_embedding_bytes_raw != NULL) {
-                    ESP_LOGD(TAG, "Stored embedding for %s, size: %zu bytes.", current_face->name, stored_embedding_len);
-                    size_t expected_embedding_dim = incoming_embedding->size();
-
-                    if (stored_embedding_len != (expected_embedding_dim * sizeof(float))) {
-                        ESP_LOGE(TAG, "Embedding file %s has unexpected size (actual: %zu bytes, expected: %zu bytes). Skipping comparison.",
-                            current_face->embedding_file, stored_embedding_len, expected_embedding_dim * sizeof(float));
-                        free(stored_embedding_bytes_raw);
-                        continue;
-                    }
-
-                    std::vector<float> stored_embedding(expected_embedding_dim);
-                    memcpy(stored_embedding.data(), stored_embedding_bytes_raw, expected_embedding_dim * sizeof(float));
-                    free(stored_embedding_bytes_raw);
-
-                    float similarity = s_face_recognizer.compare_embeddings(*incoming_embedding, stored_embedding);
-                    ESP_LOGD(TAG, "Cosine similarity with %s (ID %d): %f", current_face->name, current_face->id, similarity);
-
-                    if (similarity > max_similarity) {
-                        max_similarity = similarity;
-                        recognized_id = current_face->id;
-                        recognized_name = current_face->name;
-                        ESP_LOGI(TAG, "%s,  similarity: %f", recognized_name, max_similarity);
-                        ESP_LOGD(TAG, "DB Entry %d: ", recognized_id);
-                    }
-                }
-                else {
-                    ESP_LOGE(TAG, "Failed to read embedding file %s. Error: %s.", current_face->embedding_file, esp_err_to_name(read_err));
-                    if (stored_embedding_bytes_raw) free(stored_embedding_bytes_raw);
-                }
+            int best_index = database_find_best_match(incoming_embedding.data(),
+                (int)incoming_embedding.size(), &max_similarity);
+            if (best_index >= 0) {
+                recognized_id = db_faces_ptr[best_index].id;
+                recognized_name = db_faces_ptr[best_index].name;
+                ESP_LOGI(TAG, "%s,  similarity: %f", recognized_name, max_similarity);
+                ESP_LOGD(TAG, "DB Entry %d: ", recognized_id);
             }
         }
     }
     else {
         ESP_LOGE(TAG, "Failed to get dB data.");
     }
+    perf_trace_span(PERF_STAGE_SEARCH, face.frame_id, search_start);
     ESP_LOGD(TAG, "Comparison completed. Best similarity found: %f", max_similarity);
 
+    int64_t reply_start = esp_timer_get_time();
+
     // Final decision: compares with similarity threshold in config.h
     if (recognized_id >= 0 && max_similarity >= COSINE_SIMILARITY_THRESHOLD) {
         ESP_LOGI(TAG, "\033[1;32m******************************************\033[0m");
@@ -241,20 +181,18 @@ esp_err_t image_processor_handle_new_image(
         ESP_LOGI(TAG, "\033[1;36m******************************************\033[0m");
     
 #if SEND_UNKNOWN_FACES_TO_AWS
-        handle_unknown_face(image_buffer, image_len, cropped_img_width, cropped_img_height);
+        handle_unknown_face(face.image_buffer, face.image_len, face.width, face.height);
 #endif
     }
-
-    ESP_LOGD(TAG, "De-initializing database after comparison loop.");
-    database_deinit();
-    ESP_LOGD(TAG, "Database de-initialized.");
+    perf_trace_span(PERF_STAGE_REPLY, face.frame_id, reply_start);
 
 #if ENABLE_ENROLLMENT 
     ESP_LOGI(TAG, "Enrollment is ENABLED. Proceeding to enroll new incoming face.");
+    // An aligned tile is enrolled the way it is recognized: no keypoints (no warp), the tile as the box
     esp_err_t enroll_res = enroll_new_face(
-        image_buffer, image_len, cropped_img_width, cropped_img_height,
-        adjusted_face_x, adjusted_face_y, face_w, face_h,
-        adjusted_keypoints
+        face.image_buffer, face.image_len, face.width, face.height,
+        0, 0, face.aligned ? face.width : face.face_w, face.aligned ? face.height : face.face_h,
+        face.aligned ? std::vector<int>() : adjusted_keypoints
     );
     if (enroll_res == ESP_OK) {
         ESP_LOGI(TAG, "New face enrollment process for incoming image initiated successfully.");
@@ -263,10 +201,88 @@ esp_err_t image_processor_handle_new_image(
         ESP_LOGE(TAG, "Failed to enroll new incoming face. Error: %s", esp_err_to_name(enroll_res));
     }
 #endif
+}
 
-    delete incoming_embedding;
-    ESP_LOGD(TAG, "Image processing complete. Return from image_processor_handle_new_image");
-    return ESP_OK;
+/**
+ * @brief Workes upon a batch of incoming (face detected) images for face recognition.
+ *
+ * Each image is a crop from the client with some buffer-zone around the face (20px),
+ * its box and keypoints are relative to the *original full camera frame*. They are
+ * adjusted to the crop for the esp-who AI model, then all the embeddings are extracted
+ * in one burst (pipelined over both cores) before each face is matched against the database.
+ *
+ * @param faces The received faces.
+ * @param count Number of faces.
+ * @return ESP_OK if every face was processed, ESP_FAIL if an extraction failed.
+ */
+esp_err_t image_processor_handle_new_images(const image_processor_face_t* faces, int count) {
+    if (!faces || count <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    std::vector<face_crop_t> crops(count);
+    for (int n = 0; n < count; n++) {
+        const image_processor_face_t& face = faces[n];
+        // Log the initial received data for verification
+        ESP_LOGD(TAG, "New image %d/%d Buffer Address: %p", n + 1, count, face.image_buffer);
+        ESP_LOGD(TAG, "  Buffer Length (bytes): %zu", face.image_len);
+        ESP_LOGD(TAG, "  Cropped Image Width x Height: %d x %d", face.width, face.height);
+        ESP_LOGD(TAG, "  Original Face Box (relative to full frame) - X:%d, Y:%d, W:%d, H:%d",
+            face.face_x, face.face_y, face.face_w, face.face_h);
+        log_keypoints("  Keypoints received", face.keypoints);
+
+        // Adjust face box and keypoints to the cropped image, not to the original frame.
+        // An aligned tile has them on the tile already (the template).
+        std::vector<int> adjusted_keypoints = face.keypoints;
+        for (size_t i = 0; !face.aligned && i + 1 < adjusted_keypoints.size(); i += 2) {
+            adjusted_keypoints[i] -= face.face_x;
+            adjusted_keypoints[i + 1] -= face.face_y;
+        }
+        ESP_LOGD(TAG, "Adjusted Face Box for FaceRecognizer: X:0, Y:0, W:%d, H:%d", face.face_w, face.face_h);
+        log_keypoints("Adjusted Keypoints", adjusted_keypoints);
+
+        crops[n] = { face.image_buffer, face.width, face.height, adjusted_keypoints, face.frame_id, face.aligned };
+    }
+    ESP_LOGD(TAG, "Starting AI model feature extraction for %d incoming image(s).", count);
+
+    // Use the global/static s_face_recognizer instance to extract the embeddings.
+    std::vector<std::vector<float>> embeddings = s_face_recognizer.extract_embeddings(crops);
+
+    esp_err_t ret = ESP_OK;
+    for (int n = 0; n < count; n++) {
+        if (embeddings[n].empty()) {
+            ESP_LOGE(TAG, "Incoming image features extraction error...");
+            ret = ESP_FAIL;
+            continue;
+        }
+        handle_face_embedding(faces[n], crops[n].keypoints, embeddings[n]);
+    }
+    ESP_LOGD(TAG, "Image processing complete. Return from image_processor_handle_new_images");
+    return ret;
+}
+
+/**
+ * @brief Workes upon an incoming (face detected) image for face recognition.
+ * A batch of one, see image_processor_handle_new_images().
+ *
+ * @param image_buffer Pointer to the received image data (RGB565 format, already cropped).
+ * @param image_len Length of the image_buffer in Bytes.
+ * @param cropped_img_width Width of the cropped face image_buffer
+ * @param cropped_img_height Height of the cropped face image_buffer
+ * @param original_face_x X-coordinate of the bounding box relative to the *original full camera frame*.
+ * @param original_face_y Y-coordinate of the bounding box relative to the *original full camera frame*.
+ * @param face_w Width of the face bounding box (same as cropped_img_width).
+ * @param face_h Height of the face bounding box (same as cropped_img_height).
+ * @param keypoints A vector of integers for facial keypoints, relative to the *original full camera frame*.
+ * @return ESP_OK if processing is successful, error code otherwise.
+ */
+esp_err_t image_processor_handle_new_image(
+    uint8_t* image_buffer, size_t image_len, int cropped_img_width, int cropped_img_height,
+    int original_face_x, int original_face_y, int face_w, int face_h,
+    const std::vector<int>& keypoints) {
+    image_processor_face_t face = { image_buffer, image_len, cropped_img_width, cropped_img_height,
+                                    original_face_x, original_face_y, face_w, face_h, keypoints };
+    return image_processor_handle_new_images(&face, 1);
 }
 
 /**
@@ -281,50 +297,16 @@ esp_err_t image_processor_handle_database_image(
     return ESP_OK;
 }
 
-/* If the face is unknown locally, sent to AWS for further analysis */
+/* If the face is unknown locally, sent to AWS for further analysis.
+ * Only queues the upload: pre-signed URL, PUT and MQTT notify run in the upload task. */
 static void handle_unknown_face(uint8_t* image_buffer, size_t image_len, int width, int height) {
-    ESP_LOGI(TAG, "Uploading unrecognized face to S3.");
-
     char filename[64];
     snprintf(filename, sizeof(filename), "%dx%d_%lld.bin", width, height, esp_timer_get_time());
 
-    char presigned_url[2048];
-    esp_err_t url_err = s3_uploader_get_presigned_url(filename, presigned_url, sizeof(presigned_url));
-
-    if (url_err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get pre-signed URL for S3 upload.");
+    esp_err_t err = upload_queue_submit(filename, image_buffer, image_len, "application/octet-stream", true);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to queue %s for S3 upload: %s", filename, esp_err_to_name(err));
         return;
     }
-
-    esp_err_t upload_err = s3_uploader_upload_by_url(
-        presigned_url, image_buffer, image_len, "application/octet-stream");
-
-    if (upload_err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to upload image to S3.");
-        return;
-    }
-
-    ESP_LOGI(TAG, "Image %s uloaded to S3.", filename);
-
-    // After succesful upload, publish an MQTT message
-    if (mqtt_is_connected()) { // check again if MQTT is connected
-        esp_mqtt_client_handle_t mqtt_client = get_mqtt_client();
-        cJSON* root = cJSON_CreateObject();
-        cJSON_AddStringToObject(root, "event", "unknown_face_detected");
-        cJSON_AddStringToObject(root, "s3_key", filename);
-        cJSON_AddStringToObject(root, "device_id", AWS_IOT_CLIENT_ID);
-
-        char* json_payload = cJSON_PrintUnformatted(root);
-        if (json_payload) {
-            mqtt_publish_message(mqtt_client, "faces/unknown", json_payload, 1, 0);
-            free(json_payload);
-        }
-        else {
-            ESP_LOGE(TAG, "Failed to print JSON payload for MQTT.");
-        }
-        cJSON_Delete(root);
-    }
-    else {
-        ESP_LOGE(TAG, "MQTT not connected, cannot publish notification for unknown face.");
-    }
+    ESP_LOGI(TAG, "Unrecognized face queued for S3 upload as %s.", filename);
 }
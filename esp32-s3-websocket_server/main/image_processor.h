@@ -11,6 +11,32 @@ extern "C" {
 
 esp_err_t image_processor_init(void);
 
+// One received face crop, box and keypoints relative to the original camera frame
+typedef struct {
+    uint8_t *image_buffer; // RGB565, already cropped
+    size_t image_len;
+    int width;             // crop size
+    int height;
+    int face_x;            // face box in the original frame
+    int face_y;
+    int face_w;
+    int face_h;
+    std::vector<int> keypoints; // 10 integers for 5 points, in the original frame
+    uint32_t frame_id;     // client frame id, for the latency trace (0: unknown)
+    bool aligned;          // FACE_ALIGN_SIZE tile aligned by the CAM, keypoints are the template (on the tile)
+} image_processor_face_t;
+
+/**
+ * @brief Handles several received faces at once (frames queued together, several clients).
+ * The embeddings are extracted in one pipelined burst, then each face is
+ * matched and reported as by image_processor_handle_new_image().
+ *
+ * @param faces The faces.
+ * @param count Number of faces.
+ * @return esp_err_t ESP_OK if all of them were processed.
+ */
+esp_err_t image_processor_handle_new_images(const image_processor_face_t *faces, int count);
+
 /**
  * @brief Handles ane image received, with pre-detected face box and keypoints.
  *
@@ -0,0 +1,206 @@
+/**
+ * @file inference_worker.cpp
+ * @brief Producer/consumer pipeline between the WebSocket server (producer,
+ * httpd task) and the image processor (consumer, this worker task).
+ * Feature extraction, DB scan and S3 upload used to run inside the httpd
+ * task, stalling every client's frames, heartbeats and acks meanwhile.
+ */
+#include "inference_worker.h"
+#include "image_processor.h"
+#include "websocket_server.h"
+#include "frame_decoder.h"
+#include "frame_pool.h"
+#include "perf_trace.h"
+#include "config.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static const char* TAG = "INFER_WORKER";
+
+#if FRAME_BATCH_MAX > INFERENCE_QUEUE_DEPTH || FRAME_BATCH_MAX > INFERENCE_BATCH_MAX
+#error "FRAME_BATCH_MAX: at most INFERENCE_QUEUE_DEPTH and INFERENCE_BATCH_MAX"
+#endif
+
+static QueueHandle_t s_job_queue = NULL;
+static TaskHandle_t s_worker_task = NULL;
+static inference_worker_stats_t s_stats = {};
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void notify_dropped(const inference_job_t* job) {
+    char msg[96];
+    snprintf(msg, sizeof(msg), "{\"type\":\"frame_dropped\",\"id\":%u,\"reason\":\"queue_full\"}", (unsigned)job->frame_id);
+    websocket_server_send_text_client(job->client_fd, msg);
+}
+
+static void inference_worker_task(void* arg) {
+    inference_job_t jobs[INFERENCE_BATCH_MAX];
+    ESP_LOGI(TAG, "Inference worker running on core %d, batches of up to %d frames.", xPortGetCoreID(), INFERENCE_BATCH_MAX);
+
+    while (true) {
+        if (xQueueReceive(s_job_queue, &jobs[0], portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        // Whatever queued up meanwhile goes in the same batch, never wait for more
+        int count = 1;
+        while (count < INFERENCE_BATCH_MAX && xQueueReceive(s_job_queue, &jobs[count], 0) == pdTRUE) {
+            count++;
+        }
+        // ...except the rest of a batched transfer still being queued by the server
+        while (count < INFERENCE_BATCH_MAX && jobs[count - 1].batch_left > 0 &&
+               xQueueReceive(s_job_queue, &jobs[count], pdMS_TO_TICKS(INFERENCE_BATCH_WAIT_MS)) == pdTRUE) {
+            count++;
+        }
+        int64_t start = esp_timer_get_time();
+        int64_t waited = 0;
+
+        std::vector<image_processor_face_t> faces;
+        faces.reserve(count);
+        for (int i = 0; i < count; i++) {
+            const inference_job_t& job = jobs[i];
+            if (start - job.enqueue_us > waited) waited = start - job.enqueue_us;
+            perf_trace_record(PERF_STAGE_QUEUE, job.frame_id, 0, job.enqueue_us, (uint32_t)(start - job.enqueue_us));
+
+            uint8_t* pixels = job.buffer;
+            size_t pixels_len = job.len;
+            if (job.format == FRAME_FORMAT_JPEG) {
+                // Decoded into one of the decoder's reused buffers, only this task uses them
+                int64_t decode_start = esp_timer_get_time();
+                esp_err_t err = frame_decoder_jpeg_to_rgb565(job.buffer, job.len, job.width, job.height, &pixels, &pixels_len);
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "Frame %u: JPEG decoding failed (%s), frame skipped.", (unsigned)job.frame_id, esp_err_to_name(err));
+                    continue;
+                }
+                perf_trace_span(PERF_STAGE_DECODE, job.frame_id, decode_start);
+            }
+            faces.push_back({ pixels, pixels_len, job.width, job.height, job.face_x, job.face_y, job.face_w, job.face_h,
+                              std::vector<int>(job.keypoints, job.keypoints + job.keypoint_count), job.frame_id,
+                              job.aligned });
+        }
+        if (!faces.empty()) {
+            image_processor_handle_new_images(faces.data(), (int)faces.size());
+        }
+        for (int i = 0; i < count; i++) {
+            frame_pool_release(jobs[i].buffer); // the worker owns the frame slots
+        }
+        perf_trace_heap(jobs[count - 1].frame_id);
+
+        int64_t elapsed = esp_timer_get_time() - start;
+        taskENTER_CRITICAL(&s_stats_lock);
+        s_stats.processed += count;
+        s_stats.batches++;
+        if ((uint32_t)count > s_stats.max_batch) s_stats.max_batch = count;
+        s_stats.last_process_us = elapsed;
+        if (waited > s_stats.max_wait_us) s_stats.max_wait_us = waited;
+        taskEXIT_CRITICAL(&s_stats_lock);
+        ESP_LOGD(TAG, "Frames %u..%u (%d): waited up to %lld us, processed in %lld us, %d still queued.",
+                 (unsigned)jobs[0].frame_id, (unsigned)jobs[count - 1].frame_id, count, (long long)waited,
+                 (long long)elapsed, (int)uxQueueMessagesWaiting(s_job_queue));
+    }
+}
+
+esp_err_t inference_worker_start(void) {
+    if (s_worker_task) return ESP_OK;
+
+    s_job_queue = xQueueCreate(INFERENCE_QUEUE_DEPTH, sizeof(inference_job_t));
+    if (!s_job_queue) {
+        ESP_LOGE(TAG, "Failed to create the inference queue.");
+        return ESP_ERR_NO_MEM;
+    }
+    BaseType_t ok = xTaskCreatePinnedToCore(inference_worker_task, "inference_worker",
+                                            INFERENCE_WORKER_STACK_SIZE, NULL, INFERENCE_WORKER_PRIORITY,
+                                            &s_worker_task, INFERENCE_WORKER_CORE);
+    if (ok != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the inference worker task.");
+        vQueueDelete(s_job_queue);
+        s_job_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Inference queue depth %d, drop policy: %s.", INFERENCE_QUEUE_DEPTH,
+             INFERENCE_DROP_POLICY == INFERENCE_DROP_OLDEST ? "drop oldest" : "reject newest");
+    return ESP_OK;
+}
+
+esp_err_t inference_worker_submit(const inference_job_t* job, int* out_queued) {
+    if (!job || !job->buffer) return ESP_ERR_INVALID_ARG;
+    if (!s_job_queue) return ESP_ERR_INVALID_STATE;
+
+    inference_job_t queued_job = *job;
+    queued_job.enqueue_us = esp_timer_get_time();
+
+    if (xQueueSend(s_job_queue, &queued_job, 0) != pdTRUE) {
+#if INFERENCE_DROP_POLICY == INFERENCE_DROP_OLDEST
+        // Evict the oldest waiting frame: the newest one is the most relevant for a live camera
+        inference_job_t oldest;
+        if (xQueueReceive(s_job_queue, &oldest, 0) == pdTRUE) {
+            ESP_LOGW(TAG, "Queue full, dropping oldest frame %u.", (unsigned)oldest.frame_id);
+            notify_dropped(&oldest);
+            frame_pool_release(oldest.buffer);
+            taskENTER_CRITICAL(&s_stats_lock);
+            s_stats.dropped++;
+            taskEXIT_CRITICAL(&s_stats_lock);
+        }
+        if (xQueueSend(s_job_queue, &queued_job, 0) != pdTRUE)
+#endif
+        {
+            ESP_LOGW(TAG, "Queue full, frame %u rejected.", (unsigned)job->frame_id);
+            taskENTER_CRITICAL(&s_stats_lock);
+            s_stats.dropped++;
+            taskEXIT_CRITICAL(&s_stats_lock);
+            if (out_queued) *out_queued = (int)uxQueueMessagesWaiting(s_job_queue);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    int queued = (int)uxQueueMessagesWaiting(s_job_queue);
+    taskENTER_CRITICAL(&s_stats_lock);
+    s_stats.submitted++;
+    if ((uint32_t)queued > s_stats.max_queued) s_stats.max_queued = queued;
+    taskEXIT_CRITICAL(&s_stats_lock);
+    if (out_queued) *out_queued = queued;
+    return ESP_OK;
+}
+
+esp_err_t inference_worker_submit_batch(const inference_job_t* jobs, int count, int* out_queued) {
+    if (!jobs || count <= 0 || count > FRAME_BATCH_MAX) return ESP_ERR_INVALID_ARG;
+    if (!s_job_queue) return ESP_ERR_INVALID_STATE;
+
+#if INFERENCE_DROP_POLICY != INFERENCE_DROP_OLDEST
+    // Only the server task submits: the room checked here is still there below
+    if ((int)uxQueueSpacesAvailable(s_job_queue) < count) {
+        ESP_LOGW(TAG, "Queue full, batch of %d (frames %u..%u) rejected.", count,
+                 (unsigned)jobs[0].frame_id, (unsigned)jobs[count - 1].frame_id);
+        taskENTER_CRITICAL(&s_stats_lock);
+        s_stats.dropped += count;
+        taskEXIT_CRITICAL(&s_stats_lock);
+        if (out_queued) *out_queued = (int)uxQueueMessagesWaiting(s_job_queue);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    // FRAME_BATCH_MAX <= INFERENCE_QUEUE_DEPTH: evictions never reach the batch itself
+    for (int i = 0; i < count; i++) {
+        inference_job_t job = jobs[i];
+        job.batch_left = count - 1 - i;
+        inference_worker_submit(&job, out_queued);
+    }
+    return ESP_OK;
+}
+
+int inference_worker_queued(void) {
+    return s_job_queue ? (int)uxQueueMessagesWaiting(s_job_queue) : 0;
+}
+
+void inference_worker_get_stats(inference_worker_stats_t* out_stats) {
+    if (!out_stats) return;
+    taskENTER_CRITICAL(&s_stats_lock);
+    *out_stats = s_stats;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
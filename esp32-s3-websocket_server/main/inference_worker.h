@@ -0,0 +1,89 @@
+/**
+ * @file inference_worker.h
+ * @brief Bounded frame queue + inference worker task.
+ * The WebSocket server hands over complete frames and goes back to receiving,
+ * the worker (pinned to the other core) runs the image processor on them,
+ * a batch of all the frames waiting at once.
+ */
+#ifndef INFERENCE_WORKER_H
+#define INFERENCE_WORKER_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INFERENCE_MAX_KEYPOINTS 10
+
+// One complete frame. The worker OWNS buffer (a frame_pool slot) after a successful submit and releases it.
+typedef struct {
+    uint8_t* buffer;
+    size_t len;
+    int format;         // frame_format_t: raw RGB565 or JPEG (decoded by the worker)
+    int width;
+    int height;
+    int face_x;
+    int face_y;
+    int face_w;
+    int face_h;
+    int keypoints[INFERENCE_MAX_KEYPOINTS];
+    int keypoint_count;
+    bool aligned;       // FRAME_FLAG_ALIGNED: a tile aligned by the CAM, no warp
+    int client_fd;      // submitting client
+    uint32_t frame_id;  // client frame id
+    int batch_left;     // faces of the same client batch queued right after this one, set by inference_worker_submit_batch
+    int64_t enqueue_us; // set by inference_worker_submit
+} inference_job_t;
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t processed;
+    uint32_t batches;      // worker wake-ups, processed / batches = average batch size
+    uint32_t max_batch;    // largest batch (INFERENCE_BATCH_MAX)
+    uint32_t dropped;      // rejected (queue full) or evicted by the drop policy
+    uint32_t max_queued;   // queue high watermark
+    int64_t max_wait_us;   // longest time a frame waited in the queue
+    int64_t last_process_us; // whole last batch
+} inference_worker_stats_t;
+
+/**
+ * @brief Creates the queue and the worker task. Call after image_processor_init().
+ * @return ESP_OK, or ESP_ERR_NO_MEM.
+ */
+esp_err_t inference_worker_start(void);
+
+/**
+ * @brief Hands a frame over to the worker, never blocks.
+ * On ESP_OK the job (and its buffer) belongs to the worker.
+ * When the queue is full, INFERENCE_DROP_POLICY decides: reject the new
+ * frame (ESP_ERR_NO_MEM, the caller keeps and releases the buffer) or evict
+ * the oldest queued one (its client gets a frame_dropped message).
+ * @param job Frame to process, copied into the queue.
+ * @param out_queued Frames waiting after this call (optional).
+ */
+esp_err_t inference_worker_submit(const inference_job_t* job, int* out_queued);
+
+/**
+ * @brief Hands the faces of one batched transfer over to the worker, which
+ * processes them in the same batch. All or nothing: with INFERENCE_DROP_NEWEST
+ * and not enough room, none is queued. Call from the WebSocket server only.
+ * @param jobs Faces, at most FRAME_BATCH_MAX.
+ * @param count Number of faces.
+ * @param out_queued Frames waiting after this call (optional).
+ * @return ESP_OK (every job belongs to the worker), ESP_ERR_NO_MEM (the caller keeps them all).
+ */
+esp_err_t inference_worker_submit_batch(const inference_job_t* jobs, int count, int* out_queued);
+
+// Frames currently waiting in the queue
+int inference_worker_queued(void);
+
+void inference_worker_get_stats(inference_worker_stats_t* out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INFERENCE_WORKER_H
@@ -23,6 +23,7 @@ extern "C" {
 #include "wifi.h"
 #include "time_sync.h"
 #include "s3_uploader.h"
+#include "upload_queue.h"
 
 #if MQTT_ENABLED
 #include "mqtt.h"
@@ -83,6 +84,7 @@ static void configure_system_logging() {
     esp_log_level_set("WEBSOCKET_SERVER", ESP_LOG_INFO);
     esp_log_level_set("FACE_RECOGN", ESP_LOG_INFO);
     esp_log_level_set("S3_UPLOADER", ESP_LOG_INFO);
+    esp_log_level_set("UPLOAD_QUEUE", ESP_LOG_INFO);
 
     // Example: set S3_UPLOADER only, to be verbose. EASY TO DEBUG!
     //esp_log_level_set("S3_UPLOADER", ESP_LOG_VERBOSE);
@@ -106,6 +108,11 @@ extern "C" void app_main(void) {
         while (1);
     }
 
+    // Before any recognition: picks up uploads spilled to flash by the previous run
+    if (upload_queue_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Upload queue failed! Unknown faces will not reach S3.");
+    }
+
     if (WIFI_ENABLED) {
         wifi_init_sta();
         if (!wifi_is_connected()) {
@@ -0,0 +1,170 @@
+/**
+ * @file perf_trace.c
+ * @brief Latency trace ring, written by the httpd task, the inference worker
+ * and the esp-dl pipeline stage 2 task (both cores), read by the httpd task.
+ * Events are numbered: a reader asks for what it has not seen yet and learns
+ * how many were overwritten meanwhile.
+ */
+#include "perf_trace.h"
+#include "inference_worker.h"
+#include "frame_pool.h"
+#include "config.h"
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "PERF_TRACE";
+
+#if (PERF_TRACE_EVENTS & (PERF_TRACE_EVENTS - 1)) != 0
+#error "PERF_TRACE_EVENTS: a power of two"
+#endif
+
+// Longest event row: 6 numbers of up to 10 digits, brackets and commas
+#define EVENT_JSON_MAX 72
+#define HEADER_JSON_MAX 1024
+
+static const char* const s_stage_names[PERF_STAGE_COUNT] = {
+    "receive", "queue", "decode", "align", "module", "postprocess", "search", "reply", "heap_internal", "heap_psram"
+};
+
+static perf_trace_event_t* s_events = NULL;
+static uint32_t s_seq = 0; // events recorded since boot, the next one goes to s_events[s_seq % PERF_TRACE_EVENTS]
+static uint32_t s_inputs[INFERENCE_BATCH_MAX];
+static int s_input_count = 0;
+static portMUX_TYPE s_trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t perf_trace_init(void) {
+#if PERF_TRACE_ENABLED
+    if (s_events) return ESP_OK;
+
+    s_events = (perf_trace_event_t*)heap_caps_calloc(PERF_TRACE_EVENTS, sizeof(perf_trace_event_t),
+                                                     MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!s_events) {
+        ESP_LOGE(TAG, "Failed to allocate %d trace events.", PERF_TRACE_EVENTS);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Latency trace: %d events (%zu bytes) in PSRAM.", PERF_TRACE_EVENTS,
+             PERF_TRACE_EVENTS * sizeof(perf_trace_event_t));
+#endif
+    return ESP_OK;
+}
+
+void perf_trace_record(perf_stage_t stage, uint32_t frame_id, uint16_t detail, int64_t start_us, uint32_t value) {
+    if (!s_events) return;
+
+    perf_trace_event_t event = { frame_id, (uint8_t)stage, (uint8_t)xPortGetCoreID(), detail, (uint32_t)start_us, value };
+    taskENTER_CRITICAL(&s_trace_lock);
+    s_events[s_seq & (PERF_TRACE_EVENTS - 1)] = event;
+    s_seq++;
+    taskEXIT_CRITICAL(&s_trace_lock);
+}
+
+void perf_trace_span(perf_stage_t stage, uint32_t frame_id, int64_t start_us) {
+    perf_trace_record(stage, frame_id, 0, start_us, (uint32_t)(esp_timer_get_time() - start_us));
+}
+
+void perf_trace_heap(uint32_t frame_id) {
+    if (!s_events) return;
+
+    int64_t now = esp_timer_get_time();
+    perf_trace_record(PERF_STAGE_HEAP_INTERNAL, frame_id, 0, now, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    perf_trace_record(PERF_STAGE_HEAP_PSRAM, frame_id, 0, now, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+}
+
+void perf_trace_set_inputs(const uint32_t* frame_ids, int count) {
+    if (!frame_ids || count < 0) count = 0;
+    if (count > INFERENCE_BATCH_MAX) count = INFERENCE_BATCH_MAX;
+    memcpy(s_inputs, frame_ids, count * sizeof(uint32_t)); // set before the burst, read while it runs
+    s_input_count = count;
+}
+
+void perf_trace_model_step(void* arg, int input, int module, int64_t start_us, int64_t end_us) {
+    uint32_t frame_id = (input >= 0 && input < s_input_count) ? s_inputs[input] : 0;
+    perf_stage_t stage = PERF_STAGE_MODULE;
+    if (module < 0) {
+        stage = module == -1 ? PERF_STAGE_ALIGN : PERF_STAGE_POSTPROCESS; // MODEL_TRACE_PREPROCESS / _POSTPROCESS
+    }
+    perf_trace_record(stage, frame_id, module < 0 ? 0 : (uint16_t)module, start_us, (uint32_t)(end_us - start_us));
+}
+
+size_t perf_trace_read(uint32_t since, perf_trace_event_t* out, size_t max, uint32_t* out_next, uint32_t* out_lost) {
+    uint32_t lost = 0;
+    size_t count = 0;
+    if (s_events) {
+        // A copy of at most max events (16 bytes each) under the lock, keep max moderate
+        taskENTER_CRITICAL(&s_trace_lock);
+        uint32_t oldest = s_seq > PERF_TRACE_EVENTS ? s_seq - PERF_TRACE_EVENTS : 0;
+        if (since < oldest) {
+            lost = oldest - since;
+            since = oldest;
+        }
+        if (since > s_seq) { // a reader from before a reboot
+            since = oldest;
+        }
+        while (since != s_seq && count < max) {
+            out[count++] = s_events[since & (PERF_TRACE_EVENTS - 1)];
+            since++;
+        }
+        taskEXIT_CRITICAL(&s_trace_lock);
+    }
+    if (out_next) *out_next = since;
+    if (out_lost) *out_lost = lost;
+    return count;
+}
+
+char* perf_trace_stats_json(uint32_t since, int max_events) {
+    if (max_events <= 0 || max_events > PERF_TRACE_MAX_EVENTS_PER_MESSAGE) {
+        max_events = PERF_TRACE_MAX_EVENTS_PER_MESSAGE;
+    }
+    perf_trace_event_t* events = (perf_trace_event_t*)heap_caps_malloc(max_events * sizeof(perf_trace_event_t),
+                                                                      MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    size_t size = HEADER_JSON_MAX + (size_t)max_events * EVENT_JSON_MAX;
+    char* json = (char*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!events || !json) {
+        ESP_LOGE(TAG, "Failed to allocate the stats reply (%zu bytes).", size);
+        heap_caps_free(events);
+        heap_caps_free(json);
+        return NULL;
+    }
+
+    uint32_t next = 0, lost = 0;
+    size_t count = perf_trace_read(since, events, max_events, &next, &lost);
+    inference_worker_stats_t worker;
+    inference_worker_get_stats(&worker);
+    frame_pool_stats_t pool;
+    frame_pool_get_stats(&pool);
+
+    int len = snprintf(json, size,
+        "{\"type\":\"stats\",\"now\":%lu,\"seq\":%lu,\"lost\":%lu,\"stages\":[",
+        (unsigned long)(uint32_t)esp_timer_get_time(), (unsigned long)next, (unsigned long)lost);
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        len += snprintf(json + len, size - len, "%s\"%s\"", i ? "," : "", s_stage_names[i]);
+    }
+    len += snprintf(json + len, size - len,
+        "],\"heap\":{\"internal\":%u,\"internal_min\":%u,\"psram\":%u,\"psram_min\":%u},"
+        "\"worker\":{\"submitted\":%lu,\"processed\":%lu,\"batches\":%lu,\"dropped\":%lu,\"max_queued\":%lu,"
+        "\"max_wait_us\":%lld,\"queued\":%d},"
+        "\"pool\":{\"slots\":%lu,\"in_use\":%lu,\"max_in_use\":%lu,\"exhausted\":%lu},\"events\":[",
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM),
+        (unsigned long)worker.submitted, (unsigned long)worker.processed, (unsigned long)worker.batches,
+        (unsigned long)worker.dropped, (unsigned long)worker.max_queued, (long long)worker.max_wait_us,
+        inference_worker_queued(),
+        (unsigned long)pool.slots, (unsigned long)pool.in_use, (unsigned long)pool.max_in_use, (unsigned long)pool.exhausted);
+    for (size_t i = 0; i < count; i++) {
+        const perf_trace_event_t* e = &events[i];
+        len += snprintf(json + len, size - len, "%s[%lu,%u,%u,%u,%lu,%lu]", i ? "," : "",
+                        (unsigned long)e->frame_id, e->stage, e->detail, e->core,
+                        (unsigned long)e->start_us, (unsigned long)e->value);
+    }
+    snprintf(json + len, size - len, "]}");
+    heap_caps_free(events);
+    return json;
+}
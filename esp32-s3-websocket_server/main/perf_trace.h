@@ -0,0 +1,109 @@
+/**
+ * @file perf_trace.h
+ * @brief Always-on latency trace: a ring of fixed-size events in PSRAM.
+ * Every frame leaves one event per stage it goes through (receive, queue,
+ * decode, align, each module of the feature model, DB search, reply) plus
+ * heap levels after each batch. Recording is a spinlock and a 16-byte copy,
+ * cheap enough to stay on in the field.
+ * Clients read it with a {"type":"stats"} message, see perf_trace_stats_json().
+ */
+#ifndef PERF_TRACE_H
+#define PERF_TRACE_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    PERF_STAGE_RECEIVE = 0,   // first bytes to complete frame (httpd task)
+    PERF_STAGE_QUEUE,         // waiting in the inference queue
+    PERF_STAGE_DECODE,        // JPEG to RGB565
+    PERF_STAGE_ALIGN,         // face alignment / resize into the model input
+    PERF_STAGE_MODULE,        // one module of the feature model, detail: its index in the execution plan
+    PERF_STAGE_POSTPROCESS,   // model output to embedding
+    PERF_STAGE_SEARCH,        // database match
+    PERF_STAGE_REPLY,         // result sent / upload queued
+    PERF_STAGE_HEAP_INTERNAL, // after a batch, value: free internal bytes
+    PERF_STAGE_HEAP_PSRAM,    // after a batch, value: free PSRAM bytes
+    PERF_STAGE_COUNT
+} perf_stage_t;
+
+typedef struct {
+    uint32_t frame_id;  // client frame id, 0: unknown
+    uint8_t stage;      // perf_stage_t
+    uint8_t core;       // core that recorded it
+    uint16_t detail;    // PERF_STAGE_MODULE: module index
+    uint32_t start_us;  // esp_timer, low 32 bits (wraps every ~71 minutes)
+    uint32_t value;     // duration in us, bytes for the heap stages
+} perf_trace_event_t;
+
+/**
+ * @brief Allocates the ring (PERF_TRACE_EVENTS events), once. Recording before is a no-op.
+ * @return ESP_OK, or ESP_ERR_NO_MEM.
+ */
+esp_err_t perf_trace_init(void);
+
+/**
+ * @brief Records one event, from any task or core.
+ * @param stage The stage.
+ * @param frame_id Client frame id.
+ * @param detail Stage specific (module index).
+ * @param start_us esp_timer time the stage started.
+ * @param value Duration in us, or bytes.
+ */
+void perf_trace_record(perf_stage_t stage, uint32_t frame_id, uint16_t detail, int64_t start_us, uint32_t value);
+
+// Records a stage that started at start_us and ends now
+void perf_trace_span(perf_stage_t stage, uint32_t frame_id, int64_t start_us);
+
+// Records the free internal and PSRAM bytes now, after frame_id (the last frame of a batch)
+void perf_trace_heap(uint32_t frame_id);
+
+/**
+ * @brief Frame id of each input of the next model inferences: input k of a
+ * pipelined burst (or 0 for a single inference) belongs to frame_ids[k].
+ * @param frame_ids Ids, copied. NULL: unknown frames.
+ * @param count Number of ids (at most INFERENCE_BATCH_MAX).
+ */
+void perf_trace_set_inputs(const uint32_t* frame_ids, int count);
+
+/**
+ * @brief dl::model_trace_t callback, install it with dl::Model::set_trace().
+ * Module steps become PERF_STAGE_MODULE events, pre/postprocess become
+ * PERF_STAGE_ALIGN / PERF_STAGE_POSTPROCESS, of the frame set by perf_trace_set_inputs().
+ */
+void perf_trace_model_step(void* arg, int input, int module, int64_t start_us, int64_t end_us);
+
+/**
+ * @brief Copies the events recorded since a sequence number, oldest first.
+ * @param since Sequence number of the first wanted event (0: everything still in the ring).
+ * @param out Events.
+ * @param max Capacity of out.
+ * @param out_next Sequence number to ask for next time.
+ * @param out_lost Events between since and the oldest one still in the ring, overwritten before being read.
+ * @return Number of events copied.
+ */
+size_t perf_trace_read(uint32_t since, perf_trace_event_t* out, size_t max, uint32_t* out_next, uint32_t* out_lost);
+
+/**
+ * @brief The "stats" reply: the events since a sequence number, heap watermarks,
+ * inference worker and frame pool counters, as one JSON object:
+ *   {"type":"stats","now":us,"seq":next,"lost":n,"stages":[names],
+ *    "heap":{...},"worker":{...},"pool":{...},
+ *    "events":[[frame_id,stage,detail,core,start_us,value],...]}
+ * Ask again with "since":seq until "events" is empty.
+ * @param since Sequence number of the first wanted event.
+ * @param max_events At most this many events (and PERF_TRACE_MAX_EVENTS_PER_MESSAGE).
+ * @return string in PSRAM (free() it), NULL on allocation failure.
+ */
+char* perf_trace_stats_json(uint32_t since, int max_events);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PERF_TRACE_H
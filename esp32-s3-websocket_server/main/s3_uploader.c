@@ -4,6 +4,8 @@
 #include "storage_manager.h"
 #include "face_database.h"
 #include "string.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include "cJSON.h"
 #include "config.h"
 #include "time_sync.h"
@@ -23,6 +25,7 @@ esp_err_t _http_event_handler(esp_http_client_event_t* evt) {
 
     switch (evt->event_id) {
     case HTTP_EVENT_ON_DATA:
+        if (!response_data) break; // no request in progress
         if (response_data->data_len + evt->data_len < response_data->buffer_size) {
             memcpy(response_data->buffer + response_data->data_len, evt->data, evt->data_len);
             response_data->data_len += evt->data_len;
@@ -44,14 +47,37 @@ esp_err_t _http_event_handler(esp_http_client_event_t* evt) {
     return ESP_OK;
 }
 
-esp_err_t s3_uploader_get_presigned_url(const char* filename, char* presigned_url, size_t max_url_len) {
+/* Base of the presigned-URL endpoint: API Gateway, or a local stand-in server (config.h) */
+static void build_api_url(char* url, size_t url_len, const char* filename) {
+    if (strlen(S3_STANDIN_BASE_URL) > 0) {
+        snprintf(url, url_len, "%s%s?filename=%s", S3_STANDIN_BASE_URL, API_GATEWAY_PATH, filename);
+    }
+    else {
+        snprintf(url, url_len, "https://%s%s?filename=%s", API_GATEWAY_HOST, API_GATEWAY_PATH, filename);
+    }
+}
+
+void s3_uploader_session_close(s3_session_t* session) {
+    if (!session) return;
+    if (session->api_client) {
+        esp_http_client_cleanup(session->api_client);
+        session->api_client = NULL;
+    }
+    if (session->s3_client) {
+        esp_http_client_cleanup(session->s3_client);
+        session->s3_client = NULL;
+    }
+}
+
+esp_err_t s3_uploader_session_get_presigned_url(s3_session_t* session, const char* filename,
+                                                char* presigned_url, size_t max_url_len) {
     if (!is_time_synchronized()) {
         ESP_LOGE(TAG, "Time is not synchronized. Cannot get a pre-signed URL.");
         return ESP_FAIL;
     }
 
     char url[512];
-    snprintf(url, sizeof(url), "https://%s%s?filename=%s", API_GATEWAY_HOST, API_GATEWAY_PATH, filename);
+    build_api_url(url, sizeof(url), filename);
     ESP_LOGD(TAG, "Requesting pre-signed URL from: %s", url);
 
     char response_buffer[2048] = { 0 };
@@ -61,26 +87,32 @@ esp_err_t s3_uploader_get_presigned_url(const char* filename, char* presigned_ur
         .data_len = 0
     };
 
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_GET,
-        .timeout_ms = 10000,
-        .cert_pem = _binary_AmazonRootCA1_pem_start,
-        .event_handler = _http_event_handler,
-        .user_data = &response_data,
-    };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP client");
-        return ESP_FAIL;
+    if (!session->api_client) {
+        esp_http_client_config_t config = {
+            .url = url,
+            .method = HTTP_METHOD_GET,
+            .timeout_ms = 10000,
+            .cert_pem = strlen(S3_STANDIN_BASE_URL) > 0 ? NULL : _binary_AmazonRootCA1_pem_start,
+            .event_handler = _http_event_handler,
+            .keep_alive_enable = true,
+        };
+        session->api_client = esp_http_client_init(&config);
+        if (session->api_client == NULL) {
+            ESP_LOGE(TAG, "Failed to initialize HTTP client");
+            return ESP_FAIL;
+        }
+    }
+    else {
+        // Same host: esp_http_client keeps the TLS connection open between requests
+        esp_http_client_set_url(session->api_client, url);
     }
+    esp_http_client_set_user_data(session->api_client, &response_data);
 
-    esp_err_t err = esp_http_client_perform(client);
+    esp_err_t err = esp_http_client_perform(session->api_client);
     esp_err_t final_err = ESP_FAIL;
 
     if (err == ESP_OK) {
-        int status_code = esp_http_client_get_status_code(client);
+        int status_code = esp_http_client_get_status_code(session->api_client);
         if (status_code == 200) {
             if (response_data.data_len > 0) {
                 cJSON* root = cJSON_Parse(response_data.buffer);
@@ -110,30 +142,43 @@ esp_err_t s3_uploader_get_presigned_url(const char* filename, char* presigned_ur
     }
     else {
         ESP_LOGE(TAG, "HTTP GET request failed: %s", esp_err_to_name(err));
+        // Broken connection: start from scratch next time
+        esp_http_client_cleanup(session->api_client);
+        session->api_client = NULL;
+    }
+    if (session->api_client) {
+        esp_http_client_set_user_data(session->api_client, NULL); // response_data is on this stack
     }
-
-    esp_http_client_cleanup(client);
     return final_err;
 }
 
-esp_err_t s3_uploader_upload_by_url(const char* s3_url, const uint8_t* data, size_t data_len, const char* content_type) {
+esp_err_t s3_uploader_session_upload_by_url(s3_session_t* session, const char* s3_url,
+                                            const uint8_t* data, size_t data_len, const char* content_type) {
     ESP_LOGD(TAG, "Uploading %zu bytes to S3...", data_len);
 
-    esp_http_client_config_t config = {
-        .url = s3_url,
-        .method = HTTP_METHOD_PUT,
-        .timeout_ms = 15000,
-        .cert_pem = _binary_AmazonRootCA1_pem_start,
-        .skip_cert_common_name_check = true,
-        .buffer_size = 2048,
-        .buffer_size_tx = 2048,
-    };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP client for upload");
-        return ESP_FAIL;
+    if (!session->s3_client) {
+        esp_http_client_config_t config = {
+            .url = s3_url,
+            .method = HTTP_METHOD_PUT,
+            .timeout_ms = 15000,
+            .cert_pem = strncmp(s3_url, "https", 5) == 0 ? _binary_AmazonRootCA1_pem_start : NULL,
+            .skip_cert_common_name_check = true,
+            .buffer_size = 2048,
+            .buffer_size_tx = 2048,
+            .keep_alive_enable = true,
+        };
+        session->s3_client = esp_http_client_init(&config);
+        if (session->s3_client == NULL) {
+            ESP_LOGE(TAG, "Failed to initialize HTTP client for upload");
+            return ESP_FAIL;
+        }
+    }
+    else {
+        // Presigned URLs share the bucket host: the open connection is reused
+        esp_http_client_set_url(session->s3_client, s3_url);
+        esp_http_client_set_method(session->s3_client, HTTP_METHOD_PUT);
     }
+    esp_http_client_handle_t client = session->s3_client;
 
     esp_http_client_set_header(client, "Content-Type", content_type);
 
@@ -141,6 +186,7 @@ esp_err_t s3_uploader_upload_by_url(const char* s3_url, const uint8_t* data, siz
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
         esp_http_client_cleanup(client);
+        session->s3_client = NULL;
         return err;
     }
 
@@ -168,8 +214,29 @@ esp_err_t s3_uploader_upload_by_url(const char* s3_url, const uint8_t* data, siz
         }
     }
 
-    esp_http_client_close(client);
+    if (err == ESP_OK) {
+        // Drain the response and keep the connection open for the next PUT
+        if (esp_http_client_flush_response(client, NULL) != ESP_OK) {
+            esp_http_client_close(client); // reconnects on the next open
+        }
+        return ESP_OK;
+    }
     esp_http_client_cleanup(client);
+    session->s3_client = NULL;
+    return err;
+}
+
+esp_err_t s3_uploader_get_presigned_url(const char* filename, char* presigned_url, size_t max_url_len) {
+    s3_session_t session = { 0 };
+    esp_err_t err = s3_uploader_session_get_presigned_url(&session, filename, presigned_url, max_url_len);
+    s3_uploader_session_close(&session);
+    return err;
+}
+
+esp_err_t s3_uploader_upload_by_url(const char* s3_url, const uint8_t* data, size_t data_len, const char* content_type) {
+    s3_session_t session = { 0 };
+    esp_err_t err = s3_uploader_session_upload_by_url(&session, s3_url, data, data_len, content_type);
+    s3_uploader_session_close(&session);
     return err;
 }
 
@@ -197,12 +264,8 @@ esp_err_t s3_uploader_test_upload(void) {
     char presigned_url[2048];
     char* embedding_data = NULL;
 
-    ESP_LOGI(TAG, "Initializing DB for full S3 upload test...");
-    if (database_init() != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize database for S3 test.");
-        return ESP_FAIL;
-    }
-
+    // The database is resident (loaded once by the image processor), do not re-init/deinit it here
+    ESP_LOGI(TAG, "Reading DB for full S3 upload test...");
     if (database_get_all_faces(&records, &record_count) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get records from database.");
         goto cleanup;
@@ -214,11 +277,12 @@ esp_err_t s3_uploader_test_upload(void) {
         goto cleanup;
     }
 
-    face_record_t first_record = records[0];
-    size_t embedding_len = 0;
-
-    if (storage_read_file(first_record.embedding_file, &embedding_data, &embedding_len) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to read embedding file %s.", first_record.embedding_file);
+    // The embedding lives in the binary face store, read it back as float
+    int dim = database_get_dim();
+    size_t embedding_len = dim * sizeof(float);
+    embedding_data = (char*)malloc(embedding_len > 0 ? embedding_len : 1);
+    if (!embedding_data || database_read_embedding(0, (float*)embedding_data, dim) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read embedding of record ID %d.", records[0].id);
         goto cleanup;
     }
 
@@ -235,6 +299,5 @@ cleanup:
     if (embedding_data) {
         free(embedding_data);
     }
-    database_deinit();
     return err;
 }
\ No newline at end of file
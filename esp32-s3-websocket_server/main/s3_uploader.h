@@ -2,6 +2,7 @@
 #define S3_UPLOADER_H
 
 #include "esp_err.h"
+#include "esp_http_client.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -9,6 +10,21 @@
 extern "C" {
 #endif
 
+/* A session keeps its HTTP clients (and their TLS connections) open between
+ * requests, one for API Gateway and one for the S3 bucket host.
+ * Zero-initialize it, close it with s3_uploader_session_close().
+ * Not thread safe: one session per task. */
+typedef struct {
+    esp_http_client_handle_t api_client;
+    esp_http_client_handle_t s3_client;
+} s3_session_t;
+
+esp_err_t s3_uploader_session_get_presigned_url(s3_session_t* session, const char* filename,
+                                                char* presigned_url, size_t max_url_len);
+esp_err_t s3_uploader_session_upload_by_url(s3_session_t* session, const char* s3_url,
+                                            const uint8_t* data, size_t data_len, const char* content_type);
+void s3_uploader_session_close(s3_session_t* session);
+
 /**
  * @brief Gets a pre-signed URL for uploading a file to S3.
  *
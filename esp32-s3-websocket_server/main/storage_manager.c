@@ -110,6 +110,21 @@ esp_err_t storage_write_file_binary(const char *path, const uint8_t *data, size_
     return ESP_OK;
 }
 
+esp_err_t storage_append_file_binary(const char *path, const uint8_t *data, size_t len) {
+    FILE *f = fopen(path, "ab");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open file for appending: %s", path);
+        return ESP_FAIL;
+    }
+    size_t bytes_written = fwrite(data, 1, len, f);
+    fclose(f);
+    if (bytes_written != len) {
+        ESP_LOGE(TAG, "Failed to append all bytes to file %s (wrote %d of %d)", path, bytes_written, len);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
 esp_err_t storage_delete_file(const char *path) {
     int ret = remove(path);
     if (ret != 0) {
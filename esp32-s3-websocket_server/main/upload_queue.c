@@ -0,0 +1,473 @@
+/**
+ * @file upload_queue.c
+ * @brief Background S3 upload + MQTT notify pipeline.
+ *
+ * handle_unknown_face() used to block the recognition path on two fresh TLS
+ * handshakes (pre-signed URL GET + S3 PUT). Now it only copies the image into
+ * a job and returns. This task:
+ *  - collects due jobs and fetches all their pre-signed URLs back-to-back on
+ *    ONE kept-alive API Gateway connection, then PUTs them on ONE kept-alive
+ *    bucket connection (batching the handshakes away),
+ *  - retries failures with exponential backoff,
+ *  - spills jobs to flash (/spiffs/upq_N.bin) while Wi-Fi (or MQTT, for the
+ *    notification) is down, and picks them up again when it is back, also
+ *    after a reboot.
+ */
+#include "upload_queue.h"
+#include "s3_uploader.h"
+#include "mqtt.h"
+#include "wifi.h"
+#include "time_sync.h"
+#include "config.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const char* TAG = "UPLOAD_QUEUE";
+
+#define SPILL_DIR "/spiffs"
+#define SPILL_MAGIC 0x31515055 // "UPQ1"
+#define PRESIGNED_URL_MAX_LEN 2048
+
+typedef struct {
+    char key[UPLOAD_KEY_MAX_LEN];
+    char content_type[UPLOAD_CONTENT_TYPE_MAX_LEN];
+    uint8_t* data;        // payload, freed once uploaded
+    size_t len;
+    bool notify;          // publish faces/unknown after the upload
+    bool uploaded;        // only the MQTT notify is left
+    uint8_t attempts;
+    int64_t next_try_us;
+    uint32_t spill_seq;   // flash copy (0: none)
+    bool spill_uploaded;  // state recorded in the flash copy
+} upload_job_t;
+
+typedef struct {
+    uint32_t magic;
+    char key[UPLOAD_KEY_MAX_LEN];
+    char content_type[UPLOAD_CONTENT_TYPE_MAX_LEN];
+    uint8_t notify;
+    uint8_t uploaded;
+    uint8_t reserved[2];
+    uint32_t len; // payload bytes following the header (0 when uploaded)
+} spill_header_t;
+
+static QueueHandle_t s_queue = NULL;
+static upload_job_t* s_pending[UPLOAD_PENDING_MAX];
+static int s_pending_count = 0;
+static uint32_t s_spill_next = 1; // next sequence number, 0 means "not spilled"
+static int s_spill_count = 0;
+static upload_queue_stats_t s_stats = { 0 };
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define STATS_INC(field) do { taskENTER_CRITICAL(&s_stats_lock); s_stats.field++; taskEXIT_CRITICAL(&s_stats_lock); } while (0)
+
+static void spill_path(uint32_t seq, char* path, size_t len) {
+    snprintf(path, len, SPILL_DIR "/upq_%u.bin", (unsigned)seq);
+}
+
+static void free_job(upload_job_t* job) {
+    if (!job) return;
+    heap_caps_free(job->data);
+    free(job);
+}
+
+static void delete_spill_file(upload_job_t* job) {
+    if (job->spill_seq == 0) return;
+    char path[32];
+    spill_path(job->spill_seq, path, sizeof(path));
+    if (remove(path) == 0) {
+        s_spill_count--;
+    }
+    job->spill_seq = 0;
+}
+
+/* Job done (or given up): forget it everywhere */
+static void finish_job(int index) {
+    upload_job_t* job = s_pending[index];
+    delete_spill_file(job);
+    free_job(job);
+    memmove(&s_pending[index], &s_pending[index + 1], (s_pending_count - index - 1) * sizeof(upload_job_t*));
+    s_pending_count--;
+}
+
+/* Exponential backoff. Returns false if the job was dropped. */
+static bool schedule_retry(int index) {
+    upload_job_t* job = s_pending[index];
+    job->attempts++;
+    if (job->attempts > UPLOAD_MAX_RETRIES) {
+        ESP_LOGE(TAG, "Giving up on %s after %d attempts.", job->key, job->attempts);
+        STATS_INC(failed);
+        finish_job(index);
+        return false;
+    }
+    int64_t delay_ms = (int64_t)UPLOAD_RETRY_BASE_MS << (job->attempts - 1);
+    if (delay_ms > UPLOAD_RETRY_MAX_MS) delay_ms = UPLOAD_RETRY_MAX_MS;
+    job->next_try_us = esp_timer_get_time() + delay_ms * 1000;
+    STATS_INC(retries);
+    ESP_LOGW(TAG, "%s: attempt %d failed, retry in %lld ms.", job->key, job->attempts, (long long)delay_ms);
+    return true;
+}
+
+/* Write the job to flash and drop its RAM copy. Returns false if it had to be dropped. */
+static bool spill_job(int index) {
+    upload_job_t* job = s_pending[index];
+
+    if (job->spill_seq != 0 && job->spill_uploaded == job->uploaded) {
+        // Flash copy is up to date, only release the RAM
+        job->spill_seq = 0; // keep the file
+        free_job(job);
+        memmove(&s_pending[index], &s_pending[index + 1], (s_pending_count - index - 1) * sizeof(upload_job_t*));
+        s_pending_count--;
+        return true;
+    }
+    delete_spill_file(job); // outdated copy (it has been uploaded since)
+
+    if (s_spill_count >= UPLOAD_SPILL_MAX_FILES) {
+        ESP_LOGE(TAG, "Spill queue full (%d files), dropping %s.", s_spill_count, job->key);
+        STATS_INC(failed);
+        finish_job(index);
+        return false;
+    }
+
+    spill_header_t header = { .magic = SPILL_MAGIC };
+    strncpy(header.key, job->key, sizeof(header.key) - 1);
+    strncpy(header.content_type, job->content_type, sizeof(header.content_type) - 1);
+    header.notify = job->notify;
+    header.uploaded = job->uploaded;
+    header.len = job->uploaded ? 0 : job->len;
+
+    uint32_t seq = s_spill_next++;
+    char path[32];
+    spill_path(seq, path, sizeof(path));
+    FILE* f = fopen(path, "wb");
+    bool ok = f && fwrite(&header, 1, sizeof(header), f) == sizeof(header) &&
+              (header.len == 0 || fwrite(job->data, 1, header.len, f) == header.len);
+    if (f) fclose(f);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to spill %s to %s, dropping it.", job->key, path);
+        remove(path);
+        STATS_INC(failed);
+        finish_job(index);
+        return false;
+    }
+    s_spill_count++;
+    STATS_INC(spilled);
+    ESP_LOGI(TAG, "Offline: %s spilled to %s (%d on flash).", job->key, path, s_spill_count);
+
+    free_job(job);
+    memmove(&s_pending[index], &s_pending[index + 1], (s_pending_count - index - 1) * sizeof(upload_job_t*));
+    s_pending_count--;
+    return true;
+}
+
+static bool job_in_ram(uint32_t seq) {
+    for (int i = 0; i < s_pending_count; i++) {
+        if (s_pending[i]->spill_seq == seq) return true;
+    }
+    return false;
+}
+
+/* Oldest spill file newer than seq `after` and not in RAM yet, 0 if none.
+ * Few files, so a scan per lookup is fine. */
+static uint32_t oldest_spill_after(uint32_t after) {
+    DIR* dir = opendir(SPILL_DIR);
+    if (!dir) return 0;
+    uint32_t oldest = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned seq;
+        if (sscanf(entry->d_name, "upq_%u.bin", &seq) == 1 && seq > after && !job_in_ram(seq) &&
+            (oldest == 0 || seq < oldest)) {
+            oldest = seq;
+        }
+    }
+    closedir(dir);
+    return oldest;
+}
+
+/* Read spilled jobs back, oldest first, while there is room in RAM.
+ * Notify-only files wait for MQTT: meanwhile the oldest image upload goes. */
+static void restore_spilled(bool mqtt_up) {
+    if (s_spill_count == 0 || s_pending_count >= UPLOAD_PENDING_MAX) return;
+
+    uint32_t oldest = 0;
+    char path[32];
+    FILE* f = NULL;
+    spill_header_t header;
+    upload_job_t* job = NULL;
+    while ((oldest = oldest_spill_after(oldest)) != 0) {
+        spill_path(oldest, path, sizeof(path));
+        f = fopen(path, "rb");
+        if (!f) continue;
+        if (fread(&header, 1, sizeof(header), f) != sizeof(header) || header.magic != SPILL_MAGIC) {
+            ESP_LOGE(TAG, "Corrupted spill file %s, deleted.", path);
+            fclose(f);
+            if (remove(path) == 0) s_spill_count--;
+            continue;
+        }
+        if (header.uploaded && !mqtt_up) {
+            fclose(f); // notify only, and MQTT is still down: try a newer one
+            continue;
+        }
+        break;
+    }
+    if (oldest == 0) return;
+
+    job = (upload_job_t*)calloc(1, sizeof(upload_job_t));
+    if (job && header.len > 0) {
+        job->data = (uint8_t*)heap_caps_malloc(header.len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!job->data || fread(job->data, 1, header.len, f) != header.len) {
+            free_job(job);
+            job = NULL;
+        }
+    }
+    fclose(f);
+    if (!job) {
+        ESP_LOGE(TAG, "Failed to restore %s.", path);
+        return;
+    }
+    memcpy(job->key, header.key, sizeof(job->key));
+    job->key[sizeof(job->key) - 1] = '\0';
+    memcpy(job->content_type, header.content_type, sizeof(job->content_type));
+    job->content_type[sizeof(job->content_type) - 1] = '\0';
+    job->len = header.len;
+    job->notify = header.notify;
+    job->uploaded = header.uploaded;
+    job->spill_seq = oldest;
+    job->spill_uploaded = header.uploaded;
+    s_pending[s_pending_count++] = job;
+    STATS_INC(restored);
+    ESP_LOGI(TAG, "Restored %s from %s.", job->key, path);
+}
+
+/* Find the spill files left by a previous run */
+static void scan_spill_dir(void) {
+    DIR* dir = opendir(SPILL_DIR);
+    if (!dir) return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned seq;
+        if (sscanf(entry->d_name, "upq_%u.bin", &seq) == 1) {
+            s_spill_count++;
+            if (seq >= s_spill_next) s_spill_next = seq + 1;
+        }
+    }
+    closedir(dir);
+    if (s_spill_count > 0) {
+        ESP_LOGI(TAG, "%d spilled upload(s) found on flash.", s_spill_count);
+    }
+}
+
+static void publish_unknown_face(const char* key) {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "event", "unknown_face_detected");
+    cJSON_AddStringToObject(root, "s3_key", key);
+    cJSON_AddStringToObject(root, "device_id", AWS_IOT_CLIENT_ID);
+
+    char* json_payload = cJSON_PrintUnformatted(root);
+    if (json_payload) {
+        mqtt_publish_message(get_mqtt_client(), "faces/unknown", json_payload, 1, 0);
+        free(json_payload);
+    }
+    else {
+        ESP_LOGE(TAG, "Failed to print JSON payload for MQTT.");
+    }
+    cJSON_Delete(root);
+}
+
+/* One round over the due jobs: URLs first, then PUTs, then notifications */
+static void process_due(s3_session_t* session, bool mqtt_up) {
+    int64_t now = esp_timer_get_time();
+    upload_job_t* batch[UPLOAD_BATCH_MAX];
+    char* urls[UPLOAD_BATCH_MAX] = { 0 };
+    int n = 0;
+
+    for (int i = 0; i < s_pending_count && n < UPLOAD_BATCH_MAX; i++) {
+        if (!s_pending[i]->uploaded && s_pending[i]->next_try_us <= now) {
+            batch[n++] = s_pending[i];
+        }
+    }
+
+    // Phase 1: all pre-signed URLs on the same API Gateway connection
+    for (int b = 0; b < n; b++) {
+        urls[b] = (char*)malloc(PRESIGNED_URL_MAX_LEN);
+        if (!urls[b]) break;
+        if (s3_uploader_session_get_presigned_url(session, batch[b]->key, urls[b], PRESIGNED_URL_MAX_LEN) != ESP_OK) {
+            free(urls[b]);
+            urls[b] = NULL;
+        }
+    }
+    // Phase 2: all PUTs on the same bucket connection
+    for (int b = 0; b < n; b++) {
+        if (urls[b] && s3_uploader_session_upload_by_url(session, urls[b], batch[b]->data, batch[b]->len,
+                                                         batch[b]->content_type) == ESP_OK) {
+            ESP_LOGI(TAG, "Image %s uploaded to S3.", batch[b]->key);
+            STATS_INC(uploaded);
+            batch[b]->uploaded = true;
+            batch[b]->attempts = 0;
+            batch[b]->next_try_us = 0;
+            heap_caps_free(batch[b]->data);
+            batch[b]->data = NULL;
+        }
+        free(urls[b]);
+    }
+    // Failed uploads: backoff. Iterate backwards, finish/retry can remove entries.
+    for (int i = s_pending_count - 1; i >= 0; i--) {
+        upload_job_t* job = s_pending[i];
+        bool in_batch = false;
+        for (int b = 0; b < n; b++) in_batch |= (batch[b] == job);
+        if (in_batch && !job->uploaded) {
+            schedule_retry(i);
+        }
+    }
+
+    // Phase 3: notifications of uploaded jobs
+    now = esp_timer_get_time();
+    for (int i = 0; i < s_pending_count;) {
+        upload_job_t* job = s_pending[i];
+        if (!job->uploaded || job->next_try_us > now) {
+            i++;
+            continue;
+        }
+        if (!job->notify) {
+            finish_job(i);
+        }
+        else if (mqtt_up) {
+            publish_unknown_face(job->key);
+            STATS_INC(notified);
+            finish_job(i);
+        }
+        else {
+            // Uploaded, but MQTT is down: keep the (small) notification on flash
+            ESP_LOGW(TAG, "MQTT not connected, cannot publish notification for %s yet.", job->key);
+            spill_job(i);
+        }
+    }
+}
+
+static TickType_t next_wait_ticks(bool session_open) {
+    if (s_pending_count > 0) {
+        int64_t now = esp_timer_get_time();
+        int64_t earliest = INT64_MAX;
+        for (int i = 0; i < s_pending_count; i++) {
+            if (s_pending[i]->next_try_us < earliest) earliest = s_pending[i]->next_try_us;
+        }
+        int64_t wait_ms = earliest > now ? (earliest - now) / 1000 : 0;
+        if (wait_ms > UPLOAD_POLL_MS) wait_ms = UPLOAD_POLL_MS;
+        return pdMS_TO_TICKS(wait_ms);
+    }
+    if (s_spill_count > 0 || session_open) {
+        return pdMS_TO_TICKS(UPLOAD_POLL_MS); // wait for the network / idle timeout
+    }
+    return portMAX_DELAY;
+}
+
+static void upload_task(void* arg) {
+    s3_session_t session = { 0 };
+    int64_t last_activity_us = 0;
+
+    while (true) {
+        bool session_open = session.api_client || session.s3_client;
+        TickType_t wait = next_wait_ticks(session_open);
+        upload_job_t* job = NULL;
+
+        if (s_pending_count < UPLOAD_PENDING_MAX) {
+            if (xQueueReceive(s_queue, &job, wait) == pdTRUE) {
+                s_pending[s_pending_count++] = job;
+                while (s_pending_count < UPLOAD_PENDING_MAX && xQueueReceive(s_queue, &job, 0) == pdTRUE) {
+                    s_pending[s_pending_count++] = job;
+                }
+            }
+        }
+        else {
+            vTaskDelay(wait > 0 ? wait : 1);
+        }
+
+        bool network_up = wifi_is_connected() && is_time_synchronized();
+        bool mqtt_up = network_up && mqtt_is_connected();
+        if (!network_up) {
+            // Nothing can be sent: move everything to flash, release RAM and TLS buffers
+            for (int i = s_pending_count - 1; i >= 0; i--) {
+                spill_job(i);
+            }
+            s3_uploader_session_close(&session);
+            continue;
+        }
+
+        restore_spilled(mqtt_up);
+        if (s_pending_count > 0) {
+            process_due(&session, mqtt_up);
+            last_activity_us = esp_timer_get_time();
+        }
+        else if (session_open && esp_timer_get_time() - last_activity_us > (int64_t)UPLOAD_IDLE_CLOSE_MS * 1000) {
+            ESP_LOGD(TAG, "Idle, closing kept-alive connections.");
+            s3_uploader_session_close(&session);
+        }
+    }
+}
+
+esp_err_t upload_queue_start(void) {
+    if (s_queue) return ESP_OK;
+
+    s_queue = xQueueCreate(UPLOAD_QUEUE_DEPTH, sizeof(upload_job_t*));
+    if (!s_queue) {
+        ESP_LOGE(TAG, "Failed to create the upload queue.");
+        return ESP_ERR_NO_MEM;
+    }
+    scan_spill_dir();
+    if (xTaskCreatePinnedToCore(upload_task, "upload_queue", UPLOAD_TASK_STACK_SIZE, NULL,
+                                UPLOAD_TASK_PRIORITY, NULL, UPLOAD_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the upload task.");
+        vQueueDelete(s_queue);
+        s_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t upload_queue_submit(const char* key, const uint8_t* data, size_t len,
+                              const char* content_type, bool notify_unknown) {
+    if (!key || !data || len == 0 || !content_type) return ESP_ERR_INVALID_ARG;
+    if (!s_queue) return ESP_ERR_INVALID_STATE;
+
+    upload_job_t* job = (upload_job_t*)calloc(1, sizeof(upload_job_t));
+    if (!job) return ESP_ERR_NO_MEM;
+    job->data = (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!job->data) {
+        free(job);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(job->data, data, len);
+    job->len = len;
+    strncpy(job->key, key, sizeof(job->key) - 1);
+    strncpy(job->content_type, content_type, sizeof(job->content_type) - 1);
+    job->notify = notify_unknown;
+
+    if (xQueueSend(s_queue, &job, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Upload queue full, %s dropped.", key);
+        free_job(job);
+        STATS_INC(failed);
+        return ESP_ERR_NO_MEM;
+    }
+    STATS_INC(queued);
+    return ESP_OK;
+}
+
+void upload_queue_get_stats(upload_queue_stats_t* out_stats) {
+    if (!out_stats) return;
+    taskENTER_CRITICAL(&s_stats_lock);
+    *out_stats = s_stats;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
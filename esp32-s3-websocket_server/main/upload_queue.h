@@ -0,0 +1,57 @@
+/**
+ * @file upload_queue.h
+ * @brief Background S3 upload + MQTT notify pipeline.
+ * Callers queue a payload and return immediately. A dedicated task fetches
+ * the pre-signed URLs, uploads over kept-alive connections, retries with
+ * backoff, and spills pending jobs to flash while Wi-Fi is down.
+ */
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UPLOAD_KEY_MAX_LEN 64
+#define UPLOAD_CONTENT_TYPE_MAX_LEN 32
+
+typedef struct {
+    uint32_t queued;
+    uint32_t uploaded;
+    uint32_t notified;
+    uint32_t retries;
+    uint32_t failed;    // dropped after UPLOAD_MAX_RETRIES or queue full
+    uint32_t spilled;   // written to flash while offline
+    uint32_t restored;  // read back from flash
+} upload_queue_stats_t;
+
+/**
+ * @brief Starts the uploader task. Spilled jobs from a previous run are picked up.
+ * @return ESP_OK, or ESP_ERR_NO_MEM.
+ */
+esp_err_t upload_queue_start(void);
+
+/**
+ * @brief Queues one upload. Copies data (PSRAM), never blocks.
+ * @param key S3 object name (filename for the pre-signed URL).
+ * @param data Payload.
+ * @param len Payload size.
+ * @param content_type MIME type of the PUT.
+ * @param notify_unknown After the upload, publish the faces/unknown MQTT event with the key.
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if the queue is full or out of memory.
+ */
+esp_err_t upload_queue_submit(const char* key, const uint8_t* data, size_t len,
+                              const char* content_type, bool notify_unknown);
+
+void upload_queue_get_stats(upload_queue_stats_t* out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UPLOAD_QUEUE_H
@@ -1,8 +1,8 @@
 /* Code was taken from espidff examples and internet provided. 
  * Functionalities were used as-is.
  * The only job that the websocket server does, is upon receipt 
- * of an imnage, pass it to the image_processor module, and free 
- * the memory to be ready for the next one.
+ * of an imnage, hand it over to the inference worker queue, and be
+ * ready for the next one (it never waits for the recognition).
  * ADVICE: Dont insert other intelligence here, the websocket 
  * server has to remain agnostic.
  */
@@ -24,7 +24,14 @@
 #include "websocket_server.h"
 #include "config.h"
 #include "cJSON.h"
-#include "image_processor.h" // pass the incoming image to the image processor. No other function on image here
+#include "image_processor.h"
+#include "frame_decoder.h"
+#include "frame_header.h"
+#include "face_align.h"
+#include "inference_worker.h" // queue the incoming image for the image processor. No other function on image here
+#include "frame_pool.h"
+#include "perf_trace.h"
+#include "esp_timer.h"
 
 #ifndef WEBSOCKET_PORT
 #define WEBSOCKET_PORT 80
@@ -41,6 +48,7 @@ typedef struct {
     size_t received_size;
     bool is_receiving;
     uint32_t id;
+    int format; // frame_format_t of the payload
     int width;
     int height;
     // face bounding box coordinates
@@ -49,6 +57,15 @@ typedef struct {
     int face_w;
     int face_h;
     std::vector<int> keypoints; // store received keypoints
+    bool binary_header;   // started by a frame_header_t: complete when total_size bytes arrived, no frame_end
+    uint32_t payload_crc; // from the binary header, 0: not checked
+    bool windowed;        // chunks carry a frame_chunk_header_t, progress is acked
+    size_t acked_size;    // offset last reported with frame_progress
+    size_t resend_requested; // offset of the last resend request (+1, 0: none)
+    int64_t receive_start_us; // frame_start / first binary message, for the trace
+    int batch_index;      // binary header: position in a batched transfer
+    int batch_count;      // faces in the batch, <= 1: a single transfer
+    bool aligned;         // binary header: a tile aligned by the CAM (FRAME_FLAG_ALIGNED)
 } frame_receive_state_t;
 
 typedef struct {
@@ -59,6 +76,14 @@ typedef struct {
 static httpd_handle_t server_handle = NULL;
 static ws_client_t ws_clients[MAX_WEBSOCKET_CLIENTS];
 static frame_receive_state_t client_frame_states[MAX_WEBSOCKET_CLIENTS];
+static std::vector<inference_job_t> client_batches[MAX_WEBSOCKET_CLIENTS]; // faces of a batched transfer received so far
+static int64_t client_batch_touched_us[MAX_WEBSOCKET_CLIENTS]; // last face of the batch started or held
+static esp_timer_handle_t s_batch_timer = NULL;
+static uint8_t s_drain_buffer[FRAME_DRAIN_BUFFER_SIZE]; // httpd task only
+
+// Message headers are received into the slot headroom, in front of the payload
+static_assert(sizeof(frame_header_t) <= FRAME_POOL_HEADROOM, "FRAME_POOL_HEADROOM too small for frame_header_t");
+static_assert(sizeof(frame_chunk_header_t) <= FRAME_POOL_HEADROOM, "FRAME_POOL_HEADROOM too small for frame_chunk_header_t");
 
 static void ws_async_send(void* arg);
 static esp_err_t websocket_handler(httpd_req_t* req);
@@ -88,17 +113,15 @@ static void reset_client_frame_state(int fd) {
     int client_index = find_client_index_by_fd(fd);
     if (client_index != -1) {
         if (client_frame_states[client_index].buffer) {
-            ESP_LOGD(TAG, "Freeing frame buffer for client %d", fd);
-            free(client_frame_states[client_index].buffer);
-            ESP_LOGD(TAG, "Free heap after buffer free (reset_state): %" 
-                    PRIu32, (uint32_t)heap_caps_get_free_size(
-                            MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+            ESP_LOGD(TAG, "Releasing frame slot for client %d", fd);
+            frame_pool_release(client_frame_states[client_index].buffer);
         }
         client_frame_states[client_index].buffer = NULL;
         client_frame_states[client_index].is_receiving = false;
         client_frame_states[client_index].received_size = 0;
         client_frame_states[client_index].total_size = 0;
         client_frame_states[client_index].id = 0;
+        client_frame_states[client_index].format = FRAME_FORMAT_RGB565;
         client_frame_states[client_index].width = 0;
         client_frame_states[client_index].height = 0;
         client_frame_states[client_index].face_x = 0;
@@ -106,10 +129,26 @@ static void reset_client_frame_state(int fd) {
         client_frame_states[client_index].face_w = 0;
         client_frame_states[client_index].face_h = 0;
         client_frame_states[client_index].keypoints.clear();
+        client_frame_states[client_index].binary_header = false;
+        client_frame_states[client_index].payload_crc = 0;
+        client_frame_states[client_index].windowed = false;
+        client_frame_states[client_index].acked_size = 0;
+        client_frame_states[client_index].resend_requested = 0;
+        client_frame_states[client_index].batch_index = 0;
+        client_frame_states[client_index].batch_count = 0;
+        client_frame_states[client_index].aligned = false;
         ESP_LOGD(TAG, "Client frame state reset for fd %d", fd);
     }
 }
 
+// Drops the faces of an unfinished batched transfer
+static void release_client_batch(int client_index) {
+    for (const inference_job_t& job : client_batches[client_index]) {
+        frame_pool_release(job.buffer);
+    }
+    client_batches[client_index].clear();
+}
+
 static void server_event_handler(void* arg, esp_event_base_t event_base,
     int32_t event_id, void* event_data) {
     if (event_base == ESP_HTTP_SERVER_EVENT) {
@@ -119,6 +158,7 @@ static void server_event_handler(void* arg, esp_event_base_t event_base,
             reset_client_frame_state(sockfd);
             int client_index = find_client_index_by_fd(sockfd);
             if (client_index != -1) {
+                release_client_batch(client_index);
                 ws_clients[client_index].active = false;
                 ws_clients[client_index].fd = -1;
             }
@@ -126,6 +166,304 @@ static void server_event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+/* Reads the current message into s_drain_buffer and drops it, no allocation:
+ * frames refused for lack of a slot (backpressure) go through here.
+ * head (optional) gets its frame header: true in *head_valid if it has one.
+ * httpd_ws_recv_frame() only reads whole messages and the CAM sends at most
+ * FRAME_DRAIN_BUFFER_SIZE bytes per message: a longer one gets frame_busy
+ * and its session is closed. */
+static esp_err_t ws_discard(httpd_req_t* req, httpd_ws_frame_t* ws_pkt, frame_header_t* head, bool* head_valid) {
+    if (head_valid) {
+        *head_valid = false;
+    }
+    if (ws_pkt->len > sizeof(s_drain_buffer)) {
+        int fd = httpd_req_to_sockfd(req);
+        ESP_LOGE(TAG, "Message of %zu bytes from fd %d too long to drain, closing the session.", ws_pkt->len, fd);
+        websocket_server_send_text_client(fd, "{\"type\":\"frame_busy\",\"reason\":\"too_long\"}");
+        httpd_sess_trigger_close(req->handle, fd); // queued after the reply
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ws_pkt->payload = s_drain_buffer;
+    esp_err_t ret = httpd_ws_recv_frame(req, ws_pkt, ws_pkt->len);
+    if (ret == ESP_OK && head && head_valid) {
+        *head_valid = frame_header_check(s_drain_buffer, ws_pkt->len, head);
+    }
+    return ret;
+}
+
+/* Batched transfer: the last face is in (or failed), hand the batch over to the
+ * inference worker in one go. One answer for all, with the id of the last face. */
+static void submit_client_batch(int fd, int client_index, uint32_t last_id) {
+    std::vector<inference_job_t>& batch = client_batches[client_index];
+    int queued = 0;
+    bool accepted = !batch.empty() && inference_worker_submit_batch(batch.data(), (int)batch.size(), &queued) == ESP_OK;
+    ESP_LOGI(TAG, "Batch of %zu faces (last %u) %s.", batch.size(), (unsigned int)last_id, accepted ? "queued" : "rejected");
+    char ack_msg[112];
+    snprintf(ack_msg, sizeof(ack_msg), "{\"type\":\"%s\",\"id\":%u,\"batch\":%d,\"queued\":%d,\"depth\":%d}",
+        accepted ? "frame_ack" : "frame_busy", (unsigned int)last_id, (int)batch.size(), queued, INFERENCE_QUEUE_DEPTH);
+    if (accepted) {
+        batch.clear(); // owned by the worker now
+    }
+    else {
+        release_client_batch(client_index);
+    }
+    websocket_server_send_text_client(fd, ack_msg);
+}
+
+/* A face of a batched transfer ended without being kept (no slot, bad header):
+ * if it was the last one, the faces held so far still go to the worker. */
+static void batch_face_failed(int fd, int client_index, const frame_header_t* header) {
+    if (header->batch_count > 1 && header->batch_index + 1 >= header->batch_count) {
+        submit_client_batch(fd, client_index, header->id);
+    }
+}
+
+/* Complete frame received (frame_end, or all bytes announced by the binary header):
+ * hand it over to the inference worker, or hold it until the end of its batch.
+ * The state is reset by the caller. */
+static void submit_received_frame(int fd, int client_index) {
+    frame_receive_state_t* state = &client_frame_states[client_index];
+    bool last_of_batch = state->batch_count > 1 && state->batch_index + 1 >= state->batch_count;
+    if (state->binary_header && state->payload_crc != 0) {
+        uint32_t crc = esp_rom_crc32_le(0, state->buffer, state->total_size);
+        if (crc != state->payload_crc) {
+            ESP_LOGE(TAG, "Frame %u payload CRC mismatch (0x%08" PRIx32 " != 0x%08" PRIx32 "), dropped.",
+                (unsigned int)state->id, crc, state->payload_crc);
+            char err_msg[80];
+            snprintf(err_msg, sizeof(err_msg), "{\"type\":\"frame_error\",\"id\":%u,\"reason\":\"crc\"}", (unsigned int)state->id);
+            websocket_server_send_text_client(fd, err_msg);
+            if (last_of_batch) {
+                submit_client_batch(fd, client_index, state->id);
+            }
+            return;
+        }
+    }
+
+    ESP_LOGI(TAG, "File transfer complete, size: %d", (int)state->total_size);
+
+    ESP_LOGD(TAG, "Queueing frame %u for inference: %zu bytes, %d x %d, box %d,%d,%d,%d, %zu keypoints",
+        (unsigned int)state->id,
+        state->total_size,
+        state->width, state->height,
+        state->face_x, state->face_y,
+        state->face_w, state->face_h,
+        state->keypoints.size());
+
+    inference_job_t job = {};
+    job.buffer = state->buffer;
+    job.len = state->total_size;
+    job.format = state->format;
+    job.width = state->width;
+    job.height = state->height;
+    job.face_x = state->face_x;
+    job.face_y = state->face_y;
+    job.face_w = state->face_w;
+    job.face_h = state->face_h;
+    job.keypoint_count = MIN((int)state->keypoints.size(), INFERENCE_MAX_KEYPOINTS);
+    for (int k = 0; k < job.keypoint_count; k++) {
+        job.keypoints[k] = state->keypoints[k];
+    }
+    job.aligned = state->aligned;
+    job.client_fd = fd;
+    job.frame_id = state->id;
+    perf_trace_span(PERF_STAGE_RECEIVE, job.frame_id, state->receive_start_us);
+
+    if (state->batch_count > 1) {
+        client_batches[client_index].push_back(job);
+        client_batch_touched_us[client_index] = esp_timer_get_time();
+        state->buffer = NULL; // held by the batch now
+        if (last_of_batch || (int)client_batches[client_index].size() >= FRAME_BATCH_MAX) {
+            submit_client_batch(fd, client_index, job.frame_id);
+        }
+        return;
+    }
+
+    /* Hand the frame to the inference worker. NO OTHER JOB HERE */
+    int queued = 0;
+    char ack_msg[96];
+    if (inference_worker_submit(&job, &queued) == ESP_OK) {
+        state->buffer = NULL; // owned by the worker now
+        snprintf(ack_msg, sizeof(ack_msg), "{\"type\":\"frame_ack\",\"id\":%u,\"queued\":%d,\"depth\":%d}",
+            (unsigned int)job.frame_id, queued, INFERENCE_QUEUE_DEPTH);
+    }
+    else { // backpressure: the slot is released by the caller's state reset
+        snprintf(ack_msg, sizeof(ack_msg), "{\"type\":\"frame_busy\",\"id\":%u,\"queued\":%d,\"depth\":%d}",
+            (unsigned int)job.frame_id, queued, INFERENCE_QUEUE_DEPTH);
+    }
+    websocket_server_send_text_client(fd, ack_msg);
+}
+
+/* httpd work, queued by s_batch_timer: a batch with no news for FRAME_BATCH_TIMEOUT_MS
+ * (batch_end lost, CAM gone quiet) is closed. The faces held go to the worker, a face
+ * of it still being received is dropped: its pool slots are not kept any longer. */
+static void expire_client_batches(void* arg) {
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < MAX_WEBSOCKET_CLIENTS; i++) {
+        frame_receive_state_t* state = &client_frame_states[i];
+        bool receiving = state->is_receiving && state->batch_count > 1;
+        if (!ws_clients[i].active || (client_batches[i].empty() && !receiving) ||
+            now - client_batch_touched_us[i] < (int64_t)FRAME_BATCH_TIMEOUT_MS * 1000) {
+            continue;
+        }
+        int fd = ws_clients[i].fd;
+        uint32_t last_id = receiving ? state->id : client_batches[i].back().frame_id;
+        ESP_LOGW(TAG, "Batch from fd %d idle for %d ms, closed with %zu faces.", fd, FRAME_BATCH_TIMEOUT_MS,
+            client_batches[i].size());
+        if (receiving) {
+            reset_client_frame_state(fd);
+        }
+        submit_client_batch(fd, i, last_id);
+    }
+}
+
+static void batch_timer_callback(void* arg) {
+    if (server_handle) {
+        httpd_queue_work(server_handle, expire_client_batches, NULL); // client state belongs to the httpd task
+    }
+}
+
+/* Binary protocol (frame_header.h): the first binary message holds the header and
+ * the first payload bytes, already received in place into slot (header in its headroom).
+ * slot is taken over: it becomes the frame buffer, or is released. */
+static void start_binary_frame(int fd, int client_index, uint8_t* slot, size_t first_bytes, const frame_header_t* header) {
+    frame_receive_state_t* state = &client_frame_states[client_index];
+    bool valid = header->width > 0 && header->height > 0 && header->payload_size > 0 &&
+                 first_bytes <= header->payload_size && header->payload_size <= frame_pool_slot_size();
+    if (header->format == FRAME_HEADER_FORMAT_RGB565) {
+        valid = valid && header->payload_size == (uint32_t)header->width * header->height * 2;
+    }
+    else if (header->format != FRAME_HEADER_FORMAT_JPEG || !FRAME_JPEG_ENABLED) {
+        valid = false;
+    }
+    if (header->flags & FRAME_FLAG_ALIGNED) {
+        valid = valid && header->width == FACE_ALIGN_SIZE && header->height == FACE_ALIGN_SIZE;
+    }
+    if (!valid) {
+        ESP_LOGE(TAG, "Invalid binary frame header from fd %d: id %u, format %d, %dx%d, %u bytes (%zu in first message).",
+            fd, (unsigned int)header->id, header->format, header->width, header->height,
+            (unsigned int)header->payload_size, first_bytes);
+        frame_pool_release(slot);
+        batch_face_failed(fd, client_index, header);
+        return;
+    }
+    if (header->batch_count > 1 && header->batch_index == 0 && !client_batches[client_index].empty()) {
+        ESP_LOGW(TAG, "New batch from fd %d before the end of the previous one, %zu faces dropped.",
+            fd, client_batches[client_index].size());
+        release_client_batch(client_index);
+    }
+
+    state->buffer = slot;
+    state->total_size = header->payload_size;
+    state->received_size = first_bytes;
+    state->id = header->id;
+    state->format = header->format == FRAME_HEADER_FORMAT_JPEG ? FRAME_FORMAT_JPEG : FRAME_FORMAT_RGB565;
+    state->width = header->width;
+    state->height = header->height;
+    state->face_x = header->box_x;
+    state->face_y = header->box_y;
+    state->face_w = header->box_w;
+    state->face_h = header->box_h;
+    state->keypoints.clear();
+    for (int k = 0; k < FRAME_HEADER_KEYPOINTS; k++) {
+        state->keypoints.push_back(header->keypoints[k]); // packed struct: no pointers into it
+    }
+    state->binary_header = true;
+    state->payload_crc = header->payload_crc;
+    state->windowed = (header->flags & FRAME_FLAG_WINDOWED) && FRAME_RECV_WINDOW > 0;
+    state->acked_size = 0;
+    state->resend_requested = 0;
+    state->receive_start_us = esp_timer_get_time();
+    state->batch_index = header->batch_index;
+    state->batch_count = MIN((int)header->batch_count, FRAME_BATCH_MAX);
+    if (state->batch_count > 1) {
+        client_batch_touched_us[client_index] = state->receive_start_us;
+    }
+    state->aligned = (header->flags & FRAME_FLAG_ALIGNED) != 0;
+    state->is_receiving = true;
+    ESP_LOGI(TAG, "\033[1;33m↓↓↓ New incoming image ↓↓↓\033[0m");
+    ESP_LOGD(TAG, "Incoming image (binary header): %s%s, Size: %u, Dimensions: %dx%d, %zu bytes in first message",
+        state->format == FRAME_FORMAT_JPEG ? "JPEG" : "RGB565", state->aligned ? " aligned" : "",
+        (unsigned int)state->total_size, state->width, state->height, first_bytes);
+
+    if (state->received_size == state->total_size) { // single message fast path
+        submit_received_frame(fd, client_index);
+        reset_client_frame_state(fd);
+    }
+}
+
+/* Windowed mode: contiguous offset received so far. resend: a gap was seen, the CAM restarts from offset. */
+static void send_frame_progress(int fd, frame_receive_state_t* state, bool resend) {
+    char msg[112];
+    snprintf(msg, sizeof(msg), "{\"type\":\"frame_progress\",\"id\":%u,\"offset\":%u,\"window\":%d,\"resend\":%d}",
+        (unsigned int)state->id, (unsigned int)state->received_size, FRAME_RECV_WINDOW, resend ? 1 : 0);
+    websocket_server_send_text_client(fd, msg);
+    state->acked_size = state->received_size;
+}
+
+/* Windowed mode chunk: [frame_chunk_header_t][data], read ONCE straight into the frame slot.
+ * The chunk header lands just before the write position, in the slot headroom or on
+ * payload bytes that are saved and restored around the read. */
+static esp_err_t receive_windowed_chunk(httpd_req_t* req, int client_index, httpd_ws_frame_t* ws_pkt) {
+    int fd = httpd_req_to_sockfd(req);
+    frame_receive_state_t* state = &client_frame_states[client_index];
+    const size_t header_len = sizeof(frame_chunk_header_t);
+    frame_chunk_header_t chunk = {};
+    esp_err_t ret;
+
+    if (ws_pkt->len < header_len || ws_pkt->len - header_len > frame_pool_slot_size() - state->received_size) {
+        ret = ws_discard(req, ws_pkt, NULL, NULL); // cannot be a chunk of this frame
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "httpd_ws_recv_frame (chunk) error %d: %s for fd %d", ret, esp_err_to_name(ret), fd);
+            reset_client_frame_state(fd);
+            return ret;
+        }
+        ESP_LOGW(TAG, "Oversized chunk from fd %d (%zu bytes, have %zu of %zu), ignored.", fd, ws_pkt->len,
+            state->received_size, state->total_size);
+        return ESP_OK;
+    }
+
+    size_t data_len = ws_pkt->len - header_len;
+    uint8_t* msg = state->buffer + state->received_size - header_len;
+    uint8_t saved[sizeof(frame_chunk_header_t)];
+    memcpy(saved, msg, header_len);
+    ws_pkt->payload = msg;
+    ret = httpd_ws_recv_frame(req, ws_pkt, ws_pkt->len);
+    memcpy(&chunk, msg, header_len);
+    memcpy(msg, saved, header_len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "httpd_ws_recv_frame (chunk) error %d: %s for fd %d", ret, esp_err_to_name(ret), fd);
+        reset_client_frame_state(fd);
+        return ret;
+    }
+    if (chunk.magic != FRAME_CHUNK_MAGIC || chunk.id != state->id) {
+        ESP_LOGW(TAG, "Stray chunk from fd %d (frame %u, expecting %u), ignored.", fd, (unsigned int)chunk.id, (unsigned int)state->id);
+        return ESP_OK;
+    }
+
+    // Data is already in place; past received_size it is simply not counted
+    if (chunk.offset == state->received_size && data_len <= state->total_size - state->received_size) {
+        state->received_size += data_len;
+    }
+    else if (chunk.offset > state->received_size) {
+        // Gap: ask once per offset to resume from what we have
+        if (state->resend_requested != state->received_size + 1) {
+            ESP_LOGW(TAG, "Frame %u: chunk at %u, expected %zu. Requesting resend.",
+                (unsigned int)state->id, (unsigned int)chunk.offset, state->received_size);
+            state->resend_requested = state->received_size + 1;
+            send_frame_progress(fd, state, true);
+        }
+    } // else: duplicate of data already received (resend overlap), ignored
+
+    if (state->received_size == state->total_size) {
+        submit_received_frame(fd, client_index); // the final frame_ack also acks the last bytes
+        reset_client_frame_state(fd);
+    }
+    else if (state->received_size - state->acked_size >= FRAME_RECV_WINDOW / 2) {
+        send_frame_progress(fd, state, false); // return credit before the CAM runs out
+    }
+    return ESP_OK;
+}
+
 static esp_err_t websocket_handler(httpd_req_t* req) {
     if (req->method == HTTP_GET) {
         ESP_LOGI(TAG, "Client connected with fd %d", httpd_req_to_sockfd(req));
@@ -143,8 +481,12 @@ static esp_err_t websocket_handler(httpd_req_t* req) {
             ws_clients[client_index].active = true;
             reset_client_frame_state(sockfd); // Reset state on new connection
             ESP_LOGD(TAG, "Client fd: %d added to list at index %d", sockfd, client_index);
-            char welcome_msg[64];
-            snprintf(welcome_msg, sizeof(welcome_msg), "Welcome, client fd %d!", sockfd);
+            char welcome_msg[112];
+            // Payload formats this server decodes (the client picks one per frame), the binary header version
+            // it accepts, the windowed transfer credit, the faces per batched transfer and the aligned tile size.
+            snprintf(welcome_msg, sizeof(welcome_msg), "Welcome, client fd %d! formats=%s framing=bin%d window=%d batch=%d align=%d", sockfd,
+                     FRAME_JPEG_ENABLED ? "jpeg,rgb565" : "rgb565", FRAME_HEADER_VERSION, FRAME_RECV_WINDOW, FRAME_BATCH_MAX,
+                     FACE_ALIGN_SIZE);
             websocket_server_send_text_client(sockfd, welcome_msg);
         }
         else {
@@ -224,13 +566,17 @@ static esp_err_t websocket_handler(httpd_req_t* req) {
                     cJSON* box_w = cJSON_GetObjectItem(root, "box_w");
                     cJSON* box_h = cJSON_GetObjectItem(root, "box_h");
                     cJSON* keypoints_array = cJSON_GetObjectItem(root, "keypoints");
+                    cJSON* format = cJSON_GetObjectItem(root, "format"); // optional, raw RGB565 if absent
+                    frame_format_t frame_format = frame_format_from_string(cJSON_IsString(format) ? format->valuestring : NULL);
 
                     if (cJSON_IsNumber(size) && cJSON_IsNumber(id) && cJSON_IsNumber(width) && cJSON_IsNumber(height) &&
                         cJSON_IsNumber(box_x) && cJSON_IsNumber(box_y) && cJSON_IsNumber(box_w) && cJSON_IsNumber(box_h) &&
-                        cJSON_IsArray(keypoints_array) && cJSON_GetArraySize(keypoints_array) == 10) {
+                        cJSON_IsArray(keypoints_array) && cJSON_GetArraySize(keypoints_array) == 10 &&
+                        frame_format != FRAME_FORMAT_UNKNOWN) {
 
                         client_frame_states[client_index].total_size = size->valueint;
                         client_frame_states[client_index].id = id->valueint;
+                        client_frame_states[client_index].format = frame_format;
                         client_frame_states[client_index].width = width->valueint;
                         client_frame_states[client_index].height = height->valueint;
                         client_frame_states[client_index].face_x = box_x->valueint;
@@ -255,28 +601,33 @@ static esp_err_t websocket_handler(httpd_req_t* req) {
                         }
 
                         client_frame_states[client_index].received_size = 0;
-                        client_frame_states[client_index].buffer = (uint8_t*)malloc(size->valueint);
+                        client_frame_states[client_index].buffer = size->valueint > 0 ? frame_pool_acquire(size->valueint) : NULL;
                         if (client_frame_states[client_index].buffer) {
                             client_frame_states[client_index].is_receiving = true;
+                            client_frame_states[client_index].receive_start_us = esp_timer_get_time();
                             ESP_LOGI(TAG, "\033[1;33m↓↓↓ New incoming image ↓↓↓\033[0m");
-                            ESP_LOGD(TAG, "Incoming image: Size: %d, Dimensions: %dx%d, Box: [%d,%d,%d,%d], Keypoints size: %zu",
+                            ESP_LOGD(TAG, "Incoming image: %s, Size: %d, Dimensions: %dx%d, Box: [%d,%d,%d,%d], Keypoints size: %zu",
+                                frame_format == FRAME_FORMAT_JPEG ? "JPEG" : "RGB565",
                                 (int)size->valueint, (int)width->valueint, (int)height->valueint,
                                 client_frame_states[client_index].face_x, client_frame_states[client_index].face_y,
                                 client_frame_states[client_index].face_w, client_frame_states[client_index].face_h,
                                 client_frame_states[client_index].keypoints.size());
 
-                            ESP_LOGD(TAG, "Free heap after buffer alloc: %" PRIu32, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
                             // Send acknowledgment for frame_start
                             const char* ack_msg = "{\"type\":\"frame_start_ack\"}";
                             websocket_server_send_text_client(httpd_req_to_sockfd(req), ack_msg);
                         }
-                        else {
-                            ESP_LOGE(TAG, "Failed to allocate buffer for frame ID %u!", (unsigned int)id->valueint);
-                            reset_client_frame_state(httpd_req_to_sockfd(req)); // Reset on buffer allocation failure
+                        else { // all slots busy (the CAM backs off and retries) or a frame that never fits
+                            bool fits = size->valueint > 0 && (size_t)size->valueint <= frame_pool_slot_size();
+                            char busy_msg[80];
+                            snprintf(busy_msg, sizeof(busy_msg), "{\"type\":\"%s\",\"id\":%u,\"reason\":\"%s\"}",
+                                fits ? "frame_busy" : "frame_error", (unsigned int)id->valueint, fits ? "no_slot" : "size");
+                            websocket_server_send_text_client(httpd_req_to_sockfd(req), busy_msg);
+                            reset_client_frame_state(httpd_req_to_sockfd(req));
                         }
                     }
                     else {
-                        ESP_LOGE(TAG, "Invalid frame_start JSON fields (missing/invalid numbers or keypoints array size != 10) received from fd %d. JSON: %s", httpd_req_to_sockfd(req), (const char*)buf);
+                        ESP_LOGE(TAG, "Invalid frame_start JSON fields (missing/invalid numbers, keypoints array size != 10 or unsupported format) received from fd %d. JSON: %s", httpd_req_to_sockfd(req), (const char*)buf);
                         reset_client_frame_state(httpd_req_to_sockfd(req)); // Reset on invalid JSON fields
                     }
 
@@ -284,33 +635,7 @@ static esp_err_t websocket_handler(httpd_req_t* req) {
                 else if (strcmp(type->valuestring, "frame_end") == 0) {
                     if (client_frame_states[client_index].is_receiving) {
                         if (client_frame_states[client_index].received_size == client_frame_states[client_index].total_size) {
-                            ESP_LOGI(TAG, "File transfer complete, size: %d", (int)client_frame_states[client_index].total_size);
-
-                            ESP_LOGD(TAG, "Ready to call image_processor_handle_new_image with:");
-                            ESP_LOGD(TAG, "  Buffer Addr: %p", client_frame_states[client_index].buffer);
-                            ESP_LOGD(TAG, "  Buffer Len: %zu", client_frame_states[client_index].total_size);
-                            ESP_LOGD(TAG, "  Cropped Img Dims (Width x Height): %d x %d",
-                                client_frame_states[client_index].width, client_frame_states[client_index].height);
-                            ESP_LOGD(TAG, "  Original Face Box (x,y,w,h): %d,%d,%d,%d",
-                                client_frame_states[client_index].face_x, client_frame_states[client_index].face_y,
-                                client_frame_states[client_index].face_w, client_frame_states[client_index].face_h);
-                            ESP_LOGD(TAG, "  Keypoints Count: %zu", client_frame_states[client_index].keypoints.size());
-                            ESP_LOGD(TAG, "  Free heap before image_processor: %" PRIu32 "", (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
-                            /* Pass the image to image_processor. NO OTHER JOB HERE */
-                            image_processor_handle_new_image(
-                                client_frame_states[client_index].buffer,
-                                client_frame_states[client_index].total_size,
-                                client_frame_states[client_index].width,
-                                client_frame_states[client_index].height,
-                                client_frame_states[client_index].face_x,
-                                client_frame_states[client_index].face_y,
-                                client_frame_states[client_index].face_w,
-                                client_frame_states[client_index].face_h,
-                                client_frame_states[client_index].keypoints
-                            );
-
-                            const char* ack_msg = "{\"type\":\"frame_ack\"}";
-                            websocket_server_send_text_client(httpd_req_to_sockfd(req), ack_msg);
+                            submit_received_frame(httpd_req_to_sockfd(req), client_index);
                         }
                         else {
                             ESP_LOGE(TAG, "Frame end for ID %u received, but size mismatch! Expected %d, got %d",
@@ -324,6 +649,26 @@ static esp_err_t websocket_handler(httpd_req_t* req) {
                     }
                     reset_client_frame_state(httpd_req_to_sockfd(req)); // Always reset state after frame_end
                 }
+                else if (strcmp(type->valuestring, "batch_end") == 0) {
+                    // The CAM could not send the last face of its batch: answer for the faces held
+                    int fd = httpd_req_to_sockfd(req);
+                    cJSON* id = cJSON_GetObjectItem(root, "id");
+                    if (client_frame_states[client_index].is_receiving && client_frame_states[client_index].batch_count > 1) {
+                        reset_client_frame_state(fd); // the last face, cut short
+                    }
+                    submit_client_batch(fd, client_index, cJSON_IsNumber(id) ? (uint32_t)id->valuedouble : 0);
+                }
+                else if (strcmp(type->valuestring, "stats") == 0) {
+                    // Latency trace + counters, {"type":"stats","since":seq,"max":n}, both optional
+                    cJSON* since = cJSON_GetObjectItem(root, "since");
+                    cJSON* max = cJSON_GetObjectItem(root, "max");
+                    char* stats = perf_trace_stats_json(cJSON_IsNumber(since) ? (uint32_t)since->valuedouble : 0,
+                                                        cJSON_IsNumber(max) ? max->valueint : 0);
+                    if (stats) {
+                        websocket_server_send_text_client(httpd_req_to_sockfd(req), stats);
+                        free(stats);
+                    }
+                }
                 else { // Unknown text message type
                     ESP_LOGW(TAG, "Received unknown text message type: %s from fd %d", type->valuestring, httpd_req_to_sockfd(req));
                 }
@@ -339,13 +684,22 @@ static esp_err_t websocket_handler(httpd_req_t* req) {
         }
     }
     else if (ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
-        if (client_frame_states[client_index].is_receiving) {
+        if (client_frame_states[client_index].is_receiving && client_frame_states[client_index].windowed && ws_pkt.len > 0) {
+            return receive_windowed_chunk(req, client_index, &ws_pkt);
+        }
+        else if (client_frame_states[client_index].is_receiving) {
             if (ws_pkt.len > 0 && (client_frame_states[client_index].received_size + ws_pkt.len <= client_frame_states[client_index].total_size)) {
                 // Read the binary payload into the pre-allocated buffer
                 ws_pkt.payload = client_frame_states[client_index].buffer + client_frame_states[client_index].received_size;
                 ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
                 if (ret == ESP_OK) {
                     client_frame_states[client_index].received_size += ws_pkt.len;
+                    // Binary header mode: no frame_end, complete when all announced bytes are in
+                    if (client_frame_states[client_index].binary_header &&
+                        client_frame_states[client_index].received_size == client_frame_states[client_index].total_size) {
+                        submit_received_frame(httpd_req_to_sockfd(req), client_index);
+                        reset_client_frame_state(httpd_req_to_sockfd(req));
+                    }
                 }
                 else {
                     ESP_LOGE(TAG, "httpd_ws_recv_frame (binary) error %d: %s for fd %d", ret, esp_err_to_name(ret), httpd_req_to_sockfd(req));
@@ -356,32 +710,50 @@ static esp_err_t websocket_handler(httpd_req_t* req) {
                 ESP_LOGE(TAG, "Received binary data exceeds total_size for fd %d! Expected %d, current %d, received %d. Resetting state.",
                     httpd_req_to_sockfd(req), (int)client_frame_states[client_index].total_size,
                     (int)client_frame_states[client_index].received_size, (int)ws_pkt.len);
-                uint8_t* dummy_buf = (uint8_t*)malloc(ws_pkt.len);
-                if (dummy_buf) {
-                    ws_pkt.payload = dummy_buf;
-                    httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len); // Consume the data
-                    free(dummy_buf);
-                }
-                else {
-                    ESP_LOGE(TAG, "Failed to allocate dummy buffer to consume oversized data.");
-                }
+                ws_discard(req, &ws_pkt, NULL, NULL); // Consume the data
                 reset_client_frame_state(httpd_req_to_sockfd(req)); // Reset on oversized data
             }
             else { // ws_pkt.len is 0 or negative
                 ESP_LOGW(TAG, "Received zero-length binary data from fd %d while expecting data.", httpd_req_to_sockfd(req));
             }
         }
-        else {
-            ESP_LOGW(TAG, "Received unexpected binary data from fd %d (not in receiving state). Len: %zu", httpd_req_to_sockfd(req), ws_pkt.len);
-            if (ws_pkt.len > 0) {
-                uint8_t* dummy_buf = (uint8_t*)malloc(ws_pkt.len);
-                if (dummy_buf) {
-                    ws_pkt.payload = dummy_buf;
-                    httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len); // Consume the data
-                    free(dummy_buf);
+        else if (ws_pkt.len > 0) {
+            // Not receiving: only a message starting with a binary frame header is expected.
+            // Read it into a free slot, header in the headroom: the payload lands in place.
+            int fd = httpd_req_to_sockfd(req);
+            uint8_t* slot = NULL;
+            if (ws_pkt.len >= sizeof(frame_header_t) && ws_pkt.len - sizeof(frame_header_t) <= frame_pool_slot_size()) {
+                slot = frame_pool_acquire(ws_pkt.len - sizeof(frame_header_t));
+            }
+            frame_header_t header;
+            if (slot) {
+                ws_pkt.payload = slot - sizeof(frame_header_t);
+                ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
+                if (ret != ESP_OK) {
+                    ESP_LOGE(TAG, "httpd_ws_recv_frame (binary) error %d: %s for fd %d", ret, esp_err_to_name(ret), fd);
+                    frame_pool_release(slot);
+                }
+                else if (frame_header_check(ws_pkt.payload, ws_pkt.len, &header)) {
+                    start_binary_frame(fd, client_index, slot, ws_pkt.len - sizeof(frame_header_t), &header);
                 }
                 else {
-                    ESP_LOGE(TAG, "Failed to allocate dummy buffer to consume unexpected data.");
+                    ESP_LOGW(TAG, "Received unexpected binary data from fd %d (not in receiving state). Len: %zu", fd, ws_pkt.len);
+                    frame_pool_release(slot);
+                }
+            }
+            else { // no slot free (or not a frame at all): drop it, a rejected frame is reported to the CAM
+                bool has_header = false;
+                ret = ws_discard(req, &ws_pkt, &header, &has_header);
+                if (ret == ESP_OK && has_header) {
+                    char busy_msg[80];
+                    snprintf(busy_msg, sizeof(busy_msg), "{\"type\":\"%s\",\"id\":%u,\"reason\":\"%s\"}",
+                        header.payload_size <= frame_pool_slot_size() ? "frame_busy" : "frame_error",
+                        (unsigned int)header.id, header.payload_size <= frame_pool_slot_size() ? "no_slot" : "size");
+                    websocket_server_send_text_client(fd, busy_msg);
+                    batch_face_failed(fd, client_index, &header);
+                }
+                else if (ret == ESP_OK) {
+                    ESP_LOGW(TAG, "Received unexpected binary data from fd %d (not in receiving state). Len: %zu", fd, ws_pkt.len);
                 }
             }
         }
@@ -402,7 +774,14 @@ esp_err_t start_websocket_server(void) {
 
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
+    perf_trace_init(); // without it nothing is recorded, stats replies carry no events
     image_processor_init(); // Initialize image processor
+    if (inference_worker_start() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (frame_pool_init() != ESP_OK) {
+        return ESP_FAIL;
+    }
 
     for (int i = 0; i < MAX_WEBSOCKET_CLIENTS; i++) {
         ws_clients[i].active = false;
@@ -417,7 +796,8 @@ esp_err_t start_websocket_server(void) {
 
     config.server_port = WEBSOCKET_PORT;
     config.lru_purge_enable = true;
-    config.stack_size = 24576; // can further experiment with optimal stack size
+    config.stack_size = 8192; // inference runs in its own task (inference_worker), not here
+    config.core_id = WEBSOCKET_SERVER_CORE; // the inference worker gets the other core
     config.recv_wait_timeout = 60;
     config.send_wait_timeout = 60;
 
@@ -441,12 +821,27 @@ esp_err_t start_websocket_server(void) {
         HTTP_SERVER_EVENT_DISCONNECTED,
         server_event_handler,
         server_handle));
+
+    const esp_timer_create_args_t batch_timer_args = {
+        .callback = batch_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "batch_expiry",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&batch_timer_args, &s_batch_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_batch_timer, (uint64_t)FRAME_BATCH_TIMEOUT_MS * 1000 / 2));
     ESP_LOGD(TAG, "WebSocket server up & running!");
     return ESP_OK;
 }
 
 esp_err_t stop_websocket_server(void) {
     if (server_handle) {
+        if (s_batch_timer) {
+            esp_timer_stop(s_batch_timer);
+            esp_timer_delete(s_batch_timer);
+            s_batch_timer = NULL;
+        }
         esp_event_handler_unregister(ESP_HTTP_SERVER_EVENT, HTTP_SERVER_EVENT_DISCONNECTED, server_event_handler);
         httpd_stop(server_handle);
         server_handle = NULL;